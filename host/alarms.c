@@ -0,0 +1,259 @@
+// Steps alarm_engine through a year of local time, one tick per minute as
+// the main loop's clock sees it, and checks every fire instant against a
+// plan worked out day by day with mktime(). The year is 2025 in central
+// Europe, so it crosses both DST changes:
+//
+//   0  07:00 weekdays     skipped once by a clock stepped over it
+//   1  02:30 daily        03:30 on 30 March, when 02:30 doesn't exist;
+//                         once on 26 October, when it happens twice
+//   2  09:15 weekends     snoozed twice each time, then dismissed
+//   3  12:00 one-shot     set at the start, rings once on 1 January
+//   4  07:30 one-shot     set on 1 May at 08:00, rings on 2 May
+//
+// Alarms are saved to config_store as the web server does, and a one-shot
+// that rang as main.c does. The minute after alarm 4 rings the clock
+// reboots: the config is written out, loaded again and the engine set up
+// from it, so a one-shot re-armed from a stale config rings a day late.
+//
+// Only the minute ticks' own time is simulated, so the year takes a
+// fraction of a second. Exits 1 on the first wrong, missing or extra fire.
+
+#include "sim.h"
+#include "vt.h"
+#include "alarm_engine.h"
+#include "config_store.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ALARMS_TZ        "CET-1CEST,M3.5.0,M10.5.0/3"
+#define ALARMS_SNOOZES   2          // per weekend fire, before the dismiss
+#define ALARMS_MAX_FIRES 1024
+
+typedef struct {
+    time_t at;
+    int id;
+} alarm_fire_t;
+
+// ---------------------------------------------------------------------------
+// Hooks the simulated peripherals call; nothing here drives them.
+
+int64_t sim_true_time_us(void) {
+    return vt_clock();
+}
+
+void sim_display_changed(void) {
+}
+
+void sim_gpio_output(gpio_num_t pin, int level) {
+}
+
+void sim_bus_transaction(const char *line) {
+}
+
+void sim_restart(esp_reset_reason_t reason) {
+    exit(0);
+}
+
+// ---------------------------------------------------------------------------
+// Flash, for config_store: kept in memory, so the run leaves no file behind.
+
+static uint8_t s_flash[1024];
+static size_t s_flash_len;
+
+static esp_err_t flash_load(void *buf, size_t *len) {
+    if (s_flash_len == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *len = s_flash_len < *len ? s_flash_len : *len;
+    memcpy(buf, s_flash, *len);
+    return ESP_OK;
+}
+
+static esp_err_t flash_save(const void *buf, size_t len) {
+    if (len > sizeof(s_flash)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(s_flash, buf, len);
+    s_flash_len = len;
+    return ESP_OK;
+}
+
+static const config_backend_t s_flash_backend = { flash_load, flash_save };
+
+// What the web server does with a POST /api/alarms.
+static void alarm_set(int id, const alarm_t *alarm, time_t now) {
+    alarm_engine_set(id, alarm, now);
+    config_store_set_alarm(id, alarm);
+}
+
+// What app_main() does at boot, after the config has reached flash.
+static void reboot(time_t now) {
+    config_store_flush();
+    config_store_init();
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    alarm_engine_init();
+    for (int i = 0; i < ALARM_MAX; i++) {
+        alarm_engine_set(i, &cfg.alarms[i], now);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// The plan
+
+static time_t local(int year, int mon, int mday, int hour, int min) {
+    struct tm tm = {
+        .tm_year = year - 1900, .tm_mon = mon - 1, .tm_mday = mday,
+        .tm_hour = hour, .tm_min = min, .tm_isdst = -1,
+    };
+    return mktime(&tm);
+}
+
+static void plan_add(alarm_fire_t *plan, size_t *count, time_t at, int id) {
+    if (*count == ALARMS_MAX_FIRES) {
+        fprintf(stderr, "alarms: plan too long\n");
+        exit(2);
+    }
+    plan[(*count)++] = (alarm_fire_t){ at, id };
+}
+
+static int fire_cmp(const void *a, const void *b) {
+    const alarm_fire_t *x = a, *y = b;
+    return x->at < y->at ? -1 : x->at > y->at;
+}
+
+// Every instant the alarms below should ring in 2025, in order.
+static size_t alarms_plan(alarm_fire_t *plan, time_t step_from, time_t step_to) {
+    size_t count = 0;
+    for (int day = 0; day < 365; day++) {
+        struct tm tm = { .tm_year = 125, .tm_mday = 1 + day, .tm_hour = 12, .tm_isdst = -1 };
+        mktime(&tm);
+        int y = tm.tm_year + 1900, m = tm.tm_mon + 1, d = tm.tm_mday;
+        bool weekend = tm.tm_wday == 0 || tm.tm_wday == 6;
+
+        time_t t = local(y, m, d, 7, 0);
+        if (!weekend && !(t > step_from && t <= step_to)) {
+            plan_add(plan, &count, t, 0);
+        }
+        plan_add(plan, &count, local(y, m, d, 2, 30), 1);
+        if (weekend) {
+            t = local(y, m, d, 9, 15);
+            for (int i = 0; i <= ALARMS_SNOOZES; i++) {
+                plan_add(plan, &count, t + i * ALARM_SNOOZE_MINUTES * 60, 2);
+            }
+        }
+    }
+    plan_add(plan, &count, local(2025, 1, 1, 12, 0), 3);
+    plan_add(plan, &count, local(2025, 5, 2, 7, 30), 4);
+    qsort(plan, count, sizeof(plan[0]), fire_cmp);
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// The run
+
+static void print_fire(const char *what, const alarm_fire_t *f) {
+    struct tm tm;
+    localtime_r(&f->at, &tm);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M %Z", &tm);
+    printf("alarms: %s alarm %d at %s\n", what, f->id, text);
+}
+
+int main(void) {
+    setenv("TZ", ALARMS_TZ, 1);
+    tzset();
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    // Monday 16 June: the clock jumps from 06:58 to 07:05, as an SNTP step
+    // would, and the 07:00 alarm it skipped over must not ring late.
+    time_t step_from = local(2025, 6, 16, 6, 58);
+    time_t step_to = local(2025, 6, 16, 7, 5);
+    static alarm_fire_t plan[ALARMS_MAX_FIRES];
+    size_t planned = alarms_plan(plan, step_from, step_to);
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    time_t start = local(2025, 1, 1, 0, 0);
+    time_t end = local(2026, 1, 1, 0, 0);
+    time_t late_set = local(2025, 5, 1, 8, 0);
+    time_t reboot_at = local(2025, 5, 2, 7, 31);
+    config_store_set_backend(&s_flash_backend);
+    config_store_init();
+    alarm_engine_init();
+    alarm_set(0, &(alarm_t){ 7, 0, ALARM_DAYS_WEEKDAYS, 1 }, start);
+    alarm_set(1, &(alarm_t){ 2, 30, ALARM_DAYS_DAILY, 1 }, start);
+    alarm_set(2, &(alarm_t){ 9, 15, ALARM_DAYS_WEEKEND, 1 }, start);
+    alarm_set(3, &(alarm_t){ 12, 0, ALARM_DAYS_ONCE, 1 }, start);
+    alarm_engine_replan(start);
+
+    size_t next = 0;
+    unsigned long ticks = 0;
+    int snoozes = 0;
+    int errors = 0;
+    for (time_t now = start; now < end && errors == 0; now += 60) {
+        if (now == step_from) {
+            now = step_to;
+        }
+        if (now == late_set) {
+            alarm_set(4, &(alarm_t){ 7, 30, ALARM_DAYS_ONCE, 1 }, now);
+        }
+        if (now == reboot_at) {
+            reboot(now);
+        }
+        struct tm tm;
+        localtime_r(&now, &tm);
+        int id = alarm_engine_tick(now, tm.tm_isdst);
+        ticks++;
+        if (id == ALARM_NONE) {
+            if (next < planned && plan[next].at < now) {
+                print_fire("missed", &plan[next]);
+                errors++;
+            }
+            continue;
+        }
+        alarm_fire_t got = { now, id };
+        if (next == planned || plan[next].at != now || plan[next].id != id) {
+            print_fire("unexpected", &got);
+            if (next < planned) {
+                print_fire("expected", &plan[next]);
+            }
+            errors++;
+            continue;
+        }
+        next++;
+        alarm_t fired;
+        if (alarm_engine_get(id, &fired) && !fired.enabled) {
+            config_store_set_alarm(id, &fired);
+        }
+        if (id == 2 && snoozes < ALARMS_SNOOZES) {
+            alarm_engine_snooze(now);
+            snoozes++;
+        } else {
+            alarm_engine_dismiss();
+            snoozes = 0;
+        }
+    }
+    if (errors == 0 && next < planned) {
+        print_fire("missed", &plan[next]);
+        errors++;
+    }
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    for (int id = 3; id <= 4 && errors == 0; id++) {
+        alarm_t once;
+        if (!alarm_engine_get(id, &once) || once.enabled || cfg.alarms[id].enabled) {
+            printf("alarms: one-shot alarm %d still enabled after it rang\n", id);
+            errors++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double ms = (wall_end.tv_sec - wall_start.tv_sec) * 1e3 + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+    printf("alarms: %lu ticks, %zu of %zu fires at the planned instants in %.0f ms\n", ticks, next, planned, ms);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,565 @@
+// Microbenchmarks for the clock's hot paths: glyph encoding (max7219.c),
+// transition keyframes (transition.c), matrix rendering (matrix.c), local
+// time conversion (time_utils.c) and the RTC's BCD codecs (rtci2c).
+//
+// Each benchmark is calibrated to run for --min-time, then timed over
+// BENCH_REPEATS runs; the fastest run is reported, which is the most stable
+// figure on a shared machine. Every run alternates with one of a reference
+// kernel, and a baseline is compared in multiples of that reference, so a
+// machine that is slower across the board doesn't read as a regression. Heap allocations are counted by wrapping
+// malloc and friends at link time (see CMakeLists.txt), so only calls made
+// from the code under test are seen, not ones inside the C library.
+
+#define _GNU_SOURCE // getopt_long
+
+#include "sim.h"
+#include "vt.h"
+#include "max7219.h"
+#include "transition.h"
+#include "matrix.h"
+#include "time_utils.h"
+#include "ds1307.h"
+#include "rtci2c/rtci2c.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SCHEMA       2
+#define BENCH_REPEATS      21
+#define BENCH_MAX_RESULTS  32
+#define BENCH_DEFAULT_MS   25
+#define BENCH_DEFAULT_PCT  20
+// Slowdowns smaller than this (normalised ns/op) are timer and loop noise
+// on the nanosecond benchmarks, whatever their percentage.
+#define BENCH_FLOOR_NS     1.5
+
+extern struct tm current_time; // time_utils.c
+
+typedef void (*bench_fn_t)(uint64_t iterations);
+
+typedef struct {
+    const char *name;
+    bench_fn_t fn;
+} bench_t;
+
+typedef struct {
+    const char *name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double ref_ns_per_op;       // the reference kernel, timed alongside
+} bench_result_t;
+
+// Results are folded into this so the compiler can't drop the work.
+static volatile uint32_t s_sink;
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+
+static uint64_t s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    s_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    s_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    s_allocs++;
+    return __real_realloc(p, size);
+}
+
+// ---------------------------------------------------------------------------
+// Hooks the simulated peripherals call; nothing here drives them.
+
+int64_t sim_true_time_us(void) {
+    return vt_clock();
+}
+
+void sim_display_changed(void) {
+}
+
+void sim_gpio_output(gpio_num_t pin, int level) {
+}
+
+void sim_bus_transaction(const char *line) {
+}
+
+void sim_restart(esp_reset_reason_t reason) {
+    exit(0);
+}
+
+// ---------------------------------------------------------------------------
+// max7219.c
+
+static void bench_encode_digit(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += max7219_encode_digit(i & 0x0F, i & 0x10);
+    }
+    s_sink = acc;
+}
+
+static void bench_encode_text_time(uint64_t n) {
+    static const char *const texts[] = { "12.34", "0000", "23.59", " 7.05" };
+    uint8_t frame[MAX7219_DIGITS];
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        max7219_encode_text(texts[i & 3], frame);
+        acc += frame[0];
+    }
+    s_sink = acc;
+}
+
+static void bench_encode_text_mixed(uint64_t n) {
+    static const char *const texts[] = { "-12.5", "AbCd", "Err ", "88.88.88.88." };
+    uint8_t frame[MAX7219_DIGITS];
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        max7219_encode_text(texts[i & 3], frame);
+        acc += frame[1];
+    }
+    s_sink = acc;
+}
+
+static spi_device_handle_t bench_spi(void) {
+    static spi_device_handle_t spi;
+    if (spi == NULL) {
+        spi_device_interface_config_t dev = { .clock_speed_hz = 1000000, .spics_io_num = -1, .queue_size = 1 };
+        spi_bus_add_device(SPI2_HOST, &dev, &spi);
+    }
+    return spi;
+}
+
+// The once-a-second path: nothing changed since the last frame.
+static void bench_write_frame_unchanged(uint64_t n) {
+    uint8_t frame[MAX7219_DIGITS];
+    uint8_t shadow[MAX7219_DIGITS];
+    spi_device_handle_t spi = bench_spi();
+    max7219_encode_text("12.34", frame);
+    memcpy(shadow, frame, sizeof(shadow));
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += max7219_write_frame(spi, frame, shadow);
+    }
+    s_sink = acc;
+}
+
+// A minute rollover: one or two digits change.
+static void bench_write_frame_minute(uint64_t n) {
+    uint8_t frames[2][MAX7219_DIGITS];
+    uint8_t shadow[MAX7219_DIGITS];
+    spi_device_handle_t spi = bench_spi();
+    max7219_encode_text("12.34", frames[0]);
+    max7219_encode_text("12.35", frames[1]);
+    memcpy(shadow, frames[0], sizeof(shadow));
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += max7219_write_frame(spi, frames[(i + 1) & 1], shadow);
+    }
+    s_sink = acc;
+}
+
+// ---------------------------------------------------------------------------
+// transition.c: planning an hour rollover, three digits changing.
+
+static void bench_transition_plan(transition_style_t style, uint64_t n) {
+    uint8_t frames[2][MAX7219_DIGITS];
+    transition_plan_t plan;
+    max7219_encode_text("1259", frames[0]);
+    max7219_encode_text("1300", frames[1]);
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += transition_plan(style, frames[i & 1], frames[(i + 1) & 1], &plan);
+    }
+    s_sink = acc + plan.frames[0][0];
+}
+
+static void bench_transition_plan_roll(uint64_t n) {
+    bench_transition_plan(TRANSITION_ROLL, n);
+}
+
+static void bench_transition_plan_morph(uint64_t n) {
+    bench_transition_plan(TRANSITION_MORPH, n);
+}
+
+// ---------------------------------------------------------------------------
+// matrix.c. A scroll frame is the whole per-frame path: window, transpose
+// and the shadow-diffed write of the rows that changed; 1e9 / ns_per_op is
+// the frame rate the renderer could sustain on this machine.
+
+static void bench_matrix_render_time(uint64_t n) {
+    static const char *const texts[] = { "12:34", "23:59" };
+    matrix_strip_t strip;
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += matrix_render_text(texts[i & 1], &strip);
+    }
+    s_sink = acc;
+}
+
+static void bench_matrix_transpose8(uint64_t n) {
+    uint64_t x = 0x0123456789ABCDEFULL;
+    for (uint64_t i = 0; i < n; i++) {
+        x = matrix_transpose8(x) + i;
+    }
+    s_sink = (uint32_t)x;
+}
+
+static void bench_matrix_scroll_frame(uint64_t n) {
+    matrix_strip_t strip;
+    uint8_t rows[MAX7219_DIGITS];
+    uint8_t shadow[MAX7219_DIGITS] = { 0 };
+    spi_device_handle_t spi = bench_spi();
+    matrix_render_text("12:34", &strip);
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        matrix_window(&strip, (int)(i % strip.width), rows);
+        acc += max7219_write_frame(spi, rows, shadow);
+    }
+    s_sink = acc;
+}
+
+// ---------------------------------------------------------------------------
+// time_utils.c
+
+static void bench_update_time(const char *tz, uint64_t n) {
+    setenv("TZ", tz, 1);
+    tzset();
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        update_time();
+        acc += current_time.tm_min;
+    }
+    s_sink = acc;
+}
+
+static void bench_update_time_fixed(uint64_t n) {
+    bench_update_time("IST-5:30", n);
+}
+
+static void bench_update_time_dst(uint64_t n) {
+    bench_update_time("CET-1CEST,M3.5.0,M10.5.0/3", n);
+}
+
+// ---------------------------------------------------------------------------
+// rtci2c: the BCD macros in helpers.h, and ds1307.c through the library
+// against hw.c's simulated chip.
+
+static rtci2c_context bench_rtc(void) {
+    static rtci2c_context rtc;
+    if (rtc == NULL) {
+        rtc = rtci2c_init(RTCI2C_DEVICE_DS1307, DS1307_I2C_ADDRESS, NULL);
+    }
+    return rtc;
+}
+
+static void bench_bcd_to_dec(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint8_t bcd = (uint8_t)(((i % 10) << 4) | (i / 10 % 10));
+        acc += RTC_BCD_TO_DEC(bcd);
+    }
+    s_sink = acc;
+}
+
+static void bench_dec_to_bcd(uint64_t n) {
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        acc += RTC_DEC_TO_BCD(i % 100);
+    }
+    s_sink = acc;
+}
+
+static void bench_ds1307_get(uint64_t n) {
+    rtci2c_context rtc = bench_rtc();
+    struct tm tm;
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        rtci2c_get_datetime(rtc, &tm);
+        acc += tm.tm_sec;
+    }
+    s_sink = acc;
+}
+
+static void bench_ds1307_set(uint64_t n) {
+    rtci2c_context rtc = bench_rtc();
+    struct tm tm = { .tm_year = 125, .tm_mon = 2, .tm_mday = 30, .tm_hour = 2, .tm_min = 59 };
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        tm.tm_sec = (int)(i % 60);
+        acc += rtci2c_set_datetime(rtc, &tm);
+    }
+    s_sink = acc;
+}
+
+// ---------------------------------------------------------------------------
+// Reference kernel: shifts, table loads and a data-dependent branch, the
+// same kind of work as the benchmarks above but no firmware code, so it
+// only moves when the machine does.
+
+static void bench_reference(uint64_t n) {
+    static const uint8_t table[16] = { 3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3 };
+    uint32_t x = 2463534242u;
+    uint32_t acc = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        acc += table[x & 15];
+        if (x & 0x100) {
+            acc ^= (uint32_t)i;
+        }
+    }
+    s_sink = acc;
+}
+
+static const bench_t s_reference = { "reference", bench_reference };
+
+// ---------------------------------------------------------------------------
+// Harness
+
+// Names are the JSON keys a baseline is matched on; keep them stable.
+static const bench_t s_benches[] = {
+    { "max7219_encode_digit", bench_encode_digit },
+    { "max7219_encode_text_time", bench_encode_text_time },
+    { "max7219_encode_text_mixed", bench_encode_text_mixed },
+    { "max7219_write_frame_unchanged", bench_write_frame_unchanged },
+    { "max7219_write_frame_minute", bench_write_frame_minute },
+    { "transition_plan_roll", bench_transition_plan_roll },
+    { "transition_plan_morph", bench_transition_plan_morph },
+    { "matrix_render_text_time", bench_matrix_render_time },
+    { "matrix_transpose8", bench_matrix_transpose8 },
+    { "matrix_scroll_frame", bench_matrix_scroll_frame },
+    { "time_utils_update_time_fixed_tz", bench_update_time_fixed },
+    { "time_utils_update_time_dst_tz", bench_update_time_dst },
+    { "rtc_bcd_to_dec", bench_bcd_to_dec },
+    { "rtc_dec_to_bcd", bench_dec_to_bcd },
+    { "ds1307_get_datetime", bench_ds1307_get },
+    { "ds1307_set_datetime", bench_ds1307_set },
+};
+
+static int64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t bench_time(const bench_t *b, uint64_t iterations) {
+    int64_t start = bench_now_ns();
+    b->fn(iterations);
+    return bench_now_ns() - start;
+}
+
+// Grows the iteration count until one run takes long enough to time.
+static uint64_t bench_calibrate(const bench_t *b, int64_t min_ns, int64_t *ns) {
+    uint64_t n = 1;
+    while ((*ns = bench_time(b, n)) < min_ns) {
+        uint64_t grow = *ns > 0 ? (uint64_t)(min_ns * 1.2 / *ns * n) : n * 100;
+        n = grow > n * 100 ? n * 100 : (grow > n ? grow : n * 2);
+    }
+    return n;
+}
+
+static void bench_run(const bench_t *b, int64_t min_ns, bench_result_t *out) {
+    static uint64_t ref_n;
+    int64_t ns, ref_ns;
+    if (ref_n == 0) {
+        ref_n = bench_calibrate(&s_reference, min_ns, &ref_ns);
+    }
+    uint64_t n = bench_calibrate(b, min_ns, &ns);
+
+    int64_t best = ns;
+    int64_t ref_best = INT64_MAX;
+    uint64_t allocs = 0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        ref_ns = bench_time(&s_reference, ref_n);
+        ref_best = ref_ns < ref_best ? ref_ns : ref_best;
+        uint64_t allocs_before = s_allocs;
+        ns = bench_time(b, n);
+        allocs += s_allocs - allocs_before;
+        best = ns < best ? ns : best;
+    }
+    out->name = b->name;
+    out->iterations = n;
+    out->ns_per_op = (double)best / n;
+    out->allocs_per_op = (double)allocs / ((double)n * BENCH_REPEATS);
+    out->ref_ns_per_op = (double)ref_best / ref_n;
+}
+
+static void bench_print_json(FILE *f, const bench_result_t *results, size_t count) {
+    fprintf(f, "{\n  \"schema\": %d,\n  \"benchmarks\": [\n", BENCH_SCHEMA);
+    for (size_t i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"allocs_per_op\": %.3f, "
+                "\"ref_ns_per_op\": %.3f}%s\n",
+                r->name, (unsigned long long)r->iterations, r->ns_per_op, r->allocs_per_op, r->ref_ns_per_op,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// Reads back a file bench_print_json() wrote; it is not a general JSON
+// parser. Returns the number of entries, or -1 if the file can't be read.
+static int bench_load_baseline(const char *path, bench_result_t *out, size_t max, char *names, size_t names_size) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[512];
+    int count = 0;
+    size_t used = 0;
+    while (fgets(line, sizeof(line), f) && (size_t)count < max) {
+        char name[96];
+        unsigned long long iterations;
+        double ns, allocs, ref;
+        if (sscanf(line, " {\"name\": \"%95[^\"]\", \"iterations\": %llu, \"ns_per_op\": %lf, \"allocs_per_op\": %lf, "
+                   "\"ref_ns_per_op\": %lf", name, &iterations, &ns, &allocs, &ref) != 5) {
+            continue;
+        }
+        size_t len = strlen(name) + 1;
+        if (used + len > names_size) {
+            break;
+        }
+        memcpy(names + used, name, len);
+        out[count] = (bench_result_t){ names + used, iterations, ns, allocs, ref };
+        used += len;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+// Results are scaled to the baseline's machine speed: ns/op times how much
+// faster the reference kernel ran then. A benchmark regresses when the
+// scaled figure is more than threshold_pct and BENCH_FLOOR_NS slower than
+// the baseline, or it allocates where it didn't. Returns the number of
+// regressions.
+static int bench_compare(const bench_result_t *results, size_t count, const bench_result_t *base, int base_count,
+                         int threshold_pct) {
+    int regressions = 0;
+    fprintf(stderr, "%-32s %12s %12s %8s\n", "benchmark", "base ns/op", "scaled ns/op", "change");
+    for (size_t i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        const bench_result_t *b = NULL;
+        for (int j = 0; j < base_count; j++) {
+            if (strcmp(base[j].name, r->name) == 0) {
+                b = &base[j];
+                break;
+            }
+        }
+        if (b == NULL) {
+            fprintf(stderr, "%-32s %12s %12.3f %8s\n", r->name, "-", r->ns_per_op, "new");
+            continue;
+        }
+        double scaled = r->ref_ns_per_op > 0 ? r->ns_per_op * b->ref_ns_per_op / r->ref_ns_per_op : r->ns_per_op;
+        double change = b->ns_per_op > 0 ? (scaled / b->ns_per_op - 1) * 100 : 0;
+        bool slower = change > threshold_pct && scaled - b->ns_per_op > BENCH_FLOOR_NS;
+        bool allocates = r->allocs_per_op > b->allocs_per_op + 0.001;
+        const char *verdict = slower ? "  SLOWER" : allocates ? "  ALLOCS" : "";
+        fprintf(stderr, "%-32s %12.3f %12.3f %+7.1f%%%s\n", r->name, b->ns_per_op, scaled, change, verdict);
+        if (slower || allocates) {
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+static void bench_usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -f, --filter TEXT       only benchmarks whose name contains TEXT\n"
+            "  -t, --min-time MS       calibrate each run to at least MS (default %d)\n"
+            "  -o, --output FILE       write the JSON there instead of stdout\n"
+            "  -b, --baseline FILE     compare with an earlier run; exit 1 on a regression\n"
+            "  -p, --threshold PCT     slowdown that counts as a regression (default %d)\n"
+            "  -r, --report            print the comparison but exit 0 on a regression\n"
+            "  -l, --list              list the benchmarks\n",
+            argv0, BENCH_DEFAULT_MS, BENCH_DEFAULT_PCT);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        { "filter", required_argument, NULL, 'f' },
+        { "min-time", required_argument, NULL, 't' },
+        { "output", required_argument, NULL, 'o' },
+        { "baseline", required_argument, NULL, 'b' },
+        { "threshold", required_argument, NULL, 'p' },
+        { "report", no_argument, NULL, 'r' },
+        { "list", no_argument, NULL, 'l' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 },
+    };
+    const char *filter = NULL;
+    const char *output = NULL;
+    const char *baseline = NULL;
+    int min_ms = BENCH_DEFAULT_MS;
+    int threshold_pct = BENCH_DEFAULT_PCT;
+    bool report = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "f:t:o:b:p:rlh", options, NULL)) != -1) {
+        switch (c) {
+        case 'f': filter = optarg; break;
+        case 't': min_ms = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        case 'b': baseline = optarg; break;
+        case 'p': threshold_pct = atoi(optarg); break;
+        case 'r': report = true; break;
+        case 'l':
+            for (size_t i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+                printf("%s\n", s_benches[i].name);
+            }
+            return 0;
+        default:
+            bench_usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (min_ms < 1) {
+        min_ms = 1;
+    }
+
+    bench_result_t results[BENCH_MAX_RESULTS];
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+        if (filter == NULL || strstr(s_benches[i].name, filter)) {
+            bench_run(&s_benches[i], (int64_t)min_ms * 1000000, &results[count++]);
+        }
+    }
+
+    FILE *out = stdout;
+    if (output && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 2;
+    }
+    bench_print_json(out, results, count);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (baseline) {
+        bench_result_t base[BENCH_MAX_RESULTS];
+        char names[BENCH_MAX_RESULTS * 96];
+        int base_count = bench_load_baseline(baseline, base, BENCH_MAX_RESULTS, names, sizeof(names));
+        if (base_count < 0) {
+            perror(baseline);
+            return 2;
+        }
+        int regressions = bench_compare(results, count, base, base_count, threshold_pct);
+        if (regressions) {
+            fprintf(stderr, "%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s", baseline);
+            return report ? 0 : 1;
+        }
+    }
+    return 0;
+}
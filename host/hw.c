@@ -0,0 +1,466 @@
+#include "sim.h"
+#include "vt.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "max7219.h"
+#include "board.h"
+#include "rtci2c/rtci2c.h"
+#include "sys.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// ---------------------------------------------------------------------------
+// SPI: a single MAX7219/7221 on the bus. Each transaction is the 16-bit
+// word max7219_send_cmd() builds, register in the high byte.
+
+struct spi_device_t {
+    spi_host_device_t host;
+    int clock_speed_hz;
+};
+
+static struct spi_device_t s_device;
+static sim_max7219_t s_chip = { .shutdown = true };
+static uint64_t s_spi_count;
+static uint32_t s_spi_hash = 2166136261u; // FNV-1a over (register, data)
+static bool s_bus_trace;
+
+const sim_max7219_t *sim_max7219(void) {
+    return &s_chip;
+}
+
+void sim_spi_stats(uint64_t *transactions, uint32_t *hash) {
+    *transactions = s_spi_count;
+    *hash = s_spi_hash;
+}
+
+void sim_bus_trace(bool on) {
+    s_bus_trace = on;
+}
+
+// Reverse of the firmware's font: the first character that encodes to a
+// segment pattern names it, so glyphs added to max7219.c show up here.
+static char sim_glyph(uint8_t segments) {
+    static char table[128];
+    static bool built;
+    if (!built) {
+        static const char order[] = "0123456789 -_ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+        uint8_t frame[MAX7219_DIGITS];
+        memset(table, '?', sizeof(table));
+        for (int i = (int)sizeof(order) - 2; i >= 0; i--) {
+            char text[2] = { order[i], '\0' };
+            max7219_encode_text(text, frame);
+            if (order[i] == ' ' || frame[0] != 0) {
+                table[frame[0] & 0x7F] = order[i];
+            }
+        }
+        built = true;
+    }
+    return table[segments & 0x7F];
+}
+
+// A matrix shows as its rows top to bottom, '#' for a lit pixel and '/'
+// between rows; DIG0 is the top row and bit 7 the leftmost column.
+static size_t sim_matrix_text(char *out, size_t size) {
+    size_t n = 0;
+    for (int r = 0; r <= s_chip.scan_limit && n + 10 < size; r++) {
+        uint8_t row = s_chip.test ? 0xFF : s_chip.digit[r];
+        if (r > 0) {
+            out[n++] = '/';
+        }
+        for (int b = 7; b >= 0; b--) {
+            out[n++] = (row >> b) & 1 ? '#' : '.';
+        }
+    }
+    return n;
+}
+
+void sim_max7219_text(char *out, size_t size) {
+    size_t n = 0;
+    if (!s_chip.shutdown && board_profile.matrix) {
+        n = sim_matrix_text(out, size);
+    } else if (!s_chip.shutdown) {
+        for (int d = s_chip.scan_limit; d >= 0 && n + 2 < size; d--) {
+            uint8_t seg = s_chip.test ? 0xFF : s_chip.digit[d];
+            out[n++] = sim_glyph(seg);
+            if (seg & 0x80) {
+                out[n++] = '.';
+            }
+        }
+    }
+    out[n] = '\0';
+}
+
+static void sim_max7219_write(uint8_t reg, uint8_t data) {
+    sim_max7219_t before = s_chip;
+    switch (reg) {
+    case MAX7219_REG_NOOP:
+        break;
+    case MAX7219_REG_DIGIT0 ... MAX7219_REG_DIGIT7:
+        s_chip.digit[reg - MAX7219_REG_DIGIT0] = data;
+        break;
+    case MAX7219_REG_DECODEMODE:
+        s_chip.decode_mode = data;
+        break;
+    case MAX7219_REG_INTENSITY:
+        s_chip.intensity = data & 0x0F;
+        break;
+    case MAX7219_REG_SCANLIMIT:
+        s_chip.scan_limit = data & 0x07;
+        break;
+    case MAX7219_REG_SHUTDOWN:
+        s_chip.shutdown = (data & 1) == 0;
+        break;
+    case MAX7219_REG_DISPLAYTEST:
+        s_chip.test = data & 1;
+        break;
+    default:
+        fprintf(stderr, "max7219: write to unknown register 0x%02x\n", reg);
+        break;
+    }
+    if (memcmp(&before, &s_chip, sizeof(s_chip)) != 0) {
+        sim_display_changed();
+    }
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, spi_dma_chan_t dma) {
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle) {
+    s_device.host = host;
+    s_device.clock_speed_hz = config->clock_speed_hz;
+    *handle = &s_device;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans) {
+    if (handle != &s_device || trans->length != 16) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t word;
+    memcpy(&word, (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer,
+           sizeof(word));
+    uint8_t reg = word >> 8;
+    uint8_t data = word & 0xFF;
+
+    s_spi_count++;
+    s_spi_hash = (s_spi_hash ^ reg) * 16777619u;
+    s_spi_hash = (s_spi_hash ^ data) * 16777619u;
+    if (s_bus_trace) {
+        char line[16];
+        snprintf(line, sizeof(line), "spi %02x %02x", reg, data);
+        sim_bus_transaction(line);
+    }
+    sim_max7219_write(reg, data);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans) {
+    return spi_device_polling_transmit(handle, trans);
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t wait) {
+    return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t handle) {
+}
+
+// ---------------------------------------------------------------------------
+// GPIO
+
+typedef struct {
+    gpio_mode_t mode;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    int level;
+    gpio_isr_t handler;
+    void *arg;
+} sim_pin_t;
+
+static sim_pin_t s_pins[GPIO_NUM_MAX];
+static bool s_isr_service;
+
+static bool gpio_valid(gpio_num_t gpio) {
+    return gpio >= 0 && gpio < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if (!(config->pin_bit_mask & (1ULL << pin))) {
+            continue;
+        }
+        sim_pin_t *p = &s_pins[pin];
+        p->mode = config->mode;
+        p->intr_type = config->intr_type;
+        p->intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+        if (config->mode & GPIO_MODE_INPUT) {
+            p->level = config->pull_up_en == GPIO_PULLUP_ENABLE ? 1 : 0;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio] = (sim_pin_t){ .mode = GPIO_MODE_INPUT, .level = 1 };
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((s_pins[gpio].mode & GPIO_MODE_OUTPUT) && s_pins[gpio].level != (level ? 1 : 0)) {
+        s_pins[gpio].level = level ? 1 : 0;
+        sim_gpio_output(gpio, s_pins[gpio].level);
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio) {
+    return gpio_valid(gpio) ? s_pins[gpio].level : 0;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].intr_type = type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].intr_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].intr_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags) {
+    if (s_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_isr_service = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg) {
+    if (!s_isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].handler = handler;
+    s_pins[gpio].arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio) {
+    if (!gpio_valid(gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_pins[gpio].handler = NULL;
+    return ESP_OK;
+}
+
+void sim_gpio_input(gpio_num_t pin, int level) {
+    if (!gpio_valid(pin)) {
+        return;
+    }
+    sim_pin_t *p = &s_pins[pin];
+    level = level ? 1 : 0;
+    if (p->level == level) {
+        return;
+    }
+    p->level = level;
+    bool fire = (p->intr_type == GPIO_INTR_ANYEDGE) ||
+                (p->intr_type == GPIO_INTR_POSEDGE && level) ||
+                (p->intr_type == GPIO_INTR_NEGEDGE && !level);
+    if (fire && p->intr_enabled && p->handler) {
+        vt_isr_enter();
+        p->handler(p->arg);
+        vt_isr_exit();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// I2C: a DS3231 at 0x68 behind rtci2c's low-level interface. It keeps its
+// own time from the moment it was last set; until then it holds true time,
+// as if it had been set before the battery went in.
+
+#define SIM_RTC_ADDRESS 0x68
+#define SIM_RTC_REGS    0x13
+
+typedef struct {
+    uint8_t address;
+} sim_i2c_dev_t;
+
+static struct {
+    uint8_t regs[SIM_RTC_REGS];
+    uint8_t pointer;
+    bool set;
+    bool written;               // base_s is still to be decoded from regs[0..6]
+    int64_t base_s;             // the time registers' value...
+    int64_t set_at_us;          // ...at this virtual time
+    int64_t shown_s;            // what regs[0..6] hold
+} s_rtc = { .shown_s = -1 };
+
+static sim_i2c_dev_t s_i2c_dev;
+
+static uint8_t sim_bcd(int v) {
+    return (uint8_t)(((v / 10) << 4) | (v % 10));
+}
+
+static int sim_dec(uint8_t bcd) {
+    return (bcd >> 4) * 10 + (bcd & 0x0F);
+}
+
+static void sim_rtc_latch(void);
+
+static int64_t sim_rtc_now_s(void) {
+    if (s_rtc.written) {
+        sim_rtc_latch();
+    }
+    if (!s_rtc.set) {
+        return sim_true_time_us() / 1000000;
+    }
+    return s_rtc.base_s + (vt_now() - s_rtc.set_at_us) / 1000000;
+}
+
+// The time registers only change once a second, so they are re-encoded
+// only when the second has moved on.
+static void sim_rtc_refresh(void) {
+    int64_t now = sim_rtc_now_s();
+    if (now == s_rtc.shown_s) {
+        return;
+    }
+    time_t t = (time_t)now;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    s_rtc.regs[0] = sim_bcd(tm.tm_sec);
+    s_rtc.regs[1] = sim_bcd(tm.tm_min);
+    s_rtc.regs[2] = sim_bcd(tm.tm_hour);
+    s_rtc.regs[3] = sim_bcd(tm.tm_wday + 1);
+    s_rtc.regs[4] = sim_bcd(tm.tm_mday);
+    s_rtc.regs[5] = sim_bcd(tm.tm_mon + 1);
+    s_rtc.regs[6] = sim_bcd(tm.tm_year % 100);
+    s_rtc.shown_s = now;
+}
+
+static void sim_rtc_latch(void) {
+    uint8_t hours = s_rtc.regs[2];
+    int hour = (hours & 0x40) ? sim_dec(hours & 0x1F) % 12 + ((hours & 0x20) ? 12 : 0) : sim_dec(hours & 0x3F);
+    struct tm tm = {
+        .tm_sec = sim_dec(s_rtc.regs[0] & 0x7F),
+        .tm_min = sim_dec(s_rtc.regs[1]),
+        .tm_hour = hour,
+        .tm_mday = sim_dec(s_rtc.regs[4] & 0x3F),
+        .tm_mon = sim_dec(s_rtc.regs[5] & 0x1F) - 1,
+        .tm_year = sim_dec(s_rtc.regs[6]) + 100,
+    };
+    s_rtc.base_s = timegm(&tm);
+    s_rtc.written = false;
+    s_rtc.set = true;
+    s_rtc.shown_s = s_rtc.base_s;
+}
+
+static void sim_i2c_log(const sim_i2c_dev_t *dev, char dir, uint8_t reg, const uint8_t *data, uint8_t length) {
+    if (!s_bus_trace) {
+        return;
+    }
+    char line[96];
+    int n = snprintf(line, sizeof(line), "i2c %02x %c %02x", dev->address, dir, reg);
+    if (dir == 'w') {
+        for (uint8_t i = 0; i < length && n < (int)sizeof(line) - 4; i++) {
+            n += snprintf(line + n, sizeof(line) - n, " %02x", data[i]);
+        }
+    } else {
+        snprintf(line + n, sizeof(line) - n, " +%u", length);
+    }
+    sim_bus_transaction(line);
+}
+
+i2c_lowlevel_context i2c_ll_init(uint8_t i2c_address, uint32_t i2c_speed, uint32_t i2c_timeout_ms,
+                                 i2c_lowlevel_config *config) {
+    s_i2c_dev.address = i2c_address;
+    return &s_i2c_dev;
+}
+
+bool i2c_ll_deinit(i2c_lowlevel_context ctx) {
+    return true;
+}
+
+bool i2c_ll_write_reg(i2c_lowlevel_context ctx, uint8_t reg, uint8_t *data, uint8_t length) {
+    sim_i2c_dev_t *dev = ctx;
+    sim_i2c_log(dev, 'w', reg, data, length);
+    if (dev->address != SIM_RTC_ADDRESS) {
+        return false; // nothing acknowledged
+    }
+    if (!s_rtc.written || vt_now() - s_rtc.set_at_us >= 1000000) {
+        sim_rtc_refresh();
+    }
+    bool time_written = false;
+    s_rtc.pointer = reg % SIM_RTC_REGS;
+    for (uint8_t i = 0; i < length; i++) {
+        s_rtc.regs[s_rtc.pointer] = data[i];
+        time_written |= s_rtc.pointer <= 6;
+        s_rtc.pointer = (s_rtc.pointer + 1) % SIM_RTC_REGS;
+    }
+    if (time_written) {
+        // Decoded on the next read; writes alone stay cheap for the benchmarks.
+        s_rtc.written = true;
+        s_rtc.set_at_us = vt_now();
+    }
+    return true;
+}
+
+bool i2c_ll_read_reg(i2c_lowlevel_context ctx, uint8_t reg, uint8_t *data, uint8_t length) {
+    sim_i2c_dev_t *dev = ctx;
+    sim_i2c_log(dev, 'r', reg, NULL, length);
+    if (dev->address != SIM_RTC_ADDRESS) {
+        return false;
+    }
+    sim_rtc_refresh();
+    s_rtc.pointer = reg % SIM_RTC_REGS;
+    for (uint8_t i = 0; i < length; i++) {
+        data[i] = s_rtc.regs[s_rtc.pointer];
+        s_rtc.pointer = (s_rtc.pointer + 1) % SIM_RTC_REGS;
+    }
+    return true;
+}
+
+// Plain transfers: a write's first byte sets the register pointer, a read
+// continues from it.
+bool i2c_ll_write(i2c_lowlevel_context ctx, uint8_t *data, uint8_t length) {
+    if (length == 0) {
+        return true;
+    }
+    return i2c_ll_write_reg(ctx, data[0], data + 1, length - 1);
+}
+
+bool i2c_ll_read(i2c_lowlevel_context ctx, uint8_t *data, uint8_t length) {
+    return i2c_ll_read_reg(ctx, s_rtc.pointer, data, length);
+}
@@ -0,0 +1,794 @@
+#include "sim.h"
+#include "vt.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_rom_crc.h"
+#include "esp_rtc_time.h"
+#include "esp_sntp.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "lwip/sockets.h"
+#include "nvs_flash.h"
+#include "wifi_sim.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Logging, errors, system
+
+static esp_log_level_t s_log_level = ESP_LOG_INFO;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (level > s_log_level) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (strcmp(tag, "*") == 0) {
+        s_log_level = level;
+    }
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(vt_now() / 1000);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    case ESP_ERR_HTTPD_HANDLERS_FULL: return "ESP_ERR_HTTPD_HANDLERS_FULL";
+    case ESP_ERR_HTTPD_HANDLER_EXISTS: return "ESP_ERR_HTTPD_HANDLER_EXISTS";
+    case ESP_ERR_HTTPD_RESULT_TRUNC: return "ESP_ERR_HTTPD_RESULT_TRUNC";
+    case ESP_ERR_OTA_VALIDATE_FAILED: return "ESP_ERR_OTA_VALIDATE_FAILED";
+    }
+    return "UNKNOWN ERROR";
+}
+
+// ---------------------------------------------------------------------------
+// RTC memory. RTC_NOINIT_ATTR variables land in the rtc_noinit section; a
+// restart writes it to a file in the state directory, with the reset reason
+// and the RTC timer, and the next run started there picks it up.
+
+#define SIM_RTC_FILE "rtc_mem.bin"
+#define SIM_RTC_MAGIC 0x52544353 // "RTCS"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;              // of the section that follows
+    int64_t true_us;            // true time at the reset
+    int64_t rtc_us;             // RTC timer then
+    int32_t reason;
+} sim_rtc_header_t;
+
+extern uint8_t __start_rtc_noinit[] __attribute__((weak));
+extern uint8_t __stop_rtc_noinit[] __attribute__((weak));
+
+static esp_reset_reason_t s_reset_reason = ESP_RST_POWERON;
+static int64_t s_rtc_base_us;   // RTC timer at boot
+
+uint64_t esp_rtc_get_time_us(void) {
+    return (uint64_t)(s_rtc_base_us + vt_now());
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void sim_rtc_save(esp_reset_reason_t reason, int64_t true_us) {
+    size_t size = __start_rtc_noinit ? (size_t)(__stop_rtc_noinit - __start_rtc_noinit) : 0;
+    sim_rtc_header_t h = {
+        .magic = SIM_RTC_MAGIC,
+        .size = (uint32_t)size,
+        .true_us = true_us,
+        .rtc_us = (int64_t)esp_rtc_get_time_us(),
+        .reason = reason,
+    };
+    FILE *f = fopen(SIM_RTC_FILE, "wb");
+    if (f == NULL || fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(__start_rtc_noinit, 1, size, f) != size) {
+        fprintf(stderr, "sim: cannot save RTC memory: %s\n", strerror(errno));
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+
+bool sim_rtc_resume(const char *dir, int64_t *true_us) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, SIM_RTC_FILE);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    size_t size = __start_rtc_noinit ? (size_t)(__stop_rtc_noinit - __start_rtc_noinit) : 0;
+    sim_rtc_header_t h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == SIM_RTC_MAGIC && h.size == size &&
+              fread(__start_rtc_noinit, 1, size, f) == size;
+    fclose(f);
+    // One resume per reset, as on the chip; a later run boots cold.
+    unlink(path);
+    if (!ok) {
+        fprintf(stderr, "sim: ignoring %s, saved by another build\n", path);
+        memset(__start_rtc_noinit, 0, size);
+        return false;
+    }
+    s_reset_reason = (esp_reset_reason_t)h.reason;
+    s_rtc_base_us = h.rtc_us + SIM_BOOT_US;
+    *true_us = h.true_us + SIM_BOOT_US;
+    return true;
+}
+
+void esp_restart(void) {
+    sim_restart(ESP_RST_SW);
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+    return s_reset_reason;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return 180 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return 160 * 1024;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return 110 * 1024;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    return ESP_OK;
+}
+
+// newlib has it, glibc before 2.38 does not.
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+// ---------------------------------------------------------------------------
+// SNTP: answers a poll with the simulation's true time, but only while the
+// station has an IP and the server is reachable. Failed polls retry after
+// lwIP's default 15 s.
+
+#define SIM_SNTP_RTT_MS   120
+#define SIM_SNTP_RETRY_MS 15000
+
+static bool s_sntp_enabled;
+static bool s_sntp_reachable = true;
+static sntp_sync_status_t s_sntp_status;
+static sntp_sync_time_cb_t s_sntp_cb;
+static esp_timer_handle_t s_sntp_timer;
+static uint32_t s_sntp_interval_ms = CONFIG_LWIP_SNTP_UPDATE_DELAY;
+
+static void sntp_poll(void *arg) {
+    uint32_t next_ms = SIM_SNTP_RETRY_MS;
+    if (s_sntp_reachable && wifi_sim_has_ip()) {
+        int64_t us = sim_true_time_us();
+        struct timeval tv = { .tv_sec = us / 1000000, .tv_usec = us % 1000000 };
+        settimeofday(&tv, NULL);
+        s_sntp_status = SNTP_SYNC_STATUS_COMPLETED;
+        if (s_sntp_cb) {
+            s_sntp_cb(&tv);
+        }
+        next_ms = s_sntp_interval_ms;
+    }
+    esp_timer_start_once(s_sntp_timer, (uint64_t)next_ms * 1000);
+}
+
+void sim_sntp_set_reachable(bool reachable) {
+    s_sntp_reachable = reachable;
+}
+
+void esp_sntp_setoperatingmode(sntp_operatingmode_t mode) {
+}
+
+void esp_sntp_setservername(uint8_t idx, const char *server) {
+}
+
+void esp_sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t cb) {
+    s_sntp_cb = cb;
+}
+
+void esp_sntp_init(void) {
+    if (s_sntp_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = sntp_poll,
+            .name = "sntp",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &s_sntp_timer));
+    }
+    esp_timer_stop(s_sntp_timer);
+    esp_timer_start_once(s_sntp_timer, SIM_SNTP_RTT_MS * 1000);
+    s_sntp_enabled = true;
+}
+
+void esp_sntp_stop(void) {
+    if (s_sntp_timer) {
+        esp_timer_stop(s_sntp_timer);
+    }
+    s_sntp_enabled = false;
+}
+
+bool esp_sntp_enabled(void) {
+    return s_sntp_enabled;
+}
+
+// Like ESP-IDF, reading COMPLETED resets it.
+sntp_sync_status_t sntp_get_sync_status(void) {
+    sntp_sync_status_t status = s_sntp_status;
+    if (status == SNTP_SYNC_STATUS_COMPLETED) {
+        s_sntp_status = SNTP_SYNC_STATUS_RESET;
+    }
+    return status;
+}
+
+sntp_sync_status_t esp_sntp_get_sync_status(void) {
+    return sntp_get_sync_status();
+}
+
+void sntp_set_sync_interval(uint32_t interval_ms) {
+    s_sntp_interval_ms = interval_ms;
+}
+
+// ---------------------------------------------------------------------------
+// HTTP server
+
+#define SIM_HTTPD_MAX_HANDLERS 32
+
+typedef struct {
+    const char *headers;
+    const char *body;
+    size_t body_len;
+    size_t body_off;
+    uint32_t rate_bps;
+    size_t drop_at;
+    char *resp;
+    size_t resp_size;
+    size_t resp_len;
+    int status;
+} sim_req_t;
+
+static bool s_httpd_running;
+static httpd_config_t s_httpd_config;
+static httpd_uri_t s_handlers[SIM_HTTPD_MAX_HANDLERS];
+static int s_handler_count;
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+    if (s_httpd_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_httpd_config = *config;
+    s_httpd_running = true;
+    s_handler_count = 0;
+    *handle = &s_httpd_running;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+    s_httpd_running = false;
+    s_handler_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler) {
+    for (int i = 0; i < s_handler_count; i++) {
+        if (s_handlers[i].method == uri_handler->method &&
+            strcmp(s_handlers[i].uri, uri_handler->uri) == 0) {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    if (s_handler_count >= s_httpd_config.max_uri_handlers || s_handler_count >= SIM_HTTPD_MAX_HANDLERS) {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    s_handlers[s_handler_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+static void sim_resp_append(httpd_req_t *req, const char *buf, size_t len) {
+    sim_req_t *r = req->aux;
+    size_t room = r->resp_size > r->resp_len + 1 ? r->resp_size - r->resp_len - 1 : 0;
+    size_t n = len < room ? len : room;
+    memcpy(r->resp + r->resp_len, buf, n);
+    r->resp_len += n;
+    r->resp[r->resp_len] = '\0';
+}
+
+int httpd_req_recv(httpd_req_t *req, char *buf, size_t buf_len) {
+    sim_req_t *r = req->aux;
+    size_t end = r->drop_at ? r->drop_at : r->body_len;
+    if (r->drop_at && r->body_off >= r->drop_at) {
+        return HTTPD_SOCK_ERR_FAIL;
+    }
+    size_t left = end - r->body_off;
+    size_t n = buf_len < left ? buf_len : left;
+    if (r->rate_bps) {
+        vt_sleep_until(vt_now() + (int64_t)n * 1000000 / r->rate_bps);
+    }
+    memcpy(buf, r->body + r->body_off, n);
+    r->body_off += n;
+    return (int)n;
+}
+
+// Finds "field: value" in the request's header lines, ignoring case.
+static const char *sim_req_hdr(httpd_req_t *req, const char *field, size_t *len) {
+    size_t field_len = strlen(field);
+    for (const char *p = ((sim_req_t *)req->aux)->headers; p && *p;) {
+        size_t line = strcspn(p, "\n");
+        if (line > field_len && strncasecmp(p, field, field_len) == 0 && p[field_len] == ':') {
+            const char *v = p + field_len + 1;
+            v += strspn(v, " ");
+            *len = p + line - v;
+            return v;
+        }
+        p += line + (p[line] == '\n');
+    }
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *req, const char *field) {
+    size_t len;
+    return sim_req_hdr(req, field, &len) ? len : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t val_size) {
+    size_t len;
+    const char *v = sim_req_hdr(req, field, &len);
+    if (v == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t n = len < val_size - 1 ? len : val_size - 1;
+    memcpy(val, v, n);
+    val[n] = '\0';
+    return n < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+    ((sim_req_t *)req->aux)->status = atoi(status);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field, const char *value) {
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t buf_len) {
+    if (buf) {
+        sim_resp_append(req, buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len);
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t buf_len) {
+    return httpd_resp_send(req, buf, buf_len);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg) {
+    static const int codes[] = {
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = 500, [HTTPD_501_METHOD_NOT_IMPLEMENTED] = 501,
+        [HTTPD_505_VERSION_NOT_SUPPORTED] = 505, [HTTPD_400_BAD_REQUEST] = 400,
+        [HTTPD_401_UNAUTHORIZED] = 401, [HTTPD_403_FORBIDDEN] = 403,
+        [HTTPD_404_NOT_FOUND] = 404, [HTTPD_405_METHOD_NOT_ALLOWED] = 405,
+        [HTTPD_408_REQ_TIMEOUT] = 408,
+    };
+    ((sim_req_t *)req->aux)->status = codes[error];
+    return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+    size_t key_len = strlen(key);
+    const char *p = qry;
+    while (p && *p) {
+        const char *end = strchr(p, '&');
+        size_t field_len = end ? (size_t)(end - p) : strlen(p);
+        if (field_len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char *v = p + key_len + 1;
+            size_t len = field_len - key_len - 1;
+            size_t n = len < val_size - 1 ? len : val_size - 1;
+            memcpy(val, v, n);
+            val[n] = '\0';
+            return n < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t sim_http(httpd_method_t method, const char *uri, const char *body,
+                   char *resp, size_t resp_size, int *status) {
+    sim_http_body_t b = { .body = body, .body_len = body ? strlen(body) : 0 };
+    return sim_http_send(method, uri, &b, resp, resp_size, status);
+}
+
+esp_err_t sim_http_send(httpd_method_t method, const char *uri, const sim_http_body_t *body,
+                        char *resp, size_t resp_size, int *status) {
+    sim_req_t r = {
+        .headers = body->headers,
+        .body = body->body ? body->body : "",
+        .body_len = body->body ? body->body_len : 0,
+        .rate_bps = body->rate_bps,
+        .drop_at = body->drop_at,
+        .resp = resp,
+        .resp_size = resp_size,
+        .status = 200,
+    };
+    httpd_req_t req = {
+        .method = method,
+        .content_len = r.body_len,
+        .aux = &r,
+    };
+    snprintf((char *)req.uri, sizeof(req.uri), "%s", uri);
+    resp[0] = '\0';
+
+    size_t match_len = strcspn(uri, "?");
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    bool found = false;
+    for (int i = 0; s_httpd_running && i < s_handler_count; i++) {
+        const httpd_uri_t *h = &s_handlers[i];
+        bool match = s_httpd_config.uri_match_fn
+            ? s_httpd_config.uri_match_fn(h->uri, uri, match_len)
+            : strlen(h->uri) == match_len && strncmp(h->uri, uri, match_len) == 0;
+        if (h->method == method && match) {
+            req.handle = &s_httpd_running;
+            req.user_ctx = h->user_ctx;
+            err = h->handler(&req);
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        httpd_resp_send_err(&req, HTTPD_404_NOT_FOUND, "Not found");
+    }
+    *status = r.status;
+    return err;
+}
+
+// ---------------------------------------------------------------------------
+// OTA partitions
+
+// Typical SPI NOR timings (4 KB sector erase, 256-byte page program).
+#define SIM_FLASH_SECTOR     4096
+#define SIM_FLASH_PAGE       256
+#define SIM_FLASH_ERASE_US   45000
+#define SIM_FLASH_PROGRAM_US 400
+#define SIM_IMAGE_MAGIC      0xE9
+
+static const esp_partition_t s_ota_parts[2] = {
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x1E0000, SIM_FLASH_SECTOR, "ota_0" },
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x1F0000, 0x1E0000, SIM_FLASH_SECTOR, "ota_1" },
+};
+static const esp_partition_t *s_boot_part = &s_ota_parts[0];
+
+static struct {
+    esp_ota_handle_t handle;    // 0 while no update is open
+    const esp_partition_t *part;
+    uint8_t *flash;
+    size_t written;
+    size_t erased;
+} s_ota;
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return &s_ota_parts[0];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) {
+    return s_boot_part;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    return &s_ota_parts[1];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle) {
+    if (partition != &s_ota_parts[1]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_ota.handle) {
+        return ESP_ERR_INVALID_STATE;   // the chip allows one per partition too
+    }
+    if (s_ota.flash == NULL) {
+        s_ota.flash = malloc(partition->size);
+    }
+    memset(s_ota.flash, 0xFF, partition->size);
+    s_ota.part = partition;
+    s_ota.written = 0;
+    s_ota.erased = 0;
+    // Without OTA_WITH_SEQUENTIAL_WRITES the whole image is erased up front.
+    if (image_size != OTA_WITH_SEQUENTIAL_WRITES) {
+        size_t size = image_size == OTA_SIZE_UNKNOWN ? partition->size : image_size;
+        s_ota.erased = (size + SIM_FLASH_SECTOR - 1) / SIM_FLASH_SECTOR * SIM_FLASH_SECTOR;
+        vt_sleep_until(vt_now() + (int64_t)(s_ota.erased / SIM_FLASH_SECTOR) * SIM_FLASH_ERASE_US);
+    }
+    static esp_ota_handle_t next_handle;
+    s_ota.handle = ++next_handle;
+    *out_handle = s_ota.handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+    if (handle == 0 || handle != s_ota.handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_ota.written + size > s_ota.part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int64_t busy_us = 0;
+    while (s_ota.erased < s_ota.written + size) {
+        s_ota.erased += SIM_FLASH_SECTOR;
+        busy_us += SIM_FLASH_ERASE_US;
+    }
+    busy_us += (int64_t)(size + SIM_FLASH_PAGE - 1) / SIM_FLASH_PAGE * SIM_FLASH_PROGRAM_US;
+    vt_sleep_until(vt_now() + busy_us);
+    memcpy(s_ota.flash + s_ota.written, data, size);
+    s_ota.written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+    if (handle == 0 || handle != s_ota.handle) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_ota.handle = 0;
+    return s_ota.written > 0 && s_ota.flash[0] == SIM_IMAGE_MAGIC ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+    if (handle == 0 || handle != s_ota.handle) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_ota.handle = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    if (partition != &s_ota_parts[0] && partition != &s_ota_parts[1]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_boot_part = partition;
+    return ESP_OK;
+}
+
+// ---------------------------------------------------------------------------
+// LAN: UDP between the clock and simulated hosts (sim_lan_socket()). Each
+// datagram takes SIM_LAN_DELAY_US plus up to SIM_LAN_JITTER_US, drawn from
+// a fixed-seed generator so runs repeat. The clock is only reachable while
+// its station has an address.
+
+#define SIM_LAN_SOCKETS   32
+#define SIM_LAN_QUEUE     16
+#define SIM_LAN_MTU       128
+#define SIM_LAN_DELAY_US  1500
+#define SIM_LAN_JITTER_US 2000
+#define SIM_LAN_FD_BASE   100   // clear of the host's own descriptors
+#define SIM_LAN_EPHEMERAL 49152
+
+typedef struct {
+    int64_t deliver_at;
+    struct sockaddr_in from;
+    uint16_t len;
+    uint8_t data[SIM_LAN_MTU];
+} sim_datagram_t;
+
+typedef struct {
+    bool used;
+    uint32_t ip;          // host the socket lives on, network byte order
+    uint16_t port;        // network byte order; 0 until bound or first send
+    uint32_t group;       // joined multicast group, or 0
+    int64_t timeout_us;   // SO_RCVTIMEO; 0 blocks
+    QueueHandle_t queue;
+} sim_socket_t;
+
+static sim_socket_t s_sockets[SIM_LAN_SOCKETS];
+static uint32_t s_lan_rand = 0x9E3779B9;
+static uint16_t s_lan_next_port = SIM_LAN_EPHEMERAL;
+
+static sim_socket_t *sim_socket_get(int fd) {
+    int i = fd - SIM_LAN_FD_BASE;
+    if (i < 0 || i >= SIM_LAN_SOCKETS || !s_sockets[i].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &s_sockets[i];
+}
+
+static bool sim_lan_up(uint32_t ip) {
+    return ip != SIM_DEVICE_IP || wifi_sim_has_ip();
+}
+
+static int64_t sim_lan_delay(void) {
+    s_lan_rand ^= s_lan_rand << 13;
+    s_lan_rand ^= s_lan_rand >> 17;
+    s_lan_rand ^= s_lan_rand << 5;
+    return SIM_LAN_DELAY_US + s_lan_rand % (SIM_LAN_JITTER_US + 1);
+}
+
+int sim_lan_socket(uint32_t ip) {
+    for (int i = 0; i < SIM_LAN_SOCKETS; i++) {
+        if (!s_sockets[i].used) {
+            s_sockets[i] = (sim_socket_t){
+                .used = true,
+                .ip = ip,
+                .queue = xQueueCreate(SIM_LAN_QUEUE, sizeof(sim_datagram_t)),
+            };
+            return SIM_LAN_FD_BASE + i;
+        }
+    }
+    errno = ENFILE;
+    return -1;
+}
+
+int lwip_socket(int domain, int type, int protocol) {
+    if (domain != AF_INET || type != SOCK_DGRAM) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+    return sim_lan_socket(SIM_DEVICE_IP);
+}
+
+int lwip_bind(int fd, const struct sockaddr *name, socklen_t namelen) {
+    sim_socket_t *s = sim_socket_get(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    uint16_t port = ((const struct sockaddr_in *)name)->sin_port;
+    for (int i = 0; i < SIM_LAN_SOCKETS; i++) {
+        if (s_sockets[i].used && s_sockets[i].ip == s->ip && s_sockets[i].port == port) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+    }
+    s->port = port;
+    return 0;
+}
+
+int lwip_setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen) {
+    sim_socket_t *s = sim_socket_get(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    if (level == SOL_SOCKET && optname == SO_RCVTIMEO) {
+        const struct timeval *tv = optval;
+        s->timeout_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    } else if (level == IPPROTO_IP && optname == IP_ADD_MEMBERSHIP) {
+        s->group = ((const struct ip_mreq *)optval)->imr_multiaddr.s_addr;
+    } else if (level == IPPROTO_IP && optname == IP_DROP_MEMBERSHIP) {
+        s->group = 0;
+    }
+    return 0; // the rest (TTL, loopback, reuse) mean nothing here
+}
+
+ssize_t lwip_sendto(int fd, const void *data, size_t size, int flags, const struct sockaddr *to, socklen_t tolen) {
+    sim_socket_t *s = sim_socket_get(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    if (size > SIM_LAN_MTU) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (s->port == 0) {
+        s->port = htons(s_lan_next_port++);
+    }
+    const struct sockaddr_in *dst = (const struct sockaddr_in *)to;
+    bool multicast = IN_MULTICAST(ntohl(dst->sin_addr.s_addr));
+    sim_datagram_t d = {
+        .from = { .sin_family = AF_INET, .sin_port = s->port, .sin_addr.s_addr = s->ip },
+        .len = (uint16_t)size,
+    };
+    memcpy(d.data, data, size);
+    if (!sim_lan_up(s->ip)) {
+        return (ssize_t)size; // lost, as UDP would
+    }
+    for (int i = 0; i < SIM_LAN_SOCKETS; i++) {
+        sim_socket_t *t = &s_sockets[i];
+        if (!t->used || t == s || t->port != dst->sin_port || !sim_lan_up(t->ip) ||
+            (multicast ? t->group : t->ip) != dst->sin_addr.s_addr) {
+            continue;
+        }
+        d.deliver_at = vt_now() + sim_lan_delay();
+        xQueueSend(t->queue, &d, 0);    // a full queue drops it
+    }
+    return (ssize_t)size;
+}
+
+// A datagram sits in the queue from the moment it is sent but is only
+// handed over once it has crossed the LAN.
+ssize_t lwip_recvfrom(int fd, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen) {
+    sim_socket_t *s = sim_socket_get(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    int64_t deadline = s->timeout_us ? vt_now() + s->timeout_us : INT64_MAX;
+    TickType_t ticks = s->timeout_us ? (TickType_t)((s->timeout_us + VT_TICK_US - 1) / VT_TICK_US) : portMAX_DELAY;
+    sim_datagram_t d;
+    if (xQueuePeek(s->queue, &d, ticks) != pdTRUE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (d.deliver_at > deadline) {
+        vt_sleep_until(deadline);
+        errno = EAGAIN;
+        return -1;
+    }
+    vt_sleep_until(d.deliver_at);
+    xQueueReceive(s->queue, &d, 0);
+    size_t n = d.len < len ? d.len : len;
+    memcpy(mem, d.data, n);
+    if (from && fromlen) {
+        socklen_t copy = *fromlen < sizeof(d.from) ? *fromlen : sizeof(d.from);
+        memcpy(from, &d.from, copy);
+        *fromlen = sizeof(d.from);
+    }
+    return (ssize_t)n;
+}
+
+int lwip_close(int fd) {
+    sim_socket_t *s = sim_socket_get(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    vQueueDelete(s->queue);
+    s->used = false;
+    return 0;
+}
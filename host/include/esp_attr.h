@@ -0,0 +1,15 @@
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+// Placement attributes mean nothing off-target, except RTC_NOINIT_ATTR:
+// its section is what the simulator carries across a reset (idf.c).
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
+#define RTC_FAST_ATTR
+#define RTC_SLOW_ATTR
+#define EXT_RAM_BSS_ATTR
+#define NOINLINE_ATTR __attribute__((noinline))
+
+#endif // HOST_ESP_ATTR_H
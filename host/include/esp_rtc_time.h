@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_RTC_TIME_H
+#define HOST_ESP_RTC_TIME_H
+
+#include <stdint.h>
+
+// The RTC timer, which counts on through a software or watchdog reset;
+// see the RTC memory section of idf.c.
+uint64_t esp_rtc_get_time_us(void);
+
+#endif // HOST_ESP_RTC_TIME_H
@@ -0,0 +1,34 @@
+#ifndef HOST_ESP_SNTP_H
+#define HOST_ESP_SNTP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+// A virtual NTP server (host/hw.c): once started, it answers after the
+// simulated round trip and then every CONFIG_LWIP_SNTP_UPDATE_DELAY, setting
+// the system clock to the simulation's true time.
+typedef enum {
+    SNTP_SYNC_STATUS_RESET,
+    SNTP_SYNC_STATUS_COMPLETED,
+    SNTP_SYNC_STATUS_IN_PROGRESS,
+} sntp_sync_status_t;
+
+typedef enum {
+    SNTP_OPMODE_POLL,
+    SNTP_OPMODE_LISTENONLY,
+} sntp_operatingmode_t;
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void esp_sntp_setoperatingmode(sntp_operatingmode_t mode);
+void esp_sntp_setservername(uint8_t idx, const char *server);
+void esp_sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t cb);
+void esp_sntp_init(void);
+void esp_sntp_stop(void);
+bool esp_sntp_enabled(void);
+sntp_sync_status_t sntp_get_sync_status(void);
+sntp_sync_status_t esp_sntp_get_sync_status(void);
+void sntp_set_sync_interval(uint32_t interval_ms);
+
+#endif // HOST_ESP_SNTP_H
@@ -0,0 +1,59 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// FreeRTOS as far as the clock uses it, implemented by host/vt.c on a
+// single-threaded virtual-time scheduler. Critical sections are no-ops: a
+// task only gives up the CPU inside a blocking call.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "esp_system.h" // portmacro.h pulls it in on the target
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct vt_task *TaskHandle_t;
+typedef struct vt_queue *QueueHandle_t;
+typedef struct vt_queue *SemaphoreHandle_t;
+typedef struct vt_group *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES    25
+#define configMAX_TASK_NAME_LEN 16
+#define portNUM_PROCESSORS      1
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(t)        ((TickType_t)(((uint64_t)(t) * 1000) / configTICK_RATE_HZ))
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define errQUEUE_FULL           pdFALSE
+#define tskIDLE_PRIORITY        0
+#define tskNO_AFFINITY          0x7FFFFFFF
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux)     ((void)(mux))
+#define portEXIT_CRITICAL(mux)      ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)  ((void)(mux))
+#define taskENTER_CRITICAL(mux)     ((void)(mux))
+#define taskEXIT_CRITICAL(mux)      ((void)(mux))
+#define portYIELD_FROM_ISR(woken)   ((void)(woken))
+
+BaseType_t xPortGetCoreID(void);
+BaseType_t xPortInIsrContext(void);
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,6 @@
+#ifndef HOST_LWIP_SYS_H
+#define HOST_LWIP_SYS_H
+
+// Included by app_config.h; nothing in it is used.
+
+#endif // HOST_LWIP_SYS_H
@@ -0,0 +1,11 @@
+#ifndef HOST_NEWLIB_COMPAT_H
+#define HOST_NEWLIB_COMPAT_H
+
+// Force-included into every host translation unit (host/CMakeLists.txt):
+// what the firmware gets from newlib but glibc lacks.
+
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#endif // HOST_NEWLIB_COMPAT_H
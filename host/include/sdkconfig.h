@@ -0,0 +1,9 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// The handful of Kconfig values the clock reads, at their ESP-IDF defaults.
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_LWIP_SNTP_UPDATE_DELAY 3600000
+
+#endif // HOST_SDKCONFIG_H
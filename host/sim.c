@@ -0,0 +1,1081 @@
+// Runs the clock firmware on the virtual-time kernel and drives it from a
+// scenario script. "Host Simulator" in the README lists the options and
+// the script commands.
+
+#define _GNU_SOURCE // strptime, getopt_long
+
+#include "sim.h"
+#include "vt.h"
+#include "app_config.h"
+#include "board.h"
+#include "chrono.h"
+#include "config_store.h"
+#include "display_manager.h"
+#include "sntp_server.h"
+#include "mbedtls/sha256.h"
+#include "rtci2c/rtci2c.h"
+#include "world_clock.h"
+#include "wifi_sim.h"
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lwip/sockets.h"
+
+void app_main(void);
+
+#define SIM_MAIN_PRIO   1       // as ESP-IDF's main task
+#define SIM_DRIVER_PRIO (configMAX_PRIORITIES - 1)
+#define SIM_LINE_MAX    512
+#define SIM_CHECK_REPORT 5      // clock check mismatches printed in full
+#define SIM_MESSAGE_MS  1000    // how long a script "message" stays up
+#define SIM_OTA_PRIO    5       // the HTTP server task's priority
+#define SIM_OTA_RATE    (500 * 1024) // upload bytes per second over Wi-Fi
+#define SIM_OTA_RETRY_MS 1000   // client pause before resuming
+#define SIM_OTA_ATTEMPTS 5
+#define SIM_NTP_PRIO    3       // below the clock's SNTP server
+#define SIM_NTP_HOSTS   8
+#define SIM_NTP_HOST_IP 0x6401A8C0 // 192.168.1.100, network byte order
+#define SIM_NTP_POLLS   6
+#define SIM_NTP_POLL_S  16
+#define SIM_NTP_TIMEOUT_MS 500
+#define SIM_NTP_OFFSET_US 2000000  // hosts start up to this far off
+#define SIM_NTP_DRIFT_PPM 40       // and drift up to this fast
+#define SIM_NTP_TOLERANCE_US 10000 // off the clock by more fails the run
+
+typedef struct {
+    int64_t at_us;              // virtual time since boot
+    int line;
+    char text[SIM_LINE_MAX];    // command and arguments
+} sim_event_t;
+
+static struct {
+    int64_t start_us;           // true time at boot
+    int64_t duration_us;
+    const char *tz;
+    const char *ssid;
+    const char *password;
+    bool ap_off;
+    int64_t rtc_offset_us;
+    int32_t drift_ppm;
+    const char *script;
+    const char *state_dir;
+    bool show_display;
+    bool show_bus;
+    const char *golden;
+    bool record;
+    long budget;                // most transactions the trace may hold; 0 = no limit
+    bool check_clock;
+    bool quiet;
+    bool warm;                  // resumed from RTC memory a restart saved
+} s_opt;
+
+static sim_event_t *s_events;
+static size_t s_event_count;
+static size_t s_event_cap;
+
+static uint64_t s_display_updates;
+static unsigned s_expect_passed;
+static unsigned s_expect_failed;
+static uint64_t s_check_ok;
+static uint64_t s_check_bad;
+static uint64_t s_led_edges;    // seconds LED rising edges
+static int64_t s_led_worst_us;  // furthest one from a second of the system clock
+static int64_t s_time_shown_us = -1; // when the display first read the true time
+static struct timespec s_wall_start;
+
+// Bus transactions since boot or the last "trace reset", one per line.
+static char *s_trace;
+static size_t s_trace_len;
+static size_t s_trace_cap;
+static unsigned long s_trace_count;
+static rtci2c_context s_rtc;
+
+int64_t sim_true_time_us(void) {
+    return s_opt.start_us + vt_now();
+}
+
+static void sim_stamp(char *out, size_t size) {
+    int64_t us = sim_true_time_us();
+    time_t t = (time_t)(us / 1000000);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    size_t n = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(out + n, size - n, ".%03d %s", (int)(us / 1000 % 1000), tm.tm_zone);
+}
+
+static void sim_print(const char *fmt, ...) {
+    char stamp[64];
+    sim_stamp(stamp, sizeof(stamp));
+    printf("[%s] ", stamp);
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+static void sim_print_display(void) {
+    char text[SIM_TEXT_MAX];
+    sim_max7219_text(text, sizeof(text));
+    const sim_max7219_t *chip = sim_max7219();
+    if (chip->shutdown) {
+        sim_print("display off");
+    } else {
+        sim_print("display \"%s\" intensity %u", text, chip->intensity);
+    }
+}
+
+// The seconds LED follows the clock the firmware keeps, so its edges are
+// measured against vt_clock(), not true time.
+void sim_gpio_output(gpio_num_t pin, int level) {
+    if (pin != SECONDS_LED_PIN || !level) {
+        return;
+    }
+    int64_t phase = vt_clock() % 1000000;
+    int64_t error = phase < 500000 ? phase : 1000000 - phase;
+    s_led_edges++;
+    s_led_worst_us = error > s_led_worst_us ? error : s_led_worst_us;
+}
+
+// True if a digit display reads the true local HH:MM, leading blanks aside.
+static bool sim_shows_true_time(const char *text) {
+    const char *shown = text + strspn(text, " ");
+    time_t t = (time_t)(sim_true_time_us() / 1000000);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char want[8];
+    strftime(want, sizeof(want), "%H%M", &tm);
+    return strncmp(shown, want, 4) == 0;
+}
+
+void sim_display_changed(void) {
+    s_display_updates++;
+    if (s_time_shown_us < 0 && !board_profile.matrix && !sim_max7219()->shutdown) {
+        char text[SIM_TEXT_MAX];
+        sim_max7219_text(text, sizeof(text));
+        if (sim_shows_true_time(text)) {
+            s_time_shown_us = vt_now();
+        }
+    }
+    if (s_opt.show_display) {
+        sim_print_display();
+    }
+}
+
+void sim_bus_transaction(const char *line) {
+    if (s_opt.show_bus) {
+        sim_print("%s", line);
+    }
+    if (s_opt.golden == NULL) {
+        return;
+    }
+    size_t len = strlen(line) + 1;
+    if (s_trace_len + len > s_trace_cap) {
+        s_trace_cap = s_trace_cap ? s_trace_cap * 2 : 4096;
+        s_trace = realloc(s_trace, s_trace_cap);
+        if (s_trace == NULL) {
+            perror("sim");
+            exit(2);
+        }
+    }
+    memcpy(s_trace + s_trace_len, line, len - 1);
+    s_trace[s_trace_len + len - 1] = '\n';
+    s_trace_len += len;
+    s_trace_count++;
+}
+
+static int sim_summary(void);
+
+void sim_restart(esp_reset_reason_t reason) {
+    sim_print("reset (reason %d), ending the run", reason);
+    sim_rtc_save(reason, sim_true_time_us());
+    fflush(stdout);
+    exit(sim_summary());
+}
+
+// ---------------------------------------------------------------------------
+// Parsing
+
+// "90d", "1d12h", "36h", "90m", "45s", "250ms" or a plain number of seconds.
+static bool sim_parse_duration(const char *s, int64_t *out) {
+    int64_t total = 0;
+    if (*s == '\0') {
+        return false;
+    }
+    while (*s) {
+        char *end;
+        errno = 0;
+        long long v = strtoll(s, &end, 10);
+        if (end == s || errno) {
+            return false;
+        }
+        s = end;
+        int64_t unit = 1000000;
+        if (strncmp(s, "ms", 2) == 0) {
+            unit = 1000;
+            s += 2;
+        } else if (*s == 'd') {
+            unit = 86400LL * 1000000;
+            s++;
+        } else if (*s == 'h') {
+            unit = 3600LL * 1000000;
+            s++;
+        } else if (*s == 'm') {
+            unit = 60LL * 1000000;
+            s++;
+        } else if (*s == 's') {
+            s++;
+        } else if (*s != '\0') {
+            return false;
+        }
+        total += v * unit;
+    }
+    *out = total;
+    return true;
+}
+
+// "YYYY-MM-DD HH:MM:SS" (or with a T) in the --tz zone, UTC without one.
+// Returns the rest of the string, or NULL if it is not a date.
+static const char *sim_parse_date(const char *s, int64_t *out_us) {
+    struct tm tm = { 0 };
+    const char *rest = strptime(s, "%Y-%m-%d %H:%M:%S", &tm);
+    if (rest == NULL) {
+        memset(&tm, 0, sizeof(tm));
+        rest = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    }
+    if (rest == NULL) {
+        return NULL;
+    }
+    tm.tm_isdst = -1;
+    *out_us = (int64_t)mktime(&tm) * 1000000;
+    return rest;
+}
+
+static void sim_add_event(int64_t at_us, int line, const char *text) {
+    if (s_event_count == s_event_cap) {
+        s_event_cap = s_event_cap ? s_event_cap * 2 : 32;
+        s_events = realloc(s_events, s_event_cap * sizeof(*s_events));
+        if (s_events == NULL) {
+            perror("sim");
+            exit(2);
+        }
+    }
+    // Keep time order; equal times run in script order.
+    size_t i = s_event_count++;
+    while (i > 0 && s_events[i - 1].at_us > at_us) {
+        s_events[i] = s_events[i - 1];
+        i--;
+    }
+    s_events[i].at_us = at_us;
+    s_events[i].line = line;
+    snprintf(s_events[i].text, sizeof(s_events[i].text), "%s", text);
+}
+
+static bool sim_known_command(const char *text) {
+    static const char *const commands[] = {
+        "press", "release", "get", "post", "expect", "wifi", "sntp", "show", "drift", "clock", "stop",
+        "message", "rtc", "trace", "ota", "ntp", "restart",
+    };
+    size_t len = strcspn(text, " \t");
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strlen(commands[i]) == len && strncmp(commands[i], text, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One event per line: "<when> <command> [arguments]", where <when> is
+// "+<duration>" after boot or an absolute date. '#' starts a comment.
+static void sim_load_script(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "sim: cannot open %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+    char line[SIM_LINE_MAX];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *p = line;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        int64_t at;
+        const char *rest;
+        if (*p == '+') {
+            size_t len = strcspn(p + 1, " \t");
+            char dur[32];
+            snprintf(dur, sizeof(dur), "%.*s", (int)len, p + 1);
+            if (!sim_parse_duration(dur, &at)) {
+                fprintf(stderr, "%s:%d: bad duration \"%s\"\n", path, lineno, dur);
+                exit(2);
+            }
+            rest = p + 1 + len;
+        } else if ((rest = sim_parse_date(p, &at)) != NULL) {
+            at -= s_opt.start_us;
+            if (at < 0) {
+                fprintf(stderr, "%s:%d: before the simulation starts\n", path, lineno);
+                exit(2);
+            }
+        } else {
+            fprintf(stderr, "%s:%d: expected +<duration> or a date\n", path, lineno);
+            exit(2);
+        }
+        while (isspace((unsigned char)*rest)) {
+            rest++;
+        }
+        if (!sim_known_command(rest)) {
+            fprintf(stderr, "%s:%d: unknown command \"%s\"\n", path, lineno, rest);
+            exit(2);
+        }
+        sim_add_event(at, lineno, rest);
+    }
+    fclose(f);
+}
+
+// ---------------------------------------------------------------------------
+// Scenario
+
+static void sim_expect(bool ok, int line, const char *what, const char *got) {
+    if (ok) {
+        s_expect_passed++;
+        sim_print("expect %s: ok", what);
+    } else {
+        s_expect_failed++;
+        sim_print("expect %s: FAILED at line %d, got %s", what, line, got);
+    }
+}
+
+// Strips surrounding double quotes in place.
+static char *sim_unquote(char *s) {
+    size_t len = strlen(s);
+    if (len >= 2 && s[0] == '"' && s[len - 1] == '"') {
+        s[len - 1] = '\0';
+        return s + 1;
+    }
+    return s;
+}
+
+static void sim_set_ap(bool on_air) {
+    wifi_sim_ap_t ap = {
+        .bssid = { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x01 },
+        .channel = on_air ? 6 : 0,
+        .assoc_ms = 300,
+        .dhcp_ms = 700,
+        .lease_ip = SIM_DEVICE_IP,
+    };
+    wifi_sim_set_ap(&ap);
+}
+
+// The "ota" command: a client uploading an image to POST /api/ota from a
+// task of its own, as the HTTP server would run the handler, so the
+// firmware keeps running while it streams. After a dropped connection it
+// asks GET /api/ota where to resume and sends the rest with Content-Range.
+static struct {
+    uint8_t *image;
+    size_t size;
+    size_t drop_at;             // connection fails after this many bytes; 0 = never
+    int line;
+} s_ota;
+
+// Like the response's "key":N, or 0.
+static unsigned long sim_json_ulong(const char *json, const char *key) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(json, pattern);
+    return p ? strtoul(p + strlen(pattern), NULL, 10) : 0;
+}
+
+static void sim_ota_task(void *arg) {
+    static char resp[512];
+    uint8_t digest[32];
+    char hex[65];
+    mbedtls_sha256(s_ota.image, s_ota.size, digest, 0);
+    for (int i = 0; i < 32; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+
+    int64_t start_us = vt_now();
+    int status = 0;
+    size_t from = 0;
+    int attempt;
+    for (attempt = 0; attempt < SIM_OTA_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            vt_sleep_until(vt_now() + SIM_OTA_RETRY_MS * 1000LL);
+            sim_http(HTTP_GET, "/api/ota", NULL, resp, sizeof(resp), &status);
+            from = sim_json_ulong(resp, "received");
+        }
+        char headers[160];
+        snprintf(headers, sizeof(headers), "X-SHA256: %s\nContent-Range: bytes %zu-%zu/%zu", hex, from,
+                 s_ota.size - 1, s_ota.size);
+        sim_http_body_t body = {
+            .headers = headers,
+            .body = s_ota.image + from,
+            .body_len = s_ota.size - from,
+            .rate_bps = SIM_OTA_RATE,
+            .drop_at = s_ota.drop_at > from ? s_ota.drop_at - from : 0,
+        };
+        esp_err_t err = sim_http_send(HTTP_POST, "/api/ota", &body, resp, sizeof(resp), &status);
+        if (err == ESP_OK || status != 200) {
+            break;
+        }
+        sim_print("ota: connection dropped after %zu bytes", from + body.drop_at);
+        s_ota.drop_at = 0;
+    }
+    double secs = (vt_now() - start_us) / 1e6;
+    if (status == 200 && strstr(resp, "\"state\":\"done\"")) {
+        s_expect_passed++;
+        sim_print("ota: %zu bytes in %.2f s, %.1f KB/s with %d resume%s; device %lu KB/s while receiving, "
+                  "heap peak %lu B, free heap low-water %lu B",
+                  s_ota.size, secs, s_ota.size / 1024.0 / secs, attempt, attempt == 1 ? "" : "s",
+                  sim_json_ulong(resp, "rate_kb_s"), sim_json_ulong(resp, "heap_peak"),
+                  sim_json_ulong(resp, "heap_min_free"));
+    } else {
+        s_expect_failed++;
+        sim_print("ota: FAILED at line %d: %d %s", s_ota.line, status, resp);
+    }
+    free(s_ota.image);
+    s_ota.image = NULL;
+    vTaskDelete(NULL);
+}
+
+// "ota FILE|SIZE [drop BYTES]": SIZE (e.g. 512K) uploads a made-up image.
+static void sim_ota_start(const sim_event_t *ev, const char *what, char *rest) {
+    if (s_ota.image) {
+        sim_print("line %d: an upload is already running", ev->line);
+        s_expect_failed++;
+        return;
+    }
+    FILE *f = fopen(what, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        s_ota.size = ftell(f);
+        rewind(f);
+        s_ota.image = malloc(s_ota.size ? s_ota.size : 1);
+        s_ota.size = fread(s_ota.image, 1, s_ota.size, f);
+        fclose(f);
+    } else {
+        char *end;
+        s_ota.size = strtoul(what, &end, 10) << (*end == 'K' ? 10 : *end == 'M' ? 20 : 0);
+        s_ota.image = malloc(s_ota.size ? s_ota.size : 1);
+        uint32_t x = 2463534242u;
+        for (size_t i = 0; i < s_ota.size; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            s_ota.image[i] = (uint8_t)x;
+        }
+        if (s_ota.size) {
+            s_ota.image[0] = 0xE9; // ESP_IMAGE_HEADER_MAGIC
+        }
+    }
+    char *save;
+    char *opt = strtok_r(rest, " \t", &save);
+    char *val = strtok_r(NULL, " \t", &save);
+    s_ota.drop_at = 0;
+    if (opt && strcmp(opt, "drop") == 0 && val) {
+        char *end;
+        s_ota.drop_at = strtoul(val, &end, 10) << (*end == 'K' ? 10 : *end == 'M' ? 20 : 0);
+    }
+    s_ota.line = ev->line;
+    sim_print("ota: uploading %zu bytes%s", s_ota.size, s_ota.drop_at ? ", dropping the connection once" : "");
+    xTaskCreate(sim_ota_task, "sim_ota", 4096, NULL, SIM_OTA_PRIO, NULL);
+}
+
+// The "ntp" command: hosts on the LAN, each with a clock that starts off
+// and drifts, that learn the leader from its multicast announcement and
+// then poll it SIM_NTP_POLLS times, stepping to each measured offset. At
+// the end each reports how far it is from the clock and from true time.
+typedef struct {
+    uint32_t ip;
+    int64_t base_vt;            // virtual time at the last step
+    int64_t base_us;            // the host clock then
+    int32_t ppm;
+    int replies;
+    int64_t rtt_sum;
+    int64_t rtt_max;
+} sim_ntp_host_t;
+
+static struct {
+    sim_ntp_host_t hosts[SIM_NTP_HOSTS];
+    int count;
+    int running;
+    int64_t worst_us;           // largest |offset| to the clock
+} s_ntp;
+
+static int64_t sim_ntp_clock(const sim_ntp_host_t *h) {
+    int64_t dt = vt_now() - h->base_vt;
+    return h->base_us + dt + dt * h->ppm / 1000000;
+}
+
+static void sim_ntp_put(uint8_t *p, int64_t us) {
+    uint32_t sec = (uint32_t)(us / 1000000 + 2208988800LL);
+    uint32_t frac = (uint32_t)(((uint64_t)(us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(sec >> (24 - 8 * i));
+        p[4 + i] = (uint8_t)(frac >> (24 - 8 * i));
+    }
+}
+
+static int64_t sim_ntp_get(const uint8_t *p) {
+    uint32_t sec = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    uint32_t frac = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+    return ((int64_t)sec - 2208988800LL) * 1000000 + (int64_t)(((uint64_t)frac * 1000000) >> 32);
+}
+
+static void sim_ntp_format_ip(uint32_t ip, char *out, size_t size) {
+    const uint8_t *b = (const uint8_t *)&ip;
+    snprintf(out, size, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+}
+
+// One poll of the leader; steps the host clock on a valid reply.
+static void sim_ntp_poll(sim_ntp_host_t *h, int sock, const struct sockaddr_in *leader) {
+    uint8_t req[SNTP_PACKET_LEN] = { 4 << 3 | 3 }; // version 4, client
+    int64_t t1 = sim_ntp_clock(h);
+    sim_ntp_put(req + 40, t1);
+    lwip_sendto(sock, req, sizeof(req), 0, (const struct sockaddr *)leader, sizeof(*leader));
+    int64_t deadline = vt_now() + SIM_NTP_TIMEOUT_MS * 1000;
+    while (vt_now() < deadline) {
+        uint8_t resp[SNTP_PACKET_LEN];
+        if (lwip_recvfrom(sock, resp, sizeof(resp), 0, NULL, NULL) != SNTP_PACKET_LEN ||
+            (resp[0] & 7) != 4 || memcmp(resp + 24, req + 40, 8) != 0) {
+            continue; // an announcement, a stale reply or the timeout
+        }
+        int64_t t4 = sim_ntp_clock(h);
+        int64_t t2 = sim_ntp_get(resp + 32), t3 = sim_ntp_get(resp + 40);
+        int64_t rtt = (t4 - t1) - (t3 - t2);
+        h->base_us = t4 + ((t2 - t1) + (t3 - t4)) / 2;
+        h->base_vt = vt_now();
+        h->replies++;
+        h->rtt_sum += rtt;
+        h->rtt_max = rtt > h->rtt_max ? rtt : h->rtt_max;
+        return;
+    }
+}
+
+static void sim_ntp_task(void *arg) {
+    sim_ntp_host_t *h = arg;
+    char name[16], leader_name[16] = "none";
+    sim_ntp_format_ip(h->ip, name, sizeof(name));
+    int sock = sim_lan_socket(h->ip);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(SNTP_SERVER_PORT) };
+    struct ip_mreq mreq = { .imr_multiaddr.s_addr = inet_addr(SNTP_MULTICAST_GROUP) };
+    struct timeval timeout = { .tv_usec = SIM_NTP_TIMEOUT_MS * 1000 };
+    lwip_bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    lwip_setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    lwip_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in leader = { 0 };
+    int64_t give_up = vt_now() + SNTP_LEADER_TIMEOUT_S * 1000000LL;
+    while (leader.sin_addr.s_addr == 0 && vt_now() < give_up) {
+        uint8_t pkt[SNTP_PACKET_LEN];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        if (lwip_recvfrom(sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&from, &from_len) == SNTP_PACKET_LEN &&
+            (pkt[0] & 7) == 5) {
+            leader = from;
+        }
+    }
+    if (leader.sin_addr.s_addr) {
+        sim_ntp_format_ip(leader.sin_addr.s_addr, leader_name, sizeof(leader_name));
+        for (int i = 0; i < SIM_NTP_POLLS; i++) {
+            if (i) {
+                vt_sleep_until(vt_now() + SIM_NTP_POLL_S * 1000000LL);
+            }
+            sim_ntp_poll(h, sock, &leader);
+        }
+    }
+    lwip_close(sock);
+
+    int64_t to_clock = sim_ntp_clock(h) - vt_clock();
+    int64_t to_true = sim_ntp_clock(h) - sim_true_time_us();
+    int64_t worst = to_clock < 0 ? -to_clock : to_clock;
+    s_ntp.worst_us = worst > s_ntp.worst_us ? worst : s_ntp.worst_us;
+    if (h->replies && worst <= SIM_NTP_TOLERANCE_US) {
+        s_expect_passed++;
+    } else {
+        s_expect_failed++;
+    }
+    sim_print("ntp: %s leader %s, %d/%d replies, rtt mean %.1f ms max %.1f ms, offset %+.2f ms to the clock, "
+              "%+.2f ms to true time%s",
+              name, leader_name, h->replies, SIM_NTP_POLLS,
+              h->replies ? h->rtt_sum / 1e3 / h->replies : 0.0, h->rtt_max / 1e3, to_clock / 1e3,
+              to_true / 1e3, h->replies && worst <= SIM_NTP_TOLERANCE_US ? "" : " FAILED");
+    if (--s_ntp.running == 0) {
+        sim_print("ntp: %d hosts, worst offset to the clock %.2f ms", s_ntp.count, s_ntp.worst_us / 1e3);
+    }
+    vTaskDelete(NULL);
+}
+
+// "ntp HOSTS": starts up to SIM_NTP_HOSTS hosts, 192.168.1.100 upwards.
+static void sim_ntp_start(const sim_event_t *ev, const char *arg) {
+    int count = atoi(arg);
+    if (s_ntp.running || count < 1 || count > SIM_NTP_HOSTS) {
+        sim_print("line %d: ntp needs 1 to %d hosts and none running", ev->line, SIM_NTP_HOSTS);
+        s_expect_failed++;
+        return;
+    }
+    s_ntp.count = s_ntp.running = count;
+    s_ntp.worst_us = 0;
+    uint32_t x = 0x2545F491;
+    for (int i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sim_ntp_host_t *h = &s_ntp.hosts[i];
+        *h = (sim_ntp_host_t){
+            .ip = SIM_NTP_HOST_IP + ((uint32_t)i << 24),
+            .base_vt = vt_now(),
+            .base_us = sim_true_time_us() + (int64_t)(x % (2 * SIM_NTP_OFFSET_US + 1)) - SIM_NTP_OFFSET_US,
+            .ppm = (int32_t)(x >> 16) % (2 * SIM_NTP_DRIFT_PPM + 1) - SIM_NTP_DRIFT_PPM,
+        };
+        xTaskCreate(sim_ntp_task, "sim_ntp", 4096, h, SIM_NTP_PRIO, NULL);
+    }
+    sim_print("ntp: %d hosts waiting for a leader", count);
+}
+
+static void sim_exec(const sim_event_t *ev) {
+    char buf[SIM_LINE_MAX];
+    snprintf(buf, sizeof(buf), "%s", ev->text);
+    char *save;
+    char *cmd = strtok_r(buf, " \t", &save);
+    char *arg = strtok_r(NULL, " \t", &save);
+    char *rest = save + strspn(save, " \t");
+
+    if (strcmp(cmd, "press") == 0) {
+        int64_t hold_us = 100000;
+        if (arg && !sim_parse_duration(arg, &hold_us)) {
+            hold_us = 100000;
+        }
+        sim_gpio_input(DISMISS_BUTTON_PIN, 0);
+        sim_add_event(vt_now() + hold_us, ev->line, "release");
+    } else if (strcmp(cmd, "release") == 0) {
+        sim_gpio_input(DISMISS_BUTTON_PIN, 1);
+    } else if (strcmp(cmd, "get") == 0 || strcmp(cmd, "post") == 0) {
+        static char resp[8192];
+        int status;
+        bool post = cmd[0] == 'p';
+        sim_http(post ? HTTP_POST : HTTP_GET, arg ? arg : "/", post ? rest : NULL, resp, sizeof(resp), &status);
+        sim_print("%s %s -> %d %s", post ? "POST" : "GET", arg ? arg : "/", status, resp);
+    } else if (strcmp(cmd, "expect") == 0 && arg) {
+        const sim_max7219_t *chip = sim_max7219();
+        char got[SIM_TEXT_MAX + 2];
+        char what[SIM_LINE_MAX + 16];
+        if (strcmp(arg, "display") == 0) {
+            char text[SIM_TEXT_MAX];
+            sim_max7219_text(text, sizeof(text));
+            char *want = sim_unquote(rest);
+            snprintf(got, sizeof(got), "\"%s\"", text);
+            snprintf(what, sizeof(what), "display \"%s\"", want);
+            sim_expect(strcmp(text, want) == 0, ev->line, what, got);
+        } else if (strcmp(arg, "power") == 0) {
+            snprintf(got, sizeof(got), "%s", chip->shutdown ? "off" : "on");
+            snprintf(what, sizeof(what), "power %s", rest);
+            sim_expect(strcmp(got, rest) == 0, ev->line, what, got);
+        } else if (strcmp(arg, "intensity") == 0) {
+            snprintf(got, sizeof(got), "%u", chip->intensity);
+            snprintf(what, sizeof(what), "intensity %s", rest);
+            sim_expect(atoi(rest) == chip->intensity, ev->line, what, got);
+        } else {
+            sim_print("line %d: unknown expectation \"%s\"", ev->line, arg);
+            s_expect_failed++;
+        }
+    } else if (strcmp(cmd, "wifi") == 0 && arg) {
+        if (strcmp(arg, "drop") == 0) {
+            wifi_sim_drop(WIFI_REASON_BEACON_TIMEOUT);
+        } else {
+            sim_set_ap(strcmp(arg, "on") == 0);
+        }
+        sim_print("wifi %s", arg);
+    } else if (strcmp(cmd, "sntp") == 0 && arg) {
+        sim_sntp_set_reachable(strcmp(arg, "on") == 0);
+        sim_print("sntp server %s", arg);
+    } else if (strcmp(cmd, "show") == 0) {
+        sim_print_display();
+    } else if (strcmp(cmd, "drift") == 0 && arg) {
+        vt_clock_set_drift(atoi(arg));
+        sim_print("RTC drift %d ppm", atoi(arg));
+    } else if (strcmp(cmd, "clock") == 0 && arg) {
+        // Steps the RTC, as a glitch or a wrong manual setting would.
+        long long seconds = atoll(arg);
+        vt_clock_set(vt_clock() + seconds * 1000000);
+        sim_print("RTC stepped %+lld s", seconds);
+    } else if (strcmp(cmd, "message") == 0 && arg) {
+        char text[SIM_LINE_MAX];
+        snprintf(text, sizeof(text), "%s%s%s", arg, *rest ? " " : "", rest);
+        display_message_for(sim_unquote(text), SIM_MESSAGE_MS);
+    } else if (strcmp(cmd, "rtc") == 0 && arg) {
+        // The firmware doesn't use the RTC chip yet; this drives rtci2c
+        // the way it would, so its bus traffic can be traced.
+        if (s_rtc == NULL) {
+            s_rtc = rtci2c_init(RTCI2C_DEVICE_DS3231, 0x68, NULL);
+        }
+        struct tm tm;
+        if (strcmp(arg, "set") == 0) {
+            time_t now = time(NULL);
+            gmtime_r(&now, &tm);
+            bool ok = s_rtc && rtci2c_set_datetime(s_rtc, &tm);
+            sim_print("rtc set %s", ok ? "ok" : "failed");
+        } else if (s_rtc && rtci2c_get_datetime(s_rtc, &tm)) {
+            char text[32];
+            strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+            sim_print("rtc read %s UTC", text);
+        } else {
+            sim_print("rtc read failed");
+        }
+    } else if (strcmp(cmd, "ota") == 0 && arg) {
+        sim_ota_start(ev, arg, rest);
+    } else if (strcmp(cmd, "ntp") == 0 && arg) {
+        sim_ntp_start(ev, arg);
+    } else if (strcmp(cmd, "trace") == 0 && arg && strcmp(arg, "reset") == 0) {
+        s_trace_len = 0;
+        s_trace_count = 0;
+    } else if (strcmp(cmd, "restart") == 0) {
+        // A watchdog reset keeps RTC memory just as esp_restart() does.
+        sim_restart(arg && strcmp(arg, "wdt") == 0 ? ESP_RST_TASK_WDT : ESP_RST_SW);
+    } else if (strcmp(cmd, "stop") == 0) {
+        vt_stop();
+    } else {
+        sim_print("line %d: bad command \"%s\"", ev->line, ev->text);
+        s_expect_failed++;
+    }
+}
+
+static void sim_driver_task(void *arg) {
+    size_t next = 0;
+    while (next < s_event_count) {
+        vt_sleep_until(s_events[next].at_us);
+        sim_exec(&s_events[next++]);
+    }
+    vTaskDelete(NULL);
+}
+
+// Half a minute into every true minute, the display must read the true
+// local time. It is skipped while the display is dark, the stopwatch or
+// countdown owns it, or it cycles through world clock zones.
+static void sim_check_task(void *arg) {
+    for (;;) {
+        int64_t true_us = sim_true_time_us();
+        int64_t next = (true_us / 60000000 + 1) * 60000000 + 30000000;
+        vt_sleep_until(next - s_opt.start_us);
+
+        const sim_max7219_t *chip = sim_max7219();
+        // A matrix can't be read back as digits.
+        if (chip->shutdown || chrono_mode() != CHRONO_OFF || world_clock_active() || board_profile.matrix) {
+            continue;
+        }
+        char text[SIM_TEXT_MAX];
+        sim_max7219_text(text, sizeof(text));
+        if (sim_shows_true_time(text)) {
+            s_check_ok++;
+        } else if (++s_check_bad <= SIM_CHECK_REPORT) {
+            time_t t = (time_t)(sim_true_time_us() / 1000000);
+            struct tm tm;
+            localtime_r(&t, &tm);
+            char want[8];
+            strftime(want, sizeof(want), "%H%M", &tm);
+            sim_print("clock check: display \"%s\", true time %s", text, want);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Boot
+
+// Writes the settings from the command line through config_store, so the
+// firmware's own config_store_init() in app_main finds them.
+static void sim_seed_config(void) {
+    clock_config_t cfg;
+    config_store_init();
+    config_store_get(&cfg);
+    if (s_opt.tz) {
+        snprintf(cfg.timezone, sizeof(cfg.timezone), "%s", s_opt.tz);
+    }
+    if (s_opt.ssid) {
+        snprintf(cfg.wifi_ssid, sizeof(cfg.wifi_ssid), "%s", s_opt.ssid);
+        snprintf(cfg.wifi_password, sizeof(cfg.wifi_password), "%s", s_opt.password ? s_opt.password : "");
+    }
+    config_store_update(&cfg);
+    config_store_flush();
+}
+
+static void sim_main_task(void *arg) {
+    if (s_opt.tz || s_opt.ssid) {
+        sim_seed_config();
+    }
+    app_main();
+}
+
+static void sim_usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --start DATE       true time at boot (default 2025-01-01 00:00:00)\n"
+            "  -d, --duration DUR     how long to run, e.g. 90d, 36h, 10m (default 1h)\n"
+            "  -t, --tz TZ            POSIX TZ to configure; dates are read in it\n"
+            "      --ssid SSID        Wi-Fi credentials to configure\n"
+            "      --password PASS\n"
+            "      --no-ap            the access point is off the air at boot\n"
+            "      --rtc-offset SEC   RTC error at boot, until SNTP corrects it\n"
+            "      --drift PPM        RTC drift against true time\n"
+            "  -f, --script FILE      scenario to run\n"
+            "      --state-dir DIR    where the config file and RTC memory live (default: a new temp dir)\n"
+            "      --display          print every display change\n"
+            "      --bus              print every SPI and I2C transaction\n"
+            "      --golden FILE      compare the bus trace with a recorded one\n"
+            "      --record           write the trace to the --golden file instead\n"
+            "      --budget N         fail if the trace has more than N transactions\n"
+            "      --check            compare the display with true time every minute\n"
+            "  -q, --quiet            firmware logs at warning level and above only\n",
+            argv0);
+}
+
+static void sim_parse_args(int argc, char **argv) {
+    enum { OPT_SSID = 256, OPT_PASSWORD, OPT_NO_AP, OPT_RTC_OFFSET, OPT_DRIFT, OPT_STATE_DIR,
+           OPT_DISPLAY, OPT_BUS, OPT_GOLDEN, OPT_RECORD, OPT_BUDGET, OPT_CHECK };
+    static const struct option options[] = {
+        { "start", required_argument, NULL, 's' },
+        { "duration", required_argument, NULL, 'd' },
+        { "tz", required_argument, NULL, 't' },
+        { "ssid", required_argument, NULL, OPT_SSID },
+        { "password", required_argument, NULL, OPT_PASSWORD },
+        { "no-ap", no_argument, NULL, OPT_NO_AP },
+        { "rtc-offset", required_argument, NULL, OPT_RTC_OFFSET },
+        { "drift", required_argument, NULL, OPT_DRIFT },
+        { "script", required_argument, NULL, 'f' },
+        { "state-dir", required_argument, NULL, OPT_STATE_DIR },
+        { "display", no_argument, NULL, OPT_DISPLAY },
+        { "bus", no_argument, NULL, OPT_BUS },
+        { "golden", required_argument, NULL, OPT_GOLDEN },
+        { "record", no_argument, NULL, OPT_RECORD },
+        { "budget", required_argument, NULL, OPT_BUDGET },
+        { "check", no_argument, NULL, OPT_CHECK },
+        { "quiet", no_argument, NULL, 'q' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 },
+    };
+    const char *start = "2025-01-01 00:00:00";
+    const char *duration = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "s:d:t:f:qh", options, NULL)) != -1) {
+        switch (c) {
+        case 's': start = optarg; break;
+        case 'd': duration = optarg; break;
+        case 't': s_opt.tz = optarg; break;
+        case 'f': s_opt.script = optarg; break;
+        case 'q': s_opt.quiet = true; break;
+        case OPT_SSID: s_opt.ssid = optarg; break;
+        case OPT_PASSWORD: s_opt.password = optarg; break;
+        case OPT_NO_AP: s_opt.ap_off = true; break;
+        case OPT_RTC_OFFSET: s_opt.rtc_offset_us = atoll(optarg) * 1000000; break;
+        case OPT_DRIFT: s_opt.drift_ppm = atoi(optarg); break;
+        case OPT_STATE_DIR: s_opt.state_dir = optarg; break;
+        case OPT_DISPLAY: s_opt.show_display = true; break;
+        case OPT_BUS: s_opt.show_bus = true; break;
+        case OPT_GOLDEN: s_opt.golden = optarg; break;
+        case OPT_RECORD: s_opt.record = true; break;
+        case OPT_BUDGET: s_opt.budget = atol(optarg); break;
+        case OPT_CHECK: s_opt.check_clock = true; break;
+        default:
+            sim_usage(argv[0]);
+            exit(c == 'h' ? 0 : 2);
+        }
+    }
+
+    // Dates on the command line and in the script are in the clock's zone.
+    setenv("TZ", s_opt.tz ? s_opt.tz : "UTC0", 1);
+    tzset();
+    if (sim_parse_date(start, &s_opt.start_us) == NULL) {
+        fprintf(stderr, "sim: bad --start \"%s\"\n", start);
+        exit(2);
+    }
+    // After a restart the run picks up where the last one left off.
+    if (s_opt.state_dir && sim_rtc_resume(s_opt.state_dir, &s_opt.start_us)) {
+        s_opt.warm = true;
+        printf("sim: resuming from the RTC memory in %s, %d ms after the reset\n", s_opt.state_dir,
+               SIM_BOOT_US / 1000);
+    }
+    if (s_opt.script) {
+        sim_load_script(s_opt.script);
+    }
+    if (s_opt.budget > 0 && s_opt.golden == NULL) {
+        fprintf(stderr, "sim: --budget needs --golden\n");
+        exit(2);
+    }
+    if (s_opt.golden && s_opt.golden[0] != '/') {
+        // The run happens in the state directory.
+        static char path[4096];
+        if (getcwd(path, sizeof(path)) == NULL) {
+            perror("sim");
+            exit(2);
+        }
+        size_t n = strlen(path);
+        snprintf(path + n, sizeof(path) - n, "/%s", s_opt.golden);
+        s_opt.golden = path;
+    }
+    if (duration) {
+        if (!sim_parse_duration(duration, &s_opt.duration_us)) {
+            fprintf(stderr, "sim: bad --duration \"%s\"\n", duration);
+            exit(2);
+        }
+    } else {
+        s_opt.duration_us = s_event_count ? s_events[s_event_count - 1].at_us + 1000000 : 3600LL * 1000000;
+    }
+}
+
+static void sim_format_duration(int64_t us, char *out, size_t size) {
+    int64_t s = us / 1000000;
+    snprintf(out, size, "%lldd %02lld:%02lld:%02lld", (long long)(s / 86400), (long long)(s / 3600 % 24),
+             (long long)(s / 60 % 60), (long long)(s % 60));
+}
+
+// Golden trace files hold one transaction per line, in the format of
+// sim_bus_transaction(); lines starting with '#' are comments.
+static bool sim_golden_write(void) {
+    FILE *f = fopen(s_opt.golden, "w");
+    if (f == NULL) {
+        fprintf(stderr, "sim: cannot write %s: %s\n", s_opt.golden, strerror(errno));
+        return false;
+    }
+    fprintf(f, "# clock_sim bus trace, %lu transactions\n", s_trace_count);
+    fwrite(s_trace, 1, s_trace_len, f);
+    fclose(f);
+    printf("sim: recorded %lu transactions to %s\n", s_trace_count, s_opt.golden);
+    return true;
+}
+
+// Reports the first line where the run's trace and the golden one part
+// ways. Returns true if they are identical.
+static bool sim_golden_compare(void) {
+    FILE *f = fopen(s_opt.golden, "r");
+    if (f == NULL) {
+        printf("sim: cannot read golden trace %s: %s\n", s_opt.golden, strerror(errno));
+        return false;
+    }
+    char want[SIM_LINE_MAX];
+    const char *got = s_trace;
+    const char *end = s_trace + s_trace_len;
+    unsigned long index = 0;
+    unsigned long golden_count = 0;
+    bool same = true;
+    while (fgets(want, sizeof(want), f)) {
+        if (want[0] == '#') {
+            continue;
+        }
+        want[strcspn(want, "\n")] = '\0';
+        golden_count++;
+        if (!same) {
+            continue;
+        }
+        const char *nl = got < end ? memchr(got, '\n', end - got) : NULL;
+        size_t len = nl ? (size_t)(nl - got) : 0;
+        if (nl == NULL || len != strlen(want) || memcmp(got, want, len) != 0) {
+            printf("sim: trace differs from %s at transaction %lu: expected \"%s\", got \"%.*s\"\n",
+                   s_opt.golden, index + 1, want, (int)len, nl ? got : "");
+            same = false;
+            continue;
+        }
+        got = nl + 1;
+        index++;
+    }
+    fclose(f);
+    if (same && got < end) {
+        const char *nl = memchr(got, '\n', end - got);
+        printf("sim: trace differs from %s at transaction %lu: expected the end, got \"%.*s\"\n",
+               s_opt.golden, index + 1, (int)(nl - got), got);
+        same = false;
+    }
+    printf("sim: bus trace %lu transactions, golden %lu%s\n", s_trace_count, golden_count,
+           same ? ", identical" : "");
+    return same;
+}
+
+// Prints the run's totals; returns the process exit status.
+static int sim_summary(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall = (now.tv_sec - s_wall_start.tv_sec) + (now.tv_nsec - s_wall_start.tv_nsec) / 1e9;
+    char ran[32];
+    sim_format_duration(vt_now(), ran, sizeof(ran));
+    uint64_t spi_count;
+    uint32_t spi_hash;
+    sim_spi_stats(&spi_count, &spi_hash);
+    printf("sim: %s simulated in %.2f s (x%.0f), %llu task switches\n", ran, wall,
+           wall > 0 ? vt_now() / 1e6 / wall : 0.0, (unsigned long long)vt_switch_count());
+    printf("sim: %llu display updates, %llu SPI transactions, SPI hash %08x\n",
+           (unsigned long long)s_display_updates, (unsigned long long)spi_count, spi_hash);
+    if (s_time_shown_us >= 0) {
+        printf("sim: display showed the time %lld ms after the reset (%s boot)\n",
+               (long long)((s_time_shown_us + SIM_BOOT_US) / 1000), s_opt.warm ? "warm" : "cold");
+    }
+    if (s_led_edges) {
+        printf("sim: seconds LED %llu edges, worst %lld us from the system clock's second\n",
+               (unsigned long long)s_led_edges, (long long)s_led_worst_us);
+    }
+    if (s_opt.check_clock) {
+        printf("sim: clock check %llu ok, %llu wrong\n", (unsigned long long)s_check_ok,
+               (unsigned long long)s_check_bad);
+    }
+    if (s_expect_passed || s_expect_failed) {
+        printf("sim: expectations %u passed, %u failed\n", s_expect_passed, s_expect_failed);
+    }
+    bool trace_ok = true;
+    if (s_opt.golden) {
+        trace_ok = s_opt.record ? sim_golden_write() : sim_golden_compare();
+    }
+    bool in_budget = s_opt.budget <= 0 || s_trace_count <= (unsigned long)s_opt.budget;
+    if (!in_budget) {
+        printf("sim: bus traffic over budget: %lu transactions, budget %ld\n", s_trace_count, s_opt.budget);
+    }
+    fflush(stdout);
+    return (s_expect_failed || s_check_bad || !trace_ok || !in_budget) ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    sim_parse_args(argc, argv);
+
+    char temp_dir[] = "/tmp/clock_sim.XXXXXX";
+    const char *dir = s_opt.state_dir ? s_opt.state_dir : mkdtemp(temp_dir);
+    if (dir == NULL || chdir(dir) != 0) {
+        fprintf(stderr, "sim: cannot use state dir: %s\n", strerror(errno));
+        return 2;
+    }
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    if (s_opt.quiet) {
+        esp_log_level_set("*", ESP_LOG_WARN);
+    }
+
+    sim_bus_trace(s_opt.show_bus || s_opt.golden);
+    // A reset restarts the system clock from the epoch; after a warm one the
+    // firmware has to put the time back itself.
+    vt_clock_set(s_opt.warm ? 0 : s_opt.start_us + s_opt.rtc_offset_us);
+    vt_clock_set_drift(s_opt.drift_ppm);
+    sim_set_ap(s_opt.ssid && !s_opt.ap_off);
+
+    vt_init();
+    xTaskCreate(sim_main_task, "main", 3584, NULL, SIM_MAIN_PRIO, NULL);
+    xTaskCreate(sim_driver_task, "sim", 4096, NULL, SIM_DRIVER_PRIO, NULL);
+    if (s_opt.check_clock) {
+        xTaskCreate(sim_check_task, "sim_check", 4096, NULL, SIM_DRIVER_PRIO, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &s_wall_start);
+    bool alive = vt_run(s_opt.duration_us);
+    fflush(stdout);
+    if (!alive) {
+        fprintf(stderr, "sim: deadlock at %lld us, every task is blocked forever:\n", (long long)vt_now());
+        vt_dump_tasks();
+        return 2;
+    }
+    return sim_summary();
+}
@@ -0,0 +1,79 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_http_server.h"
+#include "esp_system.h"
+
+// Hooks between the simulated peripherals (hw.c, idf.c) and the scenario
+// driver (sim.c).
+
+// sim.c
+int64_t sim_true_time_us(void);   // what an NTP server would answer
+void sim_display_changed(void);   // the MAX7219 model's visible state changed
+void sim_gpio_output(gpio_num_t pin, int level); // an output pin changed level
+// Every SPI or I2C transaction, e.g. "spi 0c 01" or "i2c 68 r 00 +7".
+void sim_bus_transaction(const char *line);
+// Ends the run, saving RTC memory for the next run in the same state
+// directory to resume from.
+__attribute__((noreturn)) void sim_restart(esp_reset_reason_t reason);
+
+// hw.c: the display driver chip as the firmware programmed it, and a
+// DS3231 for rtci2c.
+typedef struct {
+    uint8_t digit[8];             // raw segments, DIG0 (rightmost) first
+    uint8_t intensity;
+    uint8_t scan_limit;
+    uint8_t decode_mode;
+    bool shutdown;
+    bool test;
+} sim_max7219_t;
+
+const sim_max7219_t *sim_max7219(void);
+// The scanned digits as text, leftmost first, or a matrix's rows; "" while
+// shut down. SIM_TEXT_MAX fits eight matrix rows.
+#define SIM_TEXT_MAX 80
+void sim_max7219_text(char *out, size_t size);
+void sim_spi_stats(uint64_t *transactions, uint32_t *hash);
+// Reports each SPI and I2C transaction to sim_bus_transaction(); off by default.
+void sim_bus_trace(bool on);
+// Drives an input pin; an enabled edge interrupt runs its handler.
+void sim_gpio_input(gpio_num_t pin, int level);
+
+// idf.c
+void sim_sntp_set_reachable(bool reachable);
+// The clock's address on the simulated LAN (192.168.1.50), as its DHCP
+// lease gives it.
+#define SIM_DEVICE_IP 0x3201A8C0
+// A UDP socket for a simulated host at ip (network byte order); use it
+// with the lwip_* calls in lwip/sockets.h.
+int sim_lan_socket(uint32_t ip);
+// Runs a registered handler and collects what it sent. Returns the
+// handler's result; *status is the HTTP status code.
+esp_err_t sim_http(httpd_method_t method, const char *uri, const char *body,
+                   char *resp, size_t resp_size, int *status);
+// A request with headers ("Name: value" lines) and a binary body that
+// arrives at rate_bps (0: all at once). With drop_at set, the connection
+// fails once that many body bytes have been read.
+typedef struct {
+    const char *headers;
+    const void *body;
+    size_t body_len;
+    uint32_t rate_bps;
+    size_t drop_at;
+} sim_http_body_t;
+esp_err_t sim_http_send(httpd_method_t method, const char *uri, const sim_http_body_t *body,
+                        char *resp, size_t resp_size, int *status);
+// From a reset to app_main: ROM and second-stage bootloader, app load.
+#define SIM_BOOT_US 300000
+// Writes RTC memory, the reset reason and the RTC timer to the current
+// directory. true_us is true time at the reset.
+void sim_rtc_save(esp_reset_reason_t reason, int64_t true_us);
+// If dir holds a save, restores RTC memory from it and consumes it; *true_us
+// is then true time at the new boot.
+bool sim_rtc_resume(const char *dir, int64_t *true_us);
+
+#endif // SIM_H
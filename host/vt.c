@@ -0,0 +1,851 @@
+#include "vt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "trace_hooks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+
+// Host code (printf, localtime) wants far more stack than the firmware
+// asks for, so every task gets the same generous one.
+#define VT_STACK_BYTES (256 * 1024)
+#define VT_FOREVER INT64_MAX
+#define VT_TIMER_TASK_PRIO 22 // as ESP-IDF's esp_timer task
+
+typedef enum {
+    VT_READY,
+    VT_BLOCKED,
+    VT_DEAD,
+} vt_state_t;
+
+struct vt_task {
+    ucontext_t ctx;
+    void *stack;
+    TaskFunction_t fn;
+    void *arg;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t prio;
+    vt_state_t state;
+    uint64_t ready_seq;     // FIFO order among tasks of equal priority
+    int64_t wake_us;        // timeout while blocked
+    const void *wait_obj;   // what it is blocked on, NULL for a delay
+    bool timed_out;
+    uint32_t notify;
+    struct vt_task *next;   // creation order
+};
+
+typedef enum {
+    VT_QUEUE,
+    VT_MUTEX,
+    VT_RECURSIVE_MUTEX,
+    VT_SEMAPHORE,
+} vt_queue_kind_t;
+
+// Semaphores are queues of zero-sized items, as in FreeRTOS.
+struct vt_queue {
+    vt_queue_kind_t kind;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;
+    TaskHandle_t holder;
+    UBaseType_t depth;      // recursive takes by the holder
+};
+
+struct vt_group {
+    EventBits_t bits;
+};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    const char *name;
+    int64_t due_us;
+    uint64_t period_us;     // 0 = one-shot
+    uint64_t seq;           // arming order breaks ties between equal due times
+    bool active;
+    struct esp_timer *next;
+};
+
+static ucontext_t s_sched_ctx;
+static struct vt_task *s_tasks;
+static struct vt_task *s_current;
+static struct vt_task *s_last_run;
+static struct vt_task *s_timer_task;
+static int64_t s_now;
+static uint64_t s_ready_seq;
+static uint64_t s_switches;
+static bool s_stop;
+static int s_isr_depth;
+
+static struct esp_timer *s_timers;
+static uint64_t s_timer_seq;
+static const char s_timer_wait = 0; // the esp_timer task blocks on this
+
+static int64_t s_clock_base_us;     // system clock when it was last set...
+static int64_t s_clock_set_at;      // ...and the virtual time it was set at
+static int32_t s_clock_drift_ppm;
+
+int64_t vt_now(void) {
+    return s_now;
+}
+
+uint64_t vt_switch_count(void) {
+    return s_switches;
+}
+
+// ---------------------------------------------------------------------------
+// Scheduler
+
+static void vt_make_ready(struct vt_task *t) {
+    t->state = VT_READY;
+    t->wait_obj = NULL;
+    t->ready_seq = ++s_ready_seq;
+}
+
+static struct vt_task *vt_pick(void) {
+    struct vt_task *best = NULL;
+    for (struct vt_task *t = s_tasks; t; t = t->next) {
+        if (t->state != VT_READY) {
+            continue;
+        }
+        if (best == NULL || t->prio > best->prio ||
+            (t->prio == best->prio && t->ready_seq < best->ready_seq)) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+// Hands the CPU back to the scheduler; returns when this task runs again.
+static void vt_switch_out(void) {
+    struct vt_task *self = s_current;
+    swapcontext(&self->ctx, &s_sched_ctx);
+}
+
+static void vt_yield(void) {
+    vt_make_ready(s_current);
+    vt_switch_out();
+}
+
+// Blocks the current task on obj until vt_wake(obj) or the deadline.
+// Returns false on timeout, including when the deadline has already passed
+// or the caller cannot block.
+static bool vt_block(const void *obj, int64_t deadline_us) {
+    if (deadline_us <= s_now || s_current == NULL || s_isr_depth > 0) {
+        return false;
+    }
+    struct vt_task *self = s_current;
+    self->state = VT_BLOCKED;
+    self->wait_obj = obj;
+    self->wake_us = deadline_us;
+    self->timed_out = false;
+    vt_switch_out();
+    return !self->timed_out;
+}
+
+// Readies every task blocked on obj; they re-check their condition. A
+// woken task of higher priority preempts the caller, except from an ISR.
+static void vt_wake(const void *obj) {
+    UBaseType_t top = 0;
+    bool any = false;
+    for (struct vt_task *t = s_tasks; t; t = t->next) {
+        if (t->state == VT_BLOCKED && t->wait_obj == obj && obj != NULL) {
+            vt_make_ready(t);
+            top = (!any || t->prio > top) ? t->prio : top;
+            any = true;
+        }
+    }
+    if (any && s_current && s_isr_depth == 0 && top > s_current->prio) {
+        vt_yield();
+    }
+}
+
+static int64_t vt_deadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return VT_FOREVER;
+    }
+    // FreeRTOS wakes on tick boundaries.
+    return (s_now / VT_TICK_US + (int64_t)ticks) * VT_TICK_US;
+}
+
+static void vt_reap(struct vt_task *dead) {
+    for (struct vt_task **p = &s_tasks; *p; p = &(*p)->next) {
+        if (*p == dead) {
+            *p = dead->next;
+            break;
+        }
+    }
+    if (s_last_run == dead) {
+        s_last_run = NULL;
+    }
+    free(dead->stack);
+    free(dead);
+}
+
+bool vt_run(int64_t until_us) {
+    s_stop = false;
+    while (!s_stop) {
+        struct vt_task *t = vt_pick();
+        if (t == NULL) {
+            int64_t next = VT_FOREVER;
+            for (struct vt_task *b = s_tasks; b; b = b->next) {
+                if (b->state == VT_BLOCKED && b->wake_us < next) {
+                    next = b->wake_us;
+                }
+            }
+            if (next == VT_FOREVER) {
+                return false;
+            }
+            if (next > until_us) {
+                s_now = until_us;
+                return true;
+            }
+            if (next > s_now) {
+                s_now = next;
+            }
+            for (struct vt_task *b = s_tasks; b; b = b->next) {
+                if (b->state == VT_BLOCKED && b->wake_us <= s_now) {
+                    b->timed_out = true;
+                    vt_make_ready(b);
+                }
+            }
+            continue;
+        }
+        s_current = t;
+        if (t != s_last_run) {
+            s_last_run = t;
+            s_switches++;
+            trace_task_switched_in();
+        }
+        swapcontext(&s_sched_ctx, &t->ctx);
+        s_current = NULL;
+        if (t->state == VT_DEAD) {
+            vt_reap(t);
+        }
+    }
+    return true;
+}
+
+void vt_stop(void) {
+    s_stop = true;
+}
+
+void vt_dump_tasks(void) {
+    static const char *const states[] = { "ready", "blocked", "dead" };
+    for (struct vt_task *t = s_tasks; t; t = t->next) {
+        fprintf(stderr, "  %-16s prio %2u %-7s", t->name, t->prio, states[t->state]);
+        if (t->state == VT_BLOCKED) {
+            fprintf(stderr, " on %p", t->wait_obj);
+            if (t->wake_us != VT_FOREVER) {
+                fprintf(stderr, " until %lld us", (long long)t->wake_us);
+            }
+        }
+        fputc('\n', stderr);
+    }
+}
+
+void vt_sleep_until(int64_t us) {
+    vt_block(NULL, us);
+}
+
+void vt_isr_enter(void) {
+    s_isr_depth++;
+}
+
+void vt_isr_exit(void) {
+    if (--s_isr_depth == 0 && s_current) {
+        struct vt_task *next = vt_pick();
+        if (next && next->prio > s_current->prio) {
+            vt_yield();
+        }
+    }
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return 0;
+}
+
+BaseType_t xPortInIsrContext(void) {
+    return s_isr_depth > 0;
+}
+
+// ---------------------------------------------------------------------------
+// Tasks
+
+static void vt_task_entry(void) {
+    struct vt_task *self = s_current;
+    self->fn(self->arg);
+    vTaskDelete(NULL);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *created,
+                                   BaseType_t core) {
+    struct vt_task *t = calloc(1, sizeof(*t));
+    if (t == NULL || (t->stack = malloc(VT_STACK_BYTES)) == NULL) {
+        free(t);
+        return pdFAIL;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    snprintf(t->name, sizeof(t->name), "%s", name ? name : "");
+    t->prio = priority < configMAX_PRIORITIES ? priority : configMAX_PRIORITIES - 1;
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = VT_STACK_BYTES;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, vt_task_entry, 0);
+
+    struct vt_task **tail = &s_tasks;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = t;
+    vt_make_ready(t);
+    trace_task_created(t, t->name);
+    if (created) {
+        *created = t;
+    }
+    // A new task of higher priority runs at once, as on the chip.
+    if (s_current && s_isr_depth == 0 && t->prio > s_current->prio) {
+        vt_yield();
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created) {
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == s_current) {
+        s_current->state = VT_DEAD;
+        vt_switch_out();
+        abort(); // not reached: the scheduler frees the task
+    }
+    task->state = VT_DEAD;
+    vt_reap(task);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        vt_yield();
+        return;
+    }
+    vt_block(NULL, vt_deadline(ticks));
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+    *previous_wake += period;
+    vt_block(NULL, (int64_t)*previous_wake * VT_TICK_US);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(s_now / VT_TICK_US);
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+    return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return s_current;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    task = task ? task : s_current;
+    return task ? task->name : "sched";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return VT_STACK_BYTES / sizeof(StackType_t);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    task = task ? task : s_current;
+    return task ? task->prio : 0;
+}
+
+void taskYIELD(void) {
+    vt_yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    task->notify++;
+    vt_wake(&task->notify);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    task->notify++;
+    vt_wake(&task->notify);
+    if (woken) {
+        *woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    struct vt_task *self = s_current;
+    int64_t deadline = vt_deadline(ticks);
+    while (self->notify == 0) {
+        if (!vt_block(&self->notify, deadline)) {
+            return 0;
+        }
+    }
+    uint32_t value = self->notify;
+    self->notify = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+// ---------------------------------------------------------------------------
+// Queues and semaphores
+
+static QueueHandle_t vt_queue_new(vt_queue_kind_t kind, UBaseType_t length, UBaseType_t item_size) {
+    struct vt_queue *q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->kind = kind;
+    q->length = length;
+    q->item_size = item_size;
+    if (item_size > 0 && (q->items = calloc(length, item_size)) == NULL) {
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+// Waits until the queue has an item (or room, for a sender).
+static bool vt_queue_wait(QueueHandle_t q, bool for_space, TickType_t ticks) {
+    int64_t deadline = vt_deadline(ticks);
+    while (for_space ? q->count == q->length : q->count == 0) {
+        if (!vt_block(q, deadline)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void vt_queue_put(QueueHandle_t q, const void *item) {
+    if (q->item_size > 0 && item != NULL) {
+        UBaseType_t tail = (q->head + q->count) % q->length;
+        memcpy(q->items + (size_t)tail * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    vt_wake(q);
+}
+
+static void vt_queue_get(QueueHandle_t q, void *item, bool peek) {
+    if (q->item_size > 0 && item) {
+        memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+    }
+    if (!peek) {
+        q->head = (q->head + 1) % (q->length ? q->length : 1);
+        q->count--;
+        vt_wake(q);
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    return vt_queue_new(VT_QUEUE, length, item_size);
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (queue) {
+        free(queue->items);
+        free(queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    if (!vt_queue_wait(queue, true, ticks)) {
+        return errQUEUE_FULL;
+    }
+    vt_queue_put(queue, item);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    return xQueueSend(queue, item, ticks);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    if (queue->count == queue->length) {
+        return errQUEUE_FULL;
+    }
+    vt_queue_put(queue, item);
+    if (woken) {
+        *woken = pdTRUE;
+    }
+    return pdPASS;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) {
+    if (queue->count == queue->length) {
+        queue->count = 0;
+        queue->head = 0;
+    }
+    vt_queue_put(queue, item);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    if (!vt_queue_wait(queue, false, ticks)) {
+        return pdFALSE;
+    }
+    vt_queue_get(queue, item, false);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *woken) {
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    vt_queue_get(queue, item, false);
+    if (woken) {
+        *woken = pdTRUE;
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+    if (!vt_queue_wait(queue, false, ticks)) {
+        return pdFALSE;
+    }
+    vt_queue_get(queue, item, true);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    queue->count = 0;
+    queue->head = 0;
+    vt_wake(queue);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = vt_queue_new(VT_MUTEX, 1, 0);
+    if (sem) {
+        sem->count = 1;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+    SemaphoreHandle_t sem = xSemaphoreCreateMutex();
+    if (sem) {
+        sem->kind = VT_RECURSIVE_MUTEX;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return vt_queue_new(VT_SEMAPHORE, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    SemaphoreHandle_t sem = vt_queue_new(VT_SEMAPHORE, max, 0);
+    if (sem) {
+        sem->count = initial;
+    }
+    return sem;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    vQueueDelete(sem);
+}
+
+// Taking a plain mutex twice from one task deadlocks here as it does on
+// the chip, and vt_run() reports it.
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    if (!vt_queue_wait(sem, false, ticks)) {
+        return pdFALSE;
+    }
+    sem->count--;
+    if (sem->kind == VT_MUTEX || sem->kind == VT_RECURSIVE_MUTEX) {
+        sem->holder = s_current;
+        sem->depth = 1;
+    }
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks) {
+    if (sem->holder == s_current && sem->count == 0) {
+        sem->depth++;
+        return pdTRUE;
+    }
+    return xSemaphoreTake(sem, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    if (sem->count == sem->length) {
+        return pdFALSE;
+    }
+    sem->holder = NULL;
+    vt_queue_put(sem, NULL);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+    if (sem->holder != s_current) {
+        return pdFALSE;
+    }
+    if (--sem->depth > 0) {
+        return pdTRUE;
+    }
+    return xSemaphoreGive(sem);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+    if (woken) {
+        *woken = pdTRUE;
+    }
+    return xSemaphoreGive(sem);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+    return sem->count;
+}
+
+// ---------------------------------------------------------------------------
+// Event groups
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return calloc(1, sizeof(struct vt_group));
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    group->bits |= bits;
+    EventBits_t now = group->bits;
+    vt_wake(group);
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+    int64_t deadline = vt_deadline(ticks);
+    for (;;) {
+        EventBits_t have = group->bits;
+        bool met = wait_for_all ? (have & bits) == bits : (have & bits) != 0;
+        if (met) {
+            if (clear_on_exit) {
+                group->bits &= ~bits;
+            }
+            return have;
+        }
+        if (!vt_block(group, deadline)) {
+            return group->bits;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// esp_timer
+
+static struct esp_timer *vt_timer_next(void) {
+    struct esp_timer *best = NULL;
+    for (struct esp_timer *t = s_timers; t; t = t->next) {
+        if (t->active && (best == NULL || t->due_us < best->due_us ||
+                          (t->due_us == best->due_us && t->seq < best->seq))) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+// Dispatches callbacks in due order. Periodic timers that fall behind
+// catch up back to back, as ESP-IDF does without skip_unhandled_events.
+static void vt_timer_task(void *arg) {
+    for (;;) {
+        struct esp_timer *t = vt_timer_next();
+        if (t == NULL || t->due_us > s_now) {
+            vt_block(&s_timer_wait, t ? t->due_us : VT_FOREVER);
+            continue;
+        }
+        if (t->period_us) {
+            t->due_us += t->period_us;
+            t->seq = ++s_timer_seq;
+        } else {
+            t->active = false;
+        }
+        t->callback(t->arg);
+    }
+}
+
+// Pulls the esp_timer task's wake-up forward rather than waking it just to
+// re-read the list; a timer already due wakes it for real.
+static void vt_timer_armed(struct esp_timer *t) {
+    struct vt_task *task = s_timer_task;
+    if (task == NULL || task->state != VT_BLOCKED) {
+        return;
+    }
+    if (t->due_us <= s_now) {
+        vt_wake(&s_timer_wait);
+    } else if (t->due_us < task->wake_us) {
+        task->wake_us = t->due_us;
+    }
+}
+
+void vt_init(void) {
+    xTaskCreate(vt_timer_task, "esp_timer", 4096, NULL, VT_TIMER_TASK_PRIO, &s_timer_task);
+}
+
+int64_t esp_timer_get_time(void) {
+    return s_now;
+}
+
+int64_t esp_timer_get_next_alarm(void) {
+    struct esp_timer *t = vt_timer_next();
+    return t ? t->due_us : VT_FOREVER;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    if (args == NULL || args->callback == NULL || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->name = args->name;
+    t->next = s_timers;
+    s_timers = t;
+    *out = t;
+    return ESP_OK;
+}
+
+static esp_err_t vt_timer_start(esp_timer_handle_t t, uint64_t timeout_us, uint64_t period_us) {
+    if (t == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (t->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->due_us = s_now + (int64_t)timeout_us;
+    t->period_us = period_us;
+    t->seq = ++s_timer_seq;
+    t->active = true;
+    vt_timer_armed(t);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return vt_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return vt_timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_restart(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer == NULL || !timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t period = timer->period_us ? timeout_us : 0;
+    timer->active = false;
+    return vt_timer_start(timer, timeout_us, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == NULL || !timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **p = &s_timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    return timer && timer->active;
+}
+
+// ---------------------------------------------------------------------------
+// System clock. These replace the C library's versions for the whole
+// program, so the firmware's time(), gettimeofday() and settimeofday() all
+// see the virtual RTC.
+
+void vt_clock_set(int64_t epoch_us) {
+    s_clock_base_us = epoch_us;
+    s_clock_set_at = s_now;
+}
+
+int64_t vt_clock(void) {
+    int64_t elapsed = s_now - s_clock_set_at;
+    return s_clock_base_us + elapsed + elapsed * s_clock_drift_ppm / 1000000;
+}
+
+void vt_clock_set_drift(int32_t ppm) {
+    vt_clock_set(vt_clock());
+    s_clock_drift_ppm = ppm;
+}
+
+static int64_t vt_floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b < 0);
+}
+
+int gettimeofday(struct timeval *restrict tv, void *restrict tz) {
+    int64_t us = vt_clock();
+    tv->tv_sec = (time_t)vt_floor_div(us, 1000000);
+    tv->tv_usec = (suseconds_t)(us - (int64_t)tv->tv_sec * 1000000);
+    return 0;
+}
+
+int settimeofday(const struct timeval *tv, const struct timezone *tz) {
+    if (tv) {
+        vt_clock_set((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+    }
+    return 0;
+}
+
+time_t time(time_t *out) {
+    time_t now = (time_t)vt_floor_div(vt_clock(), 1000000);
+    if (out) {
+        *out = now;
+    }
+    return now;
+}
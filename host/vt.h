@@ -0,0 +1,41 @@
+#ifndef VT_H
+#define VT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Virtual-time kernel behind the FreeRTOS, esp_timer and system clock
+// shims. Tasks are coroutines on one host thread and only give up the CPU
+// in a blocking call, so a run is fully deterministic. Running code takes
+// no virtual time; the clock jumps straight to the next wake-up when every
+// task is blocked, which is what makes a month of uptime take seconds.
+
+#define VT_TICK_US (1000000LL / configTICK_RATE_HZ)
+
+// Creates the esp_timer task. Tasks made before vt_run() start with it.
+void vt_init(void);
+// Schedules until virtual time would pass until_us or vt_stop() is called.
+// Returns false if every task is blocked forever.
+bool vt_run(int64_t until_us);
+void vt_stop(void);
+// Prints each task and what it is blocked on.
+void vt_dump_tasks(void);
+
+int64_t vt_now(void);
+uint64_t vt_switch_count(void);
+// Blocks the calling task until the given virtual time.
+void vt_sleep_until(int64_t us);
+// Code between these runs as an interrupt: nothing may block, and tasks it
+// wakes run after it returns.
+void vt_isr_enter(void);
+void vt_isr_exit(void);
+
+// The system clock read by time() and gettimeofday(), in microseconds
+// since the epoch. It starts wherever the RTC says and drifts against
+// virtual time by the given parts per million until something sets it.
+void vt_clock_set(int64_t epoch_us);
+int64_t vt_clock(void);
+void vt_clock_set_drift(int32_t ppm);
+
+#endif // VT_H
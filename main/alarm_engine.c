@@ -0,0 +1,250 @@
+#include "alarm_engine.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "alarm_engine";
+
+// A jump larger than this between ticks is treated as a clock step
+// (SNTP sync, manual set) and re-plans everything instead of firing
+// every alarm that was skipped over.
+#define ALARM_STEP_SECONDS 120
+
+typedef struct {
+    alarm_t cfg;
+    time_t next;          // next fire instant, 0 if not scheduled
+    time_t snooze_until;  // overrides the schedule while non-zero
+} alarm_slot_t;
+
+static alarm_slot_t s_slots[ALARM_MAX];
+
+// Min-heap of alarm ids ordered by s_slots[id].next.
+static int8_t s_heap[ALARM_MAX];
+static int8_t s_heap_pos[ALARM_MAX];
+static int s_heap_len;
+
+static int s_ringing = ALARM_NONE;
+static int s_isdst = -1;
+static time_t s_last_now;
+static SemaphoreHandle_t s_lock;
+
+static inline bool heap_less(int a, int b) {
+    return s_slots[s_heap[a]].next < s_slots[s_heap[b]].next;
+}
+
+static void heap_swap(int a, int b) {
+    int8_t t = s_heap[a];
+    s_heap[a] = s_heap[b];
+    s_heap[b] = t;
+    s_heap_pos[s_heap[a]] = a;
+    s_heap_pos[s_heap[b]] = b;
+}
+
+static void heap_sift_up(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heap_less(i, parent)) {
+            break;
+        }
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < s_heap_len && heap_less(l, m)) m = l;
+        if (r < s_heap_len && heap_less(r, m)) m = r;
+        if (m == i) {
+            break;
+        }
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static void heap_remove(int id) {
+    int i = s_heap_pos[id];
+    if (i < 0) {
+        return;
+    }
+    s_heap_pos[id] = -1;
+    if (--s_heap_len == i) {
+        return;
+    }
+    int moved = s_heap[s_heap_len];
+    s_heap[i] = moved;
+    s_heap_pos[moved] = i;
+    heap_sift_up(i);
+    heap_sift_down(s_heap_pos[moved]);
+}
+
+static void heap_update(int id) {
+    int i = s_heap_pos[id];
+    if (i < 0) {
+        i = s_heap_len++;
+        s_heap[i] = id;
+        s_heap_pos[id] = i;
+    }
+    heap_sift_up(i);
+    heap_sift_down(s_heap_pos[id]);
+}
+
+// First instant after now matching the alarm's time and weekday mask,
+// starting the search first_day calendar days from today. mktime() with
+// tm_isdst = -1 resolves DST for each candidate day.
+static time_t alarm_next_fire(const alarm_t *a, time_t now, int first_day) {
+    struct tm today;
+    localtime_r(&now, &today);
+    for (int d = first_day; d <= 7 + first_day; d++) {
+        struct tm c = today;
+        c.tm_mday += d;
+        c.tm_hour = a->hour;
+        c.tm_min = a->minute;
+        c.tm_sec = 0;
+        c.tm_isdst = -1;
+        time_t t = mktime(&c);
+        if (t <= now) {
+            continue;
+        }
+        if (a->weekdays == ALARM_DAYS_ONCE || (a->weekdays & (1 << c.tm_wday))) {
+            return t;
+        }
+    }
+    return 0;
+}
+
+// After a fire the search starts tomorrow, so the repeated hour on a DST
+// fall-back day cannot ring the same alarm twice.
+static void alarm_schedule(int id, time_t now, bool fired) {
+    alarm_slot_t *s = &s_slots[id];
+    if (s->snooze_until) {
+        s->next = s->snooze_until;
+    } else if (s->cfg.enabled) {
+        s->next = alarm_next_fire(&s->cfg, now, fired ? 1 : 0);
+    } else {
+        s->next = 0;
+    }
+
+    if (s->next) {
+        heap_update(id);
+    } else {
+        heap_remove(id);
+    }
+}
+
+static void alarm_replan_locked(time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    s_isdst = tm.tm_isdst;
+    s_last_now = now;
+    for (int id = 0; id < ALARM_MAX; id++) {
+        alarm_schedule(id, now, false);
+    }
+}
+
+void alarm_engine_init(void) {
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+    }
+    memset(s_slots, 0, sizeof(s_slots));
+    memset(s_heap_pos, -1, sizeof(s_heap_pos));
+    s_heap_len = 0;
+    s_ringing = ALARM_NONE;
+    s_isdst = -1;
+    s_last_now = 0;
+}
+
+bool alarm_engine_set(int id, const alarm_t *alarm, time_t now) {
+    if (id < 0 || id >= ALARM_MAX || alarm->hour > 23 || alarm->minute > 59) {
+        return false;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_slots[id].cfg = *alarm;
+    s_slots[id].snooze_until = 0;
+    alarm_schedule(id, now, false);
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+bool alarm_engine_get(int id, alarm_t *out) {
+    if (id < 0 || id >= ALARM_MAX) {
+        return false;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_slots[id].cfg;
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+void alarm_engine_replan(time_t now) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    alarm_replan_locked(now);
+    xSemaphoreGive(s_lock);
+}
+
+int alarm_engine_tick(time_t now, int isdst) {
+    int fired = ALARM_NONE;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (isdst != s_isdst || now < s_last_now || now - s_last_now > ALARM_STEP_SECONDS) {
+        alarm_replan_locked(now);
+    }
+    s_last_now = now;
+
+    if (s_heap_len > 0 && s_slots[s_heap[0]].next <= now) {
+        int id = s_heap[0];
+        alarm_slot_t *s = &s_slots[id];
+        if (s->cfg.weekdays == ALARM_DAYS_ONCE && !s->snooze_until) {
+            s->cfg.enabled = 0;
+        }
+        bool was_snooze = s->snooze_until != 0;
+        s->snooze_until = 0;
+        alarm_schedule(id, now, !was_snooze);
+        s_ringing = id;
+        fired = id;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (fired != ALARM_NONE) {
+        ESP_LOGI(TAG, "Alarm %d fired", fired);
+    }
+    return fired;
+}
+
+void alarm_engine_snooze(time_t now) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_ringing != ALARM_NONE) {
+        s_slots[s_ringing].snooze_until = now + ALARM_SNOOZE_MINUTES * 60;
+        alarm_schedule(s_ringing, now, false);
+        s_ringing = ALARM_NONE;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void alarm_engine_dismiss(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_ringing = ALARM_NONE;
+    xSemaphoreGive(s_lock);
+}
+
+int alarm_engine_ringing(void) {
+    return s_ringing;
+}
+
+time_t alarm_engine_next(int *id) {
+    time_t next = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_heap_len > 0) {
+        next = s_slots[s_heap[0]].next;
+        if (id) {
+            *id = s_heap[0];
+        }
+    } else if (id) {
+        *id = ALARM_NONE;
+    }
+    xSemaphoreGive(s_lock);
+    return next;
+}
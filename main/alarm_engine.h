@@ -0,0 +1,43 @@
+#ifndef ALARM_ENGINE_H
+#define ALARM_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ALARM_MAX 8
+#define ALARM_SNOOZE_MINUTES 9
+#define ALARM_NONE (-1)
+
+// Weekday mask bits follow tm_wday: bit 0 is Sunday, bit 6 is Saturday.
+#define ALARM_DAYS_ONCE     0x00
+#define ALARM_DAYS_WEEKDAYS 0x3E
+#define ALARM_DAYS_WEEKEND  0x41
+#define ALARM_DAYS_DAILY    0x7F
+
+typedef struct {
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t weekdays; // ALARM_DAYS_ONCE fires once and then disables itself
+    uint8_t enabled;
+} alarm_t;
+
+void alarm_engine_init(void);
+
+// Edits re-plan only the alarm that changed.
+bool alarm_engine_set(int id, const alarm_t *alarm, time_t now);
+bool alarm_engine_get(int id, alarm_t *out);
+
+// Re-plan every alarm; call after a clock step or timezone change.
+void alarm_engine_replan(time_t now);
+
+// O(1) unless an alarm is due: compares against the head of the queue.
+// Returns the id of the alarm that fired, or ALARM_NONE.
+int alarm_engine_tick(time_t now, int isdst);
+
+void alarm_engine_snooze(time_t now);
+void alarm_engine_dismiss(void);
+int alarm_engine_ringing(void);
+time_t alarm_engine_next(int *id);
+
+#endif // ALARM_ENGINE_H
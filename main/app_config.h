@@ -37,24 +37,26 @@
 #define DISMISS_BUTTON_PIN 0 // GPIO0 is the BOOT button
 #define SECONDS_LED_PIN 2
 #define AMPM_LED_PIN 19
+// LDR divider on GPIO34 (ADC1 channel 6; ADC2 is unusable with Wi-Fi on).
+// Remove this line on boards without a light sensor to use the schedule.
+#define LIGHT_SENSOR_ADC_CHANNEL ADC_CHANNEL_6
+
+// Display hardware; see board.c. Uncomment for an 8-digit MAX7219 breakout
+// or an 8x8 LED matrix module instead of the clock PCB.
+// #define BOARD_MAX7219_MODULE
+// #define BOARD_MATRIX_8X8
+
+// Deferred logs (dlog.h) are formatted on the chip by a low-priority task.
+// Uncomment to print them as hex records for tools/dlog_decode.py instead,
+// which takes printf off the chip entirely.
+// #define DLOG_HOST_DECODE
 
 // Wi-Fi AP credentials
 #define WIFI_AP_SSID "ESP32_Clock"
 #define WIFI_AP_PASSWORD "12345678"
 
-// Global variables (declared as extern)
+// Hardware handles shared between drivers. Runtime state that tasks share
+// lives in app_state.h.
 extern spi_device_handle_t spi;
-extern int alarm_hour;
-extern int alarm_minute;
-extern bool alarm_triggered;
-extern int timezone_hours;
-extern int timezone_minutes;
-extern char wifi_ssid[32];
-extern char wifi_password[64];
-extern bool wifi_has_password;
-extern bool wifi_sta_connected;
-extern int ap_client_count;
-extern bool reconnect_timer_active;
-extern SemaphoreHandle_t wifi_semaphore;
 
 #endif /* MAIN_APP_CONFIG_H_ */
@@ -0,0 +1,108 @@
+#include "app_state.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+// Same double buffer as status.c: the low bit of s_seq selects the live
+// copy, the writer fills the other one and then bumps s_seq. Readers copy
+// and retry if s_seq moved underneath them. Writers are serialized by
+// s_write_lock, which readers never touch.
+static app_state_t s_buf[2] = {
+    [0] = { .alarm = { .next_hour = -1, .next_minute = -1 } },
+};
+static atomic_uint s_seq;
+static SemaphoreHandle_t s_write_lock;
+static app_state_t *s_draft;
+
+typedef struct {
+    uint32_t fields;
+    app_state_cb_t cb;
+    void *arg;
+} app_state_sub_t;
+
+static app_state_sub_t s_subs[APP_STATE_MAX_SUBSCRIBERS];
+static atomic_int s_sub_count;
+
+typedef struct {
+    uint32_t field;
+    size_t offset;
+    size_t size;
+} app_state_group_t;
+
+static const app_state_group_t s_groups[] = {
+    { APP_STATE_ALARM, offsetof(app_state_t, alarm), sizeof(app_alarm_state_t) },
+    { APP_STATE_TIMEZONE, offsetof(app_state_t, tz), sizeof(app_tz_state_t) },
+    { APP_STATE_WIFI_CREDS, offsetof(app_state_t, wifi_creds), sizeof(app_wifi_creds_t) },
+    { APP_STATE_WIFI_LINK, offsetof(app_state_t, wifi), sizeof(app_wifi_link_t) },
+};
+
+void app_state_init(void) {
+    s_write_lock = xSemaphoreCreateMutex();
+}
+
+void app_state_read(app_state_t *out) {
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&s_seq, memory_order_acquire);
+        memcpy(out, &s_buf[seq & 1], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s_seq, memory_order_relaxed) == seq) {
+            return;
+        }
+    }
+}
+
+app_state_t *app_state_begin(void) {
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    unsigned seq = atomic_load_explicit(&s_seq, memory_order_relaxed);
+    // Only writers modify the buffers and we hold the lock, so the live
+    // copy is stable here.
+    s_draft = &s_buf[(seq + 1) & 1];
+    memcpy(s_draft, &s_buf[seq & 1], sizeof(*s_draft));
+    return s_draft;
+}
+
+uint32_t app_state_commit(void) {
+    unsigned seq = atomic_load_explicit(&s_seq, memory_order_relaxed);
+    const uint8_t *live = (const uint8_t *)&s_buf[seq & 1];
+    const uint8_t *draft = (const uint8_t *)s_draft;
+    uint32_t changed = 0;
+    for (size_t i = 0; i < sizeof(s_groups) / sizeof(s_groups[0]); i++) {
+        const app_state_group_t *g = &s_groups[i];
+        if (memcmp(live + g->offset, draft + g->offset, g->size) != 0) {
+            changed |= g->field;
+        }
+    }
+    if (changed == 0) {
+        xSemaphoreGive(s_write_lock);
+        return 0;
+    }
+
+    app_state_t snapshot;
+    s_draft->version++;
+    memcpy(&snapshot, s_draft, sizeof(snapshot));
+    atomic_store_explicit(&s_seq, seq + 1, memory_order_release);
+    xSemaphoreGive(s_write_lock);
+
+    int count = atomic_load_explicit(&s_sub_count, memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        if (s_subs[i].fields & changed) {
+            s_subs[i].cb(&snapshot, changed, s_subs[i].arg);
+        }
+    }
+    return changed;
+}
+
+esp_err_t app_state_subscribe(uint32_t fields, app_state_cb_t cb, void *arg) {
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    int count = atomic_load_explicit(&s_sub_count, memory_order_relaxed);
+    if (count == APP_STATE_MAX_SUBSCRIBERS) {
+        xSemaphoreGive(s_write_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    s_subs[count] = (app_state_sub_t){ .fields = fields, .cb = cb, .arg = arg };
+    atomic_store_explicit(&s_sub_count, count + 1, memory_order_release);
+    xSemaphoreGive(s_write_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,69 @@
+#ifndef APP_STATE_H
+#define APP_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define APP_STATE_MAX_SUBSCRIBERS 8
+
+// Shared runtime state, grouped so that a change notification can name
+// exactly what moved. Persistent settings live in config_store; this is
+// what the running tasks tell each other.
+typedef struct {
+    int8_t next_hour;       // next alarm to ring, -1 if none is armed
+    int8_t next_minute;
+    bool triggered;         // ringing (alarm or countdown) until snoozed/dismissed
+} app_alarm_state_t;
+
+typedef struct {
+    int8_t hours;           // displayed UTC offset, east-positive
+    int8_t minutes;
+} app_tz_state_t;
+
+typedef struct {
+    char ssid[32];          // the password stays in config_store
+    bool has_password;
+} app_wifi_creds_t;
+
+typedef struct {
+    bool sta_connected;     // associated
+    bool got_ip;
+    bool reconnect_pending;
+    uint8_t ap_clients;
+} app_wifi_link_t;
+
+typedef struct {
+    uint32_t version;
+    app_alarm_state_t alarm;
+    app_tz_state_t tz;
+    app_wifi_creds_t wifi_creds;
+    app_wifi_link_t wifi;
+} app_state_t;
+
+typedef enum {
+    APP_STATE_ALARM      = 1 << 0,
+    APP_STATE_TIMEZONE   = 1 << 1,
+    APP_STATE_WIFI_CREDS = 1 << 2,
+    APP_STATE_WIFI_LINK  = 1 << 3,
+} app_state_field_t;
+
+// Runs in the committing task after the new version is visible; keep it
+// short and do not call app_state_begin() from it.
+typedef void (*app_state_cb_t)(const app_state_t *state, uint32_t changed, void *arg);
+
+void app_state_init(void);
+
+// Readers: lock-free, safe from any task on either core.
+void app_state_read(app_state_t *out);
+
+// Writers: begin() returns a private copy of the current state to edit and
+// holds the writer lock until commit(). commit() publishes it only if a
+// group changed, notifies the subscribers of those groups, and returns the
+// changed mask.
+app_state_t *app_state_begin(void);
+uint32_t app_state_commit(void);
+
+esp_err_t app_state_subscribe(uint32_t fields, app_state_cb_t cb, void *arg);
+
+#endif // APP_STATE_H
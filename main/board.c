@@ -0,0 +1,37 @@
+#include "board.h"
+#include "app_config.h"
+
+#ifdef BOARD_MAX7219_MODULE
+// Generic 8-digit MAX7219 breakout (0.36" digits, RSET 10k).
+const board_profile_t board_profile = {
+    .name = "max7219-module",
+    .digits = 8,
+    .has_dp = true,
+    .seg_peak_ma = 38,
+    .quiescent_ua = 8000,
+    .shutdown_ua = 150,
+};
+#elif defined(BOARD_MATRIX_8X8)
+// FC-16 style 8x8 red LED matrix module (MAX7219, RSET 10k). "digits" is
+// the eight rows; the peak current is per column.
+const board_profile_t board_profile = {
+    .name = "matrix-8x8",
+    .digits = 8,
+    .matrix = true,
+    .has_dp = true,
+    .seg_peak_ma = 38,
+    .quiescent_ua = 8000,
+    .shutdown_ua = 150,
+};
+#else
+// The clock PCB (Hardware/clock): MAX7221 driving four SBC18-11 digits on
+// DIG0..DIG3, DP not connected, RSET = R1 = 10k.
+const board_profile_t board_profile = {
+    .name = "clock-pcb",
+    .digits = 4,
+    .has_dp = false,
+    .seg_peak_ma = 38,
+    .quiescent_ua = 8000,
+    .shutdown_ua = 150,
+};
+#endif
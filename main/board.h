@@ -0,0 +1,21 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What the display driver is actually wired to. The scan limit, the clock
+// face layout and the current model all come from here.
+typedef struct {
+    const char *name;
+    uint8_t digits;          // wired digits, DIG0 (rightmost) upward
+    bool matrix;             // an 8x8 LED matrix, DIG0..7 as rows (matrix.h)
+    bool has_dp;             // SEG DP wired
+    uint16_t seg_peak_ma;    // segment drive current set by RSET
+    uint16_t quiescent_ua;   // driver supply current, display on, all segments off
+    uint16_t shutdown_ua;    // driver supply current in shutdown
+} board_profile_t;
+
+extern const board_profile_t board_profile;
+
+#endif // BOARD_H
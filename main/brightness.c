@@ -0,0 +1,157 @@
+#include "brightness.h"
+#include "app_config.h"
+#include "display_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <time.h>
+#if defined(ESP_PLATFORM) && defined(LIGHT_SENSOR_ADC_CHANNEL)
+#define BRIGHTNESS_HAVE_ADC
+#include "esp_adc/adc_oneshot.h"
+#endif
+
+static const char *TAG = "brightness";
+
+#define BRIGHTNESS_RAMP_TICKS (BRIGHTNESS_RAMP_MS * BRIGHTNESS_SAMPLE_HZ / 1000)
+#define BRIGHTNESS_ADC_MAX    4095
+// A reading this close to a rail at boot means nothing is connected.
+#define BRIGHTNESS_RAIL_MARGIN 8
+
+// Boundary between level i and i + 1 on the raw 12-bit scale. Perceived
+// brightness is roughly logarithmic, so the steps are geometric (x1.43).
+static const uint16_t level_thresholds[MAX7219_INTENSITY_MAX] = {
+    24, 34, 49, 70, 100, 144, 206, 294, 420, 601, 860, 1230, 1760, 2517, 3600,
+};
+
+static brightness_schedule_t s_schedule = {
+    .night_start = 22 * 60,
+    .day_start = 7 * 60,
+    .night_level = 0,
+    .day_level = 8,
+};
+
+static esp_timer_handle_t s_timer;
+static bool s_has_sensor;
+static int32_t s_filtered_q;     // filtered reading << BRIGHTNESS_FILTER_SHIFT
+static uint8_t s_target;
+static uint8_t s_level = MAX7219_INTENSITY_BOOT;
+static uint32_t s_ticks;
+static uint32_t s_writes;
+
+#ifdef BRIGHTNESS_HAVE_ADC
+static adc_oneshot_unit_handle_t s_adc;
+
+static bool brightness_sample(int *raw) {
+    return adc_oneshot_read(s_adc, LIGHT_SENSOR_ADC_CHANNEL, raw) == ESP_OK;
+}
+
+static bool brightness_sensor_init(void) {
+    adc_oneshot_unit_init_cfg_t unit = { .unit_id = ADC_UNIT_1 };
+    adc_oneshot_chan_cfg_t chan = { .atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_DEFAULT };
+    if (adc_oneshot_new_unit(&unit, &s_adc) != ESP_OK ||
+        adc_oneshot_config_channel(s_adc, LIGHT_SENSOR_ADC_CHANNEL, &chan) != ESP_OK) {
+        return false;
+    }
+    return true;
+}
+#else
+static bool brightness_sample(int *raw) {
+    return false;
+}
+
+static bool brightness_sensor_init(void) {
+    return false;
+}
+#endif
+
+// Moves the target only once the filtered reading is clearly past a
+// boundary (1/8 of the threshold either side), so a reading that sits on
+// a boundary does not make the display flicker between two levels.
+static uint8_t brightness_level_for(int32_t reading, uint8_t current) {
+    uint8_t level = current;
+    while (level < MAX7219_INTENSITY_MAX &&
+           reading > level_thresholds[level] + level_thresholds[level] / 8) {
+        level++;
+    }
+    while (level > 0 &&
+           reading < level_thresholds[level - 1] - level_thresholds[level - 1] / 8) {
+        level--;
+    }
+    return level;
+}
+
+static uint8_t brightness_scheduled_level(void) {
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    uint16_t minute = local.tm_hour * 60 + local.tm_min;
+    const brightness_schedule_t *s = &s_schedule;
+    bool night = (s->night_start > s->day_start)
+                 ? (minute >= s->night_start || minute < s->day_start)
+                 : (minute >= s->night_start && minute < s->day_start);
+    return night ? s->night_level : s->day_level;
+}
+
+static void brightness_tick(void *arg) {
+    int raw;
+    if (s_has_sensor && brightness_sample(&raw)) {
+        int32_t err = (raw << BRIGHTNESS_FILTER_SHIFT) - s_filtered_q;
+        s_filtered_q += err / (1 << BRIGHTNESS_FILTER_SHIFT);
+        s_target = brightness_level_for(s_filtered_q >> BRIGHTNESS_FILTER_SHIFT, s_target);
+    } else if (!s_has_sensor) {
+        s_target = brightness_scheduled_level();
+    }
+
+    // Step towards the target at the ramp rate; the SPI write only happens
+    // when the level actually moves.
+    if (++s_ticks % BRIGHTNESS_RAMP_TICKS != 0 || s_level == s_target) {
+        return;
+    }
+    s_level += (s_target > s_level) ? 1 : -1;
+    if (display_manager_set_intensity(s_level)) {
+        s_writes++;
+        ESP_LOGD(TAG, "Intensity %u -> target %u (reading %lu, %lu writes)", s_level, s_target,
+                 (unsigned long)(s_filtered_q >> BRIGHTNESS_FILTER_SHIFT), (unsigned long)s_writes);
+    }
+}
+
+void brightness_init(void) {
+    s_has_sensor = brightness_sensor_init();
+    int raw = 0;
+    if (s_has_sensor && brightness_sample(&raw) &&
+        (raw <= BRIGHTNESS_RAIL_MARGIN || raw >= BRIGHTNESS_ADC_MAX - BRIGHTNESS_RAIL_MARGIN)) {
+        s_has_sensor = false;
+    }
+    if (s_has_sensor) {
+        // Start the filter settled so the first seconds don't sweep from 0.
+        s_filtered_q = raw << BRIGHTNESS_FILTER_SHIFT;
+        s_target = brightness_level_for(raw, 0);
+    } else {
+        s_target = brightness_scheduled_level();
+    }
+    ESP_LOGI(TAG, "%s, initial target %u", s_has_sensor ? "Light sensor" : "No light sensor, using schedule",
+             s_target);
+
+    const esp_timer_create_args_t args = {
+        .callback = brightness_tick,
+        .name = "brightness",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_timer, 1000000 / BRIGHTNESS_SAMPLE_HZ));
+}
+
+void brightness_resume(uint8_t level) {
+    s_level = level > MAX7219_INTENSITY_MAX ? MAX7219_INTENSITY_MAX : level;
+    display_manager_set_intensity(s_level);
+}
+
+void brightness_set_schedule(const brightness_schedule_t *schedule) {
+    s_schedule = *schedule;
+}
+
+bool brightness_has_sensor(void) {
+    return s_has_sensor;
+}
+
+uint8_t brightness_level(void) {
+    return s_level;
+}
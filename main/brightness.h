@@ -0,0 +1,31 @@
+#ifndef BRIGHTNESS_H
+#define BRIGHTNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BRIGHTNESS_SAMPLE_HZ    10
+// One intensity step per ramp period, so a full 0..15 sweep takes ~3 s.
+#define BRIGHTNESS_RAMP_MS      200
+// IIR low-pass y += (x - y) / 2^shift: ~1.6 s time constant at 10 Hz, long
+// enough to ignore a hand waved past the sensor.
+#define BRIGHTNESS_FILTER_SHIFT 4
+
+// Fallback when there is no sensor: night level between night_start and
+// day_start (minutes after local midnight), day level otherwise.
+typedef struct {
+    uint16_t night_start;
+    uint16_t day_start;
+    uint8_t night_level;
+    uint8_t day_level;
+} brightness_schedule_t;
+
+void brightness_init(void);
+// Before brightness_init(): ramps from level instead of the boot level,
+// which a warm restart has already put back on the display.
+void brightness_resume(uint8_t level);
+void brightness_set_schedule(const brightness_schedule_t *schedule);
+bool brightness_has_sensor(void);
+uint8_t brightness_level(void);
+
+#endif // BRIGHTNESS_H
@@ -0,0 +1,178 @@
+#include "button.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "trace.h"
+#include "driver/gpio.h"
+#include "freertos/task.h"
+
+static const char *TAG = "button";
+
+// GPIO0 idles high through the pull-up and reads low while pressed.
+#define BUTTON_PRESSED_LEVEL 0
+
+// What the ISR and the debounce timer tell the button task.
+typedef struct {
+    int64_t edge_us;     // raw: when the edge came
+    bool settled;        // from the debounce timer: the level has settled
+    bool pressed;        // settled level
+} button_edge_t;
+
+static QueueHandle_t s_edge_queue;
+static QueueHandle_t s_event_queue;
+static esp_timer_handle_t s_debounce_timer;
+
+static uint32_t s_latency_count;
+static int64_t s_latency_sum_us;
+static int64_t s_latency_max_us;
+
+// The ISR only timestamps the edge and masks further edges; the button
+// task then arms the debounce timer, which samples the settled level and
+// re-enables the interrupt. If the queue is full nothing would ever arm
+// the timer, so the interrupt is left on for the next edge instead.
+static void IRAM_ATTR button_isr(void *arg) {
+    trace_isr_enter(TRACE_ID_BUTTON_ISR);
+    button_edge_t edge = { .edge_us = esp_timer_get_time() };
+    BaseType_t woken = pdFALSE;
+    gpio_intr_disable(DISMISS_BUTTON_PIN);
+    if (xQueueSendFromISR(s_edge_queue, &edge, &woken) != pdTRUE) {
+        gpio_intr_enable(DISMISS_BUTTON_PIN);
+    }
+    trace_isr_exit(TRACE_ID_BUTTON_ISR);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Runs in the esp_timer task once the edge has had BUTTON_DEBOUNCE_MS to
+// settle. An edge between the sample and gpio_intr_enable() raises no
+// interrupt, so the level is read again afterwards and a change is queued
+// as the ISR would have; a duplicate from the ISR only re-arms the timer.
+// When the queue is full the timer re-arms itself with the interrupt still
+// masked and samples again later.
+static void button_debounce_cb(void *arg) {
+    button_edge_t settled = { .settled = true };
+    settled.pressed = gpio_get_level(DISMISS_BUTTON_PIN) == BUTTON_PRESSED_LEVEL;
+    if (xQueueSend(s_edge_queue, &settled, 0) != pdTRUE) {
+        esp_timer_start_once(s_debounce_timer, BUTTON_DEBOUNCE_MS * 1000);
+        return;
+    }
+    gpio_intr_enable(DISMISS_BUTTON_PIN);
+    if ((gpio_get_level(DISMISS_BUTTON_PIN) == BUTTON_PRESSED_LEVEL) != settled.pressed) {
+        button_edge_t edge = { .edge_us = esp_timer_get_time() };
+        gpio_intr_disable(DISMISS_BUTTON_PIN);
+        if (xQueueSend(s_edge_queue, &edge, 0) != pdTRUE) {
+            esp_timer_start_once(s_debounce_timer, BUTTON_DEBOUNCE_MS * 1000);
+        }
+    }
+}
+
+static void button_post(button_event_type_t type, int64_t edge_us) {
+    button_event_t ev = { .type = type, .edge_us = edge_us };
+    if (xQueueSend(s_event_queue, &ev, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Event queue full, dropped %d", type);
+    }
+}
+
+static void button_task(void *arg) {
+    bool held = false;
+    bool long_sent = false;
+    bool short_pending = false;
+    bool debouncing = false;
+    int64_t edge_us = 0;         // first edge of the bounce being debounced
+    int64_t press_us = 0;
+    int64_t release_us = 0;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        int64_t now = esp_timer_get_time();
+        if (held && !long_sent) {
+            int64_t left = press_us + BUTTON_LONG_PRESS_MS * 1000LL - now;
+            wait = left > 0 ? pdMS_TO_TICKS(left / 1000) + 1 : 0;
+        } else if (short_pending) {
+            int64_t left = release_us + BUTTON_DOUBLE_PRESS_MS * 1000LL - now;
+            wait = left > 0 ? pdMS_TO_TICKS(left / 1000) + 1 : 0;
+        }
+
+        button_edge_t edge;
+        if (xQueueReceive(s_edge_queue, &edge, wait) == pdTRUE) {
+            if (!edge.settled) {
+                if (!debouncing) {
+                    debouncing = true;
+                    edge_us = edge.edge_us;
+                }
+                esp_timer_stop(s_debounce_timer);
+                esp_timer_start_once(s_debounce_timer, BUTTON_DEBOUNCE_MS * 1000);
+                continue;
+            }
+            debouncing = false;
+            bool pressed = edge.pressed;
+
+            if (pressed && !held) {
+                held = true;
+                long_sent = false;
+                press_us = edge_us;
+                button_post(BUTTON_PRESS, edge_us);
+            } else if (!pressed && held) {
+                held = false;
+                if (long_sent) {
+                    continue;
+                }
+                if (short_pending) {
+                    short_pending = false;
+                    button_post(BUTTON_DOUBLE_PRESS, edge_us);
+                } else {
+                    short_pending = true;
+                    release_us = edge_us;
+                }
+            }
+            continue;
+        }
+
+        now = esp_timer_get_time();
+        if (held && !long_sent && now - press_us >= BUTTON_LONG_PRESS_MS * 1000LL) {
+            long_sent = true;
+            short_pending = false;
+            button_post(BUTTON_LONG_PRESS, press_us);
+        } else if (short_pending && now - release_us >= BUTTON_DOUBLE_PRESS_MS * 1000LL) {
+            short_pending = false;
+            button_post(BUTTON_SHORT_PRESS, press_us);
+        }
+    }
+}
+
+QueueHandle_t button_init(void) {
+    gpio_config_t io = {
+        .pin_bit_mask = 1ULL << DISMISS_BUTTON_PIN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io));
+
+    s_edge_queue = xQueueCreate(4, sizeof(button_edge_t));
+    s_event_queue = xQueueCreate(8, sizeof(button_event_t));
+    const esp_timer_create_args_t debounce = {
+        .callback = button_debounce_cb,
+        .name = "button_debounce",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&debounce, &s_debounce_timer));
+    xTaskCreate(button_task, "button", 2048, NULL, 10, NULL);
+
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(DISMISS_BUTTON_PIN, button_isr, NULL));
+    return s_event_queue;
+}
+
+// Called by the consumer once it has acted on an event: measures the time
+// from the physical edge to the action.
+void button_record_latency(const button_event_t *ev) {
+    int64_t latency = esp_timer_get_time() - ev->edge_us;
+    s_latency_count++;
+    s_latency_sum_us += latency;
+    if (latency > s_latency_max_us) {
+        s_latency_max_us = latency;
+    }
+    ESP_LOGI(TAG, "Event %d handled %lld us after edge (avg %lld, max %lld, n=%lu)",
+             ev->type, (long long)latency, (long long)(s_latency_sum_us / s_latency_count),
+             (long long)s_latency_max_us, (unsigned long)s_latency_count);
+}
@@ -0,0 +1,28 @@
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#define BUTTON_DEBOUNCE_MS     10
+#define BUTTON_LONG_PRESS_MS   800
+#define BUTTON_DOUBLE_PRESS_MS 300
+
+typedef enum {
+    BUTTON_PRESS,        // debounced press, posted immediately
+    BUTTON_SHORT_PRESS,  // released, no second press within the double window
+    BUTTON_DOUBLE_PRESS,
+    BUTTON_LONG_PRESS,   // posted while still held
+} button_event_type_t;
+
+typedef struct {
+    button_event_type_t type;
+    int64_t edge_us;     // esp_timer time of the GPIO edge that started it
+} button_event_t;
+
+// Returns the queue button_event_t items are posted to.
+QueueHandle_t button_init(void);
+void button_record_latency(const button_event_t *ev);
+
+#endif // BUTTON_H
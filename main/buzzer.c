@@ -0,0 +1,192 @@
+#include "buzzer.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#ifdef ESP_PLATFORM
+#include "driver/ledc.h"
+#endif
+
+static const char *TAG = "buzzer";
+
+#define BUZZER_LEDC_MODE     LEDC_LOW_SPEED_MODE
+#define BUZZER_LEDC_TIMER    LEDC_TIMER_0
+#define BUZZER_LEDC_CHANNEL  LEDC_CHANNEL_0
+#define BUZZER_DUTY_BITS     10
+// A piezo is loudest at 50 % duty; volume scales down from there.
+#define BUZZER_DUTY_MAX      (1 << (BUZZER_DUTY_BITS - 1))
+
+static const buzzer_note_t alarm_notes[] = {
+    { 84, 12 }, { BUZZER_REST, 6 }, { 84, 12 }, { BUZZER_REST, 6 },
+    { 84, 12 }, { BUZZER_REST, 6 }, { 84, 12 }, { BUZZER_REST, 60 },
+};
+const buzzer_melody_t buzzer_melody_alarm = {
+    .notes = alarm_notes,
+    .count = sizeof(alarm_notes) / sizeof(alarm_notes[0]),
+    .ramp_loops = 8,
+    .ramp_start = 10,
+};
+
+static const buzzer_note_t beep_notes[] = {
+    { 88, 8 },
+};
+const buzzer_melody_t buzzer_melody_beep = {
+    .notes = beep_notes,
+    .count = 1,
+};
+
+static const buzzer_note_t chime_notes[] = {
+    { 76, 25 }, { 72, 25 }, { 74, 25 }, { 67, 50 },
+};
+const buzzer_melody_t buzzer_melody_chime = {
+    .notes = chime_notes,
+    .count = sizeof(chime_notes) / sizeof(chime_notes[0]),
+};
+
+// C8..B8 in Hz; lower octaves are right shifts of these.
+static const uint16_t octave8_hz[12] = {
+    4186, 4435, 4699, 4978, 5274, 5588, 5920, 6272, 6645, 7040, 7459, 7902,
+};
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer;
+static const buzzer_melody_t *s_melody;
+static bool s_loop;
+static uint8_t s_index;
+static uint8_t s_loops_done;
+static bool s_in_gap;
+static uint8_t s_volume = 100;
+
+static uint32_t note_to_hz(uint8_t note) {
+    int octave = note / 12 - 1;
+    if (note == BUZZER_REST || octave > 8) {
+        return 0;
+    }
+    return octave8_hz[note % 12] >> (8 - octave);
+}
+
+static void buzzer_output(uint32_t hz, uint8_t volume) {
+#ifdef ESP_PLATFORM
+    uint32_t duty = (hz == 0) ? 0 : (BUZZER_DUTY_MAX * volume) / 100;
+    if (hz != 0) {
+        ledc_set_freq(BUZZER_LEDC_MODE, BUZZER_LEDC_TIMER, hz);
+    }
+    ledc_set_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL, duty);
+    ledc_update_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL);
+#else
+    // The host build has no LEDC and the sim doesn't model the buzzer.
+    (void)hz;
+    (void)volume;
+#endif
+}
+
+static uint8_t buzzer_current_volume(void) {
+    const buzzer_melody_t *m = s_melody;
+    if (m->ramp_loops == 0 || s_loops_done >= m->ramp_loops) {
+        return s_volume;
+    }
+    int start = m->ramp_start;
+    return start + (((int)s_volume - start) * s_loops_done) / m->ramp_loops;
+}
+
+// Runs from the esp_timer task. Each note is a tone phase followed by a
+// short gap; the timer is re-armed for whichever phase comes next, so
+// nothing ever blocks waiting for a note to end.
+static void buzzer_step(void *arg) {
+    uint32_t hz = 0;
+    uint32_t wait_ms = 0;
+    uint8_t volume = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    const buzzer_melody_t *m = s_melody;
+    if (m == NULL) {
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    const buzzer_note_t *n = &m->notes[s_index];
+    uint32_t len_ms = n->len * BUZZER_TICK_MS;
+
+    if (!s_in_gap && n->note != BUZZER_REST && len_ms > BUZZER_GAP_MS) {
+        hz = note_to_hz(n->note);
+        volume = buzzer_current_volume();
+        wait_ms = len_ms - BUZZER_GAP_MS;
+        s_in_gap = true;
+    } else {
+        wait_ms = s_in_gap ? BUZZER_GAP_MS : len_ms;
+        s_in_gap = false;
+        if (++s_index >= m->count) {
+            s_index = 0;
+            if (s_loops_done < UINT8_MAX) {
+                s_loops_done++;
+            }
+            if (!s_loop) {
+                s_melody = NULL;
+            }
+        }
+    }
+    bool done = (s_melody == NULL);
+    portEXIT_CRITICAL(&s_lock);
+
+    buzzer_output(hz, volume);
+    if (!done) {
+        esp_timer_start_once(s_timer, (uint64_t)wait_ms * 1000);
+    }
+}
+
+void buzzer_init(void) {
+#ifdef ESP_PLATFORM
+    ledc_timer_config_t timer = {
+        .speed_mode = BUZZER_LEDC_MODE,
+        .duty_resolution = BUZZER_DUTY_BITS,
+        .timer_num = BUZZER_LEDC_TIMER,
+        .freq_hz = 2000,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&timer));
+
+    ledc_channel_config_t channel = {
+        .gpio_num = BUZZER_PIN,
+        .speed_mode = BUZZER_LEDC_MODE,
+        .channel = BUZZER_LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = BUZZER_LEDC_TIMER,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    ESP_ERROR_CHECK(ledc_channel_config(&channel));
+#endif
+
+    const esp_timer_create_args_t args = {
+        .callback = buzzer_step,
+        .name = "buzzer",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_timer));
+    ESP_LOGI(TAG, "Buzzer on GPIO %d", BUZZER_PIN);
+}
+
+void buzzer_play(const buzzer_melody_t *melody, bool loop) {
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_melody = melody;
+    s_loop = loop;
+    s_index = 0;
+    s_loops_done = 0;
+    s_in_gap = false;
+    portEXIT_CRITICAL(&s_lock);
+    buzzer_step(NULL);
+}
+
+void buzzer_stop(void) {
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_melody = NULL;
+    portEXIT_CRITICAL(&s_lock);
+    buzzer_output(0, 0);
+}
+
+void buzzer_set_volume(uint8_t percent) {
+    s_volume = percent > 100 ? 100 : percent;
+}
+
+bool buzzer_playing(void) {
+    return s_melody != NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef BUZZER_H
+#define BUZZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Silence inserted at the end of every note so repeated notes stay distinct.
+#define BUZZER_GAP_MS 15
+// Duration unit of buzzer_note_t.len.
+#define BUZZER_TICK_MS 10
+
+#define BUZZER_REST 0
+
+// One note: MIDI note number (69 = A4, 0 = rest) and length in 10 ms units.
+typedef struct {
+    uint8_t note;
+    uint8_t len;
+} buzzer_note_t;
+
+typedef struct {
+    const buzzer_note_t *notes;
+    uint8_t count;
+    uint8_t ramp_loops;   // loops to ramp from ramp_start to full volume, 0 = none
+    uint8_t ramp_start;   // starting volume in percent
+} buzzer_melody_t;
+
+extern const buzzer_melody_t buzzer_melody_alarm;
+extern const buzzer_melody_t buzzer_melody_beep;
+extern const buzzer_melody_t buzzer_melody_chime;
+
+void buzzer_init(void);
+void buzzer_play(const buzzer_melody_t *melody, bool loop);
+void buzzer_stop(void);
+void buzzer_set_volume(uint8_t percent);
+bool buzzer_playing(void);
+
+#endif // BUZZER_H
@@ -0,0 +1,216 @@
+#include "chrono.h"
+#include "display_manager.h"
+#include "max7219.h"
+#include "board.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdatomic.h>
+#include <sys/time.h>
+
+static const char *TAG = "chrono";
+
+#define CHRONO_PERIOD_US (1000000 / CHRONO_REFRESH_HZ)
+#define CHRONO_DRIFT_LOG_US (60 * 1000000LL)
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer;
+static chrono_mode_t s_mode = CHRONO_OFF;
+static bool s_running;
+static int64_t s_start_us;       // esp_timer time of the last start/resume
+static int64_t s_accum_us;       // elapsed time banked before the last pause
+static int64_t s_countdown_us;
+static atomic_bool s_expired;
+
+// Drift bookkeeping: the monotonic and wall clocks sampled at start, and the
+// frame schedule the periodic timer is meant to follow.
+static int64_t s_mono_origin_us;
+static int64_t s_wall_origin_us;
+static int64_t s_last_drift_log_us;
+static uint32_t s_frames;
+static int64_t s_max_late_us;
+
+static int64_t wall_now_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int64_t chrono_elapsed_locked(int64_t now) {
+    return s_accum_us + (s_running ? now - s_start_us : 0);
+}
+
+// Stopwatch/countdown face: MM.SS.hh below one hour, HH.MM.SS above. Four
+// digit boards show two fields, SS.hh below a minute so the hundredths
+// are seen at all, then MM.SS and HH.MM. The dots only where DP is wired.
+static void chrono_render(int64_t value_us) {
+    uint8_t frame[MAX7219_DIGITS] = { 0 };
+    uint32_t centis = (uint32_t)(value_us / 10000);
+    uint32_t secs = centis / 100;
+    uint32_t a, b, c;
+    bool wide = board_profile.digits >= 6;
+
+    if (!wide && secs < 60) {
+        a = secs;
+        b = centis % 100;
+        c = 0;
+    } else if (secs < 3600) {
+        a = secs / 60;
+        b = secs % 60;
+        c = centis % 100;
+    } else {
+        a = (secs / 3600) % 100;
+        b = (secs / 60) % 60;
+        c = secs % 60;
+    }
+    bool dp = board_profile.has_dp;
+    int d = 0;
+    if (wide) {
+        frame[d++] = max7219_encode_digit(c % 10, false);
+        frame[d++] = max7219_encode_digit(c / 10, false);
+    }
+    frame[d++] = max7219_encode_digit(b % 10, wide && dp);
+    frame[d++] = max7219_encode_digit(b / 10, false);
+    frame[d++] = max7219_encode_digit(a % 10, dp);
+    frame[d++] = max7219_encode_digit(a / 10, false);
+    display_manager_commit(frame);
+}
+
+// The shown value is derived from esp_timer on every frame, so it cannot
+// accumulate error; what is logged is frame lateness and how far the
+// monotonic clock wanders from the (SNTP-disciplined) wall clock.
+static void chrono_log_drift(int64_t now) {
+    int64_t mono = now - s_mono_origin_us;
+    int64_t wall = wall_now_us() - s_wall_origin_us;
+    int64_t ppm = mono ? ((wall - mono) * 1000000) / mono : 0;
+    ESP_LOGI(TAG, "frames=%lu max_late=%lldus wall-mono=%lldus (%lld ppm)",
+             (unsigned long)s_frames, (long long)s_max_late_us,
+             (long long)(wall - mono), (long long)ppm);
+}
+
+static void chrono_timer_cb(void *arg) {
+    int64_t now = esp_timer_get_time();
+    int64_t value;
+    bool expired = false;
+
+    portENTER_CRITICAL(&s_lock);
+    int64_t elapsed = chrono_elapsed_locked(now);
+    if (s_mode == CHRONO_COUNTDOWN) {
+        value = s_countdown_us - elapsed;
+        if (value <= 0) {
+            value = 0;
+            s_accum_us = s_countdown_us;
+            expired = s_running;
+            s_running = false;
+        }
+    } else {
+        value = elapsed;
+    }
+    int64_t late = now - (s_mono_origin_us + ((int64_t)s_frames + 1) * CHRONO_PERIOD_US);
+    portEXIT_CRITICAL(&s_lock);
+
+    s_frames++;
+    if (late > s_max_late_us) {
+        s_max_late_us = late;
+    }
+
+    chrono_render(value);
+
+    if (expired) {
+        esp_timer_stop(s_timer);
+        atomic_store(&s_expired, true);
+        ESP_LOGI(TAG, "Countdown finished");
+    }
+    if (now - s_last_drift_log_us >= CHRONO_DRIFT_LOG_US) {
+        s_last_drift_log_us = now;
+        chrono_log_drift(now);
+    }
+}
+
+void chrono_init(void) {
+    const esp_timer_create_args_t args = {
+        .callback = chrono_timer_cb,
+        .name = "chrono",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_timer));
+}
+
+static void chrono_begin(chrono_mode_t mode, int64_t countdown_us) {
+    int64_t now = esp_timer_get_time();
+
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_mode = mode;
+    s_running = true;
+    s_start_us = now;
+    s_accum_us = 0;
+    s_countdown_us = countdown_us;
+    s_mono_origin_us = now;
+    s_last_drift_log_us = now;
+    s_frames = 0;
+    s_max_late_us = 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    s_wall_origin_us = wall_now_us();
+    atomic_store(&s_expired, false);
+    esp_timer_start_periodic(s_timer, CHRONO_PERIOD_US);
+}
+
+void chrono_stopwatch_start(void) {
+    chrono_begin(CHRONO_STOPWATCH, 0);
+}
+
+void chrono_countdown_start(uint32_t seconds) {
+    chrono_begin(CHRONO_COUNTDOWN, (int64_t)seconds * 1000000);
+}
+
+void chrono_pause(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    if (s_running) {
+        s_accum_us += now - s_start_us;
+        s_running = false;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void chrono_resume(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    if (s_mode != CHRONO_OFF && !s_running &&
+        !(s_mode == CHRONO_COUNTDOWN && s_accum_us >= s_countdown_us)) {
+        s_start_us = now;
+        s_running = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void chrono_stop(void) {
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_mode = CHRONO_OFF;
+    s_running = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+chrono_mode_t chrono_mode(void) {
+    return s_mode;
+}
+
+bool chrono_running(void) {
+    return s_running;
+}
+
+int64_t chrono_value_us(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    int64_t elapsed = chrono_elapsed_locked(now);
+    int64_t value = (s_mode == CHRONO_COUNTDOWN) ? s_countdown_us - elapsed : elapsed;
+    portEXIT_CRITICAL(&s_lock);
+    return value > 0 ? value : 0;
+}
+
+bool chrono_countdown_expired(void) {
+    return atomic_exchange(&s_expired, false);
+}
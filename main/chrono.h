@@ -0,0 +1,30 @@
+#ifndef CHRONO_H
+#define CHRONO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Display refresh rate while a stopwatch or countdown is shown.
+#define CHRONO_REFRESH_HZ 100
+
+typedef enum {
+    CHRONO_OFF,
+    CHRONO_STOPWATCH,
+    CHRONO_COUNTDOWN,
+} chrono_mode_t;
+
+void chrono_init(void);
+void chrono_stopwatch_start(void);
+void chrono_countdown_start(uint32_t seconds);
+void chrono_pause(void);
+void chrono_resume(void);
+void chrono_stop(void);
+
+chrono_mode_t chrono_mode(void);
+bool chrono_running(void);
+int64_t chrono_value_us(void);
+
+// True once after a countdown reaches zero.
+bool chrono_countdown_expired(void);
+
+#endif // CHRONO_H
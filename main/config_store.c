@@ -0,0 +1,397 @@
+#include "config_store.h"
+#include "transition.h"
+#include "trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef ESP_PLATFORM
+#include "nvs.h"
+#endif
+
+static const char *TAG = "config_store";
+
+#define CONFIG_MAGIC 0x434c4b43 // "CLKC"
+#define CONFIG_BLOB_MAX 512
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    uint32_t crc;
+} config_header_t;
+
+static clock_config_t s_config;
+static clock_config_t s_saved;     // what is currently in flash
+static bool s_saved_valid = false;
+static uint32_t s_write_count = 0;
+static uint32_t s_skip_count = 0;
+static SemaphoreHandle_t s_lock;
+static esp_timer_handle_t s_save_timer;
+static TaskHandle_t s_save_task;
+static const config_backend_t *s_backend;
+
+static const clock_config_t s_defaults = {
+    .wifi_ssid = "",
+    .wifi_password = "",
+    .timezone = "IST-5:30",
+    .alarms = {
+        [0] = { .hour = 7, .minute = 0, .weekdays = ALARM_DAYS_DAILY, .enabled = 0 },
+    },
+    .world_clock = { .dwell_s = 5 },
+    .transition = TRANSITION_ROLL,
+};
+
+// v1: a single daily alarm.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    int8_t alarm_hour;
+    int8_t alarm_minute;
+    uint8_t alarm_enabled;
+    uint8_t reserved;
+} clock_config_v1_t;
+
+// v2: alarm table, no Wi-Fi cache. A prefix of the current layout.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    alarm_t alarms[ALARM_MAX];
+} clock_config_v2_t;
+
+// v3: adds the Wi-Fi cache. A prefix of the current layout.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    alarm_t alarms[ALARM_MAX];
+    wifi_cache_t wifi_cache;
+} clock_config_v3_t;
+
+// v4: adds display sleep. A prefix of the current layout.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    alarm_t alarms[ALARM_MAX];
+    wifi_cache_t wifi_cache;
+    display_sleep_t display_sleep;
+} clock_config_v4_t;
+
+// v5: adds the world clock. A prefix of the current layout.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    alarm_t alarms[ALARM_MAX];
+    wifi_cache_t wifi_cache;
+    display_sleep_t display_sleep;
+    world_clock_cfg_t world_clock;
+} clock_config_v5_t;
+
+// v6: adds the digit transition. A prefix of the current layout.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX];
+    alarm_t alarms[ALARM_MAX];
+    wifi_cache_t wifi_cache;
+    display_sleep_t display_sleep;
+    world_clock_cfg_t world_clock;
+    uint8_t transition;
+    uint8_t reserved[3];
+} clock_config_v6_t;
+
+static uint32_t config_crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+#ifdef ESP_PLATFORM
+#define CONFIG_NVS_NAMESPACE "clock"
+#define CONFIG_NVS_KEY "config"
+
+static esp_err_t nvs_backend_load(void *buf, size_t *len) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_get_blob(nvs, CONFIG_NVS_KEY, buf, len);
+    nvs_close(nvs);
+    return err;
+}
+
+static esp_err_t nvs_backend_save(const void *buf, size_t len) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, CONFIG_NVS_KEY, buf, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+static const config_backend_t s_default_backend = {
+    .load = nvs_backend_load,
+    .save = nvs_backend_save,
+};
+#else
+#define CONFIG_HOST_PATH "clock_config.bin"
+
+static esp_err_t file_backend_load(void *buf, size_t *len) {
+    FILE *f = fopen(CONFIG_HOST_PATH, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *len = fread(buf, 1, *len, f);
+    fclose(f);
+    return ESP_OK;
+}
+
+static esp_err_t file_backend_save(const void *buf, size_t len) {
+    FILE *f = fopen(CONFIG_HOST_PATH, "wb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    size_t n = fwrite(buf, 1, len, f);
+    fclose(f);
+    return n == len ? ESP_OK : ESP_FAIL;
+}
+
+static const config_backend_t s_default_backend = {
+    .load = file_backend_load,
+    .save = file_backend_save,
+};
+#endif
+
+// Layouts that are a prefix of the current one, by version: loading one is
+// a copy, and the fields it didn't have keep their defaults.
+static const size_t s_prefix_len[CONFIG_SCHEMA_VERSION + 1] = {
+    [2] = sizeof(clock_config_v2_t),
+    [3] = sizeof(clock_config_v3_t),
+    [4] = sizeof(clock_config_v4_t),
+    [5] = sizeof(clock_config_v5_t),
+    [6] = sizeof(clock_config_v6_t),
+    [CONFIG_SCHEMA_VERSION] = sizeof(clock_config_t),
+};
+
+// Bring an older payload up to the current layout. A schema bump that only
+// appends fields adds its size to s_prefix_len; one that moves fields adds
+// a case that converts the previous layout.
+static bool config_migrate(uint16_t version, const uint8_t *payload, size_t len, clock_config_t *out) {
+    *out = s_defaults;
+    switch (version) {
+    case 1: {
+        clock_config_v1_t v1;
+        if (len != sizeof(v1)) {
+            return false;
+        }
+        memcpy(&v1, payload, len);
+        memcpy(out->wifi_ssid, v1.wifi_ssid, sizeof(out->wifi_ssid));
+        memcpy(out->wifi_password, v1.wifi_password, sizeof(out->wifi_password));
+        memcpy(out->timezone, v1.timezone, sizeof(out->timezone));
+        out->alarms[0] = (alarm_t){
+            .hour = v1.alarm_hour,
+            .minute = v1.alarm_minute,
+            .weekdays = ALARM_DAYS_DAILY,
+            .enabled = v1.alarm_enabled,
+        };
+        return true;
+    }
+    default:
+        if (version > CONFIG_SCHEMA_VERSION || s_prefix_len[version] == 0 || len != s_prefix_len[version]) {
+            return false;
+        }
+        memcpy(out, payload, len);
+        return true;
+    }
+}
+
+// The NVS erase and write take tens of milliseconds. Run in the esp_timer
+// task they would hold up every other timer callback, so the debounce
+// timer only wakes this task.
+static void config_save_task(void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        config_store_flush();
+    }
+}
+
+static void config_save_timer_cb(void *arg) {
+    xTaskNotifyGive(s_save_task);
+}
+
+void config_store_set_backend(const config_backend_t *backend) {
+    s_backend = backend;
+}
+
+esp_err_t config_store_init(void) {
+    static uint8_t blob[CONFIG_BLOB_MAX];
+    int64_t start = esp_timer_get_time();
+
+    if (s_backend == NULL) {
+        s_backend = &s_default_backend;
+    }
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+        const esp_timer_create_args_t args = {
+            .callback = config_save_timer_cb,
+            .name = "config_save",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &s_save_timer));
+        xTaskCreate(config_save_task, "config_save", 3072, NULL, tskIDLE_PRIORITY + 1, &s_save_task);
+    }
+
+    s_config = s_defaults;
+    size_t len = sizeof(blob);
+    esp_err_t err = s_backend->load(blob, &len);
+    const config_header_t *hdr = (const config_header_t *)blob;
+    const uint8_t *payload = blob + sizeof(*hdr);
+
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "No stored config (%s), using defaults", esp_err_to_name(err));
+    } else if (len < sizeof(*hdr) || hdr->magic != CONFIG_MAGIC ||
+               hdr->length > len - sizeof(*hdr)) {
+        ESP_LOGW(TAG, "Stored config is malformed, using defaults");
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (config_crc32(payload, hdr->length) != hdr->crc) {
+        ESP_LOGW(TAG, "Stored config failed CRC, using defaults");
+        err = ESP_ERR_INVALID_CRC;
+    } else if (!config_migrate(hdr->version, payload, hdr->length, &s_config)) {
+        ESP_LOGW(TAG, "Cannot migrate config v%u, using defaults", hdr->version);
+        err = ESP_ERR_INVALID_ARG;
+    } else if (hdr->version == CONFIG_SCHEMA_VERSION) {
+        s_saved = s_config;
+        s_saved_valid = true;
+    } else {
+        ESP_LOGI(TAG, "Migrated config v%u -> v%u", hdr->version, CONFIG_SCHEMA_VERSION);
+    }
+
+    // Keep the strings terminated whatever was in flash.
+    s_config.wifi_ssid[sizeof(s_config.wifi_ssid) - 1] = '\0';
+    s_config.wifi_password[sizeof(s_config.wifi_password) - 1] = '\0';
+    s_config.timezone[sizeof(s_config.timezone) - 1] = '\0';
+    for (int i = 0; i < CONFIG_WORLD_ZONES; i++) {
+        world_zone_t *z = &s_config.world_clock.zones[i];
+        z->code[sizeof(z->code) - 1] = '\0';
+        z->tz[sizeof(z->tz) - 1] = '\0';
+    }
+    s_config.ntp.server[sizeof(s_config.ntp.server) - 1] = '\0';
+
+    ESP_LOGI(TAG, "Config loaded in %lld us", (long long)(esp_timer_get_time() - start));
+    return err;
+}
+
+void config_store_get(clock_config_t *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_config;
+    xSemaphoreGive(s_lock);
+}
+
+// Restarts the debounce window; a burst of edits ends in one write.
+static esp_err_t config_save_later(void) {
+    esp_timer_stop(s_save_timer);
+    return esp_timer_start_once(s_save_timer, CONFIG_SAVE_DEBOUNCE_MS * 1000ULL);
+}
+
+esp_err_t config_store_update(const clock_config_t *cfg) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_config = *cfg;
+    xSemaphoreGive(s_lock);
+    return config_save_later();
+}
+
+esp_err_t config_store_modify(config_modify_fn_t fn, void *arg) {
+    static clock_config_t before; // under s_lock
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    before = s_config;
+    fn(&s_config, arg);
+    bool changed = memcmp(&before, &s_config, sizeof(s_config)) != 0;
+    xSemaphoreGive(s_lock);
+    return changed ? config_save_later() : ESP_OK;
+}
+
+typedef struct {
+    int id;
+    const alarm_t *alarm;
+} config_alarm_edit_t;
+
+static void config_put_alarm(clock_config_t *cfg, void *arg) {
+    const config_alarm_edit_t *edit = arg;
+    cfg->alarms[edit->id] = *edit->alarm;
+}
+
+esp_err_t config_store_set_alarm(int id, const alarm_t *alarm) {
+    if (id < 0 || id >= ALARM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    config_alarm_edit_t edit = { id, alarm };
+    return config_store_modify(config_put_alarm, &edit);
+}
+
+static void config_put_wifi_cache(clock_config_t *cfg, void *arg) {
+    cfg->wifi_cache = *(const wifi_cache_t *)arg;
+}
+
+esp_err_t config_store_set_wifi_cache(const wifi_cache_t *cache) {
+    return config_store_modify(config_put_wifi_cache, (void *)cache);
+}
+
+esp_err_t config_store_flush(void) {
+    static uint8_t blob[sizeof(config_header_t) + sizeof(clock_config_t)];
+    esp_err_t err = ESP_OK;
+
+    esp_timer_stop(s_save_timer);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_saved_valid && memcmp(&s_saved, &s_config, sizeof(s_config)) == 0) {
+        s_skip_count++;
+        xSemaphoreGive(s_lock);
+        ESP_LOGD(TAG, "Config unchanged, write skipped");
+        return ESP_OK;
+    }
+
+    config_header_t *hdr = (config_header_t *)blob;
+    memcpy(blob + sizeof(*hdr), &s_config, sizeof(s_config));
+    hdr->magic = CONFIG_MAGIC;
+    hdr->version = CONFIG_SCHEMA_VERSION;
+    hdr->length = sizeof(s_config);
+    hdr->crc = config_crc32(blob + sizeof(*hdr), sizeof(s_config));
+
+    trace_begin(TRACE_ID_CONFIG_SAVE);
+    err = s_backend->save(blob, sizeof(blob));
+    trace_end(TRACE_ID_CONFIG_SAVE);
+    if (err == ESP_OK) {
+        s_saved = s_config;
+        s_saved_valid = true;
+        s_write_count++;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Config saved (%lu writes, %lu skipped)",
+                 (unsigned long)s_write_count, (unsigned long)s_skip_count);
+    } else {
+        ESP_LOGE(TAG, "Failed to save config: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+uint32_t config_store_write_count(void) {
+    return s_write_count;
+}
@@ -0,0 +1,103 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "alarm_engine.h"
+
+// Bump whenever clock_config_t changes layout and add a step to
+// config_migrate() in config_store.c.
+#define CONFIG_SCHEMA_VERSION 7
+
+// Quiet period after the last change before the blob is written to flash.
+#define CONFIG_SAVE_DEBOUNCE_MS 2000
+
+#define CONFIG_TZ_MAX 32
+#define CONFIG_WORLD_ZONES 4
+#define CONFIG_ZONE_CODE_MAX 4
+#define CONFIG_NTP_SERVER_MAX 32
+
+// Last successful association, used for a directed reconnect. Addresses
+// are stored in network byte order as esp_netif reports them.
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;  // 0 = nothing cached
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+} wifi_cache_t;
+
+// Display sleep. Quiet hours are minutes after local midnight and may wrap
+// past midnight; start == end disables them. idle_timeout_min 0 disables
+// the inactivity timeout.
+typedef struct {
+    uint16_t quiet_start;
+    uint16_t quiet_end;
+    uint16_t idle_timeout_min;
+    uint16_t reserved;
+} display_sleep_t;
+
+// World clock: the zones are shown in turn, each for dwell_s seconds. An
+// empty code ends the list; with no zones the clock shows local time.
+typedef struct {
+    char code[CONFIG_ZONE_CODE_MAX]; // up to three letters, e.g. "LON"
+    char tz[CONFIG_TZ_MAX];          // POSIX TZ string
+} world_zone_t;
+
+typedef struct {
+    world_zone_t zones[CONFIG_WORLD_ZONES];
+    uint8_t dwell_s;
+    uint8_t reserved[3];
+} world_clock_cfg_t;
+
+// LAN time (sntp_server.h). server is where this clock gets its own time,
+// a host name or address; empty means pool.ntp.org.
+typedef struct {
+    char server[CONFIG_NTP_SERVER_MAX];
+    uint8_t serve;     // answer SNTP requests from the LAN
+    uint8_t announce;  // while serving, multicast the leader's presence
+    uint8_t follow;    // sync from a leader heard announcing instead of server;
+                       // a follower neither serves nor announces
+    uint8_t reserved;
+} ntp_cfg_t;
+
+// Every persisted setting, stored as a single blob.
+typedef struct {
+    char wifi_ssid[32];
+    char wifi_password[64];
+    char timezone[CONFIG_TZ_MAX]; // POSIX TZ string, e.g. "IST-5:30"
+    alarm_t alarms[ALARM_MAX];
+    wifi_cache_t wifi_cache;
+    display_sleep_t display_sleep;
+    world_clock_cfg_t world_clock;
+    uint8_t transition;           // transition_style_t for time changes
+    uint8_t reserved[3];
+    ntp_cfg_t ntp;
+} clock_config_t;
+
+// Storage backend. NVS on target, a plain file on the host build.
+typedef struct {
+    esp_err_t (*load)(void *buf, size_t *len);
+    esp_err_t (*save)(const void *buf, size_t len);
+} config_backend_t;
+
+esp_err_t config_store_init(void);
+void config_store_set_backend(const config_backend_t *backend);
+void config_store_get(clock_config_t *out);
+esp_err_t config_store_update(const clock_config_t *cfg);
+// Read-modify-write under the store's lock: fn edits the live config, so
+// two writers of different fields can't undo each other the way a get()
+// then update() can. fn must not call back into config_store. A save is
+// scheduled only if fn changed something.
+typedef void (*config_modify_fn_t)(clock_config_t *cfg, void *arg);
+esp_err_t config_store_modify(config_modify_fn_t fn, void *arg);
+// Replace one alarm or the Wi-Fi cache, through config_store_modify().
+esp_err_t config_store_set_alarm(int id, const alarm_t *alarm);
+esp_err_t config_store_set_wifi_cache(const wifi_cache_t *cache);
+esp_err_t config_store_flush(void);
+uint32_t config_store_write_count(void);
+
+#endif // CONFIG_STORE_H
@@ -1,14 +1,325 @@
 #include "display_manager.h"
 #include "esp_log.h"
+#include "dlog.h"
 #include "driver/spi_master.h"
 #include "app_config.h"
 #include "max7219.h"
+#include "board.h"
+#include "matrix.h"
+#include "trace.h"
+#include "metrics.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
 
 static const char *TAG = "display_manager";
 spi_device_handle_t spi;
 
+#define DISPLAY_TASK_PRIO 5
+
+// Last frame and intensity written to the chip; digit 0 is the rightmost.
+// Frames and intensity are only written by the display task, power by
+// whoever sets it, so every SPI access goes through s_lock. Nothing
+// else is ever taken while s_lock is held.
+static uint8_t s_shadow[MAX7219_DIGITS];
+static uint8_t s_intensity;
+static bool s_powered = true;
+static SemaphoreHandle_t s_lock;
+
+// Layers, bottom to top. Writers replace a whole layer under s_layer_mux
+// and wake the display task, which is the only thing that merges them and
+// writes the chip, so a frame never mixes half of one update with another.
+typedef struct {
+    uint8_t buf[MAX7219_DIGITS];
+    uint8_t cover;       // message: digits it hides the face on
+    int64_t expires_us;  // message: esp_timer time it goes away, 0 = never
+} layer_state_t;
+
+static portMUX_TYPE s_layer_mux = portMUX_INITIALIZER_UNLOCKED;
+static layer_state_t s_layers[DISPLAY_LAYER_COUNT];
+// Intensity asked for, under s_layer_mux; the display task writes it to the
+// chip, so the brightness timer never waits on SPI.
+static uint8_t s_intensity_wanted = MAX7219_INTENSITY_BOOT;
+static TaskHandle_t s_task;
+
+// Face sources: the transition player and, on matrix boards, the text
+// scrollers. They build frames under s_face_lock, which is never held across
+// SPI, and hand them to the display task through layer_set(). Their timer
+// callbacks run in the esp_timer task, so they don't wait for the lock:
+// if a task holds it, the frame goes out on the next period instead.
+static SemaphoreHandle_t s_face_lock;
+static uint8_t s_face[MAX7219_DIGITS]; // what the face layer holds
+static esp_timer_handle_t s_anim_timer;
+static transition_style_t s_style = TRANSITION_NONE;
+static transition_plan_t s_plan;
+static uint8_t s_anim_target[MAX7219_DIGITS];
+static bool s_time_shown;      // the face holds show_time()'s last frame
+static int s_anim_next;        // next keyframe; playing while < s_plan.count
+static int64_t s_anim_cpu_us;  // planning plus every frame so far
+static uint32_t s_anim_writes; // digits changed across the keyframes
+
+static void layer_set(display_layer_t layer, const uint8_t buf[MAX7219_DIGITS], uint8_t cover,
+                      int64_t expires_us) {
+    portENTER_CRITICAL(&s_layer_mux);
+    layer_state_t *l = &s_layers[layer];
+    bool changed = memcmp(l->buf, buf, MAX7219_DIGITS) != 0 || l->cover != cover ||
+                   l->expires_us != expires_us;
+    memcpy(l->buf, buf, MAX7219_DIGITS);
+    l->cover = cover;
+    l->expires_us = expires_us;
+    portEXIT_CRITICAL(&s_layer_mux);
+    if (changed && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+static uint32_t frame_diff(const uint8_t a[MAX7219_DIGITS], const uint8_t b[MAX7219_DIGITS]) {
+    uint32_t n = 0;
+    for (int i = 0; i < MAX7219_DIGITS; i++) {
+        n += a[i] != b[i];
+    }
+    return n;
+}
+
+static void face_set_locked(const uint8_t frame[MAX7219_DIGITS]) {
+    memcpy(s_face, frame, MAX7219_DIGITS);
+    layer_set(DISPLAY_LAYER_FACE, frame, 0, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Transitions. show_time() plans every keyframe up front from the face to
+// the new time and a timer plays them, so the main loop never waits out an
+// animation. Any other face writer cancels it.
+
+static bool anim_playing_locked(void) {
+    return s_anim_next < s_plan.count;
+}
+
+static void anim_end_locked(void) {
+    esp_timer_stop(s_anim_timer);
+    metrics_record(METRIC_TRANSITION_US, (uint32_t)s_anim_cpu_us);
+    metrics_record(METRIC_TRANSITION_SPI, s_anim_writes);
+    s_anim_next = s_plan.count = 0;
+}
+
+static void anim_timer_cb(void *arg) {
+    int64_t start = esp_timer_get_time();
+    if (xSemaphoreTake(s_face_lock, 0) != pdTRUE) {
+        return;
+    }
+    if (anim_playing_locked()) {
+        const uint8_t *frame = s_plan.frames[s_anim_next++];
+        s_anim_writes += frame_diff(s_face, frame);
+        face_set_locked(frame);
+        s_anim_cpu_us += esp_timer_get_time() - start;
+        if (!anim_playing_locked()) {
+            anim_end_locked();
+        }
+    }
+    xSemaphoreGive(s_face_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Matrix boards show everything as text in matrix.c's font, the face and
+// the message each from their own strip. Text wider than the matrix
+// scrolls a column per timer frame. The time and messages arrive as text;
+// the other writers' seven-segment frames are read back into text first.
+
+#define MATRIX_TEXT_MAX 32
+
+typedef struct {
+    matrix_strip_t strip;
+    char text[MATRIX_TEXT_MAX + 1];
+    int x;
+} text_source_t;
+
+static esp_timer_handle_t s_scroll_timer;
+static text_source_t s_text_face;
+static text_source_t s_text_message;
+
+static void text_rows(const text_source_t *src, uint8_t rows[MAX7219_DIGITS]) {
+    if (src->strip.width > MATRIX_SIZE) {
+        matrix_window(&src->strip, src->x, rows);
+    } else {
+        matrix_center(&src->strip, rows);
+    }
+}
+
+static bool text_scrolls(const text_source_t *src) {
+    return src->strip.width > MATRIX_SIZE;
+}
+
+static bool message_visible(void) {
+    portENTER_CRITICAL(&s_layer_mux);
+    bool visible = s_layers[DISPLAY_LAYER_MESSAGE].cover != 0;
+    portEXIT_CRITICAL(&s_layer_mux);
+    return visible;
+}
+
+static void scroll_timer_cb(void *arg) {
+    int64_t start = esp_timer_get_time();
+    uint8_t rows[MAX7219_DIGITS];
+    if (xSemaphoreTake(s_face_lock, 0) != pdTRUE) {
+        return;
+    }
+    if (text_scrolls(&s_text_face)) {
+        s_text_face.x = (s_text_face.x + 1) % s_text_face.strip.width;
+        text_rows(&s_text_face, rows);
+        face_set_locked(rows);
+    }
+    // A message that has expired or been cleared isn't advanced.
+    if (text_scrolls(&s_text_message) && message_visible()) {
+        s_text_message.x = (s_text_message.x + 1) % s_text_message.strip.width;
+        text_rows(&s_text_message, rows);
+        portENTER_CRITICAL(&s_layer_mux);
+        layer_state_t *l = &s_layers[DISPLAY_LAYER_MESSAGE];
+        memcpy(l->buf, rows, MAX7219_DIGITS);
+        portEXIT_CRITICAL(&s_layer_mux);
+        xTaskNotifyGive(s_task);
+    }
+    if (!text_scrolls(&s_text_face) && !(text_scrolls(&s_text_message) && message_visible())) {
+        esp_timer_stop(s_scroll_timer);
+    }
+    xSemaphoreGive(s_face_lock);
+    metrics_record(METRIC_MATRIX_FRAME_US, (uint32_t)(esp_timer_get_time() - start));
+}
+
+// Re-renders only when the text changes. A new message scrolls in from its
+// start; a value being updated in place (the time, a stopwatch) keeps the
+// scroll position so it doesn't jump. Returns false if nothing changed.
+static bool text_set_locked(text_source_t *src, const char *text, bool restart) {
+    while (*text == ' ') {
+        text++;
+    }
+    if (strcmp(text, src->text) == 0) {
+        return false;
+    }
+    snprintf(src->text, sizeof(src->text), "%s", text);
+    int w = matrix_render_text(src->text, &src->strip);
+    if (w > MATRIX_SIZE) {
+        int gap = MATRIX_SCROLL_GAP;
+        if (w + gap > MATRIX_STRIP_MAX) {
+            gap = MATRIX_STRIP_MAX - w;
+        }
+        memset(&src->strip.cols[w], 0, gap);
+        src->strip.width = w + gap;
+        src->x = restart ? 0 : src->x % src->strip.width;
+    } else {
+        src->x = 0;
+    }
+    return true;
+}
+
+// Starts the scroll timer if something visible has to move; the timer
+// stops itself once nothing does.
+static void scroll_kick_locked(void) {
+    if ((text_scrolls(&s_text_face) || (text_scrolls(&s_text_message) && message_visible())) &&
+        !esp_timer_is_active(s_scroll_timer)) {
+        esp_timer_start_periodic(s_scroll_timer, 1000000 / MATRIX_SCROLL_FPS);
+    }
+}
+
+static void text_face_locked(const char *text) {
+    if (text_set_locked(&s_text_face, text, false)) {
+        uint8_t rows[MAX7219_DIGITS];
+        text_rows(&s_text_face, rows);
+        face_set_locked(rows);
+        scroll_kick_locked();
+    }
+}
+
+static void frame_to_text(const uint8_t frame[MAX7219_DIGITS], char *out) {
+    for (int d = board_profile.digits - 1; d >= 0; d--) {
+        *out++ = max7219_decode_char(frame[d]);
+        if (frame[d] & 0x80) {
+            *out++ = '.';
+        }
+    }
+    *out = '\0';
+}
+
+// ---------------------------------------------------------------------------
+// The display task
+
+// Bottom to top: the face, the alarm indicator OR-ed over it, the message
+// over the digits it covers, then the blink mask clearing segments during
+// the off half of each period.
+static void compose(const layer_state_t layers[DISPLAY_LAYER_COUNT], bool blink_off,
+                    uint8_t out[MAX7219_DIGITS]) {
+    const layer_state_t *msg = &layers[DISPLAY_LAYER_MESSAGE];
+    for (int d = 0; d < MAX7219_DIGITS; d++) {
+        uint8_t v = layers[DISPLAY_LAYER_FACE].buf[d] | layers[DISPLAY_LAYER_ALARM].buf[d];
+        if (msg->cover & (1u << d)) {
+            v = msg->buf[d];
+        }
+        if (blink_off) {
+            v &= ~layers[DISPLAY_LAYER_BLINK].buf[d];
+        }
+        out[d] = v;
+    }
+}
+
+static void display_task(void *arg) {
+    const int64_t half_us = DISPLAY_BLINK_MS * 1000LL;
+    TickType_t wait = portMAX_DELAY;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        layer_state_t layers[DISPLAY_LAYER_COUNT];
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&s_layer_mux);
+        layer_state_t *msg = &s_layers[DISPLAY_LAYER_MESSAGE];
+        if (msg->expires_us != 0 && now >= msg->expires_us) {
+            msg->cover = 0;
+            msg->expires_us = 0;
+        }
+        memcpy(layers, s_layers, sizeof(layers));
+        uint8_t intensity = s_intensity_wanted;
+        portEXIT_CRITICAL(&s_layer_mux);
+
+        bool blinking = false;
+        for (int d = 0; d < MAX7219_DIGITS; d++) {
+            blinking |= layers[DISPLAY_LAYER_BLINK].buf[d] != 0;
+        }
+        uint8_t frame[MAX7219_DIGITS];
+        compose(layers, blinking && (now / half_us) % 2 == 1, frame);
+
+        trace_begin(TRACE_ID_RENDER);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (intensity != s_intensity) {
+            max7219_set_intensity(spi, intensity);
+            s_intensity = intensity;
+        }
+        max7219_write_frame(spi, frame, s_shadow);
+        xSemaphoreGive(s_lock);
+        trace_end(TRACE_ID_RENDER);
+
+        // Sleep until woken, or until the next blink edge or message expiry.
+        int64_t next = INT64_MAX;
+        if (blinking) {
+            next = (now / half_us + 1) * half_us;
+        }
+        if (layers[DISPLAY_LAYER_MESSAGE].expires_us != 0 &&
+            layers[DISPLAY_LAYER_MESSAGE].expires_us < next) {
+            next = layers[DISPLAY_LAYER_MESSAGE].expires_us;
+        }
+        wait = portMAX_DELAY;
+        if (next != INT64_MAX) {
+            int64_t ms = (next - now + 999) / 1000;
+            wait = pdMS_TO_TICKS(ms);
+            if (wait == 0) {
+                wait = 1;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
 void display_manager_init(void) {
-    ESP_LOGI(TAG, "Initializing display manager");
+    DLOGI(TAG, "Initializing display manager");
     spi_bus_config_t buscfg = {
         .miso_io_num = -1,
         .mosi_io_num = PIN_NUM_MOSI,
@@ -28,23 +339,241 @@ void display_manager_init(void) {
     spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
     spi_bus_add_device(SPI2_HOST, &devcfg, &spi);
 
-    max7219_init(spi);
+    s_lock = xSemaphoreCreateMutex();
+    s_face_lock = xSemaphoreCreateMutex();
+    max7219_init(spi, board_profile.digits);
+    memset(s_shadow, 0, sizeof(s_shadow));
+    s_intensity = MAX7219_INTENSITY_BOOT;
+
+    const esp_timer_create_args_t args = {
+        .callback = anim_timer_cb,
+        .name = "transition",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_anim_timer));
+    if (board_profile.matrix) {
+        const esp_timer_create_args_t scroll_args = {
+            .callback = scroll_timer_cb,
+            .name = "scroll",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&scroll_args, &s_scroll_timer));
+    }
+    xTaskCreate(display_task, "display", 3072, NULL, DISPLAY_TASK_PRIO, &s_task);
+    DLOGI(TAG, "Board %s, %u digits", board_profile.name, board_profile.digits);
+}
+
+void display_manager_commit(const uint8_t frame[MAX7219_DIGITS]) {
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    if (anim_playing_locked()) {
+        anim_end_locked();
+    }
+    s_time_shown = false;
+    if (board_profile.matrix) {
+        char text[MAX7219_DIGITS * 2 + 1];
+        frame_to_text(frame, text);
+        text_face_locked(text);
+    } else {
+        face_set_locked(frame);
+    }
+    xSemaphoreGive(s_face_lock);
+}
+
+void display_manager_show_text(const char *text) {
+    if (!board_profile.matrix) {
+        uint8_t frame[MAX7219_DIGITS];
+        max7219_encode_text(text, frame);
+        display_manager_commit(frame);
+        return;
+    }
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    if (anim_playing_locked()) {
+        anim_end_locked();
+    }
+    s_time_shown = false;
+    text_face_locked(text);
+    xSemaphoreGive(s_face_lock);
+}
+
+// No frame_to_text() here: on a matrix the frame is already rows. The text
+// face is forgotten, so the next text shown renders even if it's the same.
+void display_manager_restore(const uint8_t frame[MAX7219_DIGITS]) {
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    if (anim_playing_locked()) {
+        anim_end_locked();
+    }
+    s_time_shown = false;
+    if (board_profile.matrix) {
+        text_set_locked(&s_text_face, "", false);
+    }
+    face_set_locked(frame);
+    xSemaphoreGive(s_face_lock);
+}
+
+// Called from the brightness timer, so it only hands the level to the
+// display task. Returns true if the register is going to be written.
+bool display_manager_set_intensity(uint8_t level) {
+    if (level > MAX7219_INTENSITY_MAX) {
+        level = MAX7219_INTENSITY_MAX;
+    }
+    portENTER_CRITICAL(&s_layer_mux);
+    bool changed = (level != s_intensity_wanted);
+    s_intensity_wanted = level;
+    portEXIT_CRITICAL(&s_layer_mux);
+    if (changed && s_task) {
+        xTaskNotifyGive(s_task);
+    }
+    return changed;
 }
 
+bool display_manager_set_power(bool on) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool changed = (on != s_powered);
+    if (changed) {
+        max7219_set_shutdown(spi, !on);
+        s_powered = on;
+    }
+    xSemaphoreGive(s_lock);
+    return changed;
+}
+
+// Snapshot for the power model: what the chip is scanning right now.
+void display_manager_get_load(display_load_t *out) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    out->powered = s_powered;
+    out->intensity = s_intensity;
+    out->lit_segments = 0;
+    for (int i = 0; i < board_profile.digits && i < MAX7219_DIGITS; i++) {
+        uint8_t seg = board_profile.has_dp ? s_shadow[i] : (s_shadow[i] & 0x7F);
+        out->lit_segments += __builtin_popcount(seg);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void display_manager_get_frame(uint8_t frame[MAX7219_DIGITS]) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(frame, s_shadow, MAX7219_DIGITS);
+    xSemaphoreGive(s_lock);
+}
+
+void display_manager_set_transition(transition_style_t style) {
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    s_style = style < TRANSITION_STYLE_COUNT ? style : TRANSITION_NONE;
+    xSemaphoreGive(s_face_lock);
+}
+
+transition_style_t display_manager_get_transition(void) {
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    transition_style_t style = s_style;
+    xSemaphoreGive(s_face_lock);
+    return style;
+}
+
+// Shows frame through the current transition. Only time-to-time changes
+// animate; coming back from the chrono or the world clock snaps. The first
+// keyframe goes out now so the change lands on the tick; the timer sends
+// the rest.
+static void show_animated(const uint8_t frame[MAX7219_DIGITS]) {
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool powered = s_powered;
+    xSemaphoreGive(s_lock);
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    bool playing = anim_playing_locked();
+    if (!(playing && memcmp(frame, s_anim_target, MAX7219_DIGITS) == 0)) {
+        if (playing) {
+            anim_end_locked(); // replan from wherever it got to
+        }
+        memcpy(s_anim_target, frame, MAX7219_DIGITS);
+        if (!powered || !s_time_shown || transition_plan(s_style, s_face, frame, &s_plan) == 0) {
+            face_set_locked(frame);
+        } else {
+            s_anim_writes = frame_diff(s_face, s_plan.frames[0]);
+            face_set_locked(s_plan.frames[0]);
+            s_anim_next = 1;
+            s_anim_cpu_us = esp_timer_get_time() - start;
+            if (anim_playing_locked()) {
+                esp_timer_start_periodic(s_anim_timer, 1000000 / TRANSITION_FPS);
+            } else {
+                anim_end_locked();
+            }
+        }
+        s_time_shown = true;
+    }
+    xSemaphoreGive(s_face_lock);
+}
+
+// Four-digit boards show HH MM; six or more show HH MM SS; a matrix
+// scrolls HH:MM.
 void display_manager_show_time(int hour, int minute, int second) {
-    max7219_clear(spi);
-    max7219_write_digit(spi, 0, second % 10, false);
-    max7219_write_digit(spi, 1, second / 10, false);
-    max7219_write_digit(spi, 2, minute % 10, false);
-    max7219_write_digit(spi, 3, minute / 10, false);
-    max7219_write_digit(spi, 4, hour % 10, false);
-    max7219_write_digit(spi, 5, hour / 10, false);
+    if (board_profile.matrix) {
+        char text[8];
+        snprintf(text, sizeof(text), "%02d:%02d", hour % 100, minute % 100);
+        xSemaphoreTake(s_face_lock, portMAX_DELAY);
+        text_face_locked(text);
+        xSemaphoreGive(s_face_lock);
+        return;
+    }
+    uint8_t frame[MAX7219_DIGITS] = { 0 };
+    int d = 0;
+    if (board_profile.digits >= 6) {
+        frame[d++] = max7219_encode_digit(second % 10, false);
+        frame[d++] = max7219_encode_digit(second / 10, false);
+    }
+    frame[d++] = max7219_encode_digit(minute % 10, false);
+    frame[d++] = max7219_encode_digit(minute / 10, false);
+    frame[d++] = max7219_encode_digit(hour % 10, false);
+    frame[d++] = max7219_encode_digit(hour / 10, false);
+    show_animated(frame);
 }
 
-void display_message(const char* message) {
-    max7219_display_text(spi, message);
+// On a matrix the text is rendered as is, so it may be longer than the
+// digits and use letters seven segments can't draw.
+void display_message_for(const char *message, uint32_t duration_ms) {
+    int64_t expires = duration_ms ? esp_timer_get_time() + duration_ms * 1000LL : 0;
+    uint8_t frame[MAX7219_DIGITS];
+    if (!board_profile.matrix) {
+        max7219_encode_text(message, frame);
+        layer_set(DISPLAY_LAYER_MESSAGE, frame, 0xFF, expires);
+        return;
+    }
+    xSemaphoreTake(s_face_lock, portMAX_DELAY);
+    text_set_locked(&s_text_message, message, true);
+    text_rows(&s_text_message, frame);
+    layer_set(DISPLAY_LAYER_MESSAGE, frame, 0xFF, expires);
+    scroll_kick_locked();
+    xSemaphoreGive(s_face_lock);
+}
+
+void display_message(const char *message) {
+    display_message_for(message, 0);
 }
 
 void display_clear(void) {
-    max7219_clear(spi);
-}
\ No newline at end of file
+    static const uint8_t blank[MAX7219_DIGITS] = { 0 };
+    if (board_profile.matrix) {
+        xSemaphoreTake(s_face_lock, portMAX_DELAY);
+        text_set_locked(&s_text_message, "", true);
+        xSemaphoreGive(s_face_lock);
+    }
+    layer_set(DISPLAY_LAYER_MESSAGE, blank, 0, 0);
+    display_manager_commit(blank);
+}
+
+// A dot in the corner: DP of the rightmost digit, or the matrix's
+// bottom-right pixel. Boards without DP wired don't show it.
+void display_manager_set_alarm_indicator(bool on) {
+    uint8_t buf[MAX7219_DIGITS] = { 0 };
+    if (on && board_profile.matrix) {
+        buf[MATRIX_SIZE - 1] = 0x01;
+    } else if (on) {
+        buf[0] = 0x80;
+    }
+    layer_set(DISPLAY_LAYER_ALARM, buf, 0, 0);
+}
+
+void display_manager_set_blink(bool on) {
+    uint8_t buf[MAX7219_DIGITS];
+    memset(buf, on ? 0xFF : 0x00, sizeof(buf));
+    layer_set(DISPLAY_LAYER_BLINK, buf, 0, 0);
+}
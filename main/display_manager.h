@@ -3,14 +3,58 @@
 
 #include <stdbool.h>
 #include "driver/spi_master.h"
+#include "max7219.h"
+#include "transition.h"
 
 extern bool display_initialized;
 
+// Half the blink period: blinking segments are off for this long, then on.
+#define DISPLAY_BLINK_MS 500
+
+// Compositor layers, bottom to top. Each holds a full frame; the display
+// task merges them and writes the difference to the chip.
+typedef enum {
+    DISPLAY_LAYER_FACE,     // the time, the world clock or the chrono
+    DISPLAY_LAYER_ALARM,    // alarm indicator, OR-ed over the face
+    DISPLAY_LAYER_MESSAGE,  // transient text, replaces the digits it covers
+    DISPLAY_LAYER_BLINK,    // segments to blank in the off half of a blink
+    DISPLAY_LAYER_COUNT
+} display_layer_t;
+
+typedef struct {
+    bool powered;          // false while in shutdown
+    uint8_t intensity;     // 0..MAX7219_INTENSITY_MAX
+    uint8_t lit_segments;  // across the scanned digits
+} display_load_t;
+
 // Function prototypes for display management
 void display_manager_init(void);
+// Face layer writers. commit() is for the ones that build their own
+// seven-segment frames (chrono, world clock); a matrix reads them back as
+// digits. show_text() is for text: a matrix renders it in its own font,
+// letters included, and seven segments show what they can of it.
 void display_manager_show_time(int hour, int minute, int second);
+void display_manager_commit(const uint8_t frame[MAX7219_DIGITS]);
+void display_manager_show_text(const char *text);
+// Puts back a frame read with display_manager_get_frame() as it was on the
+// chip, a matrix's rows included, until the next face writer replaces it.
+void display_manager_restore(const uint8_t frame[MAX7219_DIGITS]);
+// Message overlay, shown until display_clear() or the next message, or
+// for duration_ms.
 void display_message(const char* message);
+void display_message_for(const char *message, uint32_t duration_ms);
+// Drops the message and blanks the face.
 void display_clear(void);
+void display_manager_set_alarm_indicator(bool on);
+void display_manager_set_blink(bool on);
+bool display_manager_set_intensity(uint8_t level);
+bool display_manager_set_power(bool on);
+void display_manager_get_load(display_load_t *out);
+// The frame on the chip, as last written.
+void display_manager_get_frame(uint8_t frame[MAX7219_DIGITS]);
+// Used by display_manager_show_time(); everything else snaps.
+void display_manager_set_transition(transition_style_t style);
+transition_style_t display_manager_get_transition(void);
 void test_display(void);
 
 #endif // DISPLAY_MANAGER_H
@@ -0,0 +1,134 @@
+#include "display_power.h"
+#include "display_manager.h"
+#include "board.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "display_power";
+
+#define US_PER_HOUR 3600000000ULL
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static display_sleep_t s_cfg;
+static bool s_on = true;
+static int64_t s_last_activity_us;
+static int64_t s_last_tick_us;
+static int s_yday = -1;
+static uint64_t s_today_ua_us;      // integrated current, uA * us
+static uint32_t s_yesterday_uah;
+static int64_t s_today_off_us;
+static uint32_t s_current_ua;
+
+// MAX7219/7221 current model. Each scanned digit is lit for 1/digits of the
+// mux period, and within that the intensity register gates the segment
+// drivers for (2 * level + 1) / 32 of the time, so on average
+//   I = I_quiescent + I_seg * lit_segments * (2L + 1) / (32 * digits).
+static uint32_t display_power_model_ua(void) {
+    display_load_t load;
+    display_manager_get_load(&load);
+    if (!load.powered) {
+        return board_profile.shutdown_ua;
+    }
+    uint64_t seg = (uint64_t)board_profile.seg_peak_ma * 1000 * load.lit_segments *
+                   (2 * load.intensity + 1);
+    return board_profile.quiescent_ua + (uint32_t)(seg / (32 * board_profile.digits));
+}
+
+static bool in_quiet_hours(const display_sleep_t *cfg, const struct tm *local) {
+    if (cfg->quiet_start == cfg->quiet_end) {
+        return false;
+    }
+    uint16_t minute = local->tm_hour * 60 + local->tm_min;
+    if (cfg->quiet_start < cfg->quiet_end) {
+        return minute >= cfg->quiet_start && minute < cfg->quiet_end;
+    }
+    return minute >= cfg->quiet_start || minute < cfg->quiet_end; // wraps midnight
+}
+
+void display_power_init(const display_sleep_t *cfg) {
+    display_power_configure(cfg);
+    s_last_activity_us = esp_timer_get_time();
+    s_last_tick_us = s_last_activity_us;
+}
+
+void display_power_configure(const display_sleep_t *cfg) {
+    portENTER_CRITICAL(&s_lock);
+    s_cfg = *cfg;
+    portEXIT_CRITICAL(&s_lock);
+    ESP_LOGI(TAG, "Quiet %02u:%02u-%02u:%02u, idle timeout %u min",
+             cfg->quiet_start / 60, cfg->quiet_start % 60, cfg->quiet_end / 60, cfg->quiet_end % 60,
+             cfg->idle_timeout_min);
+}
+
+bool display_power_activity(void) {
+    s_last_activity_us = esp_timer_get_time();
+    if (s_on) {
+        return false;
+    }
+    s_on = true;
+    display_manager_set_power(true);
+    ESP_LOGI(TAG, "Display woken");
+    return true;
+}
+
+void display_power_tick(const struct tm *local, bool busy) {
+    int64_t now = esp_timer_get_time();
+    display_sleep_t cfg;
+    portENTER_CRITICAL(&s_lock);
+    cfg = s_cfg;
+    portEXIT_CRITICAL(&s_lock);
+
+    bool was_on = s_on;
+    int64_t idle_us = now - s_last_activity_us;
+    bool on;
+    if (busy) {
+        on = true;
+    } else if (in_quiet_hours(&cfg, local)) {
+        on = idle_us < DISPLAY_POWER_WAKE_S * 1000000LL;
+    } else {
+        on = cfg.idle_timeout_min == 0 || idle_us < cfg.idle_timeout_min * 60 * 1000000LL;
+    }
+    if (on != s_on) {
+        s_on = on;
+        display_manager_set_power(on);
+        ESP_LOGI(TAG, "Display %s", on ? "on" : "off");
+    }
+
+    // Integrate the model over the interval that just ended.
+    uint32_t ua = display_power_model_ua();
+    int64_t dt = now - s_last_tick_us;
+    s_last_tick_us = now;
+
+    bool rollover = false;
+    portENTER_CRITICAL(&s_lock);
+    if (s_yday != local->tm_yday) {
+        rollover = (s_yday >= 0);
+        if (rollover) {
+            s_yesterday_uah = (uint32_t)(s_today_ua_us / US_PER_HOUR);
+        }
+        s_today_ua_us = 0;
+        s_today_off_us = 0;
+        s_yday = local->tm_yday;
+    }
+    s_today_ua_us += (uint64_t)s_current_ua * dt;
+    if (!was_on) {
+        s_today_off_us += dt;
+    }
+    s_current_ua = ua;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (rollover) {
+        ESP_LOGI(TAG, "Display used %lu uAh yesterday", (unsigned long)s_yesterday_uah);
+    }
+}
+
+void display_power_stats(display_power_stats_t *out) {
+    portENTER_CRITICAL(&s_lock);
+    out->on = s_on;
+    out->current_ua = s_current_ua;
+    out->today_uah = (uint32_t)(s_today_ua_us / US_PER_HOUR);
+    out->yesterday_uah = s_yesterday_uah;
+    out->today_off_s = (uint32_t)(s_today_off_us / 1000000);
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,30 @@
+#ifndef DISPLAY_POWER_H
+#define DISPLAY_POWER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "config_store.h"
+
+// How long a button press lights the display during quiet hours.
+#define DISPLAY_POWER_WAKE_S 30
+
+typedef struct {
+    bool on;
+    uint32_t current_ua;      // model estimate right now
+    uint32_t today_uah;       // since local midnight
+    uint32_t yesterday_uah;
+    uint32_t today_off_s;     // time spent in shutdown since local midnight
+} display_power_stats_t;
+
+void display_power_init(const display_sleep_t *cfg);
+void display_power_configure(const display_sleep_t *cfg);
+// Call on user input. Returns true if the display was asleep, in which
+// case the caller should treat the input as a wake-up only.
+bool display_power_activity(void);
+// Call once per main-loop tick. busy keeps the display on regardless of the
+// schedule (alarm ringing, chrono running).
+void display_power_tick(const struct tm *local, bool busy);
+void display_power_stats(display_power_stats_t *out);
+
+#endif // DISPLAY_POWER_H
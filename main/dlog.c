@@ -0,0 +1,290 @@
+#include "dlog.h"
+#include "app_config.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "dlog";
+
+// Record layout, in 32-bit words:
+//   0  header: len (bits 0-7) | level (8-11) | nargs (12-15) | DLOG_VALID
+//   1  timestamp, esp_timer microseconds (low 32 bits)
+//   2  format string address
+//   3  tag address
+//   4  argument types, 3 bits each, first argument in the low bits
+//   5+ arguments: one word, two for 64-bit values, or a length-prefixed
+//      string (first byte the length, then the bytes, padded to a word)
+// A header with level DLOG_LEVEL_SKIP pads to the end of the ring.
+#define DLOG_VALID      0x80000000u
+#define DLOG_LEVEL_SKIP 0xF
+// Addresses take two words each on a 64-bit host build.
+#define DLOG_PTR_WORDS  (sizeof(void *) / sizeof(uint32_t))
+#define DLOG_FMT_AT     2
+#define DLOG_TAG_AT     (DLOG_FMT_AT + DLOG_PTR_WORDS)
+#define DLOG_TYPES_AT   (DLOG_TAG_AT + DLOG_PTR_WORDS)
+#define DLOG_HDR_WORDS  (DLOG_TYPES_AT + 1)
+
+// Producers reserve space by CAS on s_head, fill it in and publish the
+// header word last; a zero header means "still being written". The drain
+// task is the only consumer: it zeroes what it read before moving s_tail,
+// so producers always write into cleared space.
+static uint32_t s_ring[DLOG_RING_WORDS];
+static atomic_uint s_head;
+static atomic_uint s_tail;
+static atomic_uint s_dropped;
+
+_Static_assert((DLOG_RING_WORDS & (DLOG_RING_WORDS - 1)) == 0, "DLOG_RING_WORDS must be a power of two");
+
+void dlog_begin(dlog_rec_t *rec, esp_log_level_t level, const char *tag, const char *fmt) {
+    rec->words[0] = DLOG_VALID | ((uint32_t)level << 8);
+    rec->words[1] = (uint32_t)esp_timer_get_time();
+    memcpy(&rec->words[DLOG_FMT_AT], &fmt, sizeof(fmt));
+    memcpy(&rec->words[DLOG_TAG_AT], &tag, sizeof(tag));
+    rec->words[DLOG_TYPES_AT] = 0;
+    rec->len = DLOG_HDR_WORDS;
+    rec->nargs = 0;
+}
+
+// Arguments that no longer fit are dropped; the formatter prints "?".
+static bool dlog_arg(dlog_rec_t *rec, uint32_t type, unsigned words) {
+    if (rec->nargs == DLOG_MAX_ARGS || rec->len + words > DLOG_REC_WORDS) {
+        return false;
+    }
+    rec->words[DLOG_TYPES_AT] |= type << (3 * rec->nargs);
+    rec->nargs++;
+    return true;
+}
+
+void dlog_put_word(dlog_rec_t *rec, uint32_t v) {
+    if (dlog_arg(rec, DLOG_T_WORD, 1)) {
+        rec->words[rec->len++] = v;
+    }
+}
+
+void dlog_put_ptr(dlog_rec_t *rec, const void *p) {
+    dlog_put_word(rec, (uint32_t)(uintptr_t)p);
+}
+
+void dlog_put_i64(dlog_rec_t *rec, int64_t v) {
+    if (dlog_arg(rec, DLOG_T_I64, 2)) {
+        memcpy(&rec->words[rec->len], &v, sizeof(v));
+        rec->len += 2;
+    }
+}
+
+void dlog_put_dbl(dlog_rec_t *rec, double v) {
+    if (dlog_arg(rec, DLOG_T_DBL, 2)) {
+        memcpy(&rec->words[rec->len], &v, sizeof(v));
+        rec->len += 2;
+    }
+}
+
+void dlog_put_str(dlog_rec_t *rec, const char *s) {
+    size_t n = s ? strnlen(s, DLOG_STR_MAX) : 0;
+    unsigned words = (1 + n + 3) / 4;
+    if (dlog_arg(rec, DLOG_T_STR, words)) {
+        uint8_t *p = (uint8_t *)&rec->words[rec->len];
+        p[0] = (uint8_t)n;
+        memcpy(p + 1, s, n);
+        memset(p + 1 + n, 0, words * 4 - 1 - n);
+        rec->len += words;
+    }
+}
+
+void dlog_commit(dlog_rec_t *rec) {
+    unsigned n = rec->len;
+    unsigned head = atomic_load_explicit(&s_head, memory_order_relaxed);
+    unsigned pos, pad;
+    do {
+        pos = head & (DLOG_RING_WORDS - 1);
+        pad = (DLOG_RING_WORDS - pos < n) ? DLOG_RING_WORDS - pos : 0;
+        if (head + pad + n - atomic_load_explicit(&s_tail, memory_order_acquire) > DLOG_RING_WORDS) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&s_head, &head, head + pad + n,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    if (pad) {
+        atomic_store_explicit((atomic_uint *)&s_ring[pos], DLOG_VALID | (DLOG_LEVEL_SKIP << 8) | pad,
+                              memory_order_release);
+        pos = 0;
+    }
+    memcpy(&s_ring[pos + 1], &rec->words[1], (n - 1) * sizeof(uint32_t));
+    atomic_store_explicit((atomic_uint *)&s_ring[pos], rec->words[0] | rec->nargs << 12 | n,
+                          memory_order_release);
+}
+
+// Formats one conversion: spec is "%...X" without length modifiers; the
+// recorded type decides how the argument is passed.
+static int dlog_format_arg(char *out, size_t size, const char *spec, char conv, uint32_t type,
+                           const uint32_t *arg) {
+    char spec64[24];
+    switch (type) {
+    case DLOG_T_WORD:
+        if (conv == 's' || strchr("eEfFgGaA", conv)) {
+            break;
+        }
+        if (conv == 'p') {
+            return snprintf(out, size, "0x%08lx", (unsigned long)arg[0]);
+        }
+        return snprintf(out, size, spec, arg[0]);
+    case DLOG_T_I64: {
+        if (conv == 's' || conv == 'p') {
+            break;
+        }
+        int64_t v;
+        memcpy(&v, arg, sizeof(v));
+        size_t n = strlen(spec);
+        snprintf(spec64, sizeof(spec64), "%.*sll%c", (int)(n - 1), spec, conv);
+        return snprintf(out, size, spec64, (long long)v);
+    }
+    case DLOG_T_DBL: {
+        if (!strchr("eEfFgGaA", conv)) {
+            break;
+        }
+        double v;
+        memcpy(&v, arg, sizeof(v));
+        return snprintf(out, size, spec, v);
+    }
+    case DLOG_T_STR:
+        if (conv != 's') {
+            break;
+        }
+        const uint8_t *p = (const uint8_t *)arg;
+        char s[DLOG_STR_MAX + 1];
+        memcpy(s, p + 1, p[0]);
+        s[p[0]] = '\0';
+        return snprintf(out, size, spec, s);
+    }
+    return snprintf(out, size, "?");
+}
+
+static void dlog_format(const uint32_t *rec, char *out, size_t size) {
+    const char *fmt;
+    memcpy(&fmt, &rec[DLOG_FMT_AT], sizeof(fmt));
+    unsigned nargs = (rec[0] >> 12) & 0xF;
+    uint32_t types = rec[DLOG_TYPES_AT];
+    const uint32_t *arg = &rec[DLOG_HDR_WORDS];
+    unsigned argi = 0;
+    size_t n = 0;
+
+    while (*fmt && n + 1 < size) {
+        if (*fmt != '%') {
+            out[n++] = *fmt++;
+            continue;
+        }
+        if (fmt[1] == '%') {
+            out[n++] = '%';
+            fmt += 2;
+            continue;
+        }
+        char spec[16];
+        size_t s = 0;
+        spec[s++] = *fmt++;
+        while (*fmt && strchr("-+ #0123456789.", *fmt) && s < sizeof(spec) - 2) {
+            spec[s++] = *fmt++;
+        }
+        while (*fmt && strchr("hlzjtLq", *fmt)) {
+            fmt++;
+        }
+        char conv = *fmt ? *fmt++ : 'd';
+        spec[s++] = conv;
+        spec[s] = '\0';
+
+        int w;
+        if (argi < nargs) {
+            uint32_t type = (types >> (3 * argi)) & 7;
+            w = dlog_format_arg(out + n, size - n, spec, conv, type, arg);
+            arg += type == DLOG_T_STR ? (1 + ((const uint8_t *)arg)[0] + 3) / 4
+                 : (type == DLOG_T_I64 || type == DLOG_T_DBL) ? 2 : 1;
+            argi++;
+        } else {
+            w = snprintf(out + n, size - n, "?");
+        }
+        w = w > 0 ? w : 0;
+        n = (n + w < size) ? n + w : size - 1;
+    }
+    out[n] = '\0';
+}
+
+static void dlog_emit(const uint32_t *rec) {
+#ifdef DLOG_HOST_DECODE
+    unsigned len = rec[0] & 0xFF;
+    // One line per record; the host tool resolves the addresses.
+    static const char hex[] = "0123456789abcdef";
+    char line[6 + DLOG_REC_WORDS * 8 + 2] = "DLOG:";
+    char *p = line + 5;
+    for (unsigned i = 0; i < len; i++) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            *p++ = hex[(rec[i] >> shift) & 0xF];
+        }
+    }
+    *p++ = '\n';
+    *p = '\0';
+    fputs(line, stdout);
+#else
+    static const char letters[] = "NEWIDV";
+    esp_log_level_t level = (rec[0] >> 8) & 0xF;
+    const char *tag;
+    memcpy(&tag, &rec[DLOG_TAG_AT], sizeof(tag));
+    char text[160];
+    dlog_format(rec, text, sizeof(text));
+    esp_log_write(level, tag, "%c (%lu) %s: %s\n", letters[level < 6 ? level : 0],
+                  (unsigned long)(rec[1] / 1000), tag, text);
+#endif
+}
+
+static void dlog_task(void *arg) {
+    uint32_t rec[DLOG_REC_WORDS];
+    for (;;) {
+        unsigned tail = atomic_load_explicit(&s_tail, memory_order_relaxed);
+        unsigned pos = tail & (DLOG_RING_WORDS - 1);
+        uint32_t hdr = atomic_load_explicit((atomic_uint *)&s_ring[pos], memory_order_acquire);
+        if (hdr == 0) {
+            unsigned dropped = atomic_exchange_explicit(&s_dropped, 0, memory_order_relaxed);
+            if (dropped) {
+                ESP_LOGW(TAG, "%u records dropped, ring full", dropped);
+            }
+            vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+            continue;
+        }
+        unsigned len = hdr & 0xFF;
+        bool skip = ((hdr >> 8) & 0xF) == DLOG_LEVEL_SKIP;
+        if (!skip) {
+            memcpy(rec, &s_ring[pos], len * sizeof(uint32_t));
+        }
+        memset(&s_ring[pos], 0, len * sizeof(uint32_t));
+        atomic_store_explicit(&s_tail, tail + len, memory_order_release);
+        if (!skip) {
+            dlog_emit(rec);
+        }
+    }
+}
+
+// Times the two halves of a log call on this chip: what a deferred call
+// costs the caller, and the vsnprintf an ESP_LOG call does before it even
+// reaches the UART.
+static void dlog_measure(void) {
+    enum { N = 32 };
+    char buf[64];
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < N; i++) {
+        DLOG_RECORD(ESP_LOG_VERBOSE, TAG, "bench %d %s %lu", i, "x", (unsigned long)t0);
+    }
+    int64_t t1 = esp_timer_get_time();
+    for (int i = 0; i < N; i++) {
+        snprintf(buf, sizeof(buf), "bench %d %s %lu", i, "x", (unsigned long)t0);
+    }
+    int64_t t2 = esp_timer_get_time();
+    ESP_LOGI(TAG, "Deferred call %lld ns, printf formatting alone %lld ns",
+             (long long)((t1 - t0) * 1000 / N), (long long)((t2 - t1) * 1000 / N));
+}
+
+void dlog_init(void) {
+    dlog_measure();
+    xTaskCreate(dlog_task, "dlog", 3072, NULL, tskIDLE_PRIORITY + 1, NULL);
+}
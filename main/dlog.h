@@ -0,0 +1,86 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include "esp_log.h"
+#include <stdint.h>
+
+// Deferred logging. A call site copies its arguments into a lock-free ring
+// and returns; the format string and tag travel as pointers. A low-priority
+// task formats and prints the records later, or with DLOG_HOST_DECODE
+// (app_config.h) just hex-dumps them for tools/dlog_decode.py, which looks
+// the strings up in the ELF. Errors should stay on ESP_LOGE so they are out
+// before a crash.
+
+#define DLOG_RING_WORDS 1024   // power of two
+#define DLOG_REC_WORDS  40     // per record, header included
+#define DLOG_MAX_ARGS   10
+#define DLOG_STR_MAX    32     // longer %s arguments are truncated
+#define DLOG_DRAIN_MS   50
+
+// Argument types, 3 bits each in the record's type word.
+#define DLOG_T_WORD 1  // anything that fits 32 bits: ints, chars, pointers
+#define DLOG_T_I64  2
+#define DLOG_T_DBL  3
+#define DLOG_T_STR  4  // copied into the record
+
+typedef struct {
+    uint32_t words[DLOG_REC_WORDS];
+    uint8_t len;
+    uint8_t nargs;
+} dlog_rec_t;
+
+void dlog_init(void);
+void dlog_begin(dlog_rec_t *rec, esp_log_level_t level, const char *tag, const char *fmt);
+void dlog_put_word(dlog_rec_t *rec, uint32_t v);
+void dlog_put_ptr(dlog_rec_t *rec, const void *p);
+void dlog_put_i64(dlog_rec_t *rec, int64_t v);
+void dlog_put_dbl(dlog_rec_t *rec, double v);
+void dlog_put_str(dlog_rec_t *rec, const char *s);
+void dlog_commit(dlog_rec_t *rec);
+
+#define DLOG_PUT(rec, x) _Generic((x) + 0,                                  \
+    char *: dlog_put_str, const char *: dlog_put_str,                       \
+    void *: dlog_put_ptr, const void *: dlog_put_ptr,                       \
+    long long: dlog_put_i64, unsigned long long: dlog_put_i64,              \
+    double: dlog_put_dbl, float: dlog_put_dbl,                              \
+    default: dlog_put_word)(rec, (x))
+
+#define DLOG_NARGS(...) DLOG_NARGS_(_, ##__VA_ARGS__, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+// Forces the arguments to be expanded before m splits them, so MAC2STR()
+// and IP2STR() count as the six or four arguments they really are.
+#define DLOG_APPLY(m, ...) m(__VA_ARGS__)
+
+#define DLOG_PUT_0(r)
+#define DLOG_PUT_1(r, a) DLOG_PUT(r, a);
+#define DLOG_PUT_2(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_1(r, __VA_ARGS__)
+#define DLOG_PUT_3(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_2(r, __VA_ARGS__)
+#define DLOG_PUT_4(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_3(r, __VA_ARGS__)
+#define DLOG_PUT_5(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_4(r, __VA_ARGS__)
+#define DLOG_PUT_6(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_5(r, __VA_ARGS__)
+#define DLOG_PUT_7(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_6(r, __VA_ARGS__)
+#define DLOG_PUT_8(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_7(r, __VA_ARGS__)
+#define DLOG_PUT_9(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_8(r, __VA_ARGS__)
+#define DLOG_PUT_10(r, a, ...) DLOG_PUT(r, a); DLOG_PUT_9(r, __VA_ARGS__)
+
+// Records unconditionally; the drain applies the runtime log level.
+#define DLOG_RECORD(level, tag, fmt, ...) do {                                      \
+        dlog_rec_t dlog_rec_;                                                       \
+        dlog_begin(&dlog_rec_, (level), (tag), (fmt));                              \
+        DLOG_APPLY(DLOG_CAT(DLOG_PUT_, DLOG_NARGS(__VA_ARGS__)), &dlog_rec_, ##__VA_ARGS__) \
+        dlog_commit(&dlog_rec_);                                                    \
+    } while (0)
+
+#define DLOG_LEVEL(level, tag, fmt, ...) do {                                       \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                           \
+            DLOG_RECORD(level, tag, fmt, ##__VA_ARGS__);                            \
+        }                                                                           \
+    } while (0)
+
+#define DLOGW(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+#endif // DLOG_H
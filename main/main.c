@@ -9,12 +9,102 @@
 #include "driver/gpio.h"
 
 #include "app_config.h"
+#include "app_state.h"
 #include "display_manager.h"
 #include "wifi_manager.h"
 #include "time_utils.h"
+#include "sntp_server.h"
 #include "web_server.h"
+#include "status.h"
+#include "config_store.h"
+#include "alarm_engine.h"
+#include "chrono.h"
+#include "buzzer.h"
+#include "button.h"
+#include "brightness.h"
+#include "display_power.h"
+#include "world_clock.h"
+#include "seconds_led.h"
+#include "warm_start.h"
+#include "metrics.h"
+#include "dlog.h"
+#include "esp_timer.h"
+
+static const char *TAG = "main";
 
 extern struct tm current_time;
+
+static bool alarm_ringing(void) {
+    app_state_t state;
+    app_state_read(&state);
+    return state.alarm.triggered;
+}
+
+static void set_alarm_ringing(bool ringing) {
+    app_state_begin()->alarm.triggered = ringing;
+    app_state_commit();
+}
+
+static void on_wifi_link(const app_state_t *state, uint32_t changed, void *arg) {
+    if (state->wifi.got_ip) {
+        time_utils_init_sntp();
+    }
+}
+
+static void handle_button_event(const button_event_t *ev) {
+    // A press on a dark display only wakes it, including the short/long
+    // press it turns into.
+    static bool s_wake_press;
+    if (ev->type == BUTTON_PRESS) {
+        s_wake_press = display_power_activity();
+    } else if (s_wake_press) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    switch (ev->type) {
+    case BUTTON_PRESS:
+        // Silence first; what the press means is decided once it is classified.
+        if (buzzer_playing()) {
+            buzzer_stop();
+            button_record_latency(ev);
+        }
+        break;
+    case BUTTON_SHORT_PRESS:
+        if (alarm_ringing()) {
+            alarm_engine_snooze(now);
+            set_alarm_ringing(false);
+        } else if (chrono_mode() == CHRONO_STOPWATCH) {
+            chrono_running() ? chrono_pause() : chrono_resume();
+        } else if (chrono_mode() == CHRONO_COUNTDOWN && !chrono_running()) {
+            chrono_stop();
+        }
+        break;
+    case BUTTON_LONG_PRESS:
+        if (alarm_ringing()) {
+            alarm_engine_dismiss();
+            set_alarm_ringing(false);
+        } else if (chrono_mode() != CHRONO_OFF) {
+            chrono_stop();
+        }
+        break;
+    case BUTTON_DOUBLE_PRESS:
+        if (chrono_mode() == CHRONO_OFF) {
+            chrono_stopwatch_start();
+        }
+        break;
+    }
+}
+
+// A one-shot alarm turns itself off in alarm_engine when it rings. The
+// config has to follow, or the next boot re-arms it and it rings again.
+static void alarm_fired(int id) {
+    alarm_t a;
+    if (alarm_engine_get(id, &a) && !a.enabled) {
+        config_store_set_alarm(id, &a);
+    }
+}
+
 void app_main(void)
 {
     // Initialize NVS
@@ -25,40 +115,119 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    display_manager_init();
-    display_message("INIT");
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-    display_clear();
+    dlog_init();
+    app_state_init();
 
-    wifi_manager_init();
+    clock_config_t cfg;
+    config_store_init();
+    config_store_get(&cfg);
+    // After a software or watchdog reset the time, the display and the AP
+    // come back from RTC memory, so the clock is right again at once.
+    warm_state_t warm;
+    bool warm_boot = warm_start_restore(&warm);
+    if (warm_boot && warm.wifi.channel && memcmp(&warm.wifi, &cfg.wifi_cache, sizeof(warm.wifi)) != 0) {
+        cfg.wifi_cache = warm.wifi;
+        config_store_set_wifi_cache(&warm.wifi);
+    }
+    time_utils_set_system_time(cfg.timezone);
 
-    if (wifi_manager_load_sta_config()) {
-        if (wifi_manager_connect_to_ap() == ESP_OK) {
-            // Connection successful, wifi_connected is set in the wifi_manager
-        } else {
-            // Connection failed, start AP mode
-            display_message("FAIL");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            wifi_manager_start_ap();
-            display_message("AP ON");
-        }
-    } else {
-        // No STA config found, start AP mode
-        wifi_manager_start_ap();
-        display_message("AP ON");
+    alarm_engine_init();
+    for (int i = 0; i < ALARM_MAX; i++) {
+        alarm_engine_set(i, &cfg.alarms[i], time(NULL));
     }
 
-    web_server_start();
+    display_manager_init();
+    display_manager_set_transition(cfg.transition);
+    if (warm_boot) {
+        display_manager_restore(warm.frame);
+        brightness_resume(warm.intensity);
+    }
+    brightness_init();
+    display_power_init(&cfg.display_sleep);
+    seconds_led_init();
+    world_clock_init(&cfg.world_clock);
+    chrono_init();
+    buzzer_init();
+    QueueHandle_t button_events = button_init();
+    if (!warm_boot) {
+        display_message("INIT");
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        display_clear();
+    }
 
-    if (wifi_connected) {
-        sync_time();
+    // Wi-Fi comes up in the background; the clock runs from the RTC until
+    // SNTP catches up.
+    app_state_subscribe(APP_STATE_WIFI_LINK, on_wifi_link, NULL);
+    wifi_manager_init();
+    // Picks the SNTP upstream, so it goes before the link can come up.
+    sntp_server_init(&cfg.ntp);
+    wifi_manager_start();
+    if (wifi_manager_state() == WIFI_STATE_IDLE) {
+        // The clock starts underneath and shows once the message times out.
+        display_message_for("AP ON", 1000);
     }
 
+    web_server_start();
+
+    TickType_t next_tick = xTaskGetTickCount();
+    uint32_t ticks = 0;
     while (1) {
-        if (wifi_connected) {
-            update_time();
-            display_manager_show_time(current_time.tm_hour, current_time.tm_min, current_time.tm_sec);
+        int64_t wake_us = esp_timer_get_time();
+        update_time();
+        seconds_led_tick(&current_time);
+        time_t now = time(NULL);
+        int fired = alarm_engine_tick(now, current_time.tm_isdst);
+        if (fired != ALARM_NONE) {
+            alarm_fired(fired);
+        }
+        if (fired != ALARM_NONE || chrono_countdown_expired()) {
+            set_alarm_ringing(true);
+            buzzer_play(&buzzer_melody_alarm, true);
+        }
+        int next_id;
+        alarm_t next = { 0 };
+        bool armed = alarm_engine_next(&next_id) != 0;
+        if (armed) {
+            alarm_engine_get(next_id, &next);
+        }
+        app_alarm_state_t *alarm = &app_state_begin()->alarm;
+        alarm->next_hour = armed ? next.hour : -1;
+        alarm->next_minute = armed ? next.minute : -1;
+        app_state_commit(); // no-op unless the next alarm changed
+        display_manager_set_alarm_indicator(armed);
+        display_manager_set_blink(alarm_ringing());
+        status_publish(&current_time, now);
+        if (chrono_mode() == CHRONO_OFF) {
+            if (world_clock_active()) {
+                world_clock_show(now);
+            } else {
+                display_manager_show_time(current_time.tm_hour, current_time.tm_min, current_time.tm_sec);
+            }
+            if (ticks == 0) {
+                DLOGI(TAG, "Time on the display %lld ms after boot (%s start)",
+                      (long long)(esp_timer_get_time() / 1000), warm_boot ? "warm" : "cold");
+            }
+            metrics_record(METRIC_TICK_US, (uint32_t)(esp_timer_get_time() - wake_us));
+        }
+        display_power_tick(&current_time, alarm_ringing() || chrono_mode() != CHRONO_OFF);
+        warm_start_save();
+        if (++ticks % METRICS_LOG_INTERVAL_S == 0) {
+            metrics_log();
+        }
+
+        // Sleep until the next one-second tick, waking early for button events.
+        next_tick += pdMS_TO_TICKS(1000);
+        if ((int32_t)(xTaskGetTickCount() - next_tick) > 0) {
+            next_tick = xTaskGetTickCount(); // fell behind, don't burst
+        }
+        button_event_t ev;
+        for (;;) {
+            TickType_t now_ticks = xTaskGetTickCount();
+            TickType_t wait = (int32_t)(next_tick - now_ticks) > 0 ? next_tick - now_ticks : 0;
+            if (xQueueReceive(button_events, &ev, wait) != pdTRUE) {
+                break;
+            }
+            handle_button_event(&ev);
         }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "matrix.h"
+#include <string.h>
+
+typedef struct {
+    char ch;
+    uint8_t width;
+    uint8_t cols[5]; // bit 0 is the top row
+} matrix_glyph_t;
+
+// The classic 5x7 font with the blank columns of the narrow glyphs
+// dropped, so "11:11" doesn't look spaced out.
+static const matrix_glyph_t s_font[] = {
+    { ' ', 2, { 0x00, 0x00 } },
+    { '-', 3, { 0x08, 0x08, 0x08 } },
+    { '.', 1, { 0x40 } },
+    { ':', 1, { 0x36 } },
+    { '0', 5, { 0x3E, 0x51, 0x49, 0x45, 0x3E } },
+    { '1', 3, { 0x42, 0x7F, 0x40 } },
+    { '2', 5, { 0x42, 0x61, 0x51, 0x49, 0x46 } },
+    { '3', 5, { 0x21, 0x41, 0x45, 0x4B, 0x31 } },
+    { '4', 5, { 0x18, 0x14, 0x12, 0x7F, 0x10 } },
+    { '5', 5, { 0x27, 0x45, 0x45, 0x45, 0x39 } },
+    { '6', 5, { 0x3C, 0x4A, 0x49, 0x49, 0x30 } },
+    { '7', 5, { 0x01, 0x71, 0x09, 0x05, 0x03 } },
+    { '8', 5, { 0x36, 0x49, 0x49, 0x49, 0x36 } },
+    { '9', 5, { 0x06, 0x49, 0x49, 0x29, 0x1E } },
+    { 'A', 5, { 0x7E, 0x11, 0x11, 0x11, 0x7E } },
+    { 'B', 5, { 0x7F, 0x49, 0x49, 0x49, 0x36 } },
+    { 'C', 5, { 0x3E, 0x41, 0x41, 0x41, 0x22 } },
+    { 'D', 5, { 0x7F, 0x41, 0x41, 0x22, 0x1C } },
+    { 'E', 5, { 0x7F, 0x49, 0x49, 0x49, 0x41 } },
+    { 'F', 5, { 0x7F, 0x09, 0x09, 0x09, 0x01 } },
+    { 'G', 5, { 0x3E, 0x41, 0x49, 0x49, 0x7A } },
+    { 'H', 5, { 0x7F, 0x08, 0x08, 0x08, 0x7F } },
+    { 'I', 3, { 0x41, 0x7F, 0x41 } },
+    { 'J', 5, { 0x20, 0x40, 0x41, 0x3F, 0x01 } },
+    { 'K', 5, { 0x7F, 0x08, 0x14, 0x22, 0x41 } },
+    { 'L', 5, { 0x7F, 0x40, 0x40, 0x40, 0x40 } },
+    { 'M', 5, { 0x7F, 0x02, 0x0C, 0x02, 0x7F } },
+    { 'N', 5, { 0x7F, 0x04, 0x08, 0x10, 0x7F } },
+    { 'O', 5, { 0x3E, 0x41, 0x41, 0x41, 0x3E } },
+    { 'P', 5, { 0x7F, 0x09, 0x09, 0x09, 0x06 } },
+    { 'Q', 5, { 0x3E, 0x41, 0x51, 0x21, 0x5E } },
+    { 'R', 5, { 0x7F, 0x09, 0x19, 0x29, 0x46 } },
+    { 'S', 5, { 0x46, 0x49, 0x49, 0x49, 0x31 } },
+    { 'T', 5, { 0x01, 0x01, 0x7F, 0x01, 0x01 } },
+    { 'U', 5, { 0x3F, 0x40, 0x40, 0x40, 0x3F } },
+    { 'V', 5, { 0x1F, 0x20, 0x40, 0x20, 0x1F } },
+    { 'W', 5, { 0x3F, 0x40, 0x38, 0x40, 0x3F } },
+    { 'X', 5, { 0x63, 0x14, 0x08, 0x14, 0x63 } },
+    { 'Y', 5, { 0x07, 0x08, 0x70, 0x08, 0x07 } },
+    { 'Z', 5, { 0x61, 0x51, 0x49, 0x45, 0x43 } },
+};
+
+static const matrix_glyph_t *matrix_glyph(char c) {
+    if (c >= 'a' && c <= 'z') {
+        c -= 'a' - 'A';
+    }
+    for (size_t i = 0; i < sizeof(s_font) / sizeof(s_font[0]); i++) {
+        if (s_font[i].ch == c) {
+            return &s_font[i];
+        }
+    }
+    return NULL;
+}
+
+int matrix_render_text(const char *text, matrix_strip_t *out) {
+    int x = 0;
+    for (; *text; text++) {
+        const matrix_glyph_t *g = matrix_glyph(*text);
+        if (g == NULL) {
+            continue;
+        }
+        int gap = x > 0;
+        if (x + gap + g->width > MATRIX_STRIP_MAX) {
+            break;
+        }
+        if (gap) {
+            out->cols[x++] = 0;
+        }
+        memcpy(&out->cols[x], g->cols, g->width);
+        x += g->width;
+    }
+    out->width = x;
+    return x;
+}
+
+// Three rounds of swapping ever larger blocks across the diagonal
+// (Hacker's Delight, 7-3): 2x2 bit blocks, then 2x2 blocks of those, then
+// the 4x4 quadrants. Nine shifts and masks instead of 64 bit moves.
+uint64_t matrix_transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Columns go in right to left, so the transpose leaves the leftmost
+// column in bit 7 of each row as the module wants it.
+static void matrix_blit(const uint8_t cols[MATRIX_SIZE], uint8_t rows[MAX7219_DIGITS]) {
+    uint64_t x = 0;
+    for (int c = 0; c < MATRIX_SIZE; c++) {
+        x |= (uint64_t)cols[c] << (8 * (MATRIX_SIZE - 1 - c));
+    }
+    x = matrix_transpose8(x);
+    for (int r = 0; r < MATRIX_SIZE; r++) {
+        rows[r] = (uint8_t)(x >> (8 * r));
+    }
+}
+
+void matrix_window(const matrix_strip_t *strip, int x, uint8_t rows[MAX7219_DIGITS]) {
+    uint8_t cols[MATRIX_SIZE] = { 0 };
+    if (strip->width > 0) {
+        x %= strip->width;
+        for (int c = 0; c < MATRIX_SIZE; c++) {
+            cols[c] = strip->cols[x];
+            if (++x == strip->width) {
+                x = 0;
+            }
+        }
+    }
+    matrix_blit(cols, rows);
+}
+
+void matrix_center(const matrix_strip_t *strip, uint8_t rows[MAX7219_DIGITS]) {
+    uint8_t cols[MATRIX_SIZE] = { 0 };
+    int w = strip->width < MATRIX_SIZE ? strip->width : MATRIX_SIZE;
+    memcpy(&cols[(MATRIX_SIZE - w) / 2], strip->cols, w);
+    matrix_blit(cols, rows);
+}
@@ -0,0 +1,40 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+#include "max7219.h"
+
+// 8x8 LED matrix on a MAX7219 in no-decode mode, wired as the common
+// FC-16 modules are: DIG0..DIG7 drive rows top to bottom and bit 7 of each
+// is the leftmost column. A frame is therefore the same 8 bytes that a
+// seven-segment board gets, one per row, and goes through the same
+// shadow-diffed max7219_write_frame(), so a scroll step only rewrites the
+// rows that changed.
+#define MATRIX_SIZE 8
+// Scroll speed in columns per second; one column per frame.
+#define MATRIX_SCROLL_FPS 20
+// Blank columns between the end of scrolling text and its next pass.
+#define MATRIX_SCROLL_GAP 6
+#define MATRIX_STRIP_MAX 192
+
+// Rendered text, one byte per column, bit 0 the top row.
+typedef struct {
+    uint16_t width;
+    uint8_t cols[MATRIX_STRIP_MAX];
+} matrix_strip_t;
+
+// Renders text in the proportional 5x7 font, one blank column between
+// glyphs, upper case only (lower case is folded). Characters the font
+// lacks are skipped. Returns the width; text that doesn't fit is cut.
+int matrix_render_text(const char *text, matrix_strip_t *out);
+
+// Transposes an 8x8 bit matrix held as bytes 0..7 of x: bit c of byte r
+// moves to bit r of byte c.
+uint64_t matrix_transpose8(uint64_t x);
+
+// Row frame for the 8 columns starting at x, wrapping around the strip.
+void matrix_window(const matrix_strip_t *strip, int x, uint8_t rows[MAX7219_DIGITS]);
+// Row frame with the strip centered; for text no wider than the matrix.
+void matrix_center(const matrix_strip_t *strip, uint8_t rows[MAX7219_DIGITS]);
+
+#endif // MATRIX_H
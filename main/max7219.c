@@ -1,7 +1,13 @@
 #include "max7219.h"
+#include "metrics.h"
+#include "trace.h"
+#include "esp_timer.h"
 #include "driver/spi_master.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -13,15 +19,22 @@ void max7219_send_cmd(spi_device_handle_t spi, uint8_t reg, uint8_t data) {
     uint16_t cmd = (reg << 8) | data;
     t.length = 16;
     t.tx_buffer = &cmd;
+    int64_t start = esp_timer_get_time();
     esp_err_t ret = spi_device_polling_transmit(spi, &t);
+    metrics_record(METRIC_SPI_US, (uint32_t)(esp_timer_get_time() - start));
     assert(ret == ESP_OK);
 }
 
-void max7219_init(spi_device_handle_t spi) {
+// Scanning only the wired digits gives each of them 1/digits of the mux
+// period instead of 1/8, so blank slots don't eat into the brightness range.
+void max7219_init(spi_device_handle_t spi, uint8_t digits) {
+    if (digits < 1 || digits > MAX7219_DIGITS) {
+        digits = MAX7219_DIGITS;
+    }
     max7219_send_cmd(spi, MAX7219_REG_SHUTDOWN, 1);
     max7219_send_cmd(spi, MAX7219_REG_DECODEMODE, 0x00);
-    max7219_send_cmd(spi, MAX7219_REG_SCANLIMIT, 7);
-    max7219_send_cmd(spi, MAX7219_REG_INTENSITY, 1);
+    max7219_send_cmd(spi, MAX7219_REG_SCANLIMIT, digits - 1);
+    max7219_send_cmd(spi, MAX7219_REG_INTENSITY, MAX7219_INTENSITY_BOOT);
     max7219_send_cmd(spi, MAX7219_REG_DISPLAYTEST, 0);
     max7219_clear(spi);
 }
@@ -32,15 +45,18 @@ void max7219_clear(spi_device_handle_t spi) {
     }
 }
 
+void max7219_set_shutdown(spi_device_handle_t spi, bool shutdown) {
+    max7219_send_cmd(spi, MAX7219_REG_SHUTDOWN, shutdown ? 0 : 1);
+}
+
 void max7219_set_intensity(spi_device_handle_t spi, uint8_t intensity) {
-    if (intensity > 15) {
-        intensity = 15;
+    if (intensity > MAX7219_INTENSITY_MAX) {
+        intensity = MAX7219_INTENSITY_MAX;
     }
     max7219_send_cmd(spi, MAX7219_REG_INTENSITY, intensity);
 }
 
-// This is a basic font, supporting 0-9, A-F, and some symbols.
-// This can be expanded.
+// Digits 0-9 and the decimal point.
 static const uint8_t font[] = {
     0x7E, // 0
     0x30, // 1
@@ -55,45 +71,121 @@ static const uint8_t font[] = {
     0x01, // .
 };
 
-void max7219_display_text(spi_device_handle_t spi, const char* text) {
-    int len = strlen(text);
-    for (int i = 0; i < 8; i++) {
-        if (i < len) {
-            char c = text[len - 1 - i];
-            uint8_t val = 0;
-            if (c >= '0' && c <= '9') {
-                val = font[c - '0'];
-            } else if (c == '.') {
-                // find previous digit and add the dot
-                if (i > 0) {
-                    char prev_c = text[len - 1 - (i-1)];
-                     if (prev_c >= '0' && prev_c <= '9') {
-                        uint8_t prev_val = font[prev_c - '0'];
-                        max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + (i-1), prev_val | 0x80);
-                     }
-                }
-                 max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + i, 0x00); // clear current digit
-                 continue;
+uint8_t max7219_encode_digit(uint8_t value, bool dp) {
+    uint8_t val = (value < sizeof(font)) ? font[value] : 0x00;
+    return dp ? (val | 0x80) : val;
+}
+
+// Letters as seven segments can draw them, either case: some share a
+// digit's shape (O, S, Z) and a few are only suggested (K, M, V, W, X).
+static const uint8_t letters[26] = {
+    0x77, 0x1F, 0x4E, 0x3D, 0x4F, 0x47, 0x5E, 0x37, 0x06, 0x3C, 0x57, 0x0E, 0x55, // A-M
+    0x76, 0x7E, 0x67, 0x73, 0x05, 0x5B, 0x0F, 0x3E, 0x1C, 0x2A, 0x37, 0x3B, 0x6D, // N-Z
+};
+
+static uint8_t max7219_encode_char(char c) {
+    if (c >= '0' && c <= '9') {
+        return font[c - '0'];
+    }
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+        return letters[(c | 0x20) - 'a'];
+    }
+    if (c == '-') {
+        return 0x01; // segment G
+    }
+    return 0x00;
+}
+
+// The first character that encodes to segments, digits before letters,
+// or '?'. The decimal point is ignored.
+char max7219_decode_char(uint8_t segments) {
+    segments &= 0x7F;
+    if (segments == 0x00) {
+        return ' ';
+    }
+    if (segments == 0x01) {
+        return '-';
+    }
+    for (int i = 0; i < 10; i++) {
+        if (font[i] == segments) {
+            return '0' + i;
+        }
+    }
+    for (int i = 0; i < 26; i++) {
+        if (letters[i] == segments) {
+            return 'A' + i;
+        }
+    }
+    return '?';
+}
+
+// Encodes text right-aligned into frame[0..7], where frame[0] is the
+// rightmost digit. A '.' sets the decimal point of the character before it
+// instead of taking up a digit of its own.
+void max7219_encode_text(const char* text, uint8_t frame[MAX7219_DIGITS]) {
+    memset(frame, 0, MAX7219_DIGITS);
+    int pos = 0;
+    for (int i = (int)strlen(text) - 1; i >= 0 && pos < MAX7219_DIGITS; i--) {
+        if (text[i] == '.') {
+            if (i > 0 && text[i - 1] != '.') {
+                frame[pos] = max7219_encode_char(text[--i]) | 0x80;
+            } else {
+                frame[pos] = 0x80;
             }
-            max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + i, val);
         } else {
-            max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + i, 0x00); // Clear remaining digits
+            frame[pos] = max7219_encode_char(text[i]);
         }
+        pos++;
+    }
+}
+
+void max7219_write_raw(spi_device_handle_t spi, uint8_t digit, uint8_t segments) {
+    if (digit >= MAX7219_DIGITS) return;
+    max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + digit, segments);
+}
+
+// Writes only the digits that differ from shadow and updates it. The bus is
+// held across the burst so back-to-back transactions skip re-arbitration.
+int max7219_write_frame(spi_device_handle_t spi, const uint8_t frame[MAX7219_DIGITS], uint8_t shadow[MAX7219_DIGITS]) {
+    int written = 0;
+    bool acquired = false;
+    for (int i = 0; i < MAX7219_DIGITS; i++) {
+        if (frame[i] == shadow[i]) {
+            continue;
+        }
+        if (written == 0) {
+            trace_begin(TRACE_ID_SPI_FLUSH);
+            acquired = spi_device_acquire_bus(spi, portMAX_DELAY) == ESP_OK;
+        }
+        max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + i, frame[i]);
+        shadow[i] = frame[i];
+        written++;
+    }
+    if (acquired) {
+        spi_device_release_bus(spi);
+    }
+    if (written > 0) {
+        trace_end(TRACE_ID_SPI_FLUSH);
+    }
+    return written;
+}
+
+void max7219_display_text(spi_device_handle_t spi, const char* text) {
+    uint8_t frame[MAX7219_DIGITS];
+    max7219_encode_text(text, frame);
+    for (int i = 0; i < MAX7219_DIGITS; i++) {
+        max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + i, frame[i]);
     }
 }
 
 
 void max7219_display_number(spi_device_handle_t spi, int32_t number) {
     char buf[9];
-    snprintf(buf, sizeof(buf), "%ld", number);
+    snprintf(buf, sizeof(buf), "%" PRId32, number);
     max7219_display_text(spi, buf);
 }
 
 void max7219_write_digit(spi_device_handle_t spi, uint8_t digit, uint8_t value, bool dp) {
     if (digit > 7 || value > 15) return;
-    uint8_t val = font[value];
-    if (dp) {
-        val |= 0x80;
-    }
-    max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + digit, val);
+    max7219_send_cmd(spi, MAX7219_REG_DIGIT0 + digit, max7219_encode_digit(value, dp));
 }
@@ -9,6 +9,7 @@
 #define MAIN_MAX7219_H_
 
 #include "driver/spi_master.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 // MAX7219 registers
@@ -29,12 +30,24 @@
 #define MAX7219_REG_DIGIT6       0x07
 #define MAX7219_REG_DIGIT7       0x08
 
-void max7219_init(spi_device_handle_t spi);
+#define MAX7219_DIGITS           8
+#define MAX7219_INTENSITY_MAX    15
+#define MAX7219_INTENSITY_BOOT   1
+
+void max7219_init(spi_device_handle_t spi, uint8_t digits);
 void max7219_send_cmd(spi_device_handle_t spi, uint8_t reg, uint8_t data);
 void max7219_clear(spi_device_handle_t spi);
 void max7219_set_intensity(spi_device_handle_t spi, uint8_t intensity);
+void max7219_set_shutdown(spi_device_handle_t spi, bool shutdown);
 void max7219_write_digit(spi_device_handle_t spi, uint8_t digit, uint8_t value, bool dp);
 void max7219_display_text(spi_device_handle_t spi, const char* text);
 void max7219_display_number(spi_device_handle_t spi, int32_t number);
 
+// Glyph encoding and shadow-diffed frame writes
+uint8_t max7219_encode_digit(uint8_t value, bool dp);
+void max7219_encode_text(const char* text, uint8_t frame[MAX7219_DIGITS]);
+char max7219_decode_char(uint8_t segments);
+void max7219_write_raw(spi_device_handle_t spi, uint8_t digit, uint8_t segments);
+int max7219_write_frame(spi_device_handle_t spi, const uint8_t frame[MAX7219_DIGITS], uint8_t shadow[MAX7219_DIGITS]);
+
 #endif /* MAIN_MAX7219_H_ */
@@ -0,0 +1,260 @@
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static const char *TAG = "metrics";
+
+// Each core records into its own slots, so the two cores never contend for
+// a line. The atomics only cover a task being preempted mid-update by
+// another task on the same core. There is no separate count: exporters sum
+// the buckets, which keeps _count and the +Inf bucket equal even while a
+// record is in flight. Sums are 32-bit and wrap, which Prometheus treats
+// as a counter reset.
+typedef struct {
+    atomic_uint buckets[METRICS_BUCKETS];
+    atomic_uint sum;
+    atomic_uint max;
+} metrics_hist_slot_t;
+
+typedef struct {
+    metrics_hist_slot_t hist[METRIC_HIST_COUNT];
+    atomic_uint counters[METRIC_COUNTER_COUNT];
+} metrics_core_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    uint32_t base;
+} metrics_hist_info_t;
+
+static metrics_core_t s_core[portNUM_PROCESSORS];
+static atomic_int s_sntp_offset_ms;
+
+static const metrics_hist_info_t s_hist_info[METRIC_HIST_COUNT] = {
+    [METRIC_SPI_US] = { "clock_spi_us", "MAX7219 SPI transaction time", 2 },
+    [METRIC_I2C_US] = { "clock_i2c_us", "RTC I2C register read time, once the firmware reads the RTC", 16 },
+    [METRIC_SNTP_SYNC_MS] = { "clock_sntp_first_sync_ms", "SNTP start to first sync", 16 },
+    [METRIC_SNTP_OFFSET_MS] = { "clock_sntp_offset_ms", "Clock correction applied per SNTP sync", 1 },
+    [METRIC_HTTP_US] = { "clock_http_us", "HTTP handler latency", 64 },
+    [METRIC_TICK_US] = { "clock_tick_us", "Main loop wake to display commit", 16 },
+    [METRIC_TRANSITION_US] = { "clock_transition_us", "CPU time per digit transition", 16 },
+    [METRIC_TRANSITION_SPI] = { "clock_transition_spi_writes", "Digit registers written per transition", 1 },
+    [METRIC_MATRIX_FRAME_US] = { "clock_matrix_frame_us", "CPU time per matrix scroll frame", 4 },
+    [METRIC_OTA_WRITE_US] = { "clock_ota_write_us", "Flash write time per OTA chunk", 1024 },
+    [METRIC_SNTP_SERVE_US] = { "clock_sntp_serve_us", "LAN SNTP request to reply sent", 16 },
+    [METRIC_SECONDS_LED_US] = { "clock_seconds_led_error_us", "Seconds LED edge error against the system clock", 4 },
+};
+
+static const char *const s_counter_names[METRIC_COUNTER_COUNT] = {
+    [METRIC_I2C_ERRORS] = "clock_i2c_errors_total",
+    [METRIC_HTTP_ERRORS] = "clock_http_errors_total",
+};
+
+static unsigned metrics_bucket(uint32_t value, uint32_t base) {
+    if (value <= base) {
+        return 0;
+    }
+    unsigned k = 32 - __builtin_clz((value - 1) / base);
+    return k < METRICS_BUCKETS ? k : METRICS_BUCKETS - 1;
+}
+
+void metrics_record(metric_hist_t hist, uint32_t value) {
+    metrics_hist_slot_t *slot = &s_core[xPortGetCoreID()].hist[hist];
+    atomic_fetch_add_explicit(&slot->buckets[metrics_bucket(value, s_hist_info[hist].base)], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->sum, value, memory_order_relaxed);
+    unsigned max = atomic_load_explicit(&slot->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&slot->max, &max, value, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void metrics_count(metric_counter_t counter) {
+    atomic_fetch_add_explicit(&s_core[xPortGetCoreID()].counters[counter], 1, memory_order_relaxed);
+}
+
+void metrics_set_sntp_offset(int32_t offset_ms) {
+    atomic_store_explicit(&s_sntp_offset_ms, offset_ms, memory_order_relaxed);
+    metrics_record(METRIC_SNTP_OFFSET_MS, offset_ms < 0 ? -offset_ms : offset_ms);
+}
+
+typedef struct {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    uint32_t sum;
+    uint32_t max;
+} metrics_hist_total_t;
+
+static void metrics_collect(metric_hist_t hist, metrics_hist_total_t *out) {
+    *out = (metrics_hist_total_t){ 0 };
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        metrics_hist_slot_t *slot = &s_core[c].hist[hist];
+        for (int k = 0; k < METRICS_BUCKETS; k++) {
+            uint32_t n = atomic_load_explicit(&slot->buckets[k], memory_order_relaxed);
+            out->buckets[k] += n;
+            out->count += n;
+        }
+        out->sum += atomic_load_explicit(&slot->sum, memory_order_relaxed);
+        uint32_t max = atomic_load_explicit(&slot->max, memory_order_relaxed);
+        out->max = max > out->max ? max : out->max;
+    }
+}
+
+static uint32_t metrics_counter_total(metric_counter_t counter) {
+    uint32_t total = 0;
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        total += atomic_load_explicit(&s_core[c].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+// Upper bound of the bucket holding quantile q (percent), capped at the
+// observed max so the open-ended last bucket still reports something real.
+static uint32_t metrics_quantile(const metrics_hist_total_t *t, uint32_t base, unsigned q) {
+    uint32_t rank = (uint32_t)(((uint64_t)t->count * q + 99) / 100);
+    uint32_t seen = 0;
+    for (int k = 0; k < METRICS_BUCKETS - 1; k++) {
+        seen += t->buckets[k];
+        if (seen >= rank) {
+            uint32_t bound = base << k;
+            return bound < t->max ? bound : t->max;
+        }
+    }
+    return t->max;
+}
+
+// Text goes out in chunks of whole lines: a line cut short would make the
+// scraper reject the whole export.
+typedef struct {
+    char buf[1024];
+    size_t len;
+    metrics_emit_t emit;
+    void *ctx;
+} metrics_text_t;
+
+static void metrics_flush(metrics_text_t *t) {
+    if (t->len > 0) {
+        t->emit(t->ctx, t->buf, t->len);
+        t->len = 0;
+    }
+}
+
+static void metrics_printf(metrics_text_t *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Sends what is buffered and formats again if the text doesn't fit behind
+// it. A single call's text always fits an empty buffer.
+static void metrics_printf(metrics_text_t *t, const char *fmt, ...) {
+    va_list ap, retry;
+    va_start(ap, fmt);
+    va_copy(retry, ap);
+    int n = vsnprintf(t->buf + t->len, sizeof(t->buf) - t->len, fmt, ap);
+    if (n >= 0 && (size_t)n >= sizeof(t->buf) - t->len) {
+        metrics_flush(t);
+        n = vsnprintf(t->buf, sizeof(t->buf), fmt, retry);
+        assert(n >= 0 && (size_t)n < sizeof(t->buf));
+    }
+    va_end(retry);
+    va_end(ap);
+    if (n > 0) {
+        t->len += n;
+    }
+}
+
+// No firmware code reads the RTC yet, so the i2c_ll_read_reg wrap never
+// runs on target. The I2C series stay out of the export until the first
+// read instead of reporting a driver that isn't there as zero.
+static bool metrics_i2c_used(void) {
+    metrics_hist_total_t total;
+    metrics_collect(METRIC_I2C_US, &total);
+    return total.count > 0;
+}
+
+void metrics_write_prometheus(metrics_emit_t emit, void *ctx) {
+    metrics_text_t t = { .len = 0, .emit = emit, .ctx = ctx };
+    bool i2c_used = metrics_i2c_used();
+    for (int h = 0; h < METRIC_HIST_COUNT; h++) {
+        const metrics_hist_info_t *info = &s_hist_info[h];
+        metrics_hist_total_t total;
+        metrics_collect(h, &total);
+        if (h == METRIC_I2C_US && !i2c_used) {
+            continue;
+        }
+
+        metrics_printf(&t, "# HELP %s %s\n# TYPE %s histogram\n", info->name, info->help, info->name);
+        uint32_t cumulative = 0;
+        for (int k = 0; k < METRICS_BUCKETS - 1; k++) {
+            cumulative += total.buckets[k];
+            metrics_printf(&t, "%s_bucket{le=\"%lu\"} %lu\n", info->name,
+                           (unsigned long)(info->base << k), (unsigned long)cumulative);
+        }
+        metrics_printf(&t, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %lu\n%s_count %lu\n",
+                       info->name, (unsigned long)total.count, info->name, (unsigned long)total.sum,
+                       info->name, (unsigned long)total.count);
+        metrics_flush(&t);
+    }
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        if (c == METRIC_I2C_ERRORS && !i2c_used) {
+            continue;
+        }
+        metrics_printf(&t, "# TYPE %s counter\n%s %lu\n", s_counter_names[c], s_counter_names[c],
+                       (unsigned long)metrics_counter_total(c));
+    }
+    metrics_printf(&t, "# TYPE clock_sntp_last_offset_ms gauge\nclock_sntp_last_offset_ms %d\n",
+                   atomic_load_explicit(&s_sntp_offset_ms, memory_order_relaxed));
+    metrics_printf(&t,
+                   "# TYPE clock_heap_free_bytes gauge\nclock_heap_free_bytes %u\n"
+                   "# HELP clock_heap_min_free_bytes Lowest free heap since boot\n"
+                   "# TYPE clock_heap_min_free_bytes gauge\nclock_heap_min_free_bytes %u\n"
+                   "# TYPE clock_heap_largest_block_bytes gauge\nclock_heap_largest_block_bytes %u\n"
+                   "# TYPE clock_uptime_seconds counter\nclock_uptime_seconds %lld\n",
+                   (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                   (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                   (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                   (long long)(esp_timer_get_time() / 1000000));
+    metrics_flush(&t);
+}
+
+void metrics_log(void) {
+    for (int h = 0; h < METRIC_HIST_COUNT; h++) {
+        const metrics_hist_info_t *info = &s_hist_info[h];
+        metrics_hist_total_t total;
+        metrics_collect(h, &total);
+        if (total.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s n=%lu p50<=%lu p99<=%lu max=%lu", info->name + sizeof("clock_") - 1,
+                 (unsigned long)total.count, (unsigned long)metrics_quantile(&total, info->base, 50),
+                 (unsigned long)metrics_quantile(&total, info->base, 99), (unsigned long)total.max);
+    }
+    ESP_LOGI(TAG, "heap free=%u min=%u largest=%u i2c_err=%lu http_err=%lu",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+             (unsigned long)metrics_counter_total(METRIC_I2C_ERRORS),
+             (unsigned long)metrics_counter_total(METRIC_HTTP_ERRORS));
+}
+
+#ifdef ESP_PLATFORM
+// The RTC driver in managed_components is timed without patching it: the
+// component links with -Wl,--wrap=i2c_ll_read_reg (see CMakeLists.txt), so
+// its calls land here and __real_ is the original.
+bool __real_i2c_ll_read_reg(void *ctx, uint8_t reg, uint8_t *data, uint8_t length);
+
+bool __wrap_i2c_ll_read_reg(void *ctx, uint8_t reg, uint8_t *data, uint8_t length) {
+    int64_t start = esp_timer_get_time();
+    bool ok = __real_i2c_ll_read_reg(ctx, reg, data, length);
+    metrics_record(METRIC_I2C_US, (uint32_t)(esp_timer_get_time() - start));
+    if (!ok) {
+        metrics_count(METRIC_I2C_ERRORS);
+    }
+    return ok;
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log2 buckets: bucket 0 holds values <= base, bucket k values <= base << k,
+// and the last bucket everything above.
+#define METRICS_BUCKETS 16
+// How often the main loop prints metrics_log().
+#define METRICS_LOG_INTERVAL_S 300
+
+typedef enum {
+    METRIC_SPI_US,           // one max7219_send_cmd() transaction
+    METRIC_I2C_US,           // one i2c_ll_read_reg() from the RTC driver; unused so far
+    METRIC_SNTP_SYNC_MS,     // SNTP start to first sync (DNS + request + reply)
+    METRIC_SNTP_OFFSET_MS,   // |correction| applied by each later sync
+    METRIC_HTTP_US,          // one HTTP handler, receive to last byte queued
+    METRIC_TICK_US,          // main loop wake to display frame committed
+    METRIC_TRANSITION_US,    // CPU for one digit transition, plan and frames
+    METRIC_TRANSITION_SPI,   // digit registers written by one transition
+    METRIC_MATRIX_FRAME_US,  // one matrix scroll step, render to rows written
+    METRIC_OTA_WRITE_US,     // one OTA chunk: sector erase, program and hash
+    METRIC_SNTP_SERVE_US,    // LAN SNTP request received to reply sent
+    METRIC_SECONDS_LED_US,   // |seconds LED rising edge - system clock second|
+    METRIC_HIST_COUNT
+} metric_hist_t;
+
+typedef enum {
+    METRIC_I2C_ERRORS,
+    METRIC_HTTP_ERRORS,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Wait-free; safe from any task on either core, not from ISRs.
+void metrics_record(metric_hist_t hist, uint32_t value);
+void metrics_count(metric_counter_t counter);
+void metrics_set_sntp_offset(int32_t offset_ms);
+
+// Sinks get the export in pieces; each call is a complete number of lines.
+typedef void (*metrics_emit_t)(void *ctx, const char *text, size_t len);
+void metrics_write_prometheus(metrics_emit_t emit, void *ctx);
+// One line per histogram (count, p50, p99, max) plus heap, at INFO.
+void metrics_log(void);
+
+#endif // METRICS_H
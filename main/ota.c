@@ -0,0 +1,176 @@
+#include "ota.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Only the HTTP server task calls in here, one request at a time, so
+// the session needs no lock.
+
+static const char *TAG = "ota";
+
+static ota_status_t s_status = { .partition = "" };
+static uint8_t s_sha256[OTA_SHA256_LEN];
+static mbedtls_sha256_context s_sha;
+static esp_ota_handle_t s_handle;
+static const esp_partition_t *s_part;
+static uint8_t *s_buf;
+static size_t s_fill;
+static int64_t s_request_start;   // while a request holds the buffer
+static uint32_t s_heap_held;
+
+static const char *const s_state_names[] = {
+    [OTA_IDLE] = "idle",
+    [OTA_RECEIVING] = "receiving",
+    [OTA_DONE] = "done",
+    [OTA_FAILED] = "failed",
+};
+
+static void ota_sample_heap(void) {
+    uint32_t free_now = esp_get_free_heap_size();
+    if (free_now < s_status.heap_min_free) {
+        s_status.heap_min_free = free_now;
+    }
+    if (s_heap_held > s_status.heap_peak) {
+        s_status.heap_peak = s_heap_held;
+    }
+}
+
+static void ota_free_buffer(void) {
+    if (s_buf) {
+        s_status.busy_ms += (uint32_t)((esp_timer_get_time() - s_request_start) / 1000);
+    }
+    free(s_buf);
+    s_buf = NULL;
+    s_fill = 0;
+    s_heap_held = 0;
+}
+
+void ota_abort(esp_err_t error) {
+    if (s_status.state == OTA_RECEIVING) {
+        esp_ota_abort(s_handle);
+        mbedtls_sha256_free(&s_sha);
+        ESP_LOGW(TAG, "Update aborted at %lu of %lu bytes: %s", (unsigned long)s_status.received,
+                 (unsigned long)s_status.total, esp_err_to_name(error));
+        s_status.state = OTA_FAILED;
+        s_status.error = error;
+    }
+    ota_free_buffer();
+}
+
+esp_err_t ota_begin(uint32_t total, const uint8_t sha256[OTA_SHA256_LEN]) {
+    ota_abort(ESP_ERR_INVALID_STATE);
+    s_part = esp_ota_get_next_update_partition(NULL);
+    if (s_part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (total == 0 || total > s_part->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // Sequential writes erase each sector as the first chunk reaches it,
+    // rather than the whole partition up front: a 1.9 MB erase would stall
+    // flash, and with it the display, for seconds.
+    esp_err_t err = esp_ota_begin(s_part, OTA_WITH_SEQUENTIAL_WRITES, &s_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mbedtls_sha256_init(&s_sha);
+    mbedtls_sha256_starts(&s_sha, 0);
+    memcpy(s_sha256, sha256, OTA_SHA256_LEN);
+    s_status = (ota_status_t){
+        .state = OTA_RECEIVING,
+        .total = total,
+        .heap_min_free = esp_get_free_heap_size(),
+        .partition = s_part->label,
+    };
+    ESP_LOGI(TAG, "Writing %lu bytes to %s", (unsigned long)total, s_part->label);
+    return ESP_OK;
+}
+
+bool ota_matches(const uint8_t sha256[OTA_SHA256_LEN]) {
+    return s_status.state == OTA_RECEIVING && memcmp(s_sha256, sha256, OTA_SHA256_LEN) == 0;
+}
+
+uint8_t *ota_write_ptr(size_t *room) {
+    if (s_status.state != OTA_RECEIVING) {
+        return NULL;
+    }
+    if (s_buf == NULL) {
+        s_buf = malloc(OTA_CHUNK_SIZE);
+        if (s_buf == NULL) {
+            return NULL;
+        }
+        s_heap_held = OTA_CHUNK_SIZE;
+        s_request_start = esp_timer_get_time();
+        ota_sample_heap();
+    }
+    size_t left = s_status.total - s_status.received - s_fill;
+    *room = OTA_CHUNK_SIZE - s_fill < left ? OTA_CHUNK_SIZE - s_fill : left;
+    return s_buf + s_fill;
+}
+
+static esp_err_t ota_finish(void) {
+    uint8_t digest[OTA_SHA256_LEN];
+    mbedtls_sha256_finish(&s_sha, digest);
+    mbedtls_sha256_free(&s_sha);
+    // esp_ota_end() frees the handle whatever it returns.
+    s_status.state = OTA_FAILED;
+    esp_err_t err = esp_ota_end(s_handle);
+    if (err == ESP_OK && memcmp(digest, s_sha256, OTA_SHA256_LEN) != 0) {
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(s_part);
+    }
+    ota_free_buffer();
+    s_status.error = err;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Update rejected: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_status.state = OTA_DONE;
+    ESP_LOGI(TAG, "Update verified, %s boots next", s_part->label);
+    return ESP_OK;
+}
+
+esp_err_t ota_commit(size_t n) {
+    if (s_status.state != OTA_RECEIVING || s_buf == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_fill += n;
+    bool last = s_status.received + s_fill == s_status.total;
+    if (s_fill < OTA_CHUNK_SIZE && !last) {
+        return ESP_OK;
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(s_handle, s_buf, s_fill);
+    if (err != ESP_OK) {
+        ota_abort(err);
+        return err;
+    }
+    mbedtls_sha256_update(&s_sha, s_buf, s_fill);
+    metrics_record(METRIC_OTA_WRITE_US, (uint32_t)(esp_timer_get_time() - start));
+    s_status.received += s_fill;
+    s_fill = 0;
+    ota_sample_heap();
+    return last ? ota_finish() : ESP_OK;
+}
+
+void ota_pause(void) {
+    ota_free_buffer();
+}
+
+void ota_status(ota_status_t *out) {
+    *out = s_status;
+    if (s_buf) {
+        out->busy_ms += (uint32_t)((esp_timer_get_time() - s_request_start) / 1000);
+    }
+}
+
+const char *ota_state_name(ota_state_t state) {
+    return state <= OTA_FAILED ? s_state_names[state] : "idle";
+}
@@ -0,0 +1,58 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Firmware update streamed into the inactive OTA partition as it arrives.
+// Bytes collect in one OTA_CHUNK_SIZE buffer and go to flash, and into the
+// running SHA-256, a whole chunk at a time, so the image is never held in
+// RAM. A session outlives the request that started it: after a dropped
+// connection the upload resumes at ota_status().received, which is always
+// a chunk boundary.
+#define OTA_CHUNK_SIZE 4096
+#define OTA_SHA256_LEN 32
+
+typedef enum {
+    OTA_IDLE,       // no session
+    OTA_RECEIVING,  // part of the image is in flash; more may follow
+    OTA_DONE,       // verified and set to boot; restarting
+    OTA_FAILED,     // last session aborted, see error
+} ota_state_t;
+
+typedef struct {
+    ota_state_t state;
+    uint32_t received;       // bytes written to flash and hashed
+    uint32_t total;
+    uint32_t busy_ms;        // time spent in requests, across resumes
+    uint32_t heap_peak;      // most this module had allocated at once
+    uint32_t heap_min_free;  // lowest free heap seen during the session
+    const char *partition;   // label of the partition being written
+    esp_err_t error;
+} ota_status_t;
+
+// Starts a session for an image of total bytes whose SHA-256 must equal
+// sha256. Any previous session is abandoned.
+esp_err_t ota_begin(uint32_t total, const uint8_t sha256[OTA_SHA256_LEN]);
+// True if a session is open and its digest is sha256.
+bool ota_matches(const uint8_t sha256[OTA_SHA256_LEN]);
+
+// Where the next bytes of the image go and how many fit; allocates the
+// chunk buffer if the session doesn't hold it. NULL without a session or
+// on allocation failure.
+uint8_t *ota_write_ptr(size_t *room);
+// Accounts for n bytes stored at ota_write_ptr(). A full chunk, or the end
+// of the image, is hashed and written to flash. At the end, the digest is
+// checked and the partition set to boot; ota_status() then reads OTA_DONE.
+esp_err_t ota_commit(size_t n);
+// Ends a request: drops the bytes past the last chunk boundary, which the
+// client sends again when it resumes, and frees the buffer.
+void ota_pause(void);
+void ota_abort(esp_err_t error);
+
+void ota_status(ota_status_t *out);
+const char *ota_state_name(ota_state_t state);
+
+#endif // OTA_H
@@ -0,0 +1,129 @@
+#include "seconds_led.h"
+#include "app_config.h"
+#include "dlog.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <sys/time.h>
+
+static const char *TAG = "seconds_led";
+
+#define US_PER_S 1000000
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer;
+static int64_t s_offset_us;  // under s_mux: system clock minus esp_timer time
+static int64_t s_edge_us;    // under s_mux: last rising edge not yet measured, 0 = none
+static bool s_on;            // under s_mux
+static int s_pm = -1;        // AM/PM LED as last set; -1 = not yet
+static seconds_led_stats_t s_stats;
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * US_PER_S + tv.tv_usec;
+}
+
+// Position of wall within its second, [0, US_PER_S).
+static inline int64_t IRAM_ATTR second_phase(int64_t wall) {
+    int64_t phase = wall % US_PER_S;
+    return phase < 0 ? phase + US_PER_S : phase;
+}
+
+// From now (esp_timer time) to the next edge after one that left the LED
+// on or off. An edge that fired a little early or late still gets the
+// following one right, as the target is absolute.
+static uint64_t IRAM_ATTR delay_to_next_edge(int64_t now, bool on) {
+    int64_t target = on ? SECONDS_LED_ON_MS * 1000 : US_PER_S;
+    int64_t delay = target - second_phase(now + s_offset_us);
+    return delay > 0 ? delay : delay + US_PER_S;
+}
+
+// The edge itself is the first thing done, so its error is interrupt
+// latency plus however far the offset moved since the last tick.
+static void IRAM_ATTR seconds_led_edge(void *arg) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&s_mux);
+    s_on = !s_on;
+    gpio_set_level(SECONDS_LED_PIN, s_on);
+    if (s_on) {
+        s_edge_us = now;
+    }
+    uint64_t delay = delay_to_next_edge(now, s_on);
+    portEXIT_CRITICAL_ISR(&s_mux);
+    esp_timer_start_once(s_timer, delay);
+}
+
+void seconds_led_init(void) {
+    gpio_reset_pin(SECONDS_LED_PIN);
+    gpio_set_direction(SECONDS_LED_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_level(SECONDS_LED_PIN, 0);
+    gpio_reset_pin(AMPM_LED_PIN);
+    gpio_set_direction(AMPM_LED_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_level(AMPM_LED_PIN, 0);
+
+    const esp_timer_create_args_t args = {
+        .callback = seconds_led_edge,
+        .dispatch_method = ESP_TIMER_ISR,
+        .name = "seconds_led",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_timer));
+    seconds_led_resync();
+}
+
+void seconds_led_tick(const struct tm *local) {
+    int64_t offset = wall_us() - esp_timer_get_time();
+    portENTER_CRITICAL(&s_mux);
+    int64_t edge = s_edge_us;
+    s_edge_us = 0;
+    s_offset_us = offset;
+    portEXIT_CRITICAL(&s_mux);
+
+    if (edge) {
+        int64_t phase = second_phase(edge + offset);
+        int32_t error = (int32_t)(phase < US_PER_S / 2 ? phase : phase - US_PER_S);
+        s_stats.edges++;
+        s_stats.last_error_us = error;
+        if (abs(error) > s_stats.max_error_us) {
+            s_stats.max_error_us = abs(error);
+        }
+        metrics_record(METRIC_SECONDS_LED_US, (uint32_t)abs(error));
+    }
+
+    int pm = local->tm_hour >= 12;
+    if (pm != s_pm) {
+        gpio_set_level(AMPM_LED_PIN, pm);
+        s_pm = pm;
+    }
+}
+
+// A step in the system clock would otherwise show until the next tick.
+// The LED goes dark and restarts on the next second.
+void seconds_led_resync(void) {
+    if (s_timer == NULL) {
+        return;
+    }
+    esp_timer_stop(s_timer);
+    int64_t now = esp_timer_get_time();
+    int64_t offset = wall_us() - now;
+    portENTER_CRITICAL(&s_mux);
+    int64_t step = offset - s_offset_us;
+    s_offset_us = offset;
+    s_edge_us = 0;
+    s_on = false;
+    gpio_set_level(SECONDS_LED_PIN, 0);
+    uint64_t delay = delay_to_next_edge(now, false);
+    portEXIT_CRITICAL(&s_mux);
+    esp_timer_start_once(s_timer, delay);
+
+    if (s_stats.edges) {
+        DLOGI(TAG, "Re-phased by %+lld us; %lu edges, last %+ld us, worst %ld us", (long long)step,
+              (unsigned long)s_stats.edges, (long)s_stats.last_error_us, (long)s_stats.max_error_us);
+    }
+    s_stats.max_error_us = 0;
+}
+
+void seconds_led_stats(seconds_led_stats_t *out) {
+    *out = s_stats;
+}
@@ -0,0 +1,30 @@
+#ifndef SECONDS_LED_H
+#define SECONDS_LED_H
+
+#include <stdint.h>
+#include <time.h>
+
+// The seconds LED (SECONDS_LED_PIN) lights on each second of the system
+// clock for SECONDS_LED_ON_MS. Its edges come from a one-shot esp_timer
+// dispatched from the timer interrupt, aimed through the offset between
+// the system clock and esp_timer time, so they don't wait on any task.
+// The main loop refreshes that offset every tick, which absorbs slewing,
+// and a time sync re-aims the next edge at once.
+#define SECONDS_LED_ON_MS 500
+
+typedef struct {
+    uint32_t edges;          // rising edges measured
+    int32_t last_error_us;   // last rising edge minus the nearest second
+    int32_t max_error_us;    // largest |error| since boot or the last sync
+} seconds_led_stats_t;
+
+void seconds_led_init(void);
+// Once per main-loop tick: measures the last rising edge against the
+// system clock, refreshes the offset, and sets the AM/PM LED from the
+// cached local time.
+void seconds_led_tick(const struct tm *local);
+// After the system clock is set.
+void seconds_led_resync(void);
+void seconds_led_stats(seconds_led_stats_t *out);
+
+#endif // SECONDS_LED_H
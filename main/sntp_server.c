@@ -0,0 +1,267 @@
+#include "sntp_server.h"
+#include "dlog.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "time_utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lwip/sockets.h"
+
+static const char *TAG = "sntp_server";
+
+// Above the display task: the receive timestamp is taken when the task
+// runs, so any wait before that reads as network delay to the client.
+#define SNTP_SERVER_PRIO 6
+// How long the task blocks on the socket before looking at the config and
+// the announcement schedule again.
+#define SNTP_SERVER_WAKE_MS 1000
+#define SNTP_RETRY_MS 5000
+
+#define NTP_UNIX_OFFSET 2208988800ULL // 1900 to 1970, in seconds
+#define NTP_VERSION 4
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_MODE_BROADCAST 5
+// lwIP doesn't pass on the upstream's stratum; pool servers are mostly
+// stratum 2, which makes the leader 3.
+#define NTP_STRATUM 3
+#define NTP_PRECISION -20 // gettimeofday() resolves a microsecond
+#define NTP_POLL_LOG2 6   // 64 s, SNTP_ANNOUNCE_S
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static ntp_cfg_t s_cfg;         // under s_mux
+static bool s_reopen;           // under s_mux: group membership changed
+static TaskHandle_t s_task;
+static sntp_server_stats_t s_stats;
+static int64_t s_leader_heard_us;
+static int64_t s_next_announce_us;
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void put_timestamp(uint8_t *p, int64_t unix_us) {
+    put_u32(p, (uint32_t)(unix_us / 1000000 + NTP_UNIX_OFFSET));
+    put_u32(p + 4, (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000));
+}
+
+// NTP short format: 16.16 seconds.
+static uint32_t short_format(uint32_t us) {
+    return (uint32_t)(((uint64_t)us << 16) / 1000000);
+}
+
+static void fill_header(uint8_t out[SNTP_PACKET_LEN], uint8_t mode, uint8_t version,
+                        const sntp_server_clock_t *clk) {
+    memset(out, 0, SNTP_PACKET_LEN);
+    out[0] = (uint8_t)(version << 3 | mode); // leap indicator 0: synchronized
+    out[1] = NTP_STRATUM;
+    out[2] = NTP_POLL_LOG2;
+    out[3] = (uint8_t)NTP_PRECISION;
+    put_u32(out + 8, short_format(clk->dispersion_us));
+    put_timestamp(out + 16, clk->ref_ms * 1000);
+}
+
+size_t sntp_server_reply(const uint8_t *req, size_t len, const sntp_server_clock_t *clk,
+                         int64_t rx_us, int64_t tx_us, uint8_t out[SNTP_PACKET_LEN]) {
+    uint8_t version = (req[0] >> 3) & 7;
+    if (len < SNTP_PACKET_LEN || (req[0] & 7) != NTP_MODE_CLIENT || version < 1) {
+        return 0;
+    }
+    fill_header(out, NTP_MODE_SERVER, version, clk);
+    out[2] = req[2];                  // the client's poll interval
+    memcpy(out + 24, req + 40, 8);    // originate: the client's transmit time
+    put_timestamp(out + 32, rx_us);
+    put_timestamp(out + 40, tx_us);
+    return SNTP_PACKET_LEN;
+}
+
+static int64_t wall_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// False while the clock isn't fit to hand out.
+static bool leader_clock(sntp_server_clock_t *clk) {
+    int64_t sync_us, ref_ms;
+    if (!time_utils_last_sync(&sync_us, &ref_ms)) {
+        return false;
+    }
+    int64_t age_us = esp_timer_get_time() - sync_us;
+    if (age_us > SNTP_HOLDOVER_S * 1000000LL) {
+        return false;
+    }
+    clk->ref_ms = ref_ms;
+    clk->dispersion_us = (uint32_t)(age_us / 1000000 * SNTP_DRIFT_PPM);
+    return true;
+}
+
+static int open_socket(const ntp_cfg_t *cfg) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(SNTP_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct timeval timeout = { .tv_sec = SNTP_SERVER_WAKE_MS / 1000 };
+    uint8_t ttl = 1;   // announcements stay on the LAN
+    uint8_t loop = 0;  // and don't come back to this clock
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0) {
+        ESP_LOGE(TAG, "Cannot open UDP %d", SNTP_SERVER_PORT);
+        close(sock);
+        return -1;
+    }
+    if (cfg->follow) {
+        struct ip_mreq mreq = {
+            .imr_multiaddr.s_addr = inet_addr(SNTP_MULTICAST_GROUP),
+            .imr_interface.s_addr = htonl(INADDR_ANY),
+        };
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    return sock;
+}
+
+static void answer(int sock, const uint8_t *req, size_t len, const struct sockaddr_in *from,
+                   int64_t rx_us, int64_t start_us) {
+    s_stats.requests++;
+    sntp_server_clock_t clk;
+    if (!leader_clock(&clk)) {
+        s_stats.unsynced++;
+        return;
+    }
+    uint8_t out[SNTP_PACKET_LEN];
+    if (sntp_server_reply(req, len, &clk, rx_us, wall_us(), out) == 0) {
+        return;
+    }
+    sendto(sock, out, sizeof(out), 0, (const struct sockaddr *)from, sizeof(*from));
+    s_stats.replies++;
+    metrics_record(METRIC_SNTP_SERVE_US, (uint32_t)(esp_timer_get_time() - start_us));
+}
+
+// False, and nothing sent, while the clock isn't synchronized.
+static bool announce(int sock) {
+    sntp_server_clock_t clk;
+    if (!leader_clock(&clk)) {
+        return false;
+    }
+    uint8_t out[SNTP_PACKET_LEN];
+    fill_header(out, NTP_MODE_BROADCAST, NTP_VERSION, &clk);
+    put_timestamp(out + 40, wall_us());
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(SNTP_SERVER_PORT),
+        .sin_addr.s_addr = inet_addr(SNTP_MULTICAST_GROUP),
+    };
+    sendto(sock, out, sizeof(out), 0, (const struct sockaddr *)&to, sizeof(to));
+    s_stats.announcements++;
+    return true;
+}
+
+static void follow(uint32_t addr) {
+    int64_t now = esp_timer_get_time();
+    if (addr == s_stats.leader) {
+        s_leader_heard_us = now;
+        return;
+    }
+    if (s_stats.leader && now - s_leader_heard_us < SNTP_LEADER_TIMEOUT_S * 1000000LL) {
+        return; // another leader; stay with the one already followed
+    }
+    s_stats.leader = addr;
+    s_leader_heard_us = now;
+    const uint8_t *b = (const uint8_t *)&addr;
+    char name[16];
+    snprintf(name, sizeof(name), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    DLOGI(TAG, "Following %s", name);
+    time_utils_set_sntp_server(name);
+}
+
+static void sntp_server_task(void *arg) {
+    int sock = -1;
+    uint8_t buf[SNTP_PACKET_LEN + 20]; // room for a key ID and MAC
+    for (;;) {
+        portENTER_CRITICAL(&s_mux);
+        ntp_cfg_t cfg = s_cfg;
+        bool reopen = s_reopen;
+        s_reopen = false;
+        portEXIT_CRITICAL(&s_mux);
+        if (cfg.follow) {
+            cfg.serve = cfg.announce = false;
+        }
+
+        if (sock >= 0 && (reopen || (!cfg.serve && !cfg.follow))) {
+            close(sock);
+            sock = -1;
+        }
+        if (!cfg.serve && !cfg.follow) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (sock < 0 && (sock = open_socket(&cfg)) < 0) {
+            vTaskDelay(pdMS_TO_TICKS(SNTP_RETRY_MS));
+            continue;
+        }
+        if (cfg.serve && cfg.announce && esp_timer_get_time() >= s_next_announce_us && announce(sock)) {
+            s_next_announce_us = esp_timer_get_time() + SNTP_ANNOUNCE_S * 1000000LL;
+        }
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (n < SNTP_PACKET_LEN) {
+            continue; // woken to look around, or a runt
+        }
+        int64_t start_us = esp_timer_get_time();
+        int64_t rx_us = wall_us();
+        uint8_t mode = buf[0] & 7;
+        if (mode == NTP_MODE_CLIENT && cfg.serve) {
+            answer(sock, buf, n, &from, rx_us, start_us);
+        } else if (mode == NTP_MODE_BROADCAST && cfg.follow) {
+            follow(from.sin_addr.s_addr);
+        }
+    }
+}
+
+void sntp_server_configure(const ntp_cfg_t *cfg) {
+    portENTER_CRITICAL(&s_mux);
+    if (cfg->follow != s_cfg.follow) {
+        s_reopen = true;
+    }
+    if (cfg->announce && !s_cfg.announce) {
+        s_next_announce_us = 0; // announce straight away
+    }
+    s_cfg = *cfg;
+    portEXIT_CRITICAL(&s_mux);
+
+    if (cfg->follow && cfg->serve) {
+        ESP_LOGW(TAG, "Following a leader; not serving or announcing");
+    }
+    if (!cfg->follow) {
+        s_stats.leader = 0;
+        time_utils_set_sntp_server(cfg->server);
+    }
+    if (s_task) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void sntp_server_init(const ntp_cfg_t *cfg) {
+    sntp_server_configure(cfg);
+    xTaskCreate(sntp_server_task, "sntp_server", 3072, NULL, SNTP_SERVER_PRIO, &s_task);
+}
+
+void sntp_server_stats(sntp_server_stats_t *out) {
+    *out = s_stats;
+}
@@ -0,0 +1,55 @@
+#ifndef SNTP_SERVER_H
+#define SNTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config_store.h"
+
+// LAN time distribution. One clock, the leader, answers SNTP (RFC 4330)
+// on UDP 123 from its SNTP-disciplined system clock. The others poll it
+// instead of pool.ntp.org, either at its address in ntp_cfg_t.server or,
+// with follow, wherever they hear a leader announce itself on the NTP
+// multicast group. Announcements are broadcast-mode NTP packets, but a
+// follower only takes the leader's address from them: polling measures
+// the round trip, which listening to broadcasts can't. A follower never
+// serves or announces, even if its stored config says so, so followers
+// can't end up syncing from each other and only the leader's stratum is
+// ever handed out.
+#define SNTP_SERVER_PORT 123
+#define SNTP_MULTICAST_GROUP "224.0.1.1"
+#define SNTP_ANNOUNCE_S 64
+// A follower moves to another leader once its own has been silent this long.
+#define SNTP_LEADER_TIMEOUT_S (3 * SNTP_ANNOUNCE_S)
+// The leader stays silent until SNTP has set its clock and once the last
+// sync is this old, so nobody takes time from a clock that is off.
+#define SNTP_HOLDOVER_S (6 * 3600)
+// Crystal tolerance behind the root dispersion since the last sync.
+#define SNTP_DRIFT_PPM 20
+#define SNTP_PACKET_LEN 48
+
+// Written only by the server task.
+typedef struct {
+    uint32_t requests;       // client requests received
+    uint32_t replies;
+    uint32_t unsynced;       // requests ignored while not synchronized
+    uint32_t announcements;  // sent
+    uint32_t leader;         // address followed, network byte order; 0 = none
+} sntp_server_stats_t;
+
+// The leader's clock as a reply describes it.
+typedef struct {
+    int64_t ref_ms;          // last upstream sync, ms since the epoch
+    uint32_t dispersion_us;  // root dispersion
+} sntp_server_clock_t;
+
+void sntp_server_init(const ntp_cfg_t *cfg);
+void sntp_server_configure(const ntp_cfg_t *cfg);
+void sntp_server_stats(sntp_server_stats_t *out);
+
+// Builds the reply to a client request received at rx_us and sent at
+// tx_us, both microseconds since the epoch. Returns SNTP_PACKET_LEN, or 0
+// if req isn't a client request.
+size_t sntp_server_reply(const uint8_t *req, size_t len, const sntp_server_clock_t *clk,
+                         int64_t rx_us, int64_t tx_us, uint8_t out[SNTP_PACKET_LEN]);
+
+#endif // SNTP_SERVER_H
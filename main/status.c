@@ -0,0 +1,90 @@
+#include "status.h"
+#include "esp_timer.h"
+#include "app_state.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Double buffer guarded by a sequence counter. The writer fills the buffer
+// that readers are not pointed at and then bumps the counter; the low bit of
+// the counter selects the live buffer. A reader retries only if a publish
+// landed while it was copying, which at 1 Hz practically never happens.
+static status_snapshot_t s_buf[2];
+static atomic_uint s_seq;
+
+static void status_format_json(status_snapshot_t *s) {
+    char alarm[8] = "--:--";
+    if (s->alarm_hour >= 0) {
+        snprintf(alarm, sizeof(alarm), "%02u:%02u", (unsigned)s->alarm_hour % 24, (unsigned)s->alarm_minute % 60);
+    }
+    int n = snprintf(s->json, sizeof(s->json),
+                     "{\"time\":\"%02d:%02d:%02d\",\"date\":\"%04d-%02d-%02d\",\"epoch\":%lld,"
+                     "\"alarm\":\"%s\",\"alarm_triggered\":%s,"
+                     "\"tz\":\"%+03d:%02d\",\"sta_connected\":%s,\"ap_clients\":%d,"
+                     "\"uptime\":%lld}",
+                     s->local.tm_hour, s->local.tm_min, s->local.tm_sec,
+                     s->local.tm_year + 1900, s->local.tm_mon + 1, s->local.tm_mday,
+                     (long long)s->now,
+                     alarm, s->alarm_triggered ? "true" : "false",
+                     s->timezone_hours, abs(s->timezone_minutes),
+                     s->wifi_sta_connected ? "true" : "false", s->ap_client_count,
+                     (long long)(s->uptime_us / 1000000));
+    s->json_len = (n < 0) ? 0 : ((size_t)n >= sizeof(s->json) ? sizeof(s->json) - 1 : (size_t)n);
+}
+
+void status_publish(const struct tm *local, time_t now) {
+    unsigned seq = atomic_load_explicit(&s_seq, memory_order_relaxed) + 1;
+    status_snapshot_t *s = &s_buf[seq & 1];
+
+    s->seq = seq;
+    s->now = now;
+    s->local = *local;
+    app_state_t state;
+    app_state_read(&state);
+    s->alarm_hour = state.alarm.next_hour;
+    s->alarm_minute = state.alarm.next_minute;
+    s->alarm_triggered = state.alarm.triggered;
+    s->timezone_hours = state.tz.hours;
+    s->timezone_minutes = state.tz.minutes;
+    s->wifi_sta_connected = state.wifi.sta_connected;
+    s->ap_client_count = state.wifi.ap_clients;
+    s->uptime_us = esp_timer_get_time();
+    status_format_json(s);
+
+    atomic_store_explicit(&s_seq, seq, memory_order_release);
+}
+
+bool status_read(status_snapshot_t *out) {
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&s_seq, memory_order_acquire);
+        if (seq == 0) {
+            return false; // nothing published yet
+        }
+        memcpy(out, &s_buf[seq & 1], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s_seq, memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+}
+
+size_t status_read_json(char *buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    for (;;) {
+        unsigned seq = atomic_load_explicit(&s_seq, memory_order_acquire);
+        if (seq == 0) {
+            buf[0] = '\0';
+            return 0;
+        }
+        const status_snapshot_t *s = &s_buf[seq & 1];
+        size_t n = s->json_len < len - 1 ? s->json_len : len - 1;
+        memcpy(buf, s->json, n);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s_seq, memory_order_relaxed) == seq) {
+            buf[n] = '\0';
+            return n;
+        }
+    }
+}
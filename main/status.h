@@ -0,0 +1,36 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define STATUS_JSON_MAX 256
+
+// Immutable view of the clock state, rebuilt once per tick by the
+// timekeeping loop. HTTP handlers only ever read a copy of it.
+typedef struct {
+    uint32_t seq;
+    time_t now;
+    struct tm local;
+    int alarm_hour;
+    int alarm_minute;
+    bool alarm_triggered;
+    int timezone_hours;
+    int timezone_minutes;
+    bool wifi_sta_connected;
+    int ap_client_count;
+    int64_t uptime_us;
+    size_t json_len;
+    char json[STATUS_JSON_MAX];
+} status_snapshot_t;
+
+// Writer side: called from the timekeeping loop only (single writer).
+void status_publish(const struct tm *local, time_t now);
+
+// Reader side: lock-free, safe from any task or core.
+bool status_read(status_snapshot_t *out);
+size_t status_read_json(char *buf, size_t len);
+
+#endif // STATUS_H
@@ -1,15 +1,48 @@
 #include "time_utils.h"
 #include "esp_sntp.h"
 #include "esp_log.h"
+#include "dlog.h"
 #include <string.h>
 #include <sys/time.h>
 #include "app_config.h"
+#include "app_state.h"
+#include "config_store.h"
+#include "metrics.h"
+#include "seconds_led.h"
+#include "trace.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 
 static const char *TAG = "TIME_UTILS";
 struct tm current_time;
 
+static int64_t s_sntp_start_us;
+static int64_t s_last_sync_us;
+static int64_t s_last_sync_ms;  // SNTP time at the last sync, ms since epoch
+// The sync callback runs in lwIP's task; sntp_server.c reads the pair.
+static portMUX_TYPE s_sync_mux = portMUX_INITIALIZER_UNLOCKED;
+// lwIP keeps the pointer, not a copy.
+static char s_sntp_server[CONFIG_NTP_SERVER_MAX] = TIME_UTILS_DEFAULT_SNTP_SERVER;
+
+// esp_sntp doesn't expose per-request round trips, so the first sync is
+// timed from start (DNS, request and reply), and each later one by how far
+// the local clock had drifted from the SNTP time it is being set to.
 static void time_sync_notification_cb(struct timeval *tv) {
-    ESP_LOGI(TAG, "Notification of a time synchronization event");
+    int64_t now_us = esp_timer_get_time();
+    int64_t sntp_ms = (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    trace_instant(TRACE_ID_SNTP_SYNC, 0);
+    if (s_last_sync_us == 0) {
+        metrics_record(METRIC_SNTP_SYNC_MS, (uint32_t)((now_us - s_sntp_start_us) / 1000));
+    } else {
+        int64_t expected_ms = s_last_sync_ms + (now_us - s_last_sync_us) / 1000;
+        metrics_set_sntp_offset((int32_t)(sntp_ms - expected_ms));
+    }
+    portENTER_CRITICAL(&s_sync_mux);
+    s_last_sync_us = now_us;
+    s_last_sync_ms = sntp_ms;
+    portEXIT_CRITICAL(&s_sync_mux);
+    seconds_led_resync();
+    DLOGI(TAG, "Notification of a time synchronization event");
 }
 
 void sync_time(void) {
@@ -19,7 +52,7 @@ void sync_time(void) {
     int retry = 0;
     const int retry_count = 10;
     while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
+        DLOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
         vTaskDelay(2000 / portTICK_PERIOD_MS);
     }
     time(&now);
@@ -33,13 +66,48 @@ void update_time(void) {
 }
 
 void time_utils_init_sntp(void) {
-    ESP_LOGI(TAG, "Initializing SNTP");
+    if (esp_sntp_enabled()) {
+        return; // already polling; called again on every reconnect
+    }
+    DLOGI(TAG, "Initializing SNTP");
     esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, "pool.ntp.org");
+    esp_sntp_setservername(0, s_sntp_server);
     esp_sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+    s_sntp_start_us = esp_timer_get_time();
     esp_sntp_init();
 }
 
+void time_utils_set_sntp_server(const char *server) {
+    const char *name = server && server[0] ? server : TIME_UTILS_DEFAULT_SNTP_SERVER;
+    if (strcmp(name, s_sntp_server) == 0) {
+        return;
+    }
+    bool running = esp_sntp_enabled();
+    if (running) {
+        esp_sntp_stop();
+    }
+    strlcpy(s_sntp_server, name, sizeof(s_sntp_server));
+    DLOGI(TAG, "SNTP server %s", s_sntp_server);
+    if (running) {
+        time_utils_init_sntp();
+    }
+}
+
+bool time_utils_last_sync(int64_t *mono_us, int64_t *epoch_ms) {
+    portENTER_CRITICAL(&s_sync_mux);
+    *mono_us = s_last_sync_us;
+    *epoch_ms = s_last_sync_ms;
+    portEXIT_CRITICAL(&s_sync_mux);
+    return *mono_us != 0;
+}
+
+void time_utils_resume_sync(int64_t age_us, int64_t now_us) {
+    portENTER_CRITICAL(&s_sync_mux);
+    s_last_sync_us = esp_timer_get_time() - age_us;
+    s_last_sync_ms = (now_us - age_us) / 1000;
+    portEXIT_CRITICAL(&s_sync_mux);
+}
+
 void time_utils_obtain_time(void) {
     time_utils_init_sntp();
     // wait for time to be set
@@ -48,17 +116,40 @@ void time_utils_obtain_time(void) {
     int retry = 0;
     const int retry_count = 10;
     while (esp_sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
+        DLOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
         vTaskDelay(2000 / portTICK_PERIOD_MS);
     }
     time(&now);
     localtime_r(&now, &timeinfo);
 }
 
+// POSIX TZ offsets are west-positive ("IST-5:30" is UTC+5:30), so the sign
+// is flipped to get the displayed UTC offset.
+static void time_utils_parse_tz_offset(const char* tzid) {
+    const char *p = tzid;
+    while (*p && !(*p == '+' || *p == '-' || (*p >= '0' && *p <= '9'))) {
+        p++;
+    }
+    int sign = 1;
+    if (*p == '+' || *p == '-') {
+        sign = (*p == '-') ? -1 : 1;
+        p++;
+    }
+    int hours = 0, minutes = 0;
+    if (sscanf(p, "%d:%d", &hours, &minutes) < 1) {
+        hours = 0;
+    }
+    app_tz_state_t *tz = &app_state_begin()->tz;
+    tz->hours = -sign * hours;
+    tz->minutes = -sign * minutes;
+    app_state_commit();
+}
+
 void time_utils_set_system_time(const char* tzid) {
     setenv("TZ", tzid, 1);
     tzset();
-    ESP_LOGI(TAG, "Timezone set to: %s", tzid);
+    time_utils_parse_tz_offset(tzid);
+    DLOGI(TAG, "Timezone set to: %s", tzid);
 }
 
 void time_utils_set_time_from_string(const char* time_str) {
@@ -79,6 +170,7 @@ void time_utils_set_time_from_string(const char* time_str) {
         time_t new_time = mktime(now);
         struct timeval tv = { .tv_sec = new_time, .tv_usec = 0 };
         settimeofday(&tv, NULL);
-        ESP_LOGI(TAG, "Time set to: %02d:%02d", tm.tm_hour, tm.tm_min);
+        seconds_led_resync();
+        DLOGI(TAG, "Time set to: %02d:%02d", tm.tm_hour, tm.tm_min);
     }
 }
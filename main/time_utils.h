@@ -1,11 +1,24 @@
 #ifndef TIME_UTILS_H
 #define TIME_UTILS_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
+#define TIME_UTILS_DEFAULT_SNTP_SERVER "pool.ntp.org"
+
 void sync_time(void);
 void update_time(void);
 void time_utils_init_sntp(void);
+// Where SNTP polls, a host name or address; NULL or "" for the default.
+// Takes effect at once if SNTP is already running.
+void time_utils_set_sntp_server(const char *server);
+// When SNTP last set the clock: esp_timer time and the time it was set to,
+// in ms since the epoch. False if it hasn't yet.
+bool time_utils_last_sync(int64_t *mono_us, int64_t *epoch_ms);
+// After a warm restart: the clock was last synced age_us before now_us
+// (system clock), as the previous boot recorded it.
+void time_utils_resume_sync(int64_t age_us, int64_t now_us);
 void time_utils_obtain_time(void);
 void time_utils_set_system_time(const char* tzid);
 void time_utils_set_time_from_string(const char* time_str);
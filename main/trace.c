@@ -0,0 +1,130 @@
+#include "trace.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Dump format, little-endian, read by tools/trace2chrome.py:
+//   header   trace_dump_header_t
+//   tasks    task_count x { u32 handle, char name[16] }
+//   ids      id_count x char name[16], indexed by trace_id_t
+//   events   min(recorded, capacity) x trace_event_t, oldest first
+// Event timestamps are the low 32 bits of esp_timer_get_time(); the tool
+// unwraps them against now_us.
+#define TRACE_MAGIC 0x31435254 // "TRC1"
+
+typedef struct {
+    uint32_t ts_us;
+    uint8_t type;
+    uint8_t core;
+    uint16_t id;
+    uint32_t arg;
+} trace_event_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t recorded;
+    uint32_t capacity;
+    uint16_t task_count;
+    uint16_t id_count;
+    uint64_t now_us;
+} trace_dump_header_t;
+
+typedef struct {
+    uint32_t handle;
+    char name[TRACE_NAME_LEN];
+} trace_task_t;
+
+_Static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be a power of two");
+_Static_assert(sizeof(trace_event_t) == 12, "dump format");
+
+static const char s_id_names[TRACE_ID_COUNT][TRACE_NAME_LEN] = {
+    [TRACE_ID_RENDER] = "render frame",
+    [TRACE_ID_SPI_FLUSH] = "SPI flush",
+    [TRACE_ID_HTTP] = "HTTP request",
+    [TRACE_ID_CONFIG_SAVE] = "config save",
+    [TRACE_ID_SNTP_SYNC] = "SNTP sync",
+    [TRACE_ID_WIFI_EVENT] = "Wi-Fi event",
+    [TRACE_ID_BUTTON_ISR] = "button ISR",
+    [TRACE_ID_TICK_ISR] = "tick ISR",
+};
+
+// A writer claims a slot with one atomic add and fills it in; no locks, so
+// two cores, the scheduler and ISRs can all record at once. The ring and
+// the task table live in DRAM, and everything on the recording path is in
+// IRAM, because the scheduler also switches while the flash cache is off.
+static DRAM_ATTR trace_event_t s_ring[TRACE_EVENTS];
+static DRAM_ATTR trace_task_t s_tasks[TRACE_MAX_TASKS];
+static atomic_uint s_head;
+static atomic_uint s_task_count;
+static atomic_bool s_paused;
+
+void IRAM_ATTR trace_record(trace_event_type_t type, trace_id_t id, uint32_t arg) {
+    if (atomic_load_explicit(&s_paused, memory_order_relaxed)) {
+        return;
+    }
+    unsigned slot = atomic_fetch_add_explicit(&s_head, 1, memory_order_relaxed) & (TRACE_EVENTS - 1);
+    trace_event_t *ev = &s_ring[slot];
+    ev->ts_us = (uint32_t)esp_timer_get_time();
+    ev->type = type;
+    ev->core = xPortGetCoreID();
+    ev->id = id;
+    ev->arg = arg;
+}
+
+void IRAM_ATTR trace_task_switched_in(void) {
+    trace_record(TRACE_EV_TASK_IN, 0, (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle());
+}
+
+void IRAM_ATTR trace_task_created(void *handle, const char *name) {
+    unsigned i = atomic_fetch_add_explicit(&s_task_count, 1, memory_order_relaxed);
+    if (i >= TRACE_MAX_TASKS) {
+        atomic_store_explicit(&s_task_count, TRACE_MAX_TASKS, memory_order_relaxed);
+        return;
+    }
+    trace_task_t *t = &s_tasks[i];
+    t->handle = (uint32_t)(uintptr_t)handle;
+    int n = 0;
+    for (; n < TRACE_NAME_LEN - 1 && name[n]; n++) {
+        t->name[n] = name[n];
+    }
+    t->name[n] = '\0';
+}
+
+void IRAM_ATTR trace_tick_isr(int enter) {
+    trace_record(enter ? TRACE_EV_ISR_ENTER : TRACE_EV_ISR_EXIT, TRACE_ID_TICK_ISR, 0);
+}
+
+void trace_dump(trace_emit_t emit, void *ctx) {
+    atomic_store(&s_paused, true);
+    unsigned head = atomic_load(&s_head);
+    unsigned tasks = atomic_load(&s_task_count);
+    if (tasks > TRACE_MAX_TASKS) {
+        tasks = TRACE_MAX_TASKS;
+    }
+
+    trace_dump_header_t hdr = {
+        .magic = TRACE_MAGIC,
+        .recorded = head,
+        .capacity = TRACE_EVENTS,
+        .task_count = tasks,
+        .id_count = TRACE_ID_COUNT,
+        .now_us = (uint64_t)esp_timer_get_time(),
+    };
+    emit(ctx, (const char *)&hdr, sizeof(hdr));
+    emit(ctx, (const char *)s_tasks, tasks * sizeof(s_tasks[0]));
+    emit(ctx, (const char *)s_id_names, sizeof(s_id_names));
+
+    // Oldest first: once the ring has wrapped, that is the slot head points at.
+    if (head > TRACE_EVENTS) {
+        unsigned start = head & (TRACE_EVENTS - 1);
+        emit(ctx, (const char *)&s_ring[start], (TRACE_EVENTS - start) * sizeof(trace_event_t));
+        emit(ctx, (const char *)s_ring, start * sizeof(trace_event_t));
+    } else {
+        emit(ctx, (const char *)s_ring, head * sizeof(trace_event_t));
+    }
+    atomic_store(&s_paused, false);
+}
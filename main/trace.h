@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed RAM ring, 12 bytes per event; the oldest events are overwritten.
+#define TRACE_EVENTS     1024
+#define TRACE_NAME_LEN   16
+// Tasks whose names the dump can resolve; later ones show as handles.
+#define TRACE_MAX_TASKS  32
+
+// Span, ISR and instant ids. Add an entry here and a name in trace.c; the
+// dump carries the names, so tools/trace2chrome.py needs no changes.
+typedef enum {
+    TRACE_ID_RENDER,       // span: display_manager_commit()
+    TRACE_ID_SPI_FLUSH,    // span: changed digits out on the bus
+    TRACE_ID_HTTP,         // span: one HTTP handler
+    TRACE_ID_CONFIG_SAVE,  // span: config blob to NVS
+    TRACE_ID_SNTP_SYNC,    // instant
+    TRACE_ID_WIFI_EVENT,   // instant, arg = event id
+    TRACE_ID_BUTTON_ISR,   // isr
+    TRACE_ID_TICK_ISR,     // isr: FreeRTOS tick
+    TRACE_ID_COUNT
+} trace_id_t;
+
+typedef enum {
+    TRACE_EV_TASK_IN = 1,  // arg = task handle now running on core
+    TRACE_EV_ISR_ENTER,
+    TRACE_EV_ISR_EXIT,
+    TRACE_EV_SPAN_BEGIN,
+    TRACE_EV_SPAN_END,
+    TRACE_EV_INSTANT,
+} trace_event_type_t;
+
+// All of these are lock-free and IRAM-resident, so they are safe from the
+// scheduler, from ISRs and with the flash cache disabled.
+void trace_record(trace_event_type_t type, trace_id_t id, uint32_t arg);
+
+static inline void trace_begin(trace_id_t id) {
+    trace_record(TRACE_EV_SPAN_BEGIN, id, 0);
+}
+
+static inline void trace_end(trace_id_t id) {
+    trace_record(TRACE_EV_SPAN_END, id, 0);
+}
+
+static inline void trace_instant(trace_id_t id, uint32_t arg) {
+    trace_record(TRACE_EV_INSTANT, id, arg);
+}
+
+static inline void trace_isr_enter(trace_id_t id) {
+    trace_record(TRACE_EV_ISR_ENTER, id, 0);
+}
+
+static inline void trace_isr_exit(trace_id_t id) {
+    trace_record(TRACE_EV_ISR_EXIT, id, 0);
+}
+
+// Binary dump (format in trace.c). Recording is paused while it runs.
+typedef void (*trace_emit_t)(void *ctx, const char *data, size_t len);
+void trace_dump(trace_emit_t emit, void *ctx);
+
+#endif // TRACE_H
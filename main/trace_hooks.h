@@ -0,0 +1,25 @@
+#ifndef TRACE_HOOKS_H
+#define TRACE_HOOKS_H
+
+// Force-included into the FreeRTOS kernel's C sources by main/CMakeLists.txt
+// so the scheduler reports into trace.c. Nothing else should include it.
+
+#include "sdkconfig.h"
+
+#ifndef CONFIG_APPTRACE_SV_ENABLE // SystemView claims the same hooks
+void trace_task_switched_in(void);
+void trace_task_created(void *handle, const char *name);
+void trace_tick_isr(int enter);
+
+#define traceTASK_SWITCHED_IN() trace_task_switched_in()
+#define traceTASK_CREATE(pxNewTCB) trace_task_created((pxNewTCB), (pxNewTCB)->pcTaskName)
+// The tick fires on both cores at CONFIG_FREERTOS_HZ, which at the default
+// 100 Hz is ~400 events/s and most of the ring; opt in when chasing it.
+#ifdef TRACE_TICK_ISR
+#define traceISR_ENTER(id) trace_tick_isr(1)
+#define traceISR_EXIT() trace_tick_isr(0)
+#define traceISR_EXIT_TO_SCHEDULER() trace_tick_isr(0)
+#endif
+#endif
+
+#endif // TRACE_HOOKS_H
@@ -0,0 +1,115 @@
+#include "transition.h"
+#include <string.h>
+
+// Segment bits as the MAX7219 takes them with decoding off.
+#define SEG_A 0x40
+#define SEG_B 0x20
+#define SEG_C 0x10
+#define SEG_D 0x08
+#define SEG_E 0x04
+#define SEG_F 0x02
+#define SEG_G 0x01
+#define SEG_DP 0x80
+
+// Columns for the wipe, left to right.
+#define COL_LEFT (SEG_E | SEG_F)
+#define COL_MID (SEG_A | SEG_G | SEG_D)
+#define COL_RIGHT (SEG_B | SEG_C)
+
+static const char *const s_names[TRANSITION_STYLE_COUNT] = {
+    [TRANSITION_NONE] = "none",
+    [TRANSITION_ROLL] = "roll",
+    [TRANSITION_WIPE] = "wipe",
+    [TRANSITION_MORPH] = "morph",
+};
+
+// A seven-segment glyph has three rows (A, G, D) with the verticals between
+// them; moving it by a row moves each segment to the one above or below.
+static uint8_t seg_up(uint8_t g) {
+    return ((g & SEG_G) ? SEG_A : 0) | ((g & SEG_D) ? SEG_G : 0) |
+           ((g & SEG_E) ? SEG_F : 0) | ((g & SEG_C) ? SEG_B : 0);
+}
+
+static uint8_t seg_down(uint8_t g) {
+    return ((g & SEG_A) ? SEG_G : 0) | ((g & SEG_G) ? SEG_D : 0) |
+           ((g & SEG_F) ? SEG_E : 0) | ((g & SEG_B) ? SEG_C : 0);
+}
+
+// Fills steps[] with one digit's intermediate glyphs, without the decimal
+// point, ending on the new one; returns how many there are.
+static int digit_steps(transition_style_t style, uint8_t from, uint8_t to,
+                       uint8_t steps[TRANSITION_MAX_FRAMES]) {
+    int n = 0;
+    switch (style) {
+    case TRANSITION_ROLL:
+        steps[n++] = seg_up(from);
+        steps[n++] = seg_up(seg_up(from));
+        steps[n++] = seg_down(seg_down(to));
+        steps[n++] = seg_down(to);
+        break;
+    case TRANSITION_WIPE:
+        steps[n++] = from & (COL_MID | COL_RIGHT);
+        steps[n++] = from & COL_RIGHT;
+        steps[n++] = 0;
+        steps[n++] = to & COL_LEFT;
+        steps[n++] = to & (COL_LEFT | COL_MID);
+        break;
+    case TRANSITION_MORPH: {
+        uint8_t cur = from;
+        for (uint8_t bit = SEG_A; bit; bit >>= 1) {
+            if ((from & ~to) & bit) {
+                cur &= ~bit;
+                steps[n++] = cur;
+            }
+        }
+        for (uint8_t bit = SEG_A; bit; bit >>= 1) {
+            if ((to & ~from) & bit) {
+                cur |= bit;
+                steps[n++] = cur;
+            }
+        }
+        return n; // the last step is already the new glyph
+    }
+    default:
+        return 0;
+    }
+    steps[n++] = to;
+    return n;
+}
+
+int transition_plan(transition_style_t style, const uint8_t from[MAX7219_DIGITS],
+                    const uint8_t to[MAX7219_DIGITS], transition_plan_t *out) {
+    out->count = 0;
+    if (style == TRANSITION_NONE || style >= TRANSITION_STYLE_COUNT) {
+        return 0;
+    }
+    uint8_t steps[TRANSITION_MAX_FRAMES];
+    for (int d = 0; d < MAX7219_DIGITS; d++) {
+        int n = 0;
+        if (from[d] != to[d]) {
+            n = digit_steps(style, from[d] & ~SEG_DP, to[d] & ~SEG_DP, steps);
+        }
+        // A digit that finishes early, or never moves, holds the target.
+        for (int f = 0; f < TRANSITION_MAX_FRAMES; f++) {
+            out->frames[f][d] = f < n ? (steps[f] | (to[d] & SEG_DP)) : to[d];
+        }
+        if (n > out->count) {
+            out->count = n;
+        }
+    }
+    return out->count;
+}
+
+const char *transition_style_name(transition_style_t style) {
+    return style < TRANSITION_STYLE_COUNT ? s_names[style] : "none";
+}
+
+bool transition_style_parse(const char *name, transition_style_t *out) {
+    for (int i = 0; i < TRANSITION_STYLE_COUNT; i++) {
+        if (strcmp(name, s_names[i]) == 0) {
+            *out = (transition_style_t)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "max7219.h"
+
+// Keyframe rate while a transition plays; each keyframe is shown for one
+// period, so a roll takes 5 frames (100 ms) and a morph at most 14.
+#define TRANSITION_FPS 50
+#define TRANSITION_MAX_FRAMES 14
+
+typedef enum {
+    TRANSITION_NONE,  // snap to the new glyph
+    TRANSITION_ROLL,  // old glyph rolls up and out, new one in from below
+    TRANSITION_WIPE,  // left to right: old columns off, then new ones on
+    TRANSITION_MORPH, // segments only in the old glyph go out one by one,
+                      // then those only in the new one come in
+    TRANSITION_STYLE_COUNT
+} transition_style_t;
+
+// Frames to show in order after the current one; the last equals the
+// target. Digits that don't change hold their value in every frame, so
+// the shadow-diffed writer only sends the ones that are moving.
+typedef struct {
+    uint8_t count;
+    uint8_t frames[TRANSITION_MAX_FRAMES][MAX7219_DIGITS];
+} transition_plan_t;
+
+// Returns the number of frames; 0 if style is NONE or nothing changes.
+int transition_plan(transition_style_t style, const uint8_t from[MAX7219_DIGITS],
+                    const uint8_t to[MAX7219_DIGITS], transition_plan_t *out);
+
+const char *transition_style_name(transition_style_t style);
+// Accepts the names transition_style_name() returns.
+bool transition_style_parse(const char *name, transition_style_t *out);
+
+#endif // TRANSITION_H
@@ -0,0 +1,116 @@
+#include "warm_start.h"
+#include "display_manager.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_rtc_time.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "time_utils.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "warm_start";
+
+#define WARM_START_MAGIC 0x57524d53 // "WRMS"
+// Bump whenever warm_state_t changes, even when its size doesn't (a field
+// reordered or given another meaning): the size alone can't tell.
+#define WARM_START_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;        // WARM_START_VERSION of the firmware that saved it
+    uint32_t size;           // sizeof(warm_state_t) of the firmware that saved it
+    warm_state_t state;
+    uint32_t crc;            // over everything above
+} warm_record_t;
+
+// Only the main task writes the record. wifi_manager hands its copy over
+// through s_wifi.
+static RTC_NOINIT_ATTR warm_record_t s_record;
+static portMUX_TYPE s_wifi_mux = portMUX_INITIALIZER_UNLOCKED;
+static wifi_cache_t s_wifi;  // under s_wifi_mux
+
+static uint32_t warm_crc(const warm_record_t *rec) {
+    return esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(warm_record_t, crc));
+}
+
+static bool warm_reset(esp_reset_reason_t reason) {
+    switch (reason) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool warm_start_restore(warm_state_t *out) {
+    esp_reset_reason_t reason = esp_reset_reason();
+    warm_record_t rec = s_record;
+    memset(&s_record, 0, sizeof(s_record));
+    if (!warm_reset(reason)) {
+        return false;
+    }
+    if (rec.magic != WARM_START_MAGIC || rec.version != WARM_START_VERSION ||
+        rec.size != sizeof(rec.state) || rec.crc != warm_crc(&rec)) {
+        ESP_LOGW(TAG, "Reset %d without a valid saved state, cold start", reason);
+        return false;
+    }
+    int64_t down_us = (int64_t)esp_rtc_get_time_us() - rec.state.rtc_us;
+    if (down_us < 0) {
+        return false; // the RTC timer restarted too, so the time can't be carried
+    }
+
+    *out = rec.state;
+    s_wifi = rec.state.wifi;
+    out->wall_us += down_us;
+    struct timeval tv = { .tv_sec = out->wall_us / 1000000, .tv_usec = out->wall_us % 1000000 };
+    settimeofday(&tv, NULL);
+    if (out->sync_age_us >= 0) {
+        out->sync_age_us += down_us;
+        time_utils_resume_sync(out->sync_age_us, out->wall_us);
+    }
+    ESP_LOGI(TAG, "Warm start after reset %d, down %lld ms, last sync %lld s before",
+             reason, (long long)(down_us / 1000),
+             (long long)(out->sync_age_us >= 0 ? out->sync_age_us / 1000000 : -1));
+    return true;
+}
+
+void warm_start_save(void) {
+    warm_state_t st = { .sync_age_us = -1 };
+    portENTER_CRITICAL(&s_wifi_mux);
+    st.wifi = s_wifi;
+    portEXIT_CRITICAL(&s_wifi_mux);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    st.wall_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    st.rtc_us = (int64_t)esp_rtc_get_time_us();
+    int64_t sync_us, sync_ms;
+    if (time_utils_last_sync(&sync_us, &sync_ms)) {
+        st.sync_age_us = esp_timer_get_time() - sync_us;
+    }
+    display_load_t load;
+    display_manager_get_load(&load);
+    st.intensity = load.intensity;
+    display_manager_get_frame(st.frame);
+
+    // A reset can land mid-copy; the CRC then fails and the next boot is
+    // cold, which is no worse than before.
+    s_record.magic = WARM_START_MAGIC;
+    s_record.version = WARM_START_VERSION;
+    s_record.size = sizeof(st);
+    s_record.state = st;
+    s_record.crc = warm_crc(&s_record);
+}
+
+void warm_start_set_wifi(const wifi_cache_t *cache) {
+    portENTER_CRITICAL(&s_wifi_mux);
+    s_wifi = *cache;
+    portEXIT_CRITICAL(&s_wifi_mux);
+}
@@ -0,0 +1,34 @@
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config_store.h"
+#include "max7219.h"
+
+// State carried across a software or watchdog reset in RTC slow memory,
+// so the clock comes back showing the right time instead of rerunning a
+// cold boot. RTC_NOINIT_ATTR memory keeps its contents through those
+// resets (RTC_DATA_ATTR is reloaded on every boot but a deep-sleep wake);
+// a magic number and CRC reject whatever a power-on left there, and a
+// layout version whatever other firmware saved.
+typedef struct {
+    int64_t wall_us;         // system clock at the last save
+    int64_t rtc_us;          // RTC timer then; it keeps counting through a reset
+    int64_t sync_age_us;     // since the last SNTP sync at that save; -1 = never synced
+    uint8_t frame[MAX7219_DIGITS]; // what the display showed
+    uint8_t intensity;
+    uint8_t reserved[3];
+    wifi_cache_t wifi;       // last association and lease; channel 0 = none
+} warm_state_t;
+
+// True if the last reset kept RTC memory and it holds a valid state,
+// copied to out. Call once, early in app_main.
+bool warm_start_restore(warm_state_t *out);
+// Once per main-loop tick: snapshots the clock and the display.
+void warm_start_save(void);
+// After each association, so a reset before the config blob reaches
+// flash still has the AP for a fast connect.
+void warm_start_set_wifi(const wifi_cache_t *cache);
+
+#endif // WARM_START_H
@@ -1,9 +1,777 @@
 #include "web_server.h"
 #include "esp_log.h"
+#include "status.h"
+#include "config_store.h"
+#include "time_utils.h"
+#include "alarm_engine.h"
+#include "chrono.h"
+#include "display_manager.h"
+#include "display_power.h"
+#include "world_clock.h"
+#include "sntp_server.h"
+#include "ota.h"
+#include "metrics.h"
+#include "trace.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const char *TAG = "web_server";
+static httpd_handle_t server = NULL;
+
+extern const char root_html_start[] asm("_binary_root_html_start");
+extern const char root_html_end[] asm("_binary_root_html_end");
+
+static esp_err_t root_get_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, root_html_start, root_html_end - root_html_start);
+}
+
+// Served straight from the preformatted snapshot: no localtime_r, no
+// formatting and no locks on the request path.
+static esp_err_t status_get_handler(httpd_req_t *req) {
+    char json[STATUS_JSON_MAX];
+    size_t len = status_read_json(json, sizeof(json));
+    if (len == 0) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status not ready");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, json, len);
+}
+
+// Decodes an application/x-www-form-urlencoded value in place.
+static void url_decode(char *s) {
+    char *out = s;
+    while (*s) {
+        if (*s == '+') {
+            *out++ = ' ';
+            s++;
+        } else if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+            char hex[3] = { s[1], s[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            s += 3;
+        } else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+}
+
+// Appends to the json[size] reply holding n bytes and returns the new
+// length. snprintf() reports what it would have written, so a truncated
+// write must not push n past the buffer or the next size - n wraps.
+static size_t json_append(char *json, size_t size, size_t n, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+static size_t json_append(char *json, size_t size, size_t n, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int w = vsnprintf(json + n, size - n, fmt, ap);
+    va_end(ap);
+    if (w > 0) {
+        n = n + w < size ? n + w : size - 1;
+    }
+    return n;
+}
+
+// Copies s into out as the body of a JSON string.
+static void json_escape(const char *s, char *out, size_t len) {
+    size_t n = 0;
+    for (; *s && n + 7 <= len; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = c;
+        } else if (c < 0x20) {
+            n += snprintf(out + n, len - n, "\\u%04x", c);
+        } else {
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+}
+
+static bool form_value(const char *body, const char *key, char *out, size_t len) {
+    if (httpd_query_key_value(body, key, out, len) != ESP_OK) {
+        return false;
+    }
+    url_decode(out);
+    return true;
+}
+
+// The forms edit a copy of the config and hand back only their own
+// section through config_store_modify(), so a Wi-Fi cache or alarm saved
+// in the meantime isn't overwritten by the copy's stale one.
+static void put_settings(clock_config_t *cfg, void *arg) {
+    const clock_config_t *form = arg;
+    memcpy(cfg->wifi_ssid, form->wifi_ssid, sizeof(cfg->wifi_ssid));
+    memcpy(cfg->wifi_password, form->wifi_password, sizeof(cfg->wifi_password));
+    memcpy(cfg->timezone, form->timezone, sizeof(cfg->timezone));
+}
+
+static void put_display(clock_config_t *cfg, void *arg) {
+    const clock_config_t *form = arg;
+    cfg->display_sleep = form->display_sleep;
+    cfg->transition = form->transition;
+}
+
+static void put_world(clock_config_t *cfg, void *arg) {
+    cfg->world_clock = ((const clock_config_t *)arg)->world_clock;
+}
+
+static void put_ntp(clock_config_t *cfg, void *arg) {
+    cfg->ntp = ((const clock_config_t *)arg)->ntp;
+}
+
+static esp_err_t settings_post_handler(httpd_req_t *req) {
+    char body[256];
+    if (req->content_len >= sizeof(body)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Form too large");
+        return ESP_FAIL;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, body + received, req->content_len - received);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                continue;
+            }
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    body[received] = '\0';
+
+    clock_config_t cfg;
+    config_store_get(&cfg);
+
+    char value[64];
+    if (form_value(body, "ssid", value, sizeof(value))) {
+        strlcpy(cfg.wifi_ssid, value, sizeof(cfg.wifi_ssid));
+    }
+    if (form_value(body, "password", value, sizeof(value))) {
+        strlcpy(cfg.wifi_password, value, sizeof(cfg.wifi_password));
+    }
+    if (form_value(body, "timezone", value, sizeof(value)) && value[0] != '\0') {
+        strlcpy(cfg.timezone, value, sizeof(cfg.timezone));
+        time_utils_set_system_time(cfg.timezone);
+    }
+    if (form_value(body, "time", value, sizeof(value)) && value[0] != '\0') {
+        time_utils_set_time_from_string(value);
+    }
+
+    config_store_modify(put_settings, &cfg);
+    // "Save and Restart": persist now rather than waiting out the debounce.
+    config_store_flush();
+
+    httpd_resp_set_type(req, "text/html");
+    httpd_resp_send(req, "<html><body><h2>Saved. Restarting...</h2></body></html>", HTTPD_RESP_USE_STRLEN);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    esp_restart();
+    return ESP_OK;
+}
+
+static esp_err_t alarms_get_handler(httpd_req_t *req) {
+    char json[ALARM_MAX * 64 + 4];
+    size_t n = 0;
+    json[n++] = '[';
+    for (int i = 0; i < ALARM_MAX; i++) {
+        alarm_t a;
+        alarm_engine_get(i, &a);
+        n = json_append(json, sizeof(json), n,
+                        "%s{\"id\":%d,\"time\":\"%02d:%02d\",\"days\":%d,\"enabled\":%s}",
+                        i ? "," : "", i, a.hour, a.minute, a.weekdays, a.enabled ? "true" : "false");
+    }
+    json[n++] = ']';
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, n);
+}
+
+// Form fields: id, time (HH:MM), days (tm_wday bit mask, 0 = once), enabled.
+static esp_err_t alarms_post_handler(httpd_req_t *req) {
+    char body[128];
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    if (len <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty form");
+        return ESP_FAIL;
+    }
+    body[len] = '\0';
+
+    char value[16];
+    int id = -1, hour = -1, minute = -1;
+    alarm_t a = { .weekdays = ALARM_DAYS_DAILY, .enabled = 1 };
+    if (form_value(body, "id", value, sizeof(value))) {
+        id = atoi(value);
+    }
+    if (form_value(body, "time", value, sizeof(value))) {
+        sscanf(value, "%d:%d", &hour, &minute);
+    }
+    if (form_value(body, "days", value, sizeof(value))) {
+        a.weekdays = atoi(value) & ALARM_DAYS_DAILY;
+    }
+    if (form_value(body, "enabled", value, sizeof(value))) {
+        a.enabled = atoi(value) != 0;
+    }
+    // Checked here, before alarm_t's uint8_t fields would wrap 256:00 to 00:00.
+    if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad time");
+        return ESP_FAIL;
+    }
+    a.hour = hour;
+    a.minute = minute;
+    if (!alarm_engine_set(id, &a, time(NULL))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad alarm");
+        return ESP_FAIL;
+    }
+
+    config_store_set_alarm(id, &a);
+    return alarms_get_handler(req);
+}
+
+// Form fields: action = stopwatch|countdown|pause|resume|stop, seconds.
+static esp_err_t chrono_post_handler(httpd_req_t *req) {
+    char body[64];
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    body[len > 0 ? len : 0] = '\0';
+
+    char action[16] = "";
+    char value[16];
+    form_value(body, "action", action, sizeof(action));
+    if (strcmp(action, "stopwatch") == 0) {
+        chrono_stopwatch_start();
+    } else if (strcmp(action, "countdown") == 0 && form_value(body, "seconds", value, sizeof(value))) {
+        chrono_countdown_start((uint32_t)strtoul(value, NULL, 10));
+    } else if (strcmp(action, "pause") == 0) {
+        chrono_pause();
+    } else if (strcmp(action, "resume") == 0) {
+        chrono_resume();
+    } else if (strcmp(action, "stop") == 0) {
+        chrono_stop();
+    } else {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad action");
+        return ESP_FAIL;
+    }
+
+    char json[64];
+    int n = snprintf(json, sizeof(json), "{\"mode\":%d,\"running\":%s,\"value_ms\":%lld}",
+                     chrono_mode(), chrono_running() ? "true" : "false",
+                     (long long)(chrono_value_us() / 1000));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, n);
+}
+
+static esp_err_t display_get_handler(httpd_req_t *req) {
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    display_power_stats_t st;
+    display_power_stats(&st);
+    const display_sleep_t *ds = &cfg.display_sleep;
+
+    char json[224];
+    int n = snprintf(json, sizeof(json),
+                     "{\"quiet\":\"%02u:%02u-%02u:%02u\",\"idle_min\":%u,\"transition\":\"%s\",\"on\":%s,"
+                     "\"current_ua\":%lu,\"today_uah\":%lu,\"yesterday_uah\":%lu,\"today_off_s\":%lu}",
+                     ds->quiet_start / 60, ds->quiet_start % 60, ds->quiet_end / 60, ds->quiet_end % 60,
+                     ds->idle_timeout_min, transition_style_name(cfg.transition), st.on ? "true" : "false",
+                     (unsigned long)st.current_ua, (unsigned long)st.today_uah,
+                     (unsigned long)st.yesterday_uah, (unsigned long)st.today_off_s);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, n);
+}
+
+// Form fields: quiet (HH:MM-HH:MM, equal times disable), idle (minutes, 0 = never).
+static esp_err_t display_post_handler(httpd_req_t *req) {
+    char body[64];
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    body[len > 0 ? len : 0] = '\0';
+
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    display_sleep_t *ds = &cfg.display_sleep;
+    char value[16];
+    if (form_value(body, "quiet", value, sizeof(value))) {
+        int sh, sm, eh, em;
+        if (sscanf(value, "%d:%d-%d:%d", &sh, &sm, &eh, &em) != 4 ||
+            sh < 0 || sh > 23 || sm < 0 || sm > 59 || eh < 0 || eh > 23 || em < 0 || em > 59) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad quiet hours");
+            return ESP_FAIL;
+        }
+        ds->quiet_start = sh * 60 + sm;
+        ds->quiet_end = eh * 60 + em;
+    }
+    if (form_value(body, "idle", value, sizeof(value))) {
+        unsigned long idle = strtoul(value, NULL, 10);
+        ds->idle_timeout_min = idle > UINT16_MAX ? UINT16_MAX : idle;
+    }
+    if (form_value(body, "transition", value, sizeof(value))) {
+        transition_style_t style;
+        if (!transition_style_parse(value, &style)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad transition");
+            return ESP_FAIL;
+        }
+        cfg.transition = style;
+        display_manager_set_transition(style);
+    }
+
+    display_power_configure(ds);
+    config_store_modify(put_display, &cfg);
+    return display_get_handler(req);
+}
+
+static esp_err_t world_get_handler(httpd_req_t *req) {
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    time_t now = time(NULL);
+
+    char json[96 + CONFIG_WORLD_ZONES * (64 + 2 * CONFIG_TZ_MAX)];
+    size_t n = json_append(json, sizeof(json), 0, "{\"dwell\":%u,\"zones\":[", cfg.world_clock.dwell_s);
+    for (int i = 0; i < world_clock_zone_count(); i++) {
+        world_clock_time_t t;
+        if (!world_clock_zone_time(i, now, &t)) {
+            break;
+        }
+        const world_zone_t *z = &cfg.world_clock.zones[t.slot];
+        int off = t.utc_offset_s / 60;
+        char code[CONFIG_ZONE_CODE_MAX * 6], tz[CONFIG_TZ_MAX * 6];
+        json_escape(z->code, code, sizeof(code));
+        json_escape(z->tz, tz, sizeof(tz));
+        n = json_append(json, sizeof(json), n,
+                        "%s{\"code\":\"%s\",\"tz\":\"%s\",\"time\":\"%02u:%02u\",\"utc_offset\":\"%c%02d:%02d\",\"dst\":%s}",
+                        i ? "," : "", code, tz, t.hour, t.minute, off < 0 ? '-' : '+',
+                        abs(off) / 60, abs(off) % 60, t.dst ? "true" : "false");
+    }
+    n = json_append(json, sizeof(json), n, "]}");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, n);
+}
+
+// Form fields: zones (CODE=TZ pairs separated by ';', empty to turn the
+// world clock off), dwell (seconds per zone).
+static esp_err_t world_post_handler(httpd_req_t *req) {
+    char body[384];
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    body[len > 0 ? len : 0] = '\0';
+
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    world_clock_cfg_t *wc = &cfg.world_clock;
+    char value[CONFIG_WORLD_ZONES * (CONFIG_ZONE_CODE_MAX + CONFIG_TZ_MAX) + 8];
+    if (form_value(body, "zones", value, sizeof(value))) {
+        memset(wc->zones, 0, sizeof(wc->zones));
+        int count = 0;
+        char *save;
+        for (char *item = strtok_r(value, ";", &save); item; item = strtok_r(NULL, ";", &save)) {
+            char *eq = strchr(item, '=');
+            if (eq == NULL || eq == item || eq - item >= CONFIG_ZONE_CODE_MAX ||
+                strlen(eq + 1) >= CONFIG_TZ_MAX || count == CONFIG_WORLD_ZONES) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad zone list");
+                return ESP_FAIL;
+            }
+            *eq = '\0';
+            // The display has no glyphs for anything else.
+            for (char *c = item; *c; c++) {
+                *c = toupper((unsigned char)*c);
+                if (!isupper((unsigned char)*c) && !isdigit((unsigned char)*c)) {
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad zone code");
+                    return ESP_FAIL;
+                }
+            }
+            if (!world_clock_valid_tz(eq + 1)) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad TZ string");
+                return ESP_FAIL;
+            }
+            strlcpy(wc->zones[count].code, item, sizeof(wc->zones[count].code));
+            strlcpy(wc->zones[count].tz, eq + 1, sizeof(wc->zones[count].tz));
+            count++;
+        }
+    }
+    if (form_value(body, "dwell", value, sizeof(value))) {
+        unsigned long dwell = strtoul(value, NULL, 10);
+        wc->dwell_s = dwell < WORLD_CLOCK_MIN_DWELL_S ? WORLD_CLOCK_MIN_DWELL_S : dwell > UINT8_MAX ? UINT8_MAX : dwell;
+    }
+
+    world_clock_configure(wc);
+    config_store_modify(put_world, &cfg);
+    return world_get_handler(req);
+}
+
+static esp_err_t ntp_get_handler(httpd_req_t *req) {
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    sntp_server_stats_t st;
+    sntp_server_stats(&st);
+    const uint8_t *b = (const uint8_t *)&st.leader;
+
+    char json[256];
+    int n = snprintf(json, sizeof(json),
+                     "{\"server\":\"%s\",\"serve\":%s,\"announce\":%s,\"follow\":%s,\"leader\":\"%u.%u.%u.%u\","
+                     "\"requests\":%lu,\"replies\":%lu,\"unsynced\":%lu,\"announcements\":%lu}",
+                     cfg.ntp.server, cfg.ntp.serve ? "true" : "false", cfg.ntp.announce ? "true" : "false",
+                     cfg.ntp.follow ? "true" : "false", b[0], b[1], b[2], b[3],
+                     (unsigned long)st.requests, (unsigned long)st.replies,
+                     (unsigned long)st.unsynced, (unsigned long)st.announcements);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, n);
+}
+
+static bool valid_host(const char *host) {
+    for (; *host; host++) {
+        if (!isalnum((unsigned char)*host) && *host != '.' && *host != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Form fields: server (upstream host name or address, empty for the
+// default), serve (answer SNTP on the LAN), announce (advertise this clock
+// as leader), follow (take the upstream from announcements instead of
+// server); flags are 0 or 1. A clock either serves or follows: two
+// clocks that do both would end up taking their time from each other.
+static esp_err_t ntp_post_handler(httpd_req_t *req) {
+    char body[128];
+    int len = httpd_req_recv(req, body, sizeof(body) - 1);
+    body[len > 0 ? len : 0] = '\0';
+
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    ntp_cfg_t *ntp = &cfg.ntp;
+    char value[CONFIG_NTP_SERVER_MAX];
+    if (form_value(body, "server", value, sizeof(value))) {
+        if (!valid_host(value)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad server");
+            return ESP_FAIL;
+        }
+        strlcpy(ntp->server, value, sizeof(ntp->server));
+    }
+    if (form_value(body, "serve", value, sizeof(value))) {
+        ntp->serve = atoi(value) != 0;
+    }
+    if (form_value(body, "announce", value, sizeof(value))) {
+        ntp->announce = atoi(value) != 0;
+    }
+    if (form_value(body, "follow", value, sizeof(value))) {
+        ntp->follow = atoi(value) != 0;
+    }
+    if (ntp->serve && ntp->follow) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Serve or follow, not both");
+        return ESP_FAIL;
+    }
+
+    sntp_server_configure(ntp);
+    config_store_modify(put_ntp, &cfg);
+    return ntp_get_handler(req);
+}
+
+static esp_err_t ota_send_status(httpd_req_t *req, const char *status) {
+    ota_status_t st;
+    ota_status(&st);
+    char json[224];
+    int n = snprintf(json, sizeof(json),
+                     "{\"state\":\"%s\",\"partition\":\"%s\",\"received\":%lu,\"total\":%lu,"
+                     "\"rate_kb_s\":%lu,\"heap_peak\":%lu,\"heap_min_free\":%lu,\"error\":\"%s\"}",
+                     ota_state_name(st.state), st.partition, (unsigned long)st.received,
+                     (unsigned long)st.total,
+                     st.busy_ms ? (unsigned long)((uint64_t)st.received * 1000 / 1024 / st.busy_ms) : 0UL,
+                     (unsigned long)st.heap_peak, (unsigned long)st.heap_min_free, esp_err_to_name(st.error));
+    if (status) {
+        httpd_resp_set_status(req, status);
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, json, n);
+}
+
+static bool parse_sha256(const char *hex, uint8_t out[OTA_SHA256_LEN]) {
+    if (strlen(hex) != 2 * OTA_SHA256_LEN) {
+        return false;
+    }
+    for (int i = 0; i < OTA_SHA256_LEN; i++) {
+        if (!isxdigit((unsigned char)hex[2 * i]) || !isxdigit((unsigned char)hex[2 * i + 1])) {
+            return false;
+        }
+        char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        out[i] = (uint8_t)strtoul(byte, NULL, 16);
+    }
+    return true;
+}
+
+static void ota_restart(void *arg) {
+    esp_restart();
+}
+
+static esp_err_t ota_get_handler(httpd_req_t *req) {
+    return ota_send_status(req, NULL);
+}
+
+// The body is the raw image. X-SHA256 (hex) starts an update. After a
+// dropped connection, Content-Range: bytes START-END/TOTAL sends the rest,
+// where START is the "received" GET /api/ota reports; any other START gets
+// a 416 with the status. The body is read straight into the chunk buffer,
+// and the device restarts into the new image once it checks out.
+static esp_err_t ota_post_handler(httpd_req_t *req) {
+    char value[2 * OTA_SHA256_LEN + 8];
+    uint8_t sha[OTA_SHA256_LEN];
+    bool have_sha = httpd_req_get_hdr_value_str(req, "X-SHA256", value, sizeof(value)) == ESP_OK &&
+                    parse_sha256(value, sha);
+    unsigned long start = 0, total = req->content_len;
+    if (httpd_req_get_hdr_value_str(req, "Content-Range", value, sizeof(value)) == ESP_OK) {
+        unsigned long end;
+        if (sscanf(value, "bytes %lu-%lu/%lu", &start, &end, &total) != 3 ||
+            end < start || end >= total || end - start + 1 != req->content_len) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad Content-Range");
+            return ESP_FAIL;
+        }
+    }
+
+    ota_status_t st;
+    ota_status(&st);
+    if (start == 0) {
+        if (!have_sha) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing X-SHA256");
+            return ESP_FAIL;
+        }
+        esp_err_t err = ota_begin(total, sha);
+        if (err == ESP_ERR_INVALID_SIZE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image too large");
+            return ESP_FAIL;
+        }
+        if (err != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot start update");
+            return ESP_FAIL;
+        }
+    } else if (st.state != OTA_RECEIVING || st.total != total || st.received != start ||
+               (have_sha && !ota_matches(sha))) {
+        return ota_send_status(req, "416 Range Not Satisfiable");
+    }
+
+    size_t left = req->content_len;
+    esp_err_t err = ESP_OK;
+    while (left > 0 && err == ESP_OK) {
+        size_t room;
+        uint8_t *dst = ota_write_ptr(&room);
+        if (dst == NULL) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        int ret = httpd_req_recv(req, (char *)dst, room < left ? room : left);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (ret <= 0) {
+            // Dropped: what reached flash stays there for the resume.
+            ota_pause();
+            return ESP_FAIL;
+        }
+        left -= ret;
+        err = ota_commit(ret);
+    }
+    ota_pause();
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_NO_MEM) {
+            ota_abort(err);
+        }
+        ota_send_status(req, "500 Internal Server Error");
+        return ESP_FAIL;
+    }
+    ota_status(&st);
+    if (st.state == OTA_DONE) {
+        // From a timer, so this request completes and the client sees it.
+        const esp_timer_create_args_t args = { .callback = ota_restart, .name = "ota_restart" };
+        esp_timer_handle_t timer;
+        if (esp_timer_create(&args, &timer) == ESP_OK) {
+            esp_timer_start_once(timer, 500 * 1000);
+        }
+    }
+    return ota_send_status(req, NULL);
+}
+
+static void metrics_send_chunk(void *ctx, const char *text, size_t len) {
+    httpd_resp_send_chunk((httpd_req_t *)ctx, text, len);
+}
+
+// Prometheus text exposition, streamed one histogram per chunk.
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    metrics_write_prometheus(metrics_send_chunk, req);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void trace_send_chunk(void *ctx, const char *data, size_t len) {
+    httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
+
+// Raw ring dump; tools/trace2chrome.py turns it into a Perfetto trace.
+static esp_err_t trace_get_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"clock.trace\"");
+    trace_dump(trace_send_chunk, req);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Every handler is registered through here so its latency lands in
+// METRIC_HTTP_US; the real handler rides in user_ctx.
+static esp_err_t timed_handler(httpd_req_t *req) {
+    esp_err_t (*handler)(httpd_req_t *) = (esp_err_t (*)(httpd_req_t *))req->user_ctx;
+    int64_t start = esp_timer_get_time();
+    trace_begin(TRACE_ID_HTTP);
+    esp_err_t ret = handler(req);
+    trace_end(TRACE_ID_HTTP);
+    metrics_record(METRIC_HTTP_US, (uint32_t)(esp_timer_get_time() - start));
+    if (ret != ESP_OK) {
+        metrics_count(METRIC_HTTP_ERRORS);
+    }
+    return ret;
+}
+
+static void register_timed(httpd_handle_t handle, const httpd_uri_t *uri) {
+    httpd_uri_t timed = *uri;
+    timed.handler = timed_handler;
+    timed.user_ctx = (void *)uri->handler;
+    httpd_register_uri_handler(handle, &timed);
+}
+
+static const httpd_uri_t root_uri = {
+    .uri = "/",
+    .method = HTTP_GET,
+    .handler = root_get_handler,
+};
+
+static const httpd_uri_t status_uri = {
+    .uri = "/api/status",
+    .method = HTTP_GET,
+    .handler = status_get_handler,
+};
+
+static const httpd_uri_t alarms_get_uri = {
+    .uri = "/api/alarms",
+    .method = HTTP_GET,
+    .handler = alarms_get_handler,
+};
+
+static const httpd_uri_t alarms_post_uri = {
+    .uri = "/api/alarms",
+    .method = HTTP_POST,
+    .handler = alarms_post_handler,
+};
+
+static const httpd_uri_t chrono_uri = {
+    .uri = "/api/chrono",
+    .method = HTTP_POST,
+    .handler = chrono_post_handler,
+};
+
+static const httpd_uri_t display_get_uri = {
+    .uri = "/api/display",
+    .method = HTTP_GET,
+    .handler = display_get_handler,
+};
+
+static const httpd_uri_t display_post_uri = {
+    .uri = "/api/display",
+    .method = HTTP_POST,
+    .handler = display_post_handler,
+};
+
+static const httpd_uri_t world_get_uri = {
+    .uri = "/api/world",
+    .method = HTTP_GET,
+    .handler = world_get_handler,
+};
+
+static const httpd_uri_t world_post_uri = {
+    .uri = "/api/world",
+    .method = HTTP_POST,
+    .handler = world_post_handler,
+};
+
+static const httpd_uri_t ntp_get_uri = {
+    .uri = "/api/ntp",
+    .method = HTTP_GET,
+    .handler = ntp_get_handler,
+};
+
+static const httpd_uri_t ntp_post_uri = {
+    .uri = "/api/ntp",
+    .method = HTTP_POST,
+    .handler = ntp_post_handler,
+};
+
+static const httpd_uri_t ota_get_uri = {
+    .uri = "/api/ota",
+    .method = HTTP_GET,
+    .handler = ota_get_handler,
+};
+
+static const httpd_uri_t ota_post_uri = {
+    .uri = "/api/ota",
+    .method = HTTP_POST,
+    .handler = ota_post_handler,
+};
+
+static const httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_get_handler,
+};
+
+static const httpd_uri_t trace_uri = {
+    .uri = "/api/trace",
+    .method = HTTP_GET,
+    .handler = trace_get_handler,
+};
+
+static const httpd_uri_t settings_uri = {
+    .uri = "/settings",
+    .method = HTTP_POST,
+    .handler = settings_post_handler,
+};
+
+httpd_handle_t start_webserver(void) {
+    httpd_handle_t handle = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.lru_purge_enable = true;
+    config.max_uri_handlers = 16;
+
+    ESP_LOGI(TAG, "Starting server on port %d", config.server_port);
+    if (httpd_start(&handle, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Error starting server");
+        return NULL;
+    }
+    register_timed(handle, &root_uri);
+    register_timed(handle, &status_uri);
+    register_timed(handle, &settings_uri);
+    register_timed(handle, &alarms_get_uri);
+    register_timed(handle, &alarms_post_uri);
+    register_timed(handle, &chrono_uri);
+    register_timed(handle, &display_get_uri);
+    register_timed(handle, &display_post_uri);
+    register_timed(handle, &world_get_uri);
+    register_timed(handle, &world_post_uri);
+    register_timed(handle, &ntp_get_uri);
+    register_timed(handle, &ntp_post_uri);
+    register_timed(handle, &ota_get_uri);
+    register_timed(handle, &ota_post_uri);
+    register_timed(handle, &metrics_uri);
+    register_timed(handle, &trace_uri);
+    return handle;
+}
+
+void stop_webserver(httpd_handle_t handle) {
+    if (handle) {
+        httpd_stop(handle);
+    }
+}
 
 void web_server_start(void) {
     ESP_LOGI(TAG, "Starting web server");
-    // Dummy function
+    if (server == NULL) {
+        server = start_webserver();
+    }
 }
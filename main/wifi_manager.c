@@ -1,65 +1,400 @@
 #include "wifi_manager.h"
 #include "esp_log.h"
-#include "esp_wifi.h"
-#include "nvs_flash.h"
+#include "dlog.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
 #include <string.h>
-#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "app_config.h"
+#include "app_state.h"
+#include "trace.h"
+#include "warm_start.h"
+#ifndef ESP_PLATFORM
+#include "wifi_sim.h"
+#endif
 
 static const char *TAG = "wifi_manager";
-static EventGroupHandle_t s_wifi_event_group;
+
 static char sta_ssid[32];
 static char sta_password[64];
-bool wifi_connected = false;
 
-void wifi_manager_init(void) {
-    // Dummy function, real implementation would initialize WiFi hardware
-}
-
-void wifi_manager_start_ap(void)
-{
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = "ESP32_CLOCK",
-            .password = "12345678",
-            .ssid_len = strlen("ESP32_CLOCK"),
-            .channel = 1,
-            .authmode = WIFI_AUTH_WPA_WPA2_PSK,
-            .max_connection = 4,
-        },
+// Directed attempt to the cached BSSID/channel first, then a full scan.
+typedef enum {
+    WIFI_ATTEMPT_FAST,
+    WIFI_ATTEMPT_FULL,
+} wifi_attempt_t;
+
+// All state below is owned by whoever holds s_lock: the event handler and
+// the timer callback are the only two entry points after start.
+static SemaphoreHandle_t s_lock;
+static esp_timer_handle_t s_timer;
+static const wifi_driver_t *s_driver;
+static wifi_state_t s_state = WIFI_STATE_IDLE;
+static wifi_attempt_t s_attempt_kind;
+static int64_t s_attempt_start_us;
+static uint32_t s_attempt_no;
+static uint32_t s_failures;      // consecutive failed attempts
+static uint32_t s_backoff_ms;
+static bool s_ap_enabled;
+static bool s_sta_associated;
+static bool s_static_lease;      // the cached lease is applied and DHCP is stopped
+                                 // (while connected: until the timer restarts it)
+static uint8_t s_ap_clients;
+static wifi_event_sta_connected_t s_last_assoc;
+
+static const char *attempt_name(wifi_attempt_t kind) {
+    return kind == WIFI_ATTEMPT_FAST ? "fast" : "full";
+}
+
+static const char *state_name(wifi_state_t state) {
+    switch (state) {
+    case WIFI_STATE_IDLE: return "idle";
+    case WIFI_STATE_CONNECTING: return "connecting";
+    case WIFI_STATE_CONNECTED: return "connected";
+    case WIFI_STATE_BACKOFF: return "backoff";
+    }
+    return "?";
+}
+
+static void wifi_set_state(wifi_state_t state) {
+    if (state != s_state) {
+        DLOGI(TAG, "%s -> %s", state_name(s_state), state_name(state));
+        s_state = state;
+    }
+}
+
+// Called at the end of every entry point, still under s_lock, so the
+// published link state follows the same order as the events.
+static void wifi_publish_link(void) {
+    app_wifi_link_t *link = &app_state_begin()->wifi;
+    link->sta_connected = s_sta_associated;
+    link->got_ip = (s_state == WIFI_STATE_CONNECTED);
+    link->reconnect_pending = (s_state == WIFI_STATE_BACKOFF);
+    link->ap_clients = s_ap_clients;
+    app_state_commit();
+}
+
+static void wifi_arm_timer(uint32_t ms) {
+    esp_timer_stop(s_timer);
+    esp_timer_start_once(s_timer, (uint64_t)ms * 1000);
+}
+
+#ifdef ESP_PLATFORM
+static esp_netif_t *s_sta_netif;
+
+static void esp_event_cb(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    wifi_manager_handle_event(base, id, data);
+}
+
+static esp_err_t esp_driver_init(void) {
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    esp_netif_create_default_wifi_ap();
+
+    wifi_init_config_t init_cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&init_cfg));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                                        esp_event_cb, NULL, NULL));
+    return esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                               esp_event_cb, NULL, NULL);
+}
+
+static esp_err_t esp_driver_set_static_ip(const wifi_cache_t *lease) {
+    if (lease == NULL) {
+        return esp_netif_dhcpc_start(s_sta_netif);
+    }
+    esp_netif_ip_info_t ip = {
+        .ip.addr = lease->ip,
+        .netmask.addr = lease->netmask,
+        .gw.addr = lease->gw,
     };
+    esp_netif_dhcpc_stop(s_sta_netif);
+    esp_err_t err = esp_netif_set_ip_info(s_sta_netif, &ip);
+    if (err == ESP_OK && lease->dns) {
+        esp_netif_dns_info_t dns = { .ip.u_addr.ip4.addr = lease->dns, .ip.type = 0 };
+        err = esp_netif_set_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    return err;
+}
+
+static esp_err_t esp_driver_get_dns(uint32_t *dns) {
+    esp_netif_dns_info_t info;
+    esp_err_t err = esp_netif_get_dns_info(s_sta_netif, ESP_NETIF_DNS_MAIN, &info);
+    *dns = (err == ESP_OK) ? info.ip.u_addr.ip4.addr : 0;
+    return err;
+}
+
+static const wifi_driver_t s_default_driver = {
+    .init = esp_driver_init,
+    .set_mode = esp_wifi_set_mode,
+    .set_config = esp_wifi_set_config,
+    .start = esp_wifi_start,
+    .connect = esp_wifi_connect,
+    .disconnect = esp_wifi_disconnect,
+    .set_static_ip = esp_driver_set_static_ip,
+    .get_dns = esp_driver_get_dns,
+};
+#endif
+
+static bool wifi_has_cache(const clock_config_t *cfg) {
+    return cfg->wifi_cache.channel != 0 && cfg->wifi_cache.ip != 0;
+}
+
+static void wifi_save_cache(const esp_netif_ip_info_t *ip) {
+    wifi_cache_t cache = { 0 };
+    memcpy(cache.bssid, s_last_assoc.bssid, sizeof(cache.bssid));
+    cache.channel = s_last_assoc.channel;
+    cache.ip = ip->ip.addr;
+    cache.netmask = ip->netmask.addr;
+    cache.gw = ip->gw.addr;
+    s_driver->get_dns(&cache.dns);
+    warm_start_set_wifi(&cache);
+
+    // Only touches flash when the AP or lease actually changed.
+    config_store_set_wifi_cache(&cache);
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
-    ESP_LOGI(TAG, "AP SSID:%s password:%s",
-             "ESP32_CLOCK",
-             "12345678");
+// The ESP32 has one radio: while the STA is associated the AP is forced onto
+// the STA's channel, and every STA scan takes the AP off-channel. So the AP
+// only runs while it is needed, and is never torn down under a client.
+static void wifi_set_ap(bool enable) {
+    if (enable == s_ap_enabled || (!enable && s_ap_clients > 0)) {
+        return;
+    }
+    s_ap_enabled = enable;
+    s_driver->set_mode(enable ? WIFI_MODE_APSTA : WIFI_MODE_STA);
+    if (enable) {
+        wifi_config_t ap_config = {
+            .ap = {
+                .ssid = WIFI_AP_SSID,
+                .password = WIFI_AP_PASSWORD,
+                .ssid_len = strlen(WIFI_AP_SSID),
+                .channel = 1,
+                .authmode = WIFI_AUTH_WPA_WPA2_PSK,
+                .max_connection = 4,
+            },
+        };
+        s_driver->set_config(WIFI_IF_AP, &ap_config);
+        DLOGI(TAG, "AP SSID:%s password:%s", WIFI_AP_SSID, WIFI_AP_PASSWORD);
+    } else {
+        DLOGI(TAG, "AP off");
+    }
 }
 
-esp_err_t wifi_manager_connect_to_ap(void)
-{
-    s_wifi_event_group = xEventGroupCreate();
+static void wifi_start_attempt(wifi_attempt_t kind) {
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    const wifi_cache_t *cache = &cfg.wifi_cache;
 
-    wifi_config_t wifi_config;
-    if (wifi_manager_load_sta_config()) {
-        strncpy((char*)wifi_config.sta.ssid, sta_ssid, sizeof(wifi_config.sta.ssid));
-        strncpy((char*)wifi_config.sta.password, sta_password, sizeof(wifi_config.sta.password));
-        wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    wifi_config_t wifi_config = { 0 };
+    strlcpy((char*)wifi_config.sta.ssid, sta_ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char*)wifi_config.sta.password, sta_password, sizeof(wifi_config.sta.password));
+    wifi_config.sta.threshold.authmode = sta_password[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
 
+    if (kind == WIFI_ATTEMPT_FAST) {
+        // Skip the scan: go straight to the known AP on its known channel,
+        // and reuse the previous lease so DHCP is skipped too.
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, cache->bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = cache->channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        s_driver->set_static_ip(cache);
+        s_static_lease = true;
+    } else {
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+        s_driver->set_static_ip(NULL);
+        s_static_lease = false;
+    }
 
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-        ESP_ERROR_CHECK(esp_wifi_start());
+    s_attempt_kind = kind;
+    s_attempt_no++;
+    s_attempt_start_us = esp_timer_get_time();
+    wifi_set_state(WIFI_STATE_CONNECTING);
+    wifi_arm_timer(kind == WIFI_ATTEMPT_FAST ? WIFI_FAST_CONNECT_TIMEOUT_MS
+                                             : WIFI_FULL_CONNECT_TIMEOUT_MS);
 
-        ESP_LOGI(TAG, "Connecting to AP SSID:%s", sta_ssid);
+    s_driver->set_config(WIFI_IF_STA, &wifi_config);
+    DLOGI(TAG, "Connecting to AP SSID:%s (%s, attempt %lu)", sta_ssid,
+             attempt_name(kind), (unsigned long)s_attempt_no);
+    s_driver->connect();
+}
+
+static void wifi_schedule_retry(void) {
+    s_backoff_ms = s_backoff_ms ? s_backoff_ms * 2 : WIFI_BACKOFF_MIN_MS;
+    // A scan takes the AP off-channel; don't keep doing that to someone who
+    // is connected to the setup page.
+    if (s_backoff_ms > WIFI_BACKOFF_MAX_MS || s_ap_clients > 0) {
+        s_backoff_ms = WIFI_BACKOFF_MAX_MS;
+    }
+    DLOGI(TAG, "Retrying in %lu ms", (unsigned long)s_backoff_ms);
+    wifi_set_state(WIFI_STATE_BACKOFF);
+    wifi_arm_timer(s_backoff_ms);
+}
+
+// Called with the lock held when an attempt did not end in an IP.
+static void wifi_attempt_failed(void) {
+    s_failures++;
+    if (s_failures >= WIFI_AP_FALLBACK_ATTEMPTS) {
+        wifi_set_ap(true);
+    }
+
+    if (s_failures == 1 && s_attempt_kind == WIFI_ATTEMPT_FAST) {
+        // The cache was stale; scan straight away rather than backing off.
+        DLOGW(TAG, "Fast connect failed, falling back to full scan");
+        wifi_start_attempt(WIFI_ATTEMPT_FULL);
+        return;
+    }
+    wifi_schedule_retry();
+}
+
+static void wifi_timer_cb(void *arg) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_state == WIFI_STATE_CONNECTING) {
+        DLOGW(TAG, "%s attempt %lu timed out", attempt_name(s_attempt_kind),
+                 (unsigned long)s_attempt_no);
+        s_driver->disconnect();
+        wifi_attempt_failed();
+    } else if (s_state == WIFI_STATE_BACKOFF) {
+        clock_config_t cfg;
+        config_store_get(&cfg);
+        // Right after a drop the AP is usually still where it was.
+        wifi_start_attempt(s_failures <= 1 && wifi_has_cache(&cfg)
+                           ? WIFI_ATTEMPT_FAST : WIFI_ATTEMPT_FULL);
+    } else if (s_state == WIFI_STATE_CONNECTED && s_static_lease) {
+        // Left static, the address would never be renewed and the router
+        // would eventually hand it to someone else. DHCP asks for it again.
+        DLOGI(TAG, "Restarting DHCP after the fast connect");
+        s_static_lease = false;
+        s_driver->set_static_ip(NULL);
+    }
+    wifi_publish_link();
+    xSemaphoreGive(s_lock);
+}
+
+void wifi_manager_handle_event(esp_event_base_t base, int32_t id, void *data) {
+    // IP events are offset by 0x100 so the two bases don't collide.
+    trace_instant(TRACE_ID_WIFI_EVENT, (base == IP_EVENT ? 0x100 : 0) | id);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_CONNECTED) {
+        memcpy(&s_last_assoc, data, sizeof(s_last_assoc));
+        s_sta_associated = true;
+        DLOGI(TAG, "Associated with " MACSTR " on channel %d (%lld ms, %s)",
+                 MAC2STR(s_last_assoc.bssid), s_last_assoc.channel,
+                 (long long)((esp_timer_get_time() - s_attempt_start_us) / 1000),
+                 attempt_name(s_attempt_kind));
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        wifi_event_sta_disconnected_t *ev = (wifi_event_sta_disconnected_t *)data;
+        s_sta_associated = false;
+        DLOGW(TAG, "Disconnected in state %s, reason %d", state_name(s_state), ev->reason);
+        if (ev->reason == WIFI_REASON_ASSOC_LEAVE) {
+            // Our own disconnect() after a timeout; already accounted for.
+        } else if (s_state == WIFI_STATE_CONNECTED) {
+            // A fresh drop starts the schedule over.
+            s_failures = 0;
+            s_backoff_ms = 0;
+            wifi_schedule_retry();
+        } else if (s_state == WIFI_STATE_CONNECTING) {
+            wifi_attempt_failed();
+        }
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP && s_state == WIFI_STATE_CONNECTED) {
+        // DHCP, restarted after a fast connect, has the lease again.
+        ip_event_got_ip_t *ev = (ip_event_got_ip_t *)data;
+        DLOGI(TAG, "DHCP lease " IPSTR, IP2STR(&ev->ip_info.ip));
+        wifi_save_cache(&ev->ip_info);
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *ev = (ip_event_got_ip_t *)data;
+        DLOGI(TAG, "Got IP " IPSTR " in %lld ms (%s connect, attempt %lu)",
+                 IP2STR(&ev->ip_info.ip),
+                 (long long)((esp_timer_get_time() - s_attempt_start_us) / 1000),
+                 attempt_name(s_attempt_kind), (unsigned long)s_attempt_no);
+        esp_timer_stop(s_timer);
+        s_failures = 0;
+        s_backoff_ms = 0;
+        wifi_set_state(WIFI_STATE_CONNECTED);
+        wifi_save_cache(&ev->ip_info);
+        wifi_set_ap(false);
+        if (s_static_lease) {
+            // The cached lease brought the link up without DHCP. Restarting
+            // DHCP now would drop the address under SNTP's first lookup.
+            wifi_arm_timer(WIFI_DHCP_RESTART_MS);
+        }
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STACONNECTED) {
+        s_ap_clients++;
+        DLOGI(TAG, "AP client joined (%d)", s_ap_clients);
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STADISCONNECTED) {
+        if (s_ap_clients > 0) {
+            s_ap_clients--;
+        }
+        DLOGI(TAG, "AP client left (%d)", s_ap_clients);
+        if (s_state == WIFI_STATE_CONNECTED) {
+            wifi_set_ap(false);  // was kept up only for this client
+        }
+    }
+    wifi_publish_link();
+    xSemaphoreGive(s_lock);
+}
+
+void wifi_manager_set_driver(const wifi_driver_t *driver) {
+    s_driver = driver;
+}
+
+void wifi_manager_init(void) {
+    if (s_driver == NULL) {
+#ifdef ESP_PLATFORM
+        s_driver = &s_default_driver;
+#else
+        s_driver = wifi_sim_driver();
+#endif
+    }
+    s_lock = xSemaphoreCreateMutex();
+    const esp_timer_create_args_t args = {
+        .callback = wifi_timer_cb,
+        .name = "wifi",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &s_timer));
+    ESP_ERROR_CHECK(s_driver->init());
+}
+
+void wifi_manager_start(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool have_sta = wifi_manager_load_sta_config();
+    // Without credentials the AP is the only way in; with them it waits
+    // until the STA has failed a few times.
+    s_ap_enabled = false;
+    s_driver->set_mode(WIFI_MODE_STA);
+    if (!have_sta) {
+        wifi_set_ap(true);
+    }
+    s_driver->start();
+
+    if (have_sta) {
+        clock_config_t cfg;
+        config_store_get(&cfg);
+        wifi_start_attempt(wifi_has_cache(&cfg) ? WIFI_ATTEMPT_FAST : WIFI_ATTEMPT_FULL);
     } else {
-        ESP_LOGE(TAG, "Failed to load STA config");
-        return ESP_FAIL;
+        wifi_set_state(WIFI_STATE_IDLE);
     }
+    wifi_publish_link();
+    xSemaphoreGive(s_lock);
+}
 
-    return ESP_OK;
+wifi_state_t wifi_manager_state(void) {
+    return s_state;
 }
 
 bool wifi_manager_load_sta_config(void) {
-    // Dummy function, real implementation would load from NVS
-    return false;
-}
\ No newline at end of file
+    clock_config_t cfg;
+    config_store_get(&cfg);
+    if (cfg.wifi_ssid[0] == '\0') {
+        return false;
+    }
+    strlcpy(sta_ssid, cfg.wifi_ssid, sizeof(sta_ssid));
+    strlcpy(sta_password, cfg.wifi_password, sizeof(sta_password));
+    app_wifi_creds_t *creds = &app_state_begin()->wifi_creds;
+    strlcpy(creds->ssid, cfg.wifi_ssid, sizeof(creds->ssid));
+    creds->has_password = sta_password[0] != '\0';
+    app_state_commit();
+    return true;
+}
@@ -2,14 +2,54 @@
 #define WIFI_MANAGER_H
 
 #include "esp_err.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
 #include <stdbool.h>
+#include "config_store.h"
 
-extern bool wifi_connected;
+// A directed connect to the cached BSSID/channel either associates within a
+// beacon interval or two, or the AP has moved; don't wait long before scanning.
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+#define WIFI_FULL_CONNECT_TIMEOUT_MS 10000
+#define WIFI_BACKOFF_MIN_MS          1000
+#define WIFI_BACKOFF_MAX_MS          60000
+// After a fast connect the cached lease stays static this long before DHCP
+// takes over. Starting DHCP drops the address until the new lease arrives,
+// so it waits until SNTP's first sync is long done and its next poll, an
+// hour on, is far off.
+#define WIFI_DHCP_RESTART_MS         300000
+// Failed STA attempts in a row before the setup AP is brought up.
+#define WIFI_AP_FALLBACK_ATTEMPTS    2
 
-// Function prototypes for WiFi management
+typedef enum {
+    WIFI_STATE_IDLE,        // no credentials, AP only
+    WIFI_STATE_CONNECTING,  // attempt in flight, timer is the attempt timeout
+    WIFI_STATE_CONNECTED,   // STA has an IP
+    WIFI_STATE_BACKOFF,     // waiting to retry, timer is the backoff
+} wifi_state_t;
+
+// Everything the manager asks of the radio. The default talks to esp_wifi
+// and esp_netif; the host build uses the simulator in wifi_sim.c, which
+// answers by calling wifi_manager_handle_event().
+typedef struct {
+    esp_err_t (*init)(void);
+    esp_err_t (*set_mode)(wifi_mode_t mode);
+    esp_err_t (*set_config)(wifi_interface_t iface, wifi_config_t *cfg);
+    esp_err_t (*start)(void);
+    esp_err_t (*connect)(void);
+    esp_err_t (*disconnect)(void);
+    // NULL selects DHCP; otherwise the cached lease is applied statically.
+    esp_err_t (*set_static_ip)(const wifi_cache_t *lease);
+    esp_err_t (*get_dns)(uint32_t *dns);
+} wifi_driver_t;
+
+// Must be called before wifi_manager_init() to take effect.
+void wifi_manager_set_driver(const wifi_driver_t *driver);
 void wifi_manager_init(void);
-void wifi_manager_start_ap(void);
-esp_err_t wifi_manager_connect_to_ap(void);
+// Non-blocking: brings up the AP and/or starts the first STA attempt.
+void wifi_manager_start(void);
+void wifi_manager_handle_event(esp_event_base_t base, int32_t id, void *data);
+wifi_state_t wifi_manager_state(void);
 bool wifi_manager_load_sta_config(void);
 
 #endif // WIFI_MANAGER_H
@@ -0,0 +1,255 @@
+#include "wifi_sim.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+
+static const char *TAG = "wifi_sim";
+
+#define WIFI_SIM_MAX_PENDING 8
+
+typedef struct {
+    int64_t due_us;
+    esp_event_base_t base;
+    int32_t id;
+    union {
+        wifi_event_sta_connected_t connected;
+        wifi_event_sta_disconnected_t disconnected;
+        wifi_event_ap_staconnected_t ap_join;
+        wifi_event_ap_stadisconnected_t ap_leave;
+        ip_event_got_ip_t got_ip;
+    } data;
+} wifi_sim_event_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer;
+static wifi_sim_event_t s_pending[WIFI_SIM_MAX_PENDING];
+static int s_pending_count;
+
+static wifi_sim_ap_t s_ap;
+static wifi_mode_t s_mode = WIFI_MODE_NULL;
+static wifi_sta_config_t s_sta;
+static wifi_cache_t s_static;    // channel 0 = DHCP
+static bool s_associated;
+static bool s_has_ip;            // GOT_IP delivered and the address not dropped since
+static uint8_t s_next_aid = 1;
+
+static void wifi_sim_arm(void) {
+    esp_timer_stop(s_timer);
+    if (s_pending_count > 0) {
+        int64_t wait = s_pending[0].due_us - esp_timer_get_time();
+        esp_timer_start_once(s_timer, wait > 0 ? wait : 0);
+    }
+}
+
+// Inserts in due-time order; equal times keep posting order.
+static void wifi_sim_post(const wifi_sim_event_t *ev) {
+    portENTER_CRITICAL(&s_lock);
+    if (s_pending_count == WIFI_SIM_MAX_PENDING) {
+        portEXIT_CRITICAL(&s_lock);
+        ESP_LOGW(TAG, "Event queue full, dropped %ld", (long)ev->id);
+        return;
+    }
+    int i = s_pending_count++;
+    while (i > 0 && s_pending[i - 1].due_us > ev->due_us) {
+        s_pending[i] = s_pending[i - 1];
+        i--;
+    }
+    s_pending[i] = *ev;
+    portEXIT_CRITICAL(&s_lock);
+    wifi_sim_arm();
+}
+
+static void wifi_sim_post_disconnected(uint32_t delay_ms, uint8_t reason) {
+    wifi_sim_event_t ev = {
+        .due_us = esp_timer_get_time() + delay_ms * 1000LL,
+        .base = WIFI_EVENT,
+        .id = WIFI_EVENT_STA_DISCONNECTED,
+    };
+    memcpy(ev.data.disconnected.bssid, s_ap.bssid, sizeof(s_ap.bssid));
+    ev.data.disconnected.reason = reason;
+    wifi_sim_post(&ev);
+}
+
+// The lease as the netif would report it: the static one if set, or the
+// AP's DHCP lease.
+static void wifi_sim_post_got_ip(int64_t due_us) {
+    wifi_sim_event_t ip = {
+        .due_us = due_us,
+        .base = IP_EVENT,
+        .id = IP_EVENT_STA_GOT_IP,
+    };
+    ip.data.got_ip.ip_info.ip.addr = s_static.channel ? s_static.ip : s_ap.lease_ip;
+    ip.data.got_ip.ip_info.netmask.addr = s_static.channel ? s_static.netmask : 0x00FFFFFF;
+    ip.data.got_ip.ip_info.gw.addr = s_static.channel ? s_static.gw : (s_ap.lease_ip & 0x00FFFFFF) | 0x01000000;
+    wifi_sim_post(&ip);
+}
+
+static void wifi_sim_timer_cb(void *arg) {
+    for (;;) {
+        portENTER_CRITICAL(&s_lock);
+        if (s_pending_count == 0 || s_pending[0].due_us > esp_timer_get_time()) {
+            portEXIT_CRITICAL(&s_lock);
+            break;
+        }
+        wifi_sim_event_t ev = s_pending[0];
+        memmove(&s_pending[0], &s_pending[1], --s_pending_count * sizeof(s_pending[0]));
+        portEXIT_CRITICAL(&s_lock);
+
+        if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_CONNECTED) {
+            s_associated = true;
+            // With a static lease the netif reports the IP as soon as the
+            // link is up; otherwise DHCP takes its time.
+            wifi_sim_post_got_ip(ev.due_us + (s_static.channel ? 0 : s_ap.dhcp_ms * 1000LL));
+        } else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_DISCONNECTED) {
+            s_associated = false;
+            s_has_ip = false;
+        } else if (ev.base == IP_EVENT && !s_associated) {
+            continue; // link went away before the lease arrived
+        } else if (ev.base == IP_EVENT) {
+            s_has_ip = true;
+        }
+        wifi_manager_handle_event(ev.base, ev.id, &ev.data);
+    }
+    wifi_sim_arm();
+}
+
+static esp_err_t wifi_sim_init(void) {
+    const esp_timer_create_args_t args = {
+        .callback = wifi_sim_timer_cb,
+        .name = "wifi_sim",
+    };
+    return esp_timer_create(&args, &s_timer);
+}
+
+static esp_err_t wifi_sim_set_mode(wifi_mode_t mode) {
+    s_mode = mode;
+    ESP_LOGI(TAG, "mode %d", mode);
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_set_config(wifi_interface_t iface, wifi_config_t *cfg) {
+    if (iface == WIFI_IF_STA) {
+        s_sta = cfg->sta;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_start(void) {
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_connect(void) {
+    uint8_t reason = 0;
+    if (s_ap.channel == 0) {
+        reason = WIFI_REASON_NO_AP_FOUND;
+    } else if (s_sta.bssid_set &&
+               (memcmp(s_sta.bssid, s_ap.bssid, sizeof(s_ap.bssid)) != 0 ||
+                s_sta.channel != s_ap.channel)) {
+        // A directed connect only looks on the one channel for the one BSSID.
+        reason = WIFI_REASON_NO_AP_FOUND;
+    } else if (s_ap.fail_connects > 0) {
+        s_ap.fail_connects--;
+        reason = WIFI_REASON_AUTH_FAIL;
+    }
+
+    // A full scan visits every channel before associating.
+    uint32_t delay_ms = s_ap.assoc_ms + (s_sta.scan_method == WIFI_ALL_CHANNEL_SCAN ? 1500 : 0);
+    if (reason) {
+        wifi_sim_post_disconnected(delay_ms, reason);
+        return ESP_OK;
+    }
+    wifi_sim_event_t ev = {
+        .due_us = esp_timer_get_time() + delay_ms * 1000LL,
+        .base = WIFI_EVENT,
+        .id = WIFI_EVENT_STA_CONNECTED,
+    };
+    memcpy(ev.data.connected.bssid, s_ap.bssid, sizeof(s_ap.bssid));
+    ev.data.connected.channel = s_ap.channel;
+    wifi_sim_post(&ev);
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_disconnect(void) {
+    // Whatever the STA had in flight is abandoned; AP side events stand.
+    portENTER_CRITICAL(&s_lock);
+    int kept = 0;
+    for (int i = 0; i < s_pending_count; i++) {
+        if (s_pending[i].id == WIFI_EVENT_AP_STACONNECTED ||
+            s_pending[i].id == WIFI_EVENT_AP_STADISCONNECTED) {
+            s_pending[kept++] = s_pending[i];
+        }
+    }
+    s_pending_count = kept;
+    s_associated = false;
+    s_has_ip = false;
+    portEXIT_CRITICAL(&s_lock);
+    wifi_sim_post_disconnected(0, WIFI_REASON_ASSOC_LEAVE);
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_set_static_ip(const wifi_cache_t *lease) {
+    if (lease == NULL) {
+        // DHCP started on a link that is up: as on IDF, the static address
+        // is dropped at once and the station has none until the lease comes.
+        bool renew = s_associated && s_static.channel;
+        memset(&s_static, 0, sizeof(s_static));
+        if (renew) {
+            s_has_ip = false;
+            wifi_sim_post_got_ip(esp_timer_get_time() + s_ap.dhcp_ms * 1000LL);
+        }
+    } else {
+        s_static = *lease;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t wifi_sim_get_dns(uint32_t *dns) {
+    *dns = s_static.channel ? s_static.dns : (s_ap.lease_ip & 0x00FFFFFF) | 0x01000000;
+    return ESP_OK;
+}
+
+static const wifi_driver_t s_sim_driver = {
+    .init = wifi_sim_init,
+    .set_mode = wifi_sim_set_mode,
+    .set_config = wifi_sim_set_config,
+    .start = wifi_sim_start,
+    .connect = wifi_sim_connect,
+    .disconnect = wifi_sim_disconnect,
+    .set_static_ip = wifi_sim_set_static_ip,
+    .get_dns = wifi_sim_get_dns,
+};
+
+const wifi_driver_t *wifi_sim_driver(void) {
+    return &s_sim_driver;
+}
+
+void wifi_sim_set_ap(const wifi_sim_ap_t *ap) {
+    s_ap = *ap;
+}
+
+void wifi_sim_drop(uint8_t reason) {
+    if (s_associated) {
+        wifi_sim_post_disconnected(0, reason);
+    }
+}
+
+void wifi_sim_ap_client(bool join) {
+    if (s_mode != WIFI_MODE_APSTA) {
+        return;
+    }
+    wifi_sim_event_t ev = {
+        .due_us = esp_timer_get_time(),
+        .base = WIFI_EVENT,
+        .id = join ? WIFI_EVENT_AP_STACONNECTED : WIFI_EVENT_AP_STADISCONNECTED,
+    };
+    ev.data.ap_join.aid = join ? s_next_aid++ : s_next_aid - 1;
+    wifi_sim_post(&ev);
+}
+
+wifi_mode_t wifi_sim_mode(void) {
+    return s_mode;
+}
+
+bool wifi_sim_has_ip(void) {
+    return s_has_ip;
+}
@@ -0,0 +1,31 @@
+#ifndef WIFI_SIM_H
+#define WIFI_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wifi_manager.h"
+
+// A scripted access point for exercising the Wi-Fi state machine without a
+// radio. Driver calls are answered with the events the real stack would
+// post, delivered later from an esp_timer so the manager sees them
+// asynchronously, exactly as it does on hardware.
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;          // 0 = the AP is not on the air
+    uint16_t assoc_ms;        // connect() to STA_CONNECTED
+    uint16_t dhcp_ms;         // STA_CONNECTED to GOT_IP when DHCP is used
+    uint8_t fail_connects;    // the next N connects fail with AUTH_FAIL
+    uint32_t lease_ip;        // handed out by DHCP, network byte order
+} wifi_sim_ap_t;
+
+const wifi_driver_t *wifi_sim_driver(void);
+void wifi_sim_set_ap(const wifi_sim_ap_t *ap);
+// The AP kicks the STA off, as on a router reboot.
+void wifi_sim_drop(uint8_t reason);
+// A phone joins or leaves the setup AP.
+void wifi_sim_ap_client(bool join);
+wifi_mode_t wifi_sim_mode(void);
+// The station has an address: traffic to and from the clock gets through.
+bool wifi_sim_has_ip(void);
+
+#endif // WIFI_SIM_H
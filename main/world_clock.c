@@ -0,0 +1,392 @@
+#include "world_clock.h"
+#include "display_manager.h"
+#include "max7219.h"
+#include "board.h"
+#include "dlog.h"
+#include "freertos/FreeRTOS.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "world_clock";
+
+// Each zone's rules are parsed from its POSIX TZ string once, and the
+// offset in force is cached with the UTC interval it holds for. A tick
+// converts one UTC read with a single add; the rules are only evaluated
+// again when that interval runs out, at a DST change or a clock step.
+// setenv()/tzset() would instead change the process-wide zone that the
+// rest of the firmware's localtime_r() calls depend on.
+
+#define SECS_PER_DAY 86400
+
+typedef enum {
+    TZ_RULE_JULIAN,     // Jn: day 1..365, February 29 never counted
+    TZ_RULE_ZERO_BASED, // n: day 0..365, February 29 counted
+    TZ_RULE_MONTH,      // Mm.w.d: day d of week w (5 = last) of month m
+} tz_rule_kind_t;
+
+typedef struct {
+    tz_rule_kind_t kind;
+    uint16_t day;
+    uint8_t month;
+    uint8_t week;
+    uint8_t wday;
+    int32_t time_s;     // local time of day the change happens at
+} tz_rule_t;
+
+typedef struct {
+    int32_t std_offset_s; // east of UTC
+    int32_t dst_offset_s;
+    bool has_dst;
+    tz_rule_t start;      // into DST, in standard time
+    tz_rule_t end;        // out of DST, in daylight time
+} tz_spec_t;
+
+typedef struct {
+    char code[CONFIG_ZONE_CODE_MAX];
+    uint8_t slot;
+    tz_spec_t spec;
+    int64_t valid_from;   // offset_s holds for UTC in [valid_from, valid_until)
+    int64_t valid_until;
+    int32_t offset_s;
+    bool dst;
+} zone_t;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static zone_t s_zones[CONFIG_WORLD_ZONES];
+static int s_count;
+static uint8_t s_dwell_s;
+
+// ---------------------------------------------------------------------------
+// Calendar arithmetic on days since 1970-01-01 (H. Hinnant's algorithms).
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static int64_t year_from_days(int64_t z) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    return (int64_t)yoe + era * 400 + (mp >= 10);
+}
+
+static bool is_leap(int64_t y) {
+    return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+// Local midnight of the rule's day in year y, as days since the epoch.
+static int64_t rule_day(const tz_rule_t *r, int64_t y) {
+    int64_t jan1 = days_from_civil(y, 1, 1);
+    switch (r->kind) {
+    case TZ_RULE_JULIAN:
+        return jan1 + r->day - 1 + (is_leap(y) && r->day >= 60);
+    case TZ_RULE_ZERO_BASED:
+        return jan1 + r->day;
+    case TZ_RULE_MONTH:
+    default: {
+        static const uint8_t mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        int64_t first = days_from_civil(y, r->month, 1);
+        int wday_first = (int)((first % 7 + 11) % 7); // 1970-01-01 was a Thursday
+        int64_t day = first + (r->wday - wday_first + 7) % 7 + 7 * (r->week - 1);
+        int len = mdays[r->month - 1] + (r->month == 2 && is_leap(y));
+        while (day >= first + len) {
+            day -= 7;
+        }
+        return day;
+    }
+    }
+}
+
+// UTC instant of a rule in year y; offset_s is the one in force before it.
+static int64_t rule_utc(const tz_rule_t *r, int64_t y, int32_t offset_s) {
+    return rule_day(r, y) * SECS_PER_DAY + r->time_s - offset_s;
+}
+
+// Works out the offset in force at now and the interval it holds for.
+static void zone_refresh(zone_t *z, int64_t now) {
+    const tz_spec_t *t = &z->spec;
+    if (!t->has_dst) {
+        z->offset_s = t->std_offset_s;
+        z->dst = false;
+        z->valid_from = INT64_MIN;
+        z->valid_until = INT64_MAX;
+        return;
+    }
+    int64_t y = year_from_days(floor_div(now + t->std_offset_s, SECS_PER_DAY));
+    int64_t start[3], end[3]; // years y-1, y, y+1
+    for (int i = 0; i < 3; i++) {
+        start[i] = rule_utc(&t->start, y - 1 + i, t->std_offset_s);
+        end[i] = rule_utc(&t->end, y - 1 + i, t->dst_offset_s);
+    }
+    if (start[1] < end[1]) {
+        // Northern hemisphere: DST inside the year.
+        if (now < start[1]) {
+            z->dst = false, z->valid_from = end[0], z->valid_until = start[1];
+        } else if (now < end[1]) {
+            z->dst = true, z->valid_from = start[1], z->valid_until = end[1];
+        } else {
+            z->dst = false, z->valid_from = end[1], z->valid_until = start[2];
+        }
+    } else {
+        // Southern hemisphere: DST across the new year.
+        if (now < end[1]) {
+            z->dst = true, z->valid_from = start[0], z->valid_until = end[1];
+        } else if (now < start[1]) {
+            z->dst = false, z->valid_from = end[1], z->valid_until = start[1];
+        } else {
+            z->dst = true, z->valid_from = start[1], z->valid_until = end[2];
+        }
+    }
+    z->offset_s = z->dst ? t->dst_offset_s : t->std_offset_s;
+}
+
+// ---------------------------------------------------------------------------
+// POSIX TZ: std offset [dst [offset] [,start[/time],end[/time]]]
+
+static const char *tz_parse_name(const char *p) {
+    if (*p == '<') {
+        const char *end = strchr(p, '>');
+        return end && end - p > 1 ? end + 1 : NULL;
+    }
+    const char *start = p;
+    while (isalpha((unsigned char)*p)) {
+        p++;
+    }
+    return p - start >= 3 ? p : NULL;
+}
+
+// [+|-]hh[:mm[:ss]] into seconds; max_hours bounds hh.
+static const char *tz_parse_time(const char *p, int max_hours, int32_t *out) {
+    int sign = 1;
+    if (*p == '+' || *p == '-') {
+        sign = *p++ == '-' ? -1 : 1;
+    }
+    if (!isdigit((unsigned char)*p)) {
+        return NULL;
+    }
+    int32_t parts[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3; i++) {
+        if (!isdigit((unsigned char)*p)) {
+            return NULL;
+        }
+        while (isdigit((unsigned char)*p)) {
+            parts[i] = parts[i] * 10 + (*p++ - '0');
+            if (parts[i] > 999) {
+                return NULL;
+            }
+        }
+        if (*p != ':' || i == 2) {
+            break;
+        }
+        p++;
+    }
+    if (parts[0] > max_hours || parts[1] > 59 || parts[2] > 59) {
+        return NULL;
+    }
+    *out = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return p;
+}
+
+static const char *tz_parse_number(const char *p, int min, int max, int *out) {
+    if (!isdigit((unsigned char)*p)) {
+        return NULL;
+    }
+    int v = 0;
+    while (isdigit((unsigned char)*p)) {
+        v = v * 10 + (*p++ - '0');
+        if (v > max) {
+            return NULL;
+        }
+    }
+    if (v < min) {
+        return NULL;
+    }
+    *out = v;
+    return p;
+}
+
+static const char *tz_parse_rule(const char *p, tz_rule_t *r) {
+    int a, b, c;
+    if (*p == 'M') {
+        if ((p = tz_parse_number(p + 1, 1, 12, &a)) == NULL || *p != '.' ||
+            (p = tz_parse_number(p + 1, 1, 5, &b)) == NULL || *p != '.' ||
+            (p = tz_parse_number(p + 1, 0, 6, &c)) == NULL) {
+            return NULL;
+        }
+        *r = (tz_rule_t){ .kind = TZ_RULE_MONTH, .month = a, .week = b, .wday = c };
+    } else if (*p == 'J') {
+        if ((p = tz_parse_number(p + 1, 1, 365, &a)) == NULL) {
+            return NULL;
+        }
+        *r = (tz_rule_t){ .kind = TZ_RULE_JULIAN, .day = a };
+    } else {
+        if ((p = tz_parse_number(p, 0, 365, &a)) == NULL) {
+            return NULL;
+        }
+        *r = (tz_rule_t){ .kind = TZ_RULE_ZERO_BASED, .day = a };
+    }
+    r->time_s = 2 * 3600;
+    if (*p == '/') {
+        p = tz_parse_time(p + 1, 167, &r->time_s);
+    }
+    return p;
+}
+
+static bool tz_parse(const char *tz, tz_spec_t *out) {
+    const char *p = tz_parse_name(tz);
+    int32_t west;
+    if (p == NULL || (p = tz_parse_time(p, 24, &west)) == NULL) {
+        return false;
+    }
+    *out = (tz_spec_t){ .std_offset_s = -west };
+    if (*p == '\0') {
+        return true;
+    }
+    if ((p = tz_parse_name(p)) == NULL) {
+        return false;
+    }
+    out->has_dst = true;
+    out->dst_offset_s = out->std_offset_s + 3600;
+    if (*p != ',' && *p != '\0') {
+        if ((p = tz_parse_time(p, 24, &west)) == NULL) {
+            return false;
+        }
+        out->dst_offset_s = -west;
+    }
+    if (*p == '\0') {
+        // No rules given: the US ones, as newlib and glibc assume.
+        p = ",M3.2.0,M11.1.0";
+    }
+    if (*p != ',' || (p = tz_parse_rule(p + 1, &out->start)) == NULL ||
+        *p != ',' || (p = tz_parse_rule(p + 1, &out->end)) == NULL) {
+        return false;
+    }
+    return *p == '\0';
+}
+
+bool world_clock_valid_tz(const char *tz) {
+    tz_spec_t spec;
+    return tz_parse(tz, &spec);
+}
+
+// ---------------------------------------------------------------------------
+
+void world_clock_init(const world_clock_cfg_t *cfg) {
+    world_clock_configure(cfg);
+}
+
+void world_clock_configure(const world_clock_cfg_t *cfg) {
+    zone_t zones[CONFIG_WORLD_ZONES];
+    int count = 0;
+    for (int i = 0; i < CONFIG_WORLD_ZONES && cfg->zones[i].code[0] != '\0'; i++) {
+        zone_t *z = &zones[count];
+        if (!tz_parse(cfg->zones[i].tz, &z->spec)) {
+            DLOGW(TAG, "Zone %s: bad TZ, skipped", cfg->zones[i].code);
+            continue;
+        }
+        memcpy(z->code, cfg->zones[i].code, sizeof(z->code));
+        z->slot = i;
+        z->valid_from = z->valid_until = 0; // refreshed on first use
+        count++;
+    }
+    uint8_t dwell = cfg->dwell_s < WORLD_CLOCK_MIN_DWELL_S ? WORLD_CLOCK_MIN_DWELL_S : cfg->dwell_s;
+
+    portENTER_CRITICAL(&s_lock);
+    memcpy(s_zones, zones, sizeof(zones[0]) * count);
+    s_count = count;
+    s_dwell_s = dwell;
+    portEXIT_CRITICAL(&s_lock);
+    DLOGI(TAG, "%d zones, %u s each", count, dwell);
+}
+
+bool world_clock_active(void) {
+    return s_count > 0;
+}
+
+int world_clock_zone_count(void) {
+    return s_count;
+}
+
+// Caller holds s_lock.
+static void zone_local(zone_t *z, int64_t now, world_clock_time_t *out) {
+    if (now < z->valid_from || now >= z->valid_until) {
+        zone_refresh(z, now);
+    }
+    int64_t sod = (now + z->offset_s) % SECS_PER_DAY;
+    if (sod < 0) {
+        sod += SECS_PER_DAY;
+    }
+    out->hour = sod / 3600;
+    out->minute = sod / 60 % 60;
+    out->second = sod % 60;
+    out->dst = z->dst;
+    out->utc_offset_s = z->offset_s;
+    out->slot = z->slot;
+}
+
+bool world_clock_zone_time(int i, time_t now, world_clock_time_t *out) {
+    bool ok = false;
+    portENTER_CRITICAL(&s_lock);
+    if (i >= 0 && i < s_count) {
+        zone_local(&s_zones[i], now, out);
+        ok = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return ok;
+}
+
+// Eight-digit boards show "LON 1234". Narrower ones show the code alone
+// for the first second of the zone's turn and then its time.
+void world_clock_show(time_t now) {
+    world_clock_time_t t;
+    char code[CONFIG_ZONE_CODE_MAX];
+    bool card;
+    portENTER_CRITICAL(&s_lock);
+    if (s_count == 0) {
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    int64_t slot = floor_div(now, s_dwell_s);
+    zone_t *z = &s_zones[slot % s_count];
+    zone_local(z, now, &t);
+    memcpy(code, z->code, sizeof(code));
+    card = now - slot * s_dwell_s == 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (board_profile.matrix) {
+        // Read back from segments, "LON" would come out as "L0N".
+        char text[CONFIG_ZONE_CODE_MAX + 8];
+        snprintf(text, sizeof(text), "%s %02u:%02u", code, t.hour % 100, t.minute % 100);
+        display_manager_show_text(text);
+        return;
+    }
+    uint8_t frame[MAX7219_DIGITS] = { 0 };
+    if (board_profile.digits >= 8 || card) {
+        char text[8];
+        snprintf(text, sizeof(text), "%-4s", code);
+        max7219_encode_text(text, frame);
+        if (board_profile.digits < 8) {
+            display_manager_commit(frame);
+            return;
+        }
+        memmove(frame + 4, frame, 4);
+    }
+    frame[0] = max7219_encode_digit(t.minute % 10, false);
+    frame[1] = max7219_encode_digit(t.minute / 10, false);
+    frame[2] = max7219_encode_digit(t.hour % 10, false);
+    frame[3] = max7219_encode_digit(t.hour / 10, false);
+    display_manager_commit(frame);
+}
@@ -0,0 +1,34 @@
+#ifndef WORLD_CLOCK_H
+#define WORLD_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "config_store.h"
+
+// Shortest time a zone stays on the display; on four-digit boards its
+// first second shows the zone code.
+#define WORLD_CLOCK_MIN_DWELL_S 2
+
+typedef struct {
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    bool dst;
+    int32_t utc_offset_s;  // east of UTC
+    uint8_t slot;          // index into world_clock_cfg_t.zones
+} world_clock_time_t;
+
+void world_clock_init(const world_clock_cfg_t *cfg);
+// Zones whose TZ string doesn't parse are skipped.
+void world_clock_configure(const world_clock_cfg_t *cfg);
+bool world_clock_valid_tz(const char *tz);
+// True while at least one zone is configured.
+bool world_clock_active(void);
+int world_clock_zone_count(void);
+// Local time in zone i at UTC now; false if there is no such zone.
+bool world_clock_zone_time(int i, time_t now, world_clock_time_t *out);
+// Call once per main-loop tick with that tick's UTC read.
+void world_clock_show(time_t now);
+
+#endif // WORLD_CLOCK_H
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Decode deferred log records printed by a DLOG_HOST_DECODE build.
+
+With DLOG_HOST_DECODE set, the chip prints each DLOGI/W/D record as a
+"DLOG:<hex>" line and never runs printf for it. This tool resolves the
+format string and tag addresses against the firmware ELF and prints the
+lines as ESP_LOG would have. Other lines pass through unchanged:
+
+    idf.py monitor | python3 tools/dlog_decode.py build/esp32_clock.elf
+
+Needs pyelftools (pip install pyelftools). The record layout is described
+at the top of main/dlog.c.
+"""
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+T_WORD, T_I64, T_DBL, T_STR = 1, 2, 3, 4
+LEVEL_SKIP = 0xF
+LETTERS = "NEWIDV"
+SPEC = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t|L|q)?([diouxXcspeEfFgGaA%])")
+
+
+class Strings:
+    def __init__(self, path):
+        self.sections = []
+        with open(path, "rb") as f:
+            elf = ELFFile(f)
+            for sec in elf.iter_sections():
+                if sec["sh_flags"] & 0x2 and sec["sh_type"] == "SHT_PROGBITS":  # SHF_ALLOC
+                    self.sections.append((sec["sh_addr"], sec.data()))
+        self.cache = {}
+
+    def get(self, addr):
+        if addr not in self.cache:
+            text = "<0x%08x>" % addr
+            for base, data in self.sections:
+                if base <= addr < base + len(data):
+                    end = data.find(b"\0", addr - base)
+                    text = data[addr - base:end].decode("utf-8", "replace")
+                    break
+            self.cache[addr] = text
+        return self.cache[addr]
+
+
+def unpack_args(words, types, nargs):
+    args = []
+    i = 0
+    raw = struct.pack("<%dI" % len(words), *words)
+    for n in range(nargs):
+        t = (types >> (3 * n)) & 7
+        if t == T_WORD:
+            args.append((t, words[i]))
+            i += 1
+        elif t == T_I64:
+            args.append((t, struct.unpack_from("<q", raw, i * 4)[0]))
+            i += 2
+        elif t == T_DBL:
+            args.append((t, struct.unpack_from("<d", raw, i * 4)[0]))
+            i += 2
+        elif t == T_STR:
+            length = raw[i * 4]
+            args.append((t, raw[i * 4 + 1:i * 4 + 1 + length].decode("utf-8", "replace")))
+            i += (1 + length + 3) // 4
+    return args
+
+
+def format_record(fmt, args):
+    it = iter(args)
+
+    def conv(m):
+        flags, width, prec, _length, c = m.groups()
+        if c == "%":
+            return "%"
+        arg = next(it, None)
+        if arg is None:
+            return "?"
+        t, v = arg
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        if c == "p":
+            return "0x%08x" % v
+        if c == "s":
+            return (spec + "s") % v if t == T_STR else "?"
+        if c in "eEfFgGaA":
+            return (spec + c.replace("a", "e").replace("A", "E")) % v if t == T_DBL else "?"
+        if t not in (T_WORD, T_I64):
+            return "?"
+        if c in "di" and t == T_WORD and v & 0x80000000:
+            v -= 1 << 32  # a 32-bit word holding a negative int
+        if c == "c":
+            return chr(v & 0xFF)
+        return (spec + {"i": "d", "u": "d"}.get(c, c)) % v
+
+    return SPEC.sub(conv, fmt)
+
+
+def decode(line, strings):
+    data = bytes.fromhex(line.strip())
+    words = list(struct.unpack(">%dI" % (len(data) // 4), data))  # each word is printed MSB first
+    hdr, ts, fmt_addr, tag_addr, types = words[:5]
+    level = (hdr >> 8) & 0xF
+    if level == LEVEL_SKIP:
+        return None
+    nargs = (hdr >> 12) & 0xF
+    tag = strings.get(tag_addr)
+    text = format_record(strings.get(fmt_addr), unpack_args(words[5:], types, nargs))
+    return "%s (%d) %s: %s" % (LETTERS[level] if level < len(LETTERS) else "?", ts // 1000, tag, text)
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("elf")
+    ap.add_argument("log", nargs="?", help="captured log (default: stdin)")
+    args = ap.parse_args()
+
+    strings = Strings(args.elf)
+    src = open(args.log, errors="replace") if args.log else sys.stdin
+    for line in src:
+        pos = line.find("DLOG:")
+        if pos < 0:
+            sys.stdout.write(line)
+            continue
+        try:
+            out = decode(line[pos + 5:], strings)
+        except (ValueError, struct.error):
+            sys.stdout.write(line)  # garbled on the wire, show it as is
+            continue
+        if out is not None:
+            print(out)
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
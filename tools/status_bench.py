@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Load generator for the clock's /api/status endpoint.
+
+Fires GET requests from N concurrent clients and prints p50/p99 latency per
+concurrency level, e.g.:
+
+    python3 tools/status_bench.py 192.168.4.1 --levels 1,2,4,8 --requests 200
+"""
+import argparse
+import http.client
+import threading
+import time
+
+
+def worker(host, port, path, count, out):
+    conn = http.client.HTTPConnection(host, port, timeout=5)
+    for _ in range(count):
+        t0 = time.perf_counter()
+        try:
+            conn.request("GET", path)
+            conn.getresponse().read()
+        except (OSError, http.client.HTTPException):
+            conn.close()
+            conn = http.client.HTTPConnection(host, port, timeout=5)
+            continue
+        out.append((time.perf_counter() - t0) * 1000.0)
+    conn.close()
+
+
+def percentile(samples, p):
+    if not samples:
+        return float("nan")
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100.0))]
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("host")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--path", default="/api/status")
+    ap.add_argument("--levels", default="1,2,4,8")
+    ap.add_argument("--requests", type=int, default=100, help="requests per client")
+    args = ap.parse_args()
+
+    print("clients  ok     p50_ms  p99_ms")
+    for level in (int(x) for x in args.levels.split(",")):
+        samples = []
+        threads = [threading.Thread(target=worker,
+                                    args=(args.host, args.port, args.path, args.requests, samples))
+                   for _ in range(level)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        print("%-8d %-6d %-7.2f %-7.2f" % (level, len(samples),
+                                           percentile(samples, 50), percentile(samples, 99)))
+
+
+if __name__ == "__main__":
+    main()
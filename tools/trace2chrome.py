@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Convert a clock trace dump into Chrome/Perfetto trace JSON.
+
+Grab the ring from the clock and open the result in ui.perfetto.dev or
+chrome://tracing:
+
+    curl -o clock.trace http://192.168.4.1/api/trace
+    python3 tools/trace2chrome.py clock.trace -o clock.json
+
+The "CPU" process shows which task held each core, plus ISRs on their own
+track per core. The "Tasks" process shows spans and instants on the task that
+was running when they were recorded. The binary layout is described at the
+top of main/trace.c.
+"""
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x31435254  # "TRC1"
+HEADER = struct.Struct("<IIIHHQ")
+TASK = struct.Struct("<I16s")
+EVENT = struct.Struct("<IBBHI")
+NAME_LEN = 16
+
+EV_TASK_IN, EV_ISR_ENTER, EV_ISR_EXIT, EV_SPAN_BEGIN, EV_SPAN_END, EV_INSTANT = range(1, 7)
+PID_CPU, PID_TASKS = 0, 1
+ISR_TID_BASE = 100
+
+
+def cstr(raw):
+    return raw.split(b"\0", 1)[0].decode("ascii", "replace")
+
+
+def parse(data):
+    magic, recorded, capacity, task_count, id_count, now_us = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        sys.exit("not a clock trace (magic %08x)" % magic)
+    off = HEADER.size
+    tasks = {}
+    for _ in range(task_count):
+        handle, name = TASK.unpack_from(data, off)
+        tasks[handle] = cstr(name)  # a reused handle takes the latest name
+        off += TASK.size
+    ids = [cstr(data[off + i * NAME_LEN:off + (i + 1) * NAME_LEN]) for i in range(id_count)]
+    off += id_count * NAME_LEN
+
+    events = []
+    for _ in range(min(recorded, capacity)):
+        ts32, etype, core, eid, arg = EVENT.unpack_from(data, off)
+        off += EVENT.size
+        # 32-bit microseconds wrap every ~71 min; every event is older than now.
+        ts = now_us - ((now_us - ts32) & 0xFFFFFFFF)
+        events.append((ts, etype, core, eid, arg))
+    events.sort(key=lambda e: e[0])
+    dropped = max(0, recorded - capacity)
+    return tasks, ids, events, dropped
+
+
+def convert(tasks, ids, events):
+    out = []
+    if not events:
+        return out
+    t0 = events[0][0]
+    running = {}       # core -> (handle, since)
+    open_spans = {}    # task tid -> stack of span ids
+    isr_open = {}      # core -> (id, since)
+    task_tids = set()
+
+    def task_name(handle):
+        return tasks.get(handle, "task@%08x" % handle)
+
+    def id_name(eid):
+        return ids[eid] if eid < len(ids) else "id %d" % eid
+
+    def current_tid(core):
+        cur = running.get(core)
+        return cur[0] if cur else 0xFFFF0000 | core  # before the first switch on this core
+
+    for ts, etype, core, eid, arg in events:
+        rel = ts - t0
+        if etype == EV_TASK_IN:
+            prev = running.get(core)
+            if prev and rel > prev[1]:
+                out.append({"name": task_name(prev[0]), "ph": "X", "pid": PID_CPU, "tid": core,
+                            "ts": prev[1], "dur": rel - prev[1]})
+            running[core] = (arg, rel)
+        elif etype == EV_ISR_ENTER:
+            isr_open[core] = (eid, rel)
+        elif etype == EV_ISR_EXIT:
+            start = isr_open.pop(core, None)
+            if start:
+                out.append({"name": id_name(start[0]), "ph": "X", "pid": PID_CPU,
+                            "tid": ISR_TID_BASE + core, "ts": start[1], "dur": rel - start[1]})
+        elif etype in (EV_SPAN_BEGIN, EV_SPAN_END, EV_INSTANT):
+            tid = current_tid(core)
+            task_tids.add(tid)
+            if etype == EV_SPAN_BEGIN:
+                open_spans.setdefault(tid, []).append(eid)
+                out.append({"name": id_name(eid), "ph": "B", "pid": PID_TASKS, "tid": tid, "ts": rel})
+            elif etype == EV_SPAN_END:
+                stack = open_spans.get(tid)
+                if stack and eid in stack:  # drop ends whose begin fell off the ring
+                    stack.remove(eid)
+                    out.append({"name": id_name(eid), "ph": "E", "pid": PID_TASKS, "tid": tid, "ts": rel})
+            else:
+                out.append({"name": id_name(eid), "ph": "i", "s": "t", "pid": PID_TASKS, "tid": tid,
+                            "ts": rel, "args": {"arg": arg, "core": core}})
+
+    end = events[-1][0] - t0
+    for core, (handle, since) in running.items():
+        out.append({"name": task_name(handle), "ph": "X", "pid": PID_CPU, "tid": core,
+                    "ts": since, "dur": end - since})
+
+    meta = [{"name": "process_name", "ph": "M", "pid": PID_CPU, "args": {"name": "CPU"}},
+            {"name": "process_name", "ph": "M", "pid": PID_TASKS, "args": {"name": "Tasks"}}]
+    for core in sorted(set(e[2] for e in events)):
+        meta.append({"name": "thread_name", "ph": "M", "pid": PID_CPU, "tid": core,
+                     "args": {"name": "core %d" % core}})
+        meta.append({"name": "thread_name", "ph": "M", "pid": PID_CPU, "tid": ISR_TID_BASE + core,
+                     "args": {"name": "core %d ISR" % core}})
+    for tid in sorted(task_tids):
+        name = task_name(tid) if tid < 0xFFFF0000 else "core %d (before first switch)" % (tid & 0xFF)
+        meta.append({"name": "thread_name", "ph": "M", "pid": PID_TASKS, "tid": tid,
+                     "args": {"name": name}})
+    return meta + out
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("dump")
+    ap.add_argument("-o", "--output", default="-")
+    args = ap.parse_args()
+
+    with open(args.dump, "rb") as f:
+        tasks, ids, events, dropped = parse(f.read())
+    trace = {"traceEvents": convert(tasks, ids, events), "displayTimeUnit": "ms"}
+    if args.output == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    span = (events[-1][0] - events[0][0]) / 1e6 if events else 0.0
+    print("%d events over %.3f s, %d older events overwritten" % (len(events), span, dropped),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()